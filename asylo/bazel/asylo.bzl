@@ -528,6 +528,7 @@ def cc_enclave_test(
         tags = [],
         deps = [],
         test_in_initialize = False,
+        enclave_config = "@linux_sgx//:enclave_debug_config",
         **kwargs):
     """Build target that runs a cc_test srcs inside of an enclave.
 
@@ -542,6 +543,8 @@ def cc_enclave_test(
       test_in_initialize: If True, tests run in Initialize, rather than Run. This
           allows us to ensure the initialization and post-initialization execution
           environments provide the same runtime behavior and semantics.
+      enclave_config: An sgx_enclave_configuration rule for the test enclave,
+          for tests that need more threads or heap than the default.
       **kwargs: cc_test arguments.
     """
 
@@ -560,6 +563,7 @@ def cc_enclave_test(
         name = enclave_name,
         srcs = srcs,
         deps = deps + ["//asylo/bazel:test_shim_enclave"],
+        config = enclave_config,
         testonly = 1,
     )
 
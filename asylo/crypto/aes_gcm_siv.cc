@@ -18,15 +18,56 @@
 
 #include "asylo/crypto/aes_gcm_siv.h"
 
+#include <openssl/mem.h>
 #include <openssl/rand.h>
+#include <openssl/sha.h>
 #include <string>
 
+#include "absl/memory/memory.h"
 #include "absl/strings/str_cat.h"
 #include "asylo/crypto/util/bssl_util.h"
 #include "asylo/util/status.h"
 
 namespace asylo {
 
+StatusOr<std::unique_ptr<AesGcmSivContext>> AesGcmSivContext::Create(
+    ByteContainerView key) {
+  // Pick the appropriate EVP_AEAD based on the key length.
+  EVP_AEAD const *const aead_128 = EVP_aead_aes_128_gcm_siv();
+  EVP_AEAD const *const aead_256 = EVP_aead_aes_256_gcm_siv();
+
+  auto context = absl::WrapUnique(new AesGcmSivContext());
+  if (key.size() == EVP_AEAD_key_length(aead_128)) {
+    context->aead_ = aead_128;
+  } else if (key.size() == EVP_AEAD_key_length(aead_256)) {
+    context->aead_ = aead_256;
+  } else {
+    return Status(error::GoogleError::INVALID_ARGUMENT,
+                  absl::StrCat("Key size ", key.size(), " is invalid"));
+  }
+
+  if (EVP_AEAD_CTX_init(&context->context_, context->aead_, key.data(),
+                        key.size(), EVP_AEAD_max_tag_len(context->aead_),
+                        nullptr) != 1) {
+    return Status(
+        error::GoogleError::INTERNAL,
+        absl::StrCat("EVP_AEAD_CTX_init failed: ", BsslLastErrorString()));
+  }
+
+  context->key_id_.resize(SHA256_DIGEST_LENGTH);
+  SHA256(key.data(), key.size(), context->key_id_.data());
+  return std::move(context);
+}
+
+AesGcmSivContext::AesGcmSivContext() : aead_{nullptr} {
+  EVP_AEAD_CTX_zero(&context_);
+}
+
+AesGcmSivContext::~AesGcmSivContext() {
+  EVP_AEAD_CTX_cleanup(&context_);
+  OPENSSL_cleanse(&context_, sizeof(context_));
+}
+
 Status AesGcmSivNonceGenerator::NextNonce(
     const std::vector<uint8_t> &key_id,
     AesGcmSivNonceGenerator::AesGcmSivNonce *nonce) {
@@ -27,6 +27,7 @@
 #include "absl/strings/str_cat.h"
 #include "asylo/crypto/nonce_generator.h"
 #include "asylo/crypto/util/bssl_util.h"
+#include "asylo/crypto/util/byte_container_view.h"
 #include "asylo/crypto/util/bytes.h"
 #include "asylo/util/logging.h"
 #include "asylo/util/cleansing_types.h"
@@ -48,6 +49,44 @@ class AesGcmSivNonceGenerator : public NonceGenerator<kAesGcmSivNonceSize> {
                    AesGcmSivNonce *nonce) override;
 };
 
+/// An AES GCM SIV key held in an initialized AEAD context. Sealing and opening
+/// messages with a context skips the key setup of the cipher, which saves time
+/// when many messages are protected with the same key. A context may be used by
+/// concurrent Seal() and Open() calls, and cleanses the key material it holds
+/// when it is destroyed.
+class AesGcmSivContext {
+ public:
+  /// Creates a context holding `key`.
+  ///
+  /// \param key A 128-bit or 256-bit key.
+  /// \return The created context, or a non-OK Status if `key` has an invalid
+  ///         size or the context could not be initialized.
+  static StatusOr<std::unique_ptr<AesGcmSivContext>> Create(
+      ByteContainerView key);
+
+  AesGcmSivContext(const AesGcmSivContext &other) = delete;
+  ~AesGcmSivContext();
+
+  AesGcmSivContext &operator=(const AesGcmSivContext &other) = delete;
+
+  /// Returns the AEAD selected by the size of the key.
+  EVP_AEAD const *aead() const { return aead_; }
+
+  /// Returns the AEAD context initialized with the key.
+  const EVP_AEAD_CTX *context() const { return &context_; }
+
+  /// Returns the SHA-256 digest of the key, which identifies the key to nonce
+  /// generators.
+  const std::vector<uint8_t> &key_id() const { return key_id_; }
+
+ private:
+  AesGcmSivContext();
+
+  EVP_AEAD const *aead_;
+  EVP_AEAD_CTX context_;
+  std::vector<uint8_t> key_id_;
+};
+
 /// An AEAD cryptor that provides Seal() and Open() functionality using the AES
 /// GCM SIV cipher for both 128-bit and 256-bit keys. The class must be
 /// constructed using a pointer to a 96-bit NonceGenerator. If the
@@ -121,12 +160,48 @@ class AesGcmSivCryptor {
         sizeof(typename ContainerX::value_type) == 1,
         "Template parameter ContainerX is not a valid byte container");
 
-    // Pick the appropriate EVP_AEAD based on the key length.
-    StatusOr<EVP_AEAD const *> aead_result = EvpAead(key.size());
-    if (!aead_result.ok()) {
-      return aead_result.status();
+    StatusOr<std::unique_ptr<AesGcmSivContext>> context_result =
+        AesGcmSivContext::Create(key);
+    if (!context_result.ok()) {
+      return context_result.status();
     }
-    EVP_AEAD const *const aead = aead_result.ValueOrDie();
+    return Seal(*context_result.ValueOrDie(), additional_data, plaintext, nonce,
+                ciphertext);
+  }
+
+  /// Implements AEAD Authenticated Encryption (a.k.a.\ seal) functionality
+  /// with a key held in `context`.
+  ///
+  /// \param context The context holding the encryption key.
+  /// \param additional_data Authenticated data for the seal operation.
+  ///        `additional_data` must be a container with 1-byte `value_type`.
+  /// \param plaintext The plaintext to be encrypted. `plaintext` must be a
+  ///        container with 1-byte `value_type`.
+  /// \param[out] nonce Nonce used in this sealing operation, as in the Seal()
+  ///             method that takes a key.
+  /// \param[out] ciphertext The ciphertext generated by the
+  ///             authenticated-encryption operation. `ciphertext` must be a
+  ///             resizable container with 1-byte `value_type`.
+  /// \return A non-OK Status if an error is encountered.
+  template <typename ContainerU, typename ContainerV, typename ContainerW,
+            typename ContainerX>
+  Status Seal(const AesGcmSivContext &context,
+              const ContainerU &additional_data, const ContainerV &plaintext,
+              ContainerW *nonce, ContainerX *ciphertext) {
+    static_assert(
+        sizeof(typename ContainerU::value_type) == 1,
+        "Template parameter ContainerU is not a valid byte container");
+    static_assert(
+        sizeof(typename ContainerV::value_type) == 1,
+        "Template parameter ContainerV is not a valid byte container");
+    static_assert(
+        sizeof(typename ContainerW::value_type) == 1,
+        "Template parameter ContainerW is not a valid byte container");
+    static_assert(
+        sizeof(typename ContainerX::value_type) == 1,
+        "Template parameter ContainerX is not a valid byte container");
+
+    EVP_AEAD const *const aead = context.aead();
 
     if (additional_data.size() + plaintext.size() > message_size_limit_) {
       return Status(error::GoogleError::INVALID_ARGUMENT,
@@ -143,12 +218,7 @@ class AesGcmSivCryptor {
     // nonce so that an entity outside this function would not be able to
     // change the value of the nonce while it is being used.
     UnsafeBytes<kAesGcmSivNonceSize> nonce_copy;
-    std::vector<uint8_t> key_id(SHA256_DIGEST_LENGTH);
-    if (nonce_generator_->uses_key_id()) {
-      SHA256(reinterpret_cast<const uint8_t *>(key.data()), key.size(),
-             key_id.data());
-    }
-    Status status = nonce_generator_->NextNonce(key_id, &nonce_copy);
+    Status status = nonce_generator_->NextNonce(context.key_id(), &nonce_copy);
 
     if (!status.ok()) {
       return status;
@@ -170,26 +240,15 @@ class AesGcmSivCryptor {
     // Create temporary storage for generating the ciphertext.
     std::vector<uint8_t> tmp_ciphertext(max_ciphertext_length);
 
-    // Initialize the AEAD context.
-    EVP_AEAD_CTX context;
-    if (EVP_AEAD_CTX_init(
-            &context, aead, reinterpret_cast<const uint8_t *>(key.data()),
-            key.size(), EVP_AEAD_max_tag_len(aead), nullptr) != 1) {
-      return Status(
-          error::GoogleError::INTERNAL,
-          absl::StrCat("EVP_AEAD_CTX_init failed: ", BsslLastErrorString()));
-    }
-
     // Perform actual encryption.
     size_t ciphertext_length = 0;
     if (EVP_AEAD_CTX_seal(
-            &context, tmp_ciphertext.data(), &ciphertext_length,
+            context.context(), tmp_ciphertext.data(), &ciphertext_length,
             tmp_ciphertext.size(), nonce_copy.data(), nonce_copy.size(),
             reinterpret_cast<const uint8_t *>(plaintext.data()),
             plaintext.size(),
             reinterpret_cast<const uint8_t *>(additional_data.data()),
             additional_data.size()) != 1) {
-      EVP_AEAD_CTX_cleanup(&context);
       return Status(
           error::GoogleError::INTERNAL,
           absl::StrCat("EVP_AEAD_CTX_seal failed: ", BsslLastErrorString()));
@@ -203,14 +262,12 @@ class AesGcmSivCryptor {
     // not actually change the size of the container, make sure that
     // *|ciphertext| actually has the correct size.
     if (ciphertext->size() != ciphertext_length) {
-      EVP_AEAD_CTX_cleanup(&context);
       return Status(error::GoogleError::INVALID_ARGUMENT,
                     "Could not resize *|ciphertext| to correct size");
     }
     std::copy(tmp_ciphertext.cbegin(), tmp_ciphertext.cend(),
               ciphertext->begin());
 
-    EVP_AEAD_CTX_cleanup(&context);
     return Status::OkStatus();
   }
 
@@ -248,6 +305,47 @@ class AesGcmSivCryptor {
     static_assert(
         sizeof(typename ContainerX::value_type) == 1,
         "Template parameter ContainerX is not a valid byte container");
+
+    StatusOr<std::unique_ptr<AesGcmSivContext>> context_result =
+        AesGcmSivContext::Create(key);
+    if (!context_result.ok()) {
+      return context_result.status();
+    }
+    return Open(*context_result.ValueOrDie(), additional_data, ciphertext,
+                nonce, plaintext);
+  }
+
+  /// Implements AEAD Authenticated Decryption (a.k.a.\ open) functionality
+  /// with a key held in `context`.
+  ///
+  /// \param context The context holding the encryption key.
+  /// \param additional_data Authenticated data for the open operation.
+  ///        `additional_data` must be a container with 1-byte `value_type`.
+  /// \param ciphertext The ciphertext to be decrypted. `ciphertext` must
+  ///        be a container with 1-byte `value_type`.
+  /// \param nonce Nonce used in this open operation. `nonce` must be a
+  ///        container with 1-byte `value_type`.
+  /// \param[out] plaintext The plaintext generated by the
+  ///             authenticated-decryption operation. `plaintext` must be a
+  ///             resizable, self-cleansing container with 1-byte `value_type`.
+  /// \return A non-OK Status if error encountered.
+  template <typename ContainerU, typename ContainerV, typename ContainerW,
+            typename ContainerX>
+  Status Open(const AesGcmSivContext &context,
+              const ContainerU &additional_data, const ContainerV &ciphertext,
+              const ContainerW &nonce, ContainerX *plaintext) {
+    static_assert(
+        sizeof(typename ContainerU::value_type) == 1,
+        "Template parameter ContainerU is not a valid byte container");
+    static_assert(
+        sizeof(typename ContainerV::value_type) == 1,
+        "Template parameter ContainerV is not a valid byte container");
+    static_assert(
+        sizeof(typename ContainerW::value_type) == 1,
+        "Template parameter ContainerW is not a valid byte container");
+    static_assert(
+        sizeof(typename ContainerX::value_type) == 1,
+        "Template parameter ContainerX is not a valid byte container");
     using PlaintextContainerT =
         typename std::remove_reference<decltype(*plaintext)>::type;
     using PlaintextValueT = typename PlaintextContainerT::value_type;
@@ -255,12 +353,7 @@ class AesGcmSivCryptor {
                                CleansingAllocator<PlaintextValueT>>::value,
                   "Ciphertext container must be self-cleansing");
 
-    // Pick the appropriate EVP_AEAD based on the key length.
-    StatusOr<EVP_AEAD const *> aead_result = EvpAead(key.size());
-    if (!aead_result.ok()) {
-      return aead_result.status();
-    }
-    EVP_AEAD const *const aead = aead_result.ValueOrDie();
+    EVP_AEAD const *const aead = context.aead();
 
     if (nonce.size() != EVP_AEAD_nonce_length(aead)) {
       return Status(error::GoogleError::INVALID_ARGUMENT,
@@ -280,27 +373,16 @@ class AesGcmSivCryptor {
     CleansingVector<uint8_t> tmp_plaintext;
     tmp_plaintext.resize(ciphertext.size());
 
-    // Initialize the AEAD context.
-    EVP_AEAD_CTX context;
-    if (EVP_AEAD_CTX_init(
-            &context, aead, reinterpret_cast<const uint8_t *>(key.data()),
-            key.size(), EVP_AEAD_max_tag_len(aead), nullptr) != 1) {
-      return Status(
-          error::GoogleError::INTERNAL,
-          absl::StrCat("EVP_AEAD_CTX_init failed: ", BsslLastErrorString()));
-    }
-
     // Perform the actual decryption.
     size_t plaintext_length = 0;
     if (EVP_AEAD_CTX_open(
-            &context, tmp_plaintext.data(), &plaintext_length,
+            context.context(), tmp_plaintext.data(), &plaintext_length,
             tmp_plaintext.size(),
             reinterpret_cast<const uint8_t *>(nonce.data()), nonce.size(),
             reinterpret_cast<const uint8_t *>(ciphertext.data()),
             ciphertext.size(),
             reinterpret_cast<const uint8_t *>(additional_data.data()),
             additional_data.size()) != 1) {
-      EVP_AEAD_CTX_cleanup(&context);
       return Status(
           error::GoogleError::INTERNAL,
           absl::StrCat("EVP_AEAD_CTX_open failed: ", BsslLastErrorString()));
@@ -314,32 +396,15 @@ class AesGcmSivCryptor {
     // not actually change the size of the container, make sure that
     // *|plaintext| actually has the correct size.
     if (plaintext->size() != plaintext_length) {
-      EVP_AEAD_CTX_cleanup(&context);
       return Status(error::GoogleError::INVALID_ARGUMENT,
                     "Could not resize *|plaintext| to correct size");
     }
     std::copy(tmp_plaintext.cbegin(), tmp_plaintext.cend(), plaintext->begin());
 
-    EVP_AEAD_CTX_cleanup(&context);
     return Status::OkStatus();
   }
 
  private:
-  StatusOr<EVP_AEAD const *> EvpAead(size_t key_size) {
-    // Pick the appropriate EVP_AEAD based on the key length.
-    EVP_AEAD const *const aead_128 = EVP_aead_aes_128_gcm_siv();
-    EVP_AEAD const *const aead_256 = EVP_aead_aes_256_gcm_siv();
-
-    if (key_size == EVP_AEAD_key_length(aead_128)) {
-      return aead_128;
-    } else if (key_size == EVP_AEAD_key_length(aead_256)) {
-      return aead_256;
-    } else {
-      return Status(error::GoogleError::INVALID_ARGUMENT,
-                    absl::StrCat("Key size ", key_size, " is invalid"));
-    }
-  }
-
   const size_t message_size_limit_;
   std::unique_ptr<NonceGenerator<kAesGcmSivNonceSize>> nonce_generator_;
 };
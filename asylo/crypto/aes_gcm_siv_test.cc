@@ -18,6 +18,7 @@
 
 #include "asylo/crypto/aes_gcm_siv.h"
 
+#include <memory>
 #include <string>
 #include <utility>
 #include <vector>
@@ -133,6 +134,46 @@ TEST(AesGcmSivTest, AesGcmSivTestVectors) {
   EXPECT_EQ(plaintext2, tmp_plaintext2);
 }
 
+// Verifies that sealing and opening with a context holding the key conforms to
+// a test vector from the AES GCM SIV spec, and that the context can be reused.
+TEST(AesGcmSivTest, AesGcmSivContextTestVector) {
+  auto plaintext1 =
+      InstantiateSafeBytes<sizeof(plaintext1_hex)>(plaintext1_hex);
+  auto aad1 = absl::HexStringToBytes(aad1_hex);
+  auto key1 = InstantiateSafeBytes<sizeof(key1_hex)>(key1_hex);
+  auto nonce1 = absl::HexStringToBytes(nonce1_hex);
+  auto ciphertext1 = absl::HexStringToBytes(ciphertext1_hex);
+
+  auto context_result = AesGcmSivContext::Create(key1);
+  ASSERT_THAT(context_result, IsOk());
+  std::unique_ptr<AesGcmSivContext> context =
+      std::move(context_result.ValueOrDie());
+
+  AesGcmSivCryptor cryptor1(kMessageSizeLimit, new FixedNonceGenerator(nonce1));
+  for (int i = 0; i < 2; ++i) {
+    decltype(nonce1) tmp_nonce1;
+    decltype(ciphertext1) tmp_ciphertext1;
+    EXPECT_THAT(cryptor1.Seal(*context, aad1, plaintext1, &tmp_nonce1,
+                              &tmp_ciphertext1),
+                IsOk());
+    EXPECT_EQ(nonce1, tmp_nonce1);
+    EXPECT_EQ(ciphertext1, tmp_ciphertext1);
+
+    decltype(plaintext1) tmp_plaintext1;
+    EXPECT_THAT(
+        cryptor1.Open(*context, aad1, ciphertext1, nonce1, &tmp_plaintext1),
+        IsOk());
+    EXPECT_EQ(plaintext1, tmp_plaintext1);
+  }
+}
+
+// Verifies that a context cannot be created with a key of an invalid size.
+TEST(AesGcmSivTest, AesGcmSivContextInvalidKeySize) {
+  std::vector<uint8_t> key(24);
+  EXPECT_THAT(AesGcmSivContext::Create(key).status(),
+              StatusIs(error::GoogleError::INVALID_ARGUMENT));
+}
+
 constexpr size_t kPlaintextSize = 23;
 constexpr size_t kAdditionalDataSize = 15;
 
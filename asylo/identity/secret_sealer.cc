@@ -18,13 +18,115 @@
 
 #include "asylo/identity/secret_sealer.h"
 
+#include <openssl/rand.h>
+
 #include <cstdint>
 #include <string>
 #include <vector>
 
+#include "absl/strings/str_cat.h"
 #include "asylo/crypto/util/byte_container_util.h"
 
 namespace asylo {
+namespace {
+
+// Size of the random identifier of a sealed stream. The identifier is sealed as
+// the secret of the first frame of the stream, and is authenticated with every
+// chunk of the stream.
+constexpr size_t kStreamIdSize = 32;
+
+// Maximum size of a frame of a sealed stream. Leaves room for the header and
+// the bookkeeping information of a chunk of kMaxStreamChunkSize bytes.
+constexpr size_t kMaxStreamFrameSize =
+    SecretSealer::kMaxStreamChunkSize + (1 << 16);
+
+// Size of the length that precedes each frame of a sealed stream.
+constexpr size_t kFrameLengthSize = sizeof(uint32_t);
+
+// Returns the additional authenticated data of the |index|th chunk of the
+// sealed stream identified by |stream_id|.
+Status GetChunkAad(ByteContainerView stream_id, uint64_t index, bool last,
+                   std::string *aad) {
+  std::string index_string = absl::StrCat(index);
+  std::vector<ByteContainerView> views{"SealedSecretChunk", stream_id,
+                                       index_string, last ? "last" : "more"};
+  return SerializeByteContainers(views, aad);
+}
+
+// Reads from |reader| until |size| bytes are read into |buffer| or the input
+// ends, and returns the number of bytes read.
+StatusOr<size_t> ReadFully(const SecretSealer::StreamReader &reader,
+                           uint8_t *buffer, size_t size) {
+  size_t total = 0;
+  while (total < size) {
+    StatusOr<size_t> result = reader(buffer + total, size - total);
+    if (!result.ok()) {
+      return result.status();
+    }
+    if (result.ValueOrDie() == 0) {
+      break;
+    }
+    total += result.ValueOrDie();
+  }
+  return total;
+}
+
+// Writes |message| to |writer| as a frame of a sealed stream.
+Status WriteFrame(const google::protobuf::MessageLite &message,
+                  const SecretSealer::StreamWriter &writer) {
+  const size_t size = message.ByteSizeLong();
+  if (size > kMaxStreamFrameSize) {
+    return Status(error::GoogleError::INVALID_ARGUMENT,
+                  "Sealed stream frame is too large");
+  }
+
+  std::string frame;
+  internal::AppendLittleEndianInt(size, &frame);
+  if (!message.AppendToString(&frame)) {
+    return Status(error::GoogleError::INTERNAL,
+                  "Sealed stream frame serialization failed");
+  }
+  return writer(frame);
+}
+
+// Reads a frame of a sealed stream from |reader| into |frame|. Returns an
+// INVALID_ARGUMENT error if the stream ends before the frame.
+Status ReadFrame(const SecretSealer::StreamReader &reader,
+                 std::string *frame) {
+  uint8_t length_bytes[kFrameLengthSize];
+  StatusOr<size_t> result = ReadFully(reader, length_bytes, kFrameLengthSize);
+  if (!result.ok()) {
+    return result.status();
+  }
+  if (result.ValueOrDie() != kFrameLengthSize) {
+    return Status(error::GoogleError::INVALID_ARGUMENT,
+                  "Sealed stream is truncated");
+  }
+
+  uint32_t length = 0;
+  for (size_t i = 0; i < kFrameLengthSize; ++i) {
+    length |= static_cast<uint32_t>(length_bytes[i]) << (8 * i);
+  }
+  if (length > kMaxStreamFrameSize) {
+    return Status(error::GoogleError::INVALID_ARGUMENT,
+                  "Sealed stream frame is too large");
+  }
+
+  frame->resize(length);
+  result = ReadFully(reader, reinterpret_cast<uint8_t *>(&(*frame)[0]), length);
+  if (!result.ok()) {
+    return result.status();
+  }
+  if (result.ValueOrDie() != length) {
+    return Status(error::GoogleError::INVALID_ARGUMENT,
+                  "Sealed stream is truncated");
+  }
+  return Status::OkStatus();
+}
+
+}  // namespace
+
+constexpr size_t SecretSealer::kMaxStreamChunkSize;
 
 Status SecretSealer::Reseal(const SealedSecret &old_sealed_secret,
                             const SealedSecretHeader &new_header,
@@ -39,6 +141,155 @@ Status SecretSealer::Reseal(const SealedSecret &old_sealed_secret,
               unsealed_secret, new_sealed_secret);
 }
 
+Status SecretSealer::SealStream(const SealedSecretHeader &header,
+                                ByteContainerView additional_authenticated_data,
+                                size_t chunk_size, const StreamReader &reader,
+                                const StreamWriter &writer) {
+  if (chunk_size == 0 || chunk_size > kMaxStreamChunkSize) {
+    return Status(error::GoogleError::INVALID_ARGUMENT, "Invalid chunk size");
+  }
+
+  CleansingVector<uint8_t> stream_id(kStreamIdSize);
+  if (RAND_bytes(stream_id.data(), stream_id.size()) != 1) {
+    return Status(error::GoogleError::INTERNAL,
+                  "Could not generate the sealed stream identifier");
+  }
+
+  SealedSecret stream_header;
+  Status status =
+      Seal(header, additional_authenticated_data, stream_id, &stream_header);
+  if (!status.ok()) {
+    return status;
+  }
+  status = WriteFrame(stream_header, writer);
+  if (!status.ok()) {
+    return status;
+  }
+
+  // A chunk shorter than |chunk_size|, possibly empty, is the last one.
+  CleansingVector<uint8_t> chunk(chunk_size);
+  for (uint64_t index = 0;; ++index) {
+    StatusOr<size_t> result = ReadFully(reader, chunk.data(), chunk.size());
+    if (!result.ok()) {
+      return result.status();
+    }
+    const size_t size = result.ValueOrDie();
+    const bool last = size < chunk.size();
+
+    std::string chunk_aad;
+    status = GetChunkAad(stream_id, index, last, &chunk_aad);
+    if (!status.ok()) {
+      return status;
+    }
+    SealedSecret sealed_chunk;
+    status = Seal(header, chunk_aad, ByteContainerView(chunk.data(), size),
+                  &sealed_chunk);
+    if (!status.ok()) {
+      return status;
+    }
+
+    // Chunks do not repeat the header, which is taken from the first frame
+    // when the stream is unsealed.
+    if (sealed_chunk.sealed_secret_header() !=
+        stream_header.sealed_secret_header()) {
+      return Status(error::GoogleError::INTERNAL,
+                    "Header of a sealed chunk differs from the stream header");
+    }
+    SealedSecretChunk chunk_frame;
+    chunk_frame.set_iv(sealed_chunk.iv());
+    chunk_frame.set_secret_ciphertext(sealed_chunk.secret_ciphertext());
+    chunk_frame.set_sealing_root_bookkeeping_info(
+        sealed_chunk.sealing_root_bookkeeping_info());
+    chunk_frame.set_last(last);
+    status = WriteFrame(chunk_frame, writer);
+    if (!status.ok()) {
+      return status;
+    }
+
+    if (last) {
+      return Status::OkStatus();
+    }
+  }
+}
+
+Status SecretSealer::UnsealStream(const StreamReader &reader,
+                                  const StreamWriter &writer,
+                                  std::string *additional_authenticated_data) {
+  std::string frame;
+  Status status = ReadFrame(reader, &frame);
+  if (!status.ok()) {
+    return status;
+  }
+  SealedSecret stream_header;
+  if (!stream_header.ParseFromString(frame)) {
+    return Status(error::GoogleError::INVALID_ARGUMENT,
+                  "Could not parse the sealed stream header");
+  }
+  CleansingVector<uint8_t> stream_id;
+  status = Unseal(stream_header, &stream_id);
+  if (!status.ok()) {
+    return status;
+  }
+  if (stream_id.size() != kStreamIdSize) {
+    return Status(error::GoogleError::INVALID_ARGUMENT,
+                  "Incorrect sealed stream identifier size");
+  }
+
+  CleansingVector<uint8_t> chunk;
+  for (uint64_t index = 0;; ++index) {
+    status = ReadFrame(reader, &frame);
+    if (!status.ok()) {
+      return status;
+    }
+    SealedSecretChunk chunk_frame;
+    if (!chunk_frame.ParseFromString(frame)) {
+      return Status(error::GoogleError::INVALID_ARGUMENT,
+                    "Could not parse a sealed chunk");
+    }
+
+    SealedSecret sealed_chunk;
+    sealed_chunk.set_iv(chunk_frame.iv());
+    sealed_chunk.set_sealed_secret_header(
+        stream_header.sealed_secret_header());
+    status = GetChunkAad(stream_id, index, chunk_frame.last(),
+                         sealed_chunk.mutable_additional_authenticated_data());
+    if (!status.ok()) {
+      return status;
+    }
+    sealed_chunk.set_secret_ciphertext(chunk_frame.secret_ciphertext());
+    sealed_chunk.set_sealing_root_bookkeeping_info(
+        chunk_frame.sealing_root_bookkeeping_info());
+    status = Unseal(sealed_chunk, &chunk);
+    if (!status.ok()) {
+      return status;
+    }
+    status = writer(chunk);
+    if (!status.ok()) {
+      return status;
+    }
+
+    if (chunk_frame.last()) {
+      break;
+    }
+  }
+
+  uint8_t trailing_byte;
+  StatusOr<size_t> result = ReadFully(reader, &trailing_byte, 1);
+  if (!result.ok()) {
+    return result.status();
+  }
+  if (result.ValueOrDie() != 0) {
+    return Status(error::GoogleError::INVALID_ARGUMENT,
+                  "Unexpected data after the last sealed chunk");
+  }
+
+  if (additional_authenticated_data) {
+    *additional_authenticated_data =
+        stream_header.additional_authenticated_data();
+  }
+  return Status::OkStatus();
+}
+
 StatusOr<std::string> SecretSealer::GenerateSealerId(SealingRootType type,
                                                 const std::string &name) {
   std::string serialized;
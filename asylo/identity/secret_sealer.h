@@ -19,7 +19,9 @@
 #ifndef ASYLO_IDENTITY_SECRET_SEALER_H_
 #define ASYLO_IDENTITY_SECRET_SEALER_H_
 
+#include <cstddef>
 #include <cstdint>
+#include <functional>
 #include <string>
 #include <vector>
 
@@ -35,6 +37,17 @@ namespace asylo {
 
 class SecretSealer {
  public:
+  /// Reads up to `size` bytes into `buffer`. Returns the number of bytes read,
+  /// which is 0 only at the end of the input, or a non-OK status on failure.
+  using StreamReader =
+      std::function<StatusOr<size_t>(uint8_t *buffer, size_t size)>;
+
+  /// Writes all of `data`. Returns a non-OK status on failure.
+  using StreamWriter = std::function<Status(ByteContainerView data)>;
+
+  /// Maximum size of the chunks of a secret sealed with SealStream().
+  static constexpr size_t kMaxStreamChunkSize = 1 << 24;
+
   SecretSealer() = default;
   virtual ~SecretSealer() = default;
 
@@ -102,6 +115,47 @@ class SecretSealer {
                         const SealedSecretHeader &new_header,
                         SealedSecret *new_sealed_secret);
 
+  /// Seals a secret of any size in chunks, holding a single chunk of the
+  /// secret in memory at a time.
+  ///
+  /// The secret is read from `reader` in chunks of `chunk_size` bytes, each of
+  /// which is sealed per `header` with Seal() and written to `writer` as soon
+  /// as it is sealed. The sealed stream starts with a SealedSecret carrying the
+  /// header and the additional authenticated data, followed by one
+  /// SealedSecretChunk per chunk, the last of which may be empty. Every chunk
+  /// is authenticated together with its index in the stream and whether it is
+  /// the last chunk, so chunks cannot be reordered, dropped, or moved between
+  /// streams. See sealed_secret.proto for the framing of the stream.
+  ///
+  /// \param header The metadata to guide the sealing, as for Seal().
+  /// \param additional_authenticated_data Unencrypted data that is bundled with
+  ///        the sealed secret.
+  /// \param chunk_size The size of the chunks of the secret, which may not
+  ///        exceed kMaxStreamChunkSize.
+  /// \param reader The source of the secret.
+  /// \param writer The destination for the sealed stream.
+  /// \return A non-OK status if sealing fails.
+  virtual Status SealStream(const SealedSecretHeader &header,
+                            ByteContainerView additional_authenticated_data,
+                            size_t chunk_size, const StreamReader &reader,
+                            const StreamWriter &writer);
+
+  /// Unseals a stream written by SealStream(), holding a single chunk of the
+  /// secret in memory at a time.
+  ///
+  /// Each chunk of the secret is written to `writer` once it is authenticated.
+  /// The stream as a whole is only authenticated once its last chunk is, so if
+  /// unsealing fails, the data already written must be discarded.
+  ///
+  /// \param reader The source of the sealed stream.
+  /// \param writer The destination for the unsealed secret.
+  /// \param[out] additional_authenticated_data The destination for the
+  ///             additional authenticated data of the secret. May be nullptr.
+  /// \return A non-OK Status if unsealing fails.
+  virtual Status UnsealStream(const StreamReader &reader,
+                              const StreamWriter &writer,
+                              std::string *additional_authenticated_data);
+
   /// Combines the specified sealing root type and sealing root name
   /// to form a string. The combined string uniquely identifies the SecretSealer
   /// responsible for handling secrets associated with the particular
@@ -0,0 +1,136 @@
+/*
+ *
+ * Copyright 2018 Asylo authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "asylo/identity/sgx/sealing_key_cache.h"
+
+#include <cstdint>
+#include <vector>
+
+#include "absl/strings/str_cat.h"
+#include "asylo/crypto/util/byte_container_util.h"
+#include "asylo/crypto/util/byte_container_view.h"
+#include "asylo/identity/sgx/local_secret_sealer_helpers.h"
+#include "asylo/identity/sgx/secs_attributes.h"
+#include "asylo/util/cleansing_types.h"
+
+namespace asylo {
+namespace sgx {
+namespace internal {
+namespace {
+
+// Serializes the parameters that determine the key generated by
+// GenerateCryptorKey() into |cache_id|. These are the KEYREQUEST fields that
+// the parameters set, other than KEYID, and the inputs to KEYID.
+Status GetCacheId(CipherSuite cipher_suite, const std::string &key_id,
+                  const UnsafeBytes<kCpusvnSize> &cpusvn,
+                  const CodeIdentityExpectation &sgx_expectation,
+                  size_t key_size, std::string *cache_id) {
+  const CodeIdentityMatchSpec &spec = sgx_expectation.match_spec();
+  SecsAttributeSet attributemask;
+  if (!ConvertSecsAttributeRepresentation(spec.attributes_match_mask(),
+                                          &attributemask)) {
+    return Status(::asylo::error::GoogleError::INVALID_ARGUMENT,
+                  "Invalid attributes match mask");
+  }
+
+  std::string keypolicy = ::absl::StrCat(ConvertMatchSpecToKeypolicy(spec));
+  std::string isvsvn = ::absl::StrCat(
+      sgx_expectation.reference_identity().signer_assigned_identity().isvsvn());
+  std::string flags = ::absl::StrCat(attributemask.flags);
+  std::string xfrm = ::absl::StrCat(attributemask.xfrm);
+  std::string miscmask = ::absl::StrCat(spec.miscselect_match_mask());
+  std::string cipher_suite_name = CipherSuite_Name(cipher_suite);
+  std::string key_size_string = ::absl::StrCat(key_size);
+  std::vector<ByteContainerView> views{
+      keypolicy, isvsvn,    cpusvn, flags, xfrm, miscmask, cipher_suite_name,
+      key_id,    key_size_string};
+  return SerializeByteContainers(views, cache_id);
+}
+
+}  // namespace
+
+StatusOr<std::shared_ptr<const AesGcmSivContext>> SealingKeyCache::GetContext(
+    CipherSuite cipher_suite, const std::string &key_id,
+    const UnsafeBytes<kCpusvnSize> &cpusvn,
+    const CodeIdentityExpectation &sgx_expectation, size_t key_size) {
+  std::string cache_id;
+  Status status = GetCacheId(cipher_suite, key_id, cpusvn, sgx_expectation,
+                             key_size, &cache_id);
+  if (!status.ok()) {
+    return status;
+  }
+
+  {
+    absl::MutexLock lock(&mu_);
+    auto it = index_.find(cache_id);
+    if (it != index_.end()) {
+      entries_.splice(entries_.begin(), entries_, it->second);
+      return it->second->second;
+    }
+  }
+
+  // The key is generated without holding the lock, so that callers using other
+  // keys are not held up by the hardware key derivation.
+  CleansingVector<uint8_t> key;
+  status = GenerateCryptorKey(cipher_suite, key_id, cpusvn, sgx_expectation,
+                              key_size, &key);
+  if (!status.ok()) {
+    return status;
+  }
+  StatusOr<std::unique_ptr<AesGcmSivContext>> context_result =
+      AesGcmSivContext::Create(key);
+  if (!context_result.ok()) {
+    return context_result.status();
+  }
+  std::shared_ptr<const AesGcmSivContext> context =
+      std::move(context_result.ValueOrDie());
+
+  absl::MutexLock lock(&mu_);
+  if (capacity_ == 0) {
+    return context;
+  }
+
+  // Another caller may have cached the same key in the meantime.
+  auto it = index_.find(cache_id);
+  if (it != index_.end()) {
+    entries_.splice(entries_.begin(), entries_, it->second);
+    return it->second->second;
+  }
+  if (entries_.size() == capacity_) {
+    index_.erase(entries_.back().first);
+    entries_.pop_back();
+  }
+  entries_.emplace_front(cache_id, context);
+  index_.emplace(std::move(cache_id), entries_.begin());
+  return context;
+}
+
+void SealingKeyCache::Clear() {
+  absl::MutexLock lock(&mu_);
+  index_.clear();
+  entries_.clear();
+}
+
+size_t SealingKeyCache::Size() const {
+  absl::MutexLock lock(&mu_);
+  return entries_.size();
+}
+
+}  // namespace internal
+}  // namespace sgx
+}  // namespace asylo
@@ -0,0 +1,93 @@
+/*
+ *
+ * Copyright 2018 Asylo authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef ASYLO_IDENTITY_SGX_SEALING_KEY_CACHE_H_
+#define ASYLO_IDENTITY_SGX_SEALING_KEY_CACHE_H_
+
+#include <cstddef>
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+#include "absl/synchronization/mutex.h"
+#include "asylo/crypto/aes_gcm_siv.h"
+#include "asylo/crypto/util/bytes.h"
+#include "asylo/identity/sgx/code_identity.pb.h"
+#include "asylo/identity/sgx/identity_key_management_structs.h"
+#include "asylo/identity/sgx/local_sealed_secret.pb.h"
+#include "asylo/util/statusor.h"
+
+namespace asylo {
+namespace sgx {
+namespace internal {
+
+// A bounded cache of the keys generated by GenerateCryptorKey(). Keys are held
+// in AES GCM SIV contexts, so that a cached key is used without another
+// hardware key derivation or cipher key setup. Keys are cached by the fields of
+// the KEYREQUEST they are derived from, along with the cipher suite, identifier
+// and size of the key.
+//
+// The cache holds at most |capacity| keys, and evicts the least recently used
+// key to make room for a new one. A key is cleansed when it is evicted or
+// cleared from the cache, or, if a caller still uses it, once that caller
+// releases it.
+//
+// Cached keys are bound to the enclave that derived them, so a cache must not
+// be shared between enclaves.
+class SealingKeyCache {
+ public:
+  explicit SealingKeyCache(size_t capacity) : capacity_{capacity} {}
+
+  SealingKeyCache(const SealingKeyCache &other) = delete;
+  SealingKeyCache &operator=(const SealingKeyCache &other) = delete;
+
+  // Returns a context holding the key that GenerateCryptorKey() generates from
+  // the given parameters, generating and caching the key if it is not cached.
+  StatusOr<std::shared_ptr<const AesGcmSivContext>> GetContext(
+      CipherSuite cipher_suite, const std::string &key_id,
+      const UnsafeBytes<kCpusvnSize> &cpusvn,
+      const CodeIdentityExpectation &sgx_expectation, size_t key_size)
+      LOCKS_EXCLUDED(mu_);
+
+  // Removes all keys from the cache.
+  void Clear() LOCKS_EXCLUDED(mu_);
+
+  // Returns the number of cached keys.
+  size_t Size() const LOCKS_EXCLUDED(mu_);
+
+ private:
+  using Entry = std::pair<std::string, std::shared_ptr<const AesGcmSivContext>>;
+
+  const size_t capacity_;
+
+  mutable absl::Mutex mu_;
+
+  // Cached keys ordered from the most to the least recently used, and an index
+  // of the keys by their generation parameters.
+  std::list<Entry> entries_ GUARDED_BY(mu_);
+  std::unordered_map<std::string, std::list<Entry>::iterator> index_
+      GUARDED_BY(mu_);
+};
+
+}  // namespace internal
+}  // namespace sgx
+}  // namespace asylo
+
+#endif  // ASYLO_IDENTITY_SGX_SEALING_KEY_CACHE_H_
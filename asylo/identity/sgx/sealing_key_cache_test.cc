@@ -0,0 +1,198 @@
+/*
+ *
+ * Copyright 2018 Asylo authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "asylo/identity/sgx/sealing_key_cache.h"
+
+#include <memory>
+#include <string>
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include "asylo/crypto/aes_gcm_siv.h"
+#include "asylo/crypto/util/bytes.h"
+#include "asylo/identity/sgx/code_identity.pb.h"
+#include "asylo/identity/sgx/code_identity_util.h"
+#include "asylo/identity/sgx/fake_enclave.h"
+#include "asylo/identity/sgx/local_sealed_secret.pb.h"
+#include "asylo/identity/sgx/local_secret_sealer_helpers.h"
+#include "asylo/identity/sgx/self_identity.h"
+#include "asylo/test/util/status_matchers.h"
+#include "asylo/util/cleansing_types.h"
+#include "asylo/util/status.h"
+#include "asylo/util/statusor.h"
+
+namespace asylo {
+namespace sgx {
+namespace internal {
+namespace {
+
+constexpr char kKeyId[] = "test_key_id";
+constexpr size_t kKeySize = 32;
+constexpr char kTestAad[] = "Mary had a little lamb";
+constexpr char kTestSecret[] = "Its fleece was white as snow";
+constexpr size_t kMessageSizeLimit = 1 << 16;
+
+class SealingKeyCacheTest : public ::testing::Test {
+ protected:
+  SealingKeyCacheTest() {
+    do {
+      enclave_.reset(RandomFakeEnclaveFactory::Construct());
+    } while (enclave_->get_isvsvn() == 0);
+    FakeEnclave::EnterEnclave(*enclave_);
+
+    CodeIdentityMatchSpec spec;
+    SetDefaultMatchSpec(&spec);
+    SetExpectation(spec, GetSelfIdentity()->identity, &mrsigner_expectation_);
+
+    // An expectation that differs from mrsigner_expectation_ only in ISVSVN.
+    lower_isvsvn_expectation_ = mrsigner_expectation_;
+    lower_isvsvn_expectation_.mutable_reference_identity()
+        ->mutable_signer_assigned_identity()
+        ->set_isvsvn(enclave_->get_isvsvn() - 1);
+
+    // An expectation that differs from mrsigner_expectation_ only in KEYPOLICY.
+    spec.set_is_mrenclave_match_required(true);
+    spec.set_is_mrsigner_match_required(false);
+    SetExpectation(spec, GetSelfIdentity()->identity, &mrenclave_expectation_);
+  }
+
+  ~SealingKeyCacheTest() override { FakeEnclave::ExitEnclave(); }
+
+  std::shared_ptr<const AesGcmSivContext> GetContext(
+      SealingKeyCache *cache, const CodeIdentityExpectation &expectation) {
+    StatusOr<std::shared_ptr<const AesGcmSivContext>> result =
+        cache->GetContext(AES256_GCM_SIV, kKeyId, GetSelfIdentity()->cpusvn,
+                          expectation, kKeySize);
+    EXPECT_THAT(result, IsOk());
+    return result.ok() ? result.ValueOrDie() : nullptr;
+  }
+
+  std::unique_ptr<FakeEnclave> enclave_;
+  CodeIdentityExpectation mrsigner_expectation_;
+  CodeIdentityExpectation lower_isvsvn_expectation_;
+  CodeIdentityExpectation mrenclave_expectation_;
+};
+
+// Verifies that a cached context holds the key generated by
+// GenerateCryptorKey().
+TEST_F(SealingKeyCacheTest, ContextHoldsGeneratedKey) {
+  SealingKeyCache cache(/*capacity=*/4);
+  std::shared_ptr<const AesGcmSivContext> context =
+      GetContext(&cache, mrsigner_expectation_);
+  ASSERT_NE(context, nullptr);
+
+  AesGcmSivCryptor cryptor(kMessageSizeLimit, new AesGcmSivNonceGenerator());
+  std::string nonce;
+  std::string ciphertext;
+  ASSERT_THAT(cryptor.Seal(*context, std::string(kTestAad),
+                           std::string(kTestSecret), &nonce, &ciphertext),
+              IsOk());
+
+  CleansingVector<uint8_t> key;
+  ASSERT_THAT(
+      GenerateCryptorKey(AES256_GCM_SIV, kKeyId, GetSelfIdentity()->cpusvn,
+                         mrsigner_expectation_, kKeySize, &key),
+      IsOk());
+  CleansingString plaintext;
+  ASSERT_THAT(cryptor.Open(key, std::string(kTestAad), ciphertext, nonce,
+                           &plaintext),
+              IsOk());
+  EXPECT_EQ(plaintext, kTestSecret);
+}
+
+// Verifies that keys are cached by the parameters they are generated from.
+TEST_F(SealingKeyCacheTest, CachesKeysByParameters) {
+  SealingKeyCache cache(/*capacity=*/4);
+  std::shared_ptr<const AesGcmSivContext> mrsigner_context =
+      GetContext(&cache, mrsigner_expectation_);
+  EXPECT_EQ(GetContext(&cache, mrsigner_expectation_), mrsigner_context);
+  EXPECT_EQ(cache.Size(), 1);
+
+  std::shared_ptr<const AesGcmSivContext> lower_isvsvn_context =
+      GetContext(&cache, lower_isvsvn_expectation_);
+  std::shared_ptr<const AesGcmSivContext> mrenclave_context =
+      GetContext(&cache, mrenclave_expectation_);
+  EXPECT_NE(lower_isvsvn_context, mrsigner_context);
+  EXPECT_NE(mrenclave_context, mrsigner_context);
+  EXPECT_NE(mrenclave_context, lower_isvsvn_context);
+  EXPECT_NE(lower_isvsvn_context->key_id(), mrsigner_context->key_id());
+  EXPECT_NE(mrenclave_context->key_id(), mrsigner_context->key_id());
+  EXPECT_EQ(cache.Size(), 3);
+
+  EXPECT_EQ(GetContext(&cache, mrsigner_expectation_), mrsigner_context);
+  EXPECT_EQ(GetContext(&cache, lower_isvsvn_expectation_),
+            lower_isvsvn_context);
+  EXPECT_EQ(GetContext(&cache, mrenclave_expectation_), mrenclave_context);
+}
+
+// Verifies that the least recently used key is evicted from a full cache.
+TEST_F(SealingKeyCacheTest, EvictsLeastRecentlyUsedKey) {
+  SealingKeyCache cache(/*capacity=*/2);
+  std::shared_ptr<const AesGcmSivContext> mrsigner_context =
+      GetContext(&cache, mrsigner_expectation_);
+  std::shared_ptr<const AesGcmSivContext> lower_isvsvn_context =
+      GetContext(&cache, lower_isvsvn_expectation_);
+  EXPECT_EQ(GetContext(&cache, mrsigner_expectation_), mrsigner_context);
+
+  GetContext(&cache, mrenclave_expectation_);
+  EXPECT_EQ(cache.Size(), 2);
+  EXPECT_EQ(GetContext(&cache, mrsigner_expectation_), mrsigner_context);
+  EXPECT_NE(GetContext(&cache, lower_isvsvn_expectation_),
+            lower_isvsvn_context);
+}
+
+// Verifies that a cache with no capacity does not cache keys.
+TEST_F(SealingKeyCacheTest, ZeroCapacityCachesNothing) {
+  SealingKeyCache cache(/*capacity=*/0);
+  std::shared_ptr<const AesGcmSivContext> context =
+      GetContext(&cache, mrsigner_expectation_);
+  EXPECT_NE(context, nullptr);
+  EXPECT_NE(GetContext(&cache, mrsigner_expectation_), context);
+  EXPECT_EQ(cache.Size(), 0);
+}
+
+// Verifies that Clear() removes all keys, and that contexts held by callers
+// remain usable.
+TEST_F(SealingKeyCacheTest, ClearRemovesAllKeys) {
+  SealingKeyCache cache(/*capacity=*/4);
+  std::shared_ptr<const AesGcmSivContext> context =
+      GetContext(&cache, mrsigner_expectation_);
+  GetContext(&cache, mrenclave_expectation_);
+  EXPECT_EQ(cache.Size(), 2);
+
+  cache.Clear();
+  EXPECT_EQ(cache.Size(), 0);
+  EXPECT_NE(GetContext(&cache, mrsigner_expectation_), context);
+
+  AesGcmSivCryptor cryptor(kMessageSizeLimit, new AesGcmSivNonceGenerator());
+  std::string nonce;
+  std::string ciphertext;
+  CleansingString plaintext;
+  ASSERT_THAT(cryptor.Seal(*context, std::string(kTestAad),
+                           std::string(kTestSecret), &nonce, &ciphertext),
+              IsOk());
+  ASSERT_THAT(cryptor.Open(*context, std::string(kTestAad), ciphertext, nonce,
+                           &plaintext),
+              IsOk());
+  EXPECT_EQ(plaintext, kTestSecret);
+}
+
+}  // namespace
+}  // namespace internal
+}  // namespace sgx
+}  // namespace asylo
@@ -32,6 +32,7 @@
 #include "asylo/identity/sgx/identity_key_management_structs.h"
 #include "asylo/identity/sgx/local_secret_sealer_helpers.h"
 #include "asylo/identity/sgx/self_identity.h"
+#include "asylo/util/statusor.h"
 
 namespace asylo {
 
@@ -67,6 +68,7 @@ SgxLocalSecretSealer::SgxLocalSecretSealer(
     const sgx::CodeIdentityExpectation &default_client_acl)
     : cryptor_{new AesGcmSivCryptor(kMaxAesGcmSivMessageSize,
                                     new AesGcmSivNonceGenerator())},
+      key_cache_{kMaxCachedKeys},
       default_client_acl_{default_client_acl} {}
 
 SealingRootType SgxLocalSecretSealer::RootType() const { return LOCAL; }
@@ -133,15 +135,16 @@ Status SgxLocalSecretSealer::Seal(
                                        additional_authenticated_data};
   SerializeByteContainers(views, &final_additional_data);
 
-  CleansingVector<uint8_t> key;
-  status = sgx::internal::GenerateCryptorKey(cipher_suite, "default_key_id",
-                                             cpusvn, sgx_expectation,
-                                             kAes256GcmSivKeySize, &key);
-  if (!status.ok()) {
-    return status;
+  StatusOr<std::shared_ptr<const AesGcmSivContext>> context_result =
+      key_cache_.GetContext(cipher_suite, "default_key_id", cpusvn,
+                            sgx_expectation, kAes256GcmSivKeySize);
+  if (!context_result.ok()) {
+    return context_result.status();
   }
+  std::shared_ptr<const AesGcmSivContext> context =
+      context_result.ValueOrDie();
 
-  return cryptor_->Seal(key, final_additional_data, secret,
+  return cryptor_->Seal(*context, final_additional_data, secret,
                         sealed_secret->mutable_iv(),
                         sealed_secret->mutable_secret_ciphertext());
 }
@@ -169,17 +172,20 @@ Status SgxLocalSecretSealer::Unseal(const SealedSecret &sealed_secret,
       sealed_secret.additional_authenticated_data()};
   SerializeByteContainers(views, &final_additional_data);
 
-  CleansingVector<uint8_t> key;
-  status = sgx::internal::GenerateCryptorKey(cipher_suite, "default_key_id",
-                                             cpusvn, sgx_expectation,
-                                             kAes256GcmSivKeySize, &key);
-  if (!status.ok()) {
-    return status;
+  StatusOr<std::shared_ptr<const AesGcmSivContext>> context_result =
+      key_cache_.GetContext(cipher_suite, "default_key_id", cpusvn,
+                            sgx_expectation, kAes256GcmSivKeySize);
+  if (!context_result.ok()) {
+    return context_result.status();
   }
+  std::shared_ptr<const AesGcmSivContext> context =
+      context_result.ValueOrDie();
 
-  return cryptor_->Open(key, final_additional_data,
+  return cryptor_->Open(*context, final_additional_data,
                         sealed_secret.secret_ciphertext(), sealed_secret.iv(),
                         secret);
 }
 
+void SgxLocalSecretSealer::ClearKeyCache() { key_cache_.Clear(); }
+
 }  // namespace asylo
@@ -26,6 +26,7 @@
 #include "asylo/identity/identity.pb.h"
 #include "asylo/identity/secret_sealer.h"
 #include "asylo/identity/sgx/code_identity.pb.h"
+#include "asylo/identity/sgx/sealing_key_cache.h"
 #include "asylo/identity/util/bit_vector_128.pb.h"
 #include "asylo/identity/util/sha256_hash.pb.h"
 #include "asylo/util/cleansing_types.h"
@@ -104,6 +105,11 @@ namespace asylo {
 ///   // authenticated.
 /// ```
 ///
+/// The sealer caches the sealing keys it derives, so that sealing or unsealing
+/// many secrets with the same header parameters derives the key only once. The
+/// cache is bounded, and cached keys are cleansed when they are evicted, when
+/// ClearKeyCache() is called, and when the sealer is destroyed.
+///
 /// It should be noted that the SgxLocalSecretSealer's configuration only
 /// affects the default header generated by the sealer. Users can override the
 /// generated default header. A sealer in either MRENCLAVE or MRSIGNER
@@ -139,6 +145,11 @@ class SgxLocalSecretSealer : public SecretSealer {
   Status Unseal(const SealedSecret &sealed_secret,
                 CleansingVector<uint8_t> *secret) override;
 
+  /// Cleanses and discards the sealing keys cached by this sealer. Keys in use
+  /// by concurrent Seal() or Unseal() calls are cleansed when those calls
+  /// complete.
+  void ClearKeyCache();
+
  private:
   // Maximum size (in bytes) of each protected message (including authenticated
   // data). A protected message may not be larger than 32MB.
@@ -151,6 +162,11 @@ class SgxLocalSecretSealer : public SecretSealer {
   // machine, the key lifetime would reduce to ~256 years.
   static constexpr size_t kMaxAesGcmSivMessageSize = (1 << 25);
 
+  // Maximum number of sealing keys cached by the sealer. Keys differ by the
+  // CPUSVN, ISVSVN and match policy of the header they are derived from, of
+  // which an enclave typically uses only a handful.
+  static constexpr size_t kMaxCachedKeys = 16;
+
   // Instantiates LocalSecretSealer that sets client_acl in the default sealed
   // secret header per |default_client_acl|.
   SgxLocalSecretSealer(const sgx::CodeIdentityExpectation &default_client_acl);
@@ -158,6 +174,9 @@ class SgxLocalSecretSealer : public SecretSealer {
   // Cryptor to perform AEAD operations.
   std::unique_ptr<AesGcmSivCryptor> cryptor_;
 
+  // Cache of the sealing keys derived by the sealer.
+  sgx::internal::SealingKeyCache key_cache_;
+
   // The default client ACL for this SecretSealer.
   sgx::CodeIdentityExpectation default_client_acl_;
 };
@@ -18,11 +18,16 @@
 
 #include "asylo/identity/sgx/sgx_local_secret_sealer.h"
 
+#include <algorithm>
+#include <cstring>
 #include <memory>
+#include <string>
+#include <vector>
 
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
 #include "absl/memory/memory.h"
+#include "absl/strings/str_cat.h"
 #include "asylo/crypto/util/bytes.h"
 #include "asylo/crypto/util/trivial_object_util.h"
 #include "asylo/identity/identity.pb.h"
@@ -43,6 +48,7 @@ namespace asylo {
 namespace {
 
 using ::testing::Not;
+using ::testing::SizeIs;
 
 constexpr char kBadRootName[] = "BAD";
 constexpr char kBadAdditionalInfo[] = "BAD";
@@ -53,6 +59,43 @@ constexpr char kTestAad[] = "Mary had a little lamb";
 constexpr size_t kTestAadSize = sizeof(kTestAad) - 1;
 constexpr char kTestSecret[] = "Its fleece was white as snow";
 constexpr size_t kTestSecretSize = sizeof(kTestSecret) - 1;
+constexpr size_t kTestChunkSize = 1000;
+
+// Returns a reader of |data|, which must outlive the reader. The reader returns
+// at most |max_read| bytes per call.
+SecretSealer::StreamReader ReaderOf(ByteContainerView data, size_t max_read) {
+  auto position = std::make_shared<size_t>(0);
+  return [data, max_read, position](uint8_t *buffer,
+                                    size_t size) -> StatusOr<size_t> {
+    size_t count = std::min({size, max_read, data.size() - *position});
+    memcpy(buffer, data.data() + *position, count);
+    *position += count;
+    return count;
+  };
+}
+
+// Returns a writer that appends to |output|.
+template <class ContainerT>
+SecretSealer::StreamWriter WriterTo(ContainerT *output) {
+  return [output](ByteContainerView data) {
+    output->insert(output->end(), data.begin(), data.end());
+    return Status::OkStatus();
+  };
+}
+
+// Splits a sealed stream into its frames, including their lengths.
+std::vector<std::string> SplitFrames(const std::string &stream) {
+  std::vector<std::string> frames;
+  size_t position = 0;
+  while (position + sizeof(uint32_t) <= stream.size()) {
+    uint32_t length;
+    memcpy(&length, stream.data() + position, sizeof(length));
+    size_t frame_size = sizeof(length) + length;
+    frames.push_back(stream.substr(position, frame_size));
+    position += frame_size;
+  }
+  return frames;
+}
 
 // A test fixture is used for initializing state that is commonly used across
 // different tests.
@@ -593,5 +636,153 @@ TEST_F(SgxLocalSecretSealerTest,
   EXPECT_THAT(sealer2->Unseal(sealed_secret, &output_secret), Not(IsOk()));
 }
 
+// Verify that a sealer that reuses its cached keys seals and unseals many
+// secrets under MRSIGNER and MRENCLAVE headers, including after its key cache
+// is cleared.
+TEST_F(SgxLocalSecretSealerTest, SealUnsealSuccessWithCachedKeys) {
+  std::unique_ptr<SgxLocalSecretSealer> sealer =
+      SgxLocalSecretSealer::CreateMrsignerSecretSealer();
+  SealedSecretHeader mrsigner_header;
+  PrepareSealedSecretHeader(*sealer, &mrsigner_header);
+  std::unique_ptr<SgxLocalSecretSealer> mrenclave_sealer =
+      SgxLocalSecretSealer::CreateMrenclaveSecretSealer();
+  SealedSecretHeader mrenclave_header;
+  PrepareSealedSecretHeader(*mrenclave_sealer, &mrenclave_header);
+
+  std::vector<CleansingVector<uint8_t>> input_secrets;
+  std::vector<SealedSecret> sealed_secrets;
+  for (int i = 0; i < 20; ++i) {
+    std::string secret = absl::StrCat(kTestSecret, i);
+    input_secrets.emplace_back(secret.begin(), secret.end());
+    sealed_secrets.emplace_back();
+    ASSERT_THAT(sealer->Seal(i % 2 ? mrenclave_header : mrsigner_header,
+                             kTestAad, input_secrets.back(),
+                             &sealed_secrets.back()),
+                IsOk());
+  }
+
+  for (int pass = 0; pass < 2; ++pass) {
+    for (size_t i = 0; i < sealed_secrets.size(); ++i) {
+      CleansingVector<uint8_t> output_secret;
+      ASSERT_THAT(sealer->Unseal(sealed_secrets[i], &output_secret), IsOk());
+      EXPECT_EQ(output_secret, input_secrets[i]);
+    }
+    sealer->ClearKeyCache();
+  }
+
+  // Cached keys do not bypass authentication.
+  SealedSecret modified_secret = sealed_secrets[0];
+  modified_secret.set_additional_authenticated_data("modified");
+  CleansingVector<uint8_t> output_secret;
+  EXPECT_THAT(sealer->Unseal(sealed_secrets[0], &output_secret), IsOk());
+  EXPECT_THAT(sealer->Unseal(modified_secret, &output_secret), Not(IsOk()));
+}
+
+// Verify that a secret sealed in chunks can be unsealed in chunks, whether or
+// not its size is a multiple of the chunk size.
+TEST_F(SgxLocalSecretSealerTest, SealStreamUnsealStreamSuccess) {
+  std::unique_ptr<SgxLocalSecretSealer> sealer =
+      SgxLocalSecretSealer::CreateMrsignerSecretSealer();
+  SealedSecretHeader header;
+  PrepareSealedSecretHeader(*sealer, &header);
+
+  for (size_t secret_size :
+       {size_t{0}, kTestChunkSize, 5 * kTestChunkSize + 7}) {
+    CleansingVector<uint8_t> input_secret(secret_size);
+    for (size_t i = 0; i < secret_size; ++i) {
+      input_secret[i] = kTestSecret[i % kTestSecretSize];
+    }
+
+    std::string sealed_stream;
+    ASSERT_THAT(sealer->SealStream(header, kTestAad, kTestChunkSize,
+                                   ReaderOf(input_secret, kTestChunkSize / 3),
+                                   WriterTo(&sealed_stream)),
+                IsOk());
+    // The stream header is followed by one frame per chunk, and a last chunk
+    // that is shorter than the chunk size.
+    EXPECT_THAT(SplitFrames(sealed_stream),
+                SizeIs(2 + secret_size / kTestChunkSize));
+
+    std::unique_ptr<SgxLocalSecretSealer> sealer2 =
+        SgxLocalSecretSealer::CreateMrsignerSecretSealer();
+    CleansingVector<uint8_t> output_secret;
+    std::string output_aad;
+    ASSERT_THAT(sealer2->UnsealStream(ReaderOf(sealed_stream, 100),
+                                      WriterTo(&output_secret), &output_aad),
+                IsOk());
+    EXPECT_EQ(input_secret, output_secret);
+    EXPECT_EQ(output_aad, kTestAad);
+  }
+}
+
+// Verify that a sealed stream cannot be unsealed if its chunks are reordered,
+// dropped, or taken from another stream.
+TEST_F(SgxLocalSecretSealerTest, UnsealStreamFailureModifiedStream) {
+  std::unique_ptr<SgxLocalSecretSealer> sealer =
+      SgxLocalSecretSealer::CreateMrsignerSecretSealer();
+  SealedSecretHeader header;
+  PrepareSealedSecretHeader(*sealer, &header);
+
+  CleansingVector<uint8_t> input_secret(3 * kTestChunkSize + 1, 'a');
+  input_secret[0] = 'b';
+  std::string sealed_stream;
+  ASSERT_THAT(sealer->SealStream(header, kTestAad, kTestChunkSize,
+                                 ReaderOf(input_secret, kTestChunkSize),
+                                 WriterTo(&sealed_stream)),
+              IsOk());
+  std::string other_stream;
+  ASSERT_THAT(sealer->SealStream(header, kTestAad, kTestChunkSize,
+                                 ReaderOf(input_secret, kTestChunkSize),
+                                 WriterTo(&other_stream)),
+              IsOk());
+  std::vector<std::string> frames = SplitFrames(sealed_stream);
+  std::vector<std::string> other_frames = SplitFrames(other_stream);
+  ASSERT_THAT(frames, SizeIs(5));
+  ASSERT_THAT(other_frames, SizeIs(5));
+
+  std::vector<std::vector<std::string>> modified_streams = {
+      // The first two chunks are swapped.
+      {frames[0], frames[2], frames[1], frames[3], frames[4]},
+      // The last chunk is dropped.
+      {frames[0], frames[1], frames[2], frames[3]},
+      // A chunk is dropped.
+      {frames[0], frames[1], frames[3], frames[4]},
+      // A chunk is taken from another stream.
+      {frames[0], frames[1], other_frames[2], frames[3], frames[4]},
+      // The last chunk is followed by more data.
+      {frames[0], frames[1], frames[2], frames[3], frames[4], frames[4]},
+      // The stream header is truncated.
+      {frames[0].substr(0, frames[0].size() - 1)},
+  };
+  for (const std::vector<std::string> &modified_frames : modified_streams) {
+    std::string modified_stream;
+    for (const std::string &frame : modified_frames) {
+      modified_stream += frame;
+    }
+    CleansingVector<uint8_t> output_secret;
+    EXPECT_THAT(sealer->UnsealStream(ReaderOf(modified_stream, 100),
+                                     WriterTo(&output_secret), nullptr),
+                Not(IsOk()));
+  }
+}
+
+// Verify that the chunk size of a sealed stream is bounded.
+TEST_F(SgxLocalSecretSealerTest, SealStreamFailureInvalidChunkSize) {
+  std::unique_ptr<SgxLocalSecretSealer> sealer =
+      SgxLocalSecretSealer::CreateMrsignerSecretSealer();
+  SealedSecretHeader header;
+  PrepareSealedSecretHeader(*sealer, &header);
+
+  CleansingVector<uint8_t> input_secret(kTestSecret,
+                                        kTestSecret + kTestSecretSize);
+  std::string sealed_stream;
+  for (size_t chunk_size : {size_t{0}, SecretSealer::kMaxStreamChunkSize + 1}) {
+    EXPECT_THAT(sealer->SealStream(header, kTestAad, chunk_size,
+                                   ReaderOf(input_secret, kTestChunkSize),
+                                   WriterTo(&sealed_stream)),
+                StatusIs(error::GoogleError::INVALID_ARGUMENT));
+  }
+}
+
 }  // namespace
 }  // namespace asylo
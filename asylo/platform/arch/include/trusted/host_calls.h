@@ -28,6 +28,7 @@
 #include <sched.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <sys/epoll.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <time.h>
@@ -88,6 +89,29 @@ int enc_untrusted_fstat(int fd, struct stat *stat_buffer);
 int enc_untrusted_isatty(int file);
 ssize_t enc_untrusted_writev(int fd, const struct iovec *iov, int iovcnt);
 ssize_t enc_untrusted_readv(int fd, const struct iovec *iov, int iovcnt);
+ssize_t enc_untrusted_pread(int fd, void *buf, size_t len, off_t offset);
+ssize_t enc_untrusted_pwrite(int fd, const void *buf, size_t len,
+                             off_t offset);
+
+// A range of a file transferred to or from |base| by positioned I/O.
+struct enc_untrusted_io_segment {
+  off_t offset;
+  void *base;
+  size_t length;
+};
+
+// Reads each of |segments| from the file at its offset with a single exit from
+// the enclave. Sets the length of each segment to the number of bytes read into
+// it, which is less than requested only at the end of the file. Returns the
+// total number of bytes read, or -1 on error.
+ssize_t enc_untrusted_pread_segments(int fd,
+                                     struct enc_untrusted_io_segment *segments,
+                                     int segment_count);
+
+// Writes each of |segments| to the file at its offset with a single exit from
+// the enclave. Returns the total number of bytes written, or -1 on error.
+ssize_t enc_untrusted_pwrite_segments(
+    int fd, const struct enc_untrusted_io_segment *segments, int segment_count);
 
 //////////////////////////////////////
 //            Sockets               //
@@ -107,8 +131,15 @@ const char *enc_untrusted_inet_ntop(int af, const void *src, char *dst,
                                     socklen_t size);
 int enc_untrusted_inet_pton(int af, const char *src, void *dst);
 ssize_t enc_untrusted_send(int sockfd, const void *buf, size_t len, int flags);
+
+// Sends and receives |msg| with a single exit from the enclave, passing the
+// message to the host in one block of untrusted memory. Payload buffers of
+// |msg| that already lie outside the enclave, such as buffers allocated with
+// UntrustedArenaMalloc(), are used by the host directly instead of being
+// copied.
 ssize_t enc_untrusted_sendmsg(int sockfd, const struct msghdr *msg, int flags);
 ssize_t enc_untrusted_recvmsg(int sockfd, struct msghdr *msg, int flags);
+
 int enc_untrusted_getaddrinfo(const char *node, const char *service,
                               const struct addrinfo *hints,
                               struct addrinfo **res);
@@ -128,12 +159,41 @@ int enc_untrusted_getpeername(int sockfd, struct sockaddr *addr,
 // of the named enclave.
 int enc_untrusted_create_thread(const char *name);
 
+// Exits and blocks the calling thread for as long as the 32-bit word at
+// |futex|, which must be in untrusted memory, holds |expected|, but no longer
+// than |timeout_nanoseconds| if that is non-negative. May return spuriously, so
+// callers must check the condition they are waiting for again.
+int enc_untrusted_sys_futex_wait(int32_t *futex, int32_t expected,
+                                 int64_t timeout_nanoseconds);
+
+// Exits and wakes up to |num| threads blocked in enc_untrusted_sys_futex_wait
+// on |futex|. Returns the number of threads woken.
+int enc_untrusted_sys_futex_wake(int32_t *futex, int32_t num);
+
 //////////////////////////////////////
 //            poll.h                //
 //////////////////////////////////////
 
 int enc_untrusted_poll(struct pollfd *fds, nfds_t nfds, int timeout);
 
+//////////////////////////////////////
+//            sys/epoll.h           //
+//////////////////////////////////////
+
+int enc_untrusted_epoll_create1(int flags);
+
+// Registers the host file descriptor |fd| with the host epoll instance |epfd|.
+// The data of |event| is passed to the host as is.
+int enc_untrusted_epoll_ctl(int epfd, int op, int fd,
+                            struct epoll_event *event);
+
+// Waits for events on the host epoll instance |epfd|, storing up to
+// |maxevents| ready events in |events|. At most 1024 events are stored per
+// call. Returns the number of events stored, or -1 on error. Fails with EINVAL
+// if |maxevents| is not positive or exceeds the limit of Linux.
+int enc_untrusted_epoll_wait(int epfd, struct epoll_event *events,
+                             int maxevents, int timeout);
+
 //////////////////////////////////////
 //            sched.h               //
 //////////////////////////////////////
@@ -216,6 +276,13 @@ void *enc_untrusted_acquire_shared_resource(enum SharedNameKind kind,
 int enc_untrusted_release_shared_resource(enum SharedNameKind kind,
                                           const char *name);
 
+// Attaches the enclave to the switchless host call queue published by the
+// untrusted runtime for the enclave named |enclave_name|. Once attached, host
+// calls marked switchless are handed to untrusted worker threads when one is
+// available instead of exiting the enclave. Returns 0 on success and -1 if no
+// valid queue has been published for the enclave.
+int enc_init_switchless_host_calls(const char *enclave_name);
+
 //////////////////////////////////////
 //            Debugging             //
 //////////////////////////////////////
@@ -19,6 +19,7 @@
 #ifndef ASYLO_PLATFORM_ARCH_INCLUDE_TRUSTED_MEMORY_H_
 #define ASYLO_PLATFORM_ARCH_INCLUDE_TRUSTED_MEMORY_H_
 
+#include <cstddef>
 #include <memory>
 
 #include "asylo/platform/arch/include/trusted/host_calls.h"
@@ -34,6 +35,26 @@ struct UntrustedDeleter {
 template <typename T>
 using UntrustedUniquePtr = std::unique_ptr<T, UntrustedDeleter>;
 
+// Allocates |size| bytes of untrusted memory for a temporary buffer. Small
+// buffers are carved from an arena of untrusted memory managed inside the
+// enclave, which does not require a host call. Larger buffers, and buffers
+// allocated once the arena is exhausted, are allocated with
+// enc_untrusted_malloc(). Never returns nullptr. The buffer must be released
+// with UntrustedArenaFree(), and must not be freed by the host.
+void *UntrustedArenaMalloc(size_t size);
+
+// Releases a buffer allocated with UntrustedArenaMalloc().
+void UntrustedArenaFree(void *ptr);
+
+// Deleter for memory allocated with UntrustedArenaMalloc(), for use with
+// std::unique_ptr.
+struct UntrustedArenaDeleter {
+  inline void operator()(void *ptr) const { UntrustedArenaFree(ptr); }
+};
+
+template <typename T>
+using UntrustedArenaUniquePtr = std::unique_ptr<T, UntrustedArenaDeleter>;
+
 }  // namespace asylo
 
 #endif  // ASYLO_PLATFORM_ARCH_INCLUDE_TRUSTED_MEMORY_H_
@@ -73,6 +73,10 @@ STRING = host_calls_pb2.PointerAttributeProto.STRING
 SIZE = host_calls_pb2.PointerAttributeProto.SIZE
 USER_CHECK = host_calls_pb2.PointerAttributeProto.USER_CHECK
 
+# The maximum number of parameters of a switchless host call. This must match
+# kSwitchlessMaxArguments in asylo/platform/common/switchless_queue.h.
+SWITCHLESS_MAX_PARAMETERS = 6
+
 # Map from pointer attributes to strings.
 ATTRIBUTE_STRING_MAP = {
     IN: 'in',
@@ -155,6 +159,31 @@ def validate_pointer_attributes(parameter_proto):
                      'parameter "%s"!' % (parameter_proto.name))
 
 
+def validate_switchless_host_call(host_call_proto):
+  """Check that a host call marked switchless can be served switchlessly.
+
+  Switchless host calls pass their arguments as raw 64-bit values through
+  memory shared with the host, so no memory is copied across the enclave
+  boundary on their behalf.
+
+  Args:
+    host_call_proto: a single host call protocol buffer to validate.
+
+  Raises:
+    ValueError: Host call can not be served switchlessly.
+  """
+  if len(host_call_proto.parameters) > SWITCHLESS_MAX_PARAMETERS:
+    raise_host_call_error(
+        host_call_proto.name, 'Switchless host calls take at most %d '
+        'parameters!' % (SWITCHLESS_MAX_PARAMETERS))
+  for parameter_proto in host_call_proto.parameters:
+    attributes = [p.attribute for p in parameter_proto.pointer_attributes]
+    if is_pointer_type(parameter_proto.type) and attributes != [USER_CHECK]:
+      raise_host_call_error(
+          host_call_proto.name, 'Pointer parameter "%s" of a switchless host '
+          'call must be user_check!' % (parameter_proto.name))
+
+
 def validate_host_calls_proto(host_calls_proto):
   """Check the given host calls proto for semantic errors."""
   if not host_calls_proto.IsInitialized():
@@ -181,6 +210,8 @@ def validate_host_calls_proto(host_calls_proto):
         raise_host_call_error(
             host_call_proto.name, 'Pointer attributes given '
             'for non-pointer parameter "%s"!' % (parameter_proto.name))
+    if host_call_proto.switchless:
+      validate_switchless_host_call(host_call_proto)
 
 
 def comma_delimit_items(items):
@@ -219,6 +250,28 @@ def comma_separate_arguments(parameters_proto):
   return comma_delimit_items(name_list)
 
 
+def cast_from_switchless_value(value_type, expression):
+  """Cast a 64-bit value from a switchless host call slot to |value_type|."""
+  if is_pointer_type(value_type):
+    return 'reinterpret_cast<%s>(%s)' % (value_type, expression)
+  return 'static_cast<%s>(%s)' % (value_type, expression)
+
+
+def cast_to_switchless_value(value_type, expression):
+  """Cast |expression| of type |value_type| to a switchless slot value."""
+  if is_pointer_type(value_type):
+    return 'reinterpret_cast<uint64_t>(%s)' % (expression)
+  return 'static_cast<uint64_t>(%s)' % (expression)
+
+
+def comma_separate_switchless_arguments(parameters_proto, arguments):
+  """Unpack the parameters of a host call from the switchless |arguments|."""
+  return comma_delimit_items([
+      cast_from_switchless_value(p.type, '%s[%d]' % (arguments, index))
+      for index, p in enumerate(parameters_proto)
+  ])
+
+
 def read_input_file(file_name):
   file_path = os.path.join(CODEGEN_PATH, file_name)
   with open(file_path, 'r') as file:
@@ -233,6 +286,10 @@ def fill_template(dictionary, template_file_name):
       'comma_separate_bridge_parameters'] = comma_separate_bridge_parameters
   template.globals['comma_separate_parameters'] = comma_separate_parameters
   template.globals['comma_separate_arguments'] = comma_separate_arguments
+  template.globals['comma_separate_switchless_arguments'] = (
+      comma_separate_switchless_arguments)
+  template.globals['cast_from_switchless_value'] = cast_from_switchless_value
+  template.globals['cast_to_switchless_value'] = cast_to_switchless_value
   return template.render(dictionary)
 
 
@@ -246,7 +303,18 @@ def get_host_calls_dictionary(host_calls_textproto):
   host_calls_proto = text_format.Parse(host_calls_textproto,
                                        host_calls_pb2.HostCallsProto())
   validate_host_calls_proto(host_calls_proto)
-  return {'host_calls': host_calls_proto.host_calls}
+  # The position of a host call in the switchless host calls list is the
+  # function number used to request it through the switchless queue.
+  switchless_host_calls = [
+      h for h in host_calls_proto.host_calls if h.switchless
+  ]
+  return {
+      'host_calls': host_calls_proto.host_calls,
+      'switchless_host_calls': switchless_host_calls,
+      'switchless_function_numbers': {
+          h.name: index for index, h in enumerate(switchless_host_calls)
+      }
+  }
 
 
 def main(unused_argv):
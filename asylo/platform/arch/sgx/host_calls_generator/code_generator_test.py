@@ -172,6 +172,47 @@ class CodeGeneratorTest(TestCase):
     with self.assertRaises(ValueError):
       code_generator.get_host_calls_dictionary(textproto)
 
+  def test_switchless_host_calls(self):
+    textproto = ('host_calls { name: "fsync" return_type: "int" '
+                 'parameters { name: "fd" type: "int" }} '
+                 'host_calls { name: "realloc" return_type: "void *" '
+                 'switchless: true '
+                 'parameters { name: "ptr" type: "void *" '
+                 'pointer_attributes { attribute: USER_CHECK }} '
+                 'parameters { name: "size" type: "size_t" }}')
+    host_calls = code_generator.get_host_calls_dictionary(textproto)
+    switchless_host_calls = host_calls['switchless_host_calls']
+    self.assertEqual(1, len(switchless_host_calls))
+    self.assertEqual('realloc', switchless_host_calls[0].name)
+    self.assertEqual(
+        'reinterpret_cast<void *>(args[0]), static_cast<size_t>(args[1])',
+        code_generator.comma_separate_switchless_arguments(
+            switchless_host_calls[0].parameters, 'args'))
+    self.assertEqual(
+        'reinterpret_cast<uint64_t>(ptr)',
+        code_generator.cast_to_switchless_value('void *', 'ptr'))
+    self.assertEqual('static_cast<uint64_t>(size)',
+                     code_generator.cast_to_switchless_value('size_t', 'size'))
+
+  def test_switchless_host_call_copied_pointer(self):
+    textproto = ('host_calls { name: "write" return_type: "int" '
+                 'switchless: true '
+                 'parameters { name: "buf" type: "const void *" '
+                 'pointer_attributes { attribute: IN } '
+                 'pointer_attributes { attribute: SIZE '
+                 'attribute_expression: "count" }} '
+                 'parameters { name: "count" type: "size_t" }}')
+    with self.assertRaises(ValueError):
+      code_generator.get_host_calls_dictionary(textproto)
+
+  def test_switchless_host_call_too_many_parameters(self):
+    textproto = ('host_calls { name: "f" return_type: "int" '
+                 'switchless: true ' + ''.join(
+                     'parameters { name: "p%d" type: "int" } ' % i
+                     for i in range(7)) + '}')
+    with self.assertRaises(ValueError):
+      code_generator.get_host_calls_dictionary(textproto)
+
 
 if __name__ == '__main__':
   main()
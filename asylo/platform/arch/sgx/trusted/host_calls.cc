@@ -25,6 +25,7 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <poll.h>
 #include <stdarg.h>
 #include <stdint.h>
@@ -34,6 +35,7 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
+#include <algorithm>
 #include <string>
 #include <vector>
 
@@ -47,123 +49,158 @@
 namespace asylo {
 namespace {
 
-// Allocates untrusted memory and copies the buffer |data| of size |size| to it.
-// |addr| is updated to point to the address of the copied memory. It is the
-// responsibility of the caller to free the memory pointed to by |addr|.
-bool CopyToUntrustedMemory(void **addr, void *data, size_t size) {
-  if (data && !addr) {
+// Largest |maxevents| accepted by epoll_wait, as EP_MAX_EVENTS on Linux.
+constexpr int kMaxEpollEvents = INT_MAX / sizeof(struct epoll_event);
+
+// Largest number of events fetched from the host by a single epoll_wait. This
+// bounds the buffer the events are received into. epoll_wait may report fewer
+// events than requested, so larger requests simply receive at most this many.
+constexpr int kMaxEpollEventsPerCall = 1024;
+
+// Advances |*offset| past a part of |size| bytes of an UntrustedMsghdr, keeping
+// the next part aligned. Returns false if the offset overflows.
+bool ReserveMsghdrPart(size_t size, size_t *offset) {
+  constexpr size_t kAlignment = alignof(struct bridge_msghdr);
+  if (*offset > SIZE_MAX - kAlignment ||
+      size > SIZE_MAX - kAlignment - *offset) {
     return false;
   }
-  // The operation trivially succeeds if there is nothing to copy.
-  if (!data) {
-    return true;
-  }
-  void *outside_enclave = enc_untrusted_malloc(size);
-  memcpy(outside_enclave, data, size);
-  *addr = outside_enclave;
+  *offset = (*offset + size + kAlignment - 1) & ~(kAlignment - 1);
   return true;
 }
 
-// This helper class wraps a bridge_msghdr and does a deep copy of all the
-// buffers to untrusted memory.
-class BridgeMsghdrWrapper {
+// Lays out a bridge_msghdr together with its iovec array, name, control data
+// and payloads in a single block of untrusted memory, so that a message is
+// passed to the host with one allocation and one ocall.
+//
+// Payload buffers of the message that already lie outside the enclave are
+// passed to the host as is, so data sent from or received into them is not
+// copied again. The layout is kept in trusted memory; after the ocall only the
+// lengths written back by the host are read from the untrusted block, and they
+// are bounded by the buffers of the message.
+class UntrustedMsghdr {
  public:
-  BridgeMsghdrWrapper(const struct msghdr *in);
-  bridge_msghdr *get_msg();
-  bool CopyAllBuffers();
+  // Lays out |msg|. If |copy_in| is true, the name, control data and payloads
+  // of |msg| are copied to untrusted memory, as needed to send it.
+  UntrustedMsghdr(const struct msghdr *msg, bool copy_in);
 
- private:
-  bool CopyMsgName();
-  bool CopyMsgIov();
-  bool CopyMsgIovBase();
-  bool CopyMsgControl();
-
-  const msghdr *msg_in_;
-  UntrustedUniquePtr<bridge_msghdr> msg_out_;
-  UntrustedUniquePtr<void> msg_name_ptr_;
-  UntrustedUniquePtr<void> msg_iov_ptr_;
-  UntrustedUniquePtr<void> msg_control_ptr_;
-  std::vector<UntrustedUniquePtr<void>> msg_iov_base_ptrs_;
-};
+  // Returns the bridge msghdr to pass to the host, or nullptr if |msg| could
+  // not be laid out.
+  bridge_msghdr *get() { return bridge_msg_; }
 
-BridgeMsghdrWrapper::BridgeMsghdrWrapper(const struct msghdr *in) {
-  struct bridge_msghdr tmp;
-  ToBridgeMsgHdr(in, &tmp);
-  struct bridge_msghdr *tmp_bridge_msghdr(nullptr);
-  bool ret =
-      CopyToUntrustedMemory(reinterpret_cast<void **>(&tmp_bridge_msghdr), &tmp,
-                            sizeof(struct bridge_msghdr));
-  if (ret && tmp_bridge_msghdr) {
-    msg_out_.reset(tmp_bridge_msghdr);
-  }
-  msg_in_ = in;
-}
+  // Copies |size| bytes of payload received by the host, along with the name,
+  // control data and flags, back to |msg|. Returns false if |size| exceeds the
+  // buffers of |msg|, in which case only the bytes that fit are copied.
+  bool CopyOut(size_t size, struct msghdr *msg) const;
 
-bridge_msghdr *BridgeMsghdrWrapper::get_msg() { return msg_out_.get(); }
+ private:
+  UntrustedArenaUniquePtr<uint8_t> buffer_;
+  bridge_msghdr *bridge_msg_ = nullptr;
+  uint8_t *name_ = nullptr;
+  uint8_t *control_ = nullptr;
 
-bool BridgeMsghdrWrapper::CopyMsgName() {
-  void *tmp_name_ptr(nullptr);
-  if (!CopyToUntrustedMemory(&tmp_name_ptr, msg_in_->msg_name,
-                             msg_in_->msg_namelen)) {
-    return false;
-  }
-  if (tmp_name_ptr) {
-    msg_name_ptr_.reset(tmp_name_ptr);
-    msg_out_->msg_name = tmp_name_ptr;
+  // The untrusted copy of each payload, or nullptr for a payload passed as is.
+  std::vector<uint8_t *> payloads_;
+};
+
+UntrustedMsghdr::UntrustedMsghdr(const struct msghdr *msg, bool copy_in) {
+  if (!msg || (msg->msg_iovlen > 0 && !msg->msg_iov) ||
+      msg->msg_iovlen > SIZE_MAX / sizeof(struct bridge_iovec)) {
+    return;
+  }
+  const size_t iov_count = msg->msg_iovlen;
+
+  size_t size = 0;
+  ReserveMsghdrPart(sizeof(struct bridge_msghdr), &size);
+  const size_t iov_offset = size;
+  if (!ReserveMsghdrPart(iov_count * sizeof(struct bridge_iovec), &size)) {
+    return;
+  }
+  const size_t name_offset = size;
+  if (!ReserveMsghdrPart(msg->msg_name ? msg->msg_namelen : 0, &size)) {
+    return;
+  }
+  const size_t control_offset = size;
+  if (!ReserveMsghdrPart(msg->msg_control ? msg->msg_controllen : 0, &size)) {
+    return;
+  }
+  // Offset zero holds the bridge msghdr, so it marks payloads passed as is.
+  std::vector<size_t> payload_offsets(iov_count, 0);
+  for (size_t i = 0; i < iov_count; ++i) {
+    const struct iovec &iov = msg->msg_iov[i];
+    if (iov.iov_len > 0 && sgx_is_outside_enclave(iov.iov_base, iov.iov_len)) {
+      continue;
+    }
+    payload_offsets[i] = size;
+    if (!ReserveMsghdrPart(iov.iov_len, &size)) {
+      return;
+    }
   }
-  return true;
-}
 
-bool BridgeMsghdrWrapper::CopyMsgIov() {
-  struct bridge_iovec *tmp_iov_ptr = reinterpret_cast<struct bridge_iovec *>(
-      enc_untrusted_malloc(msg_in_->msg_iovlen * sizeof(struct bridge_iovec)));
-  if (tmp_iov_ptr) {
-    msg_iov_ptr_.reset(tmp_iov_ptr);
-    msg_out_->msg_iov = tmp_iov_ptr;
+  buffer_.reset(reinterpret_cast<uint8_t *>(UntrustedArenaMalloc(size)));
+  uint8_t *base = buffer_.get();
+  bridge_msghdr *bridge_msg = reinterpret_cast<struct bridge_msghdr *>(base);
+  ToBridgeMsgHdr(msg, bridge_msg);
+  bridge_msg->msg_iov =
+      reinterpret_cast<struct bridge_iovec *>(base + iov_offset);
+  if (msg->msg_name) {
+    name_ = base + name_offset;
+    bridge_msg->msg_name = name_;
+    if (copy_in) {
+      memcpy(name_, msg->msg_name, msg->msg_namelen);
+    }
   }
-  for (int i = 0; i < msg_in_->msg_iovlen; ++i) {
-    if (!ToBridgeIovec(&msg_in_->msg_iov[i], &msg_out_->msg_iov[i])) {
-      return false;
+  if (msg->msg_control) {
+    control_ = base + control_offset;
+    bridge_msg->msg_control = control_;
+    if (copy_in) {
+      memcpy(control_, msg->msg_control, msg->msg_controllen);
     }
   }
-  return true;
-}
 
-bool BridgeMsghdrWrapper::CopyMsgIovBase() {
-  for (int i = 0; i < msg_in_->msg_iovlen; ++i) {
-    msg_iov_base_ptrs_.push_back(nullptr);
-    void *tmp_iov_base_ptr(nullptr);
-    if (!CopyToUntrustedMemory(&tmp_iov_base_ptr, msg_in_->msg_iov[i].iov_base,
-                               msg_in_->msg_iov[i].iov_len)) {
-      return false;
+  payloads_.resize(iov_count, nullptr);
+  for (size_t i = 0; i < iov_count; ++i) {
+    const struct iovec &iov = msg->msg_iov[i];
+    struct bridge_iovec *bridge_iov = &bridge_msg->msg_iov[i];
+    bridge_iov->iov_len = iov.iov_len;
+    if (payload_offsets[i] == 0) {
+      bridge_iov->iov_base = iov.iov_base;
+      continue;
     }
-    if (tmp_iov_base_ptr) {
-      msg_iov_base_ptrs_[i].reset(tmp_iov_base_ptr);
-      msg_out_->msg_iov[i].iov_base = tmp_iov_base_ptr;
+    payloads_[i] = base + payload_offsets[i];
+    bridge_iov->iov_base = payloads_[i];
+    if (copy_in && iov.iov_len > 0) {
+      memcpy(payloads_[i], iov.iov_base, iov.iov_len);
     }
   }
-  return true;
+  bridge_msg_ = bridge_msg;
 }
 
-bool BridgeMsghdrWrapper::CopyMsgControl() {
-  void *tmp_control_ptr(nullptr);
-  if (!CopyToUntrustedMemory(&tmp_control_ptr, msg_in_->msg_control,
-                             msg_in_->msg_controllen)) {
-    return false;
-  }
-  if (tmp_control_ptr) {
-    msg_control_ptr_.reset(tmp_control_ptr);
-    msg_out_->msg_control = tmp_control_ptr;
+bool UntrustedMsghdr::CopyOut(size_t size, struct msghdr *msg) const {
+  size_t bytes_left = size;
+  for (size_t i = 0; i < payloads_.size() && bytes_left > 0; ++i) {
+    const size_t bytes_to_copy = std::min(bytes_left, msg->msg_iov[i].iov_len);
+    if (payloads_[i]) {
+      memcpy(msg->msg_iov[i].iov_base, payloads_[i], bytes_to_copy);
+    }
+    bytes_left -= bytes_to_copy;
   }
-  return true;
-}
 
-bool BridgeMsghdrWrapper::CopyAllBuffers() {
-  if (!CopyMsgName() || !CopyMsgIov() || !CopyMsgIovBase() ||
-      !CopyMsgControl()) {
-    return false;
+  // Each length is read once, since the host may change it at any time.
+  if (name_) {
+    const size_t namelen = std::min<uint64_t>(bridge_msg_->msg_namelen,
+                                              msg->msg_namelen);
+    memcpy(msg->msg_name, name_, namelen);
+    msg->msg_namelen = namelen;
   }
-  return true;
+  if (control_) {
+    const size_t controllen = std::min<uint64_t>(bridge_msg_->msg_controllen,
+                                                 msg->msg_controllen);
+    memcpy(msg->msg_control, control_, controllen);
+    msg->msg_controllen = controllen;
+  }
+  msg->msg_flags = bridge_msg_->msg_flags;
+  return bytes_left == 0;
 }
 
 }  // namespace
@@ -317,8 +354,7 @@ bool create_untrusted_buffer(const struct iovec *iov, int iovcnt, char **buf,
   for (int i = 0; i < iovcnt; ++i) {
     tmp_size += iov[i].iov_len;
   }
-  char *tmp =
-      reinterpret_cast<char *>(enc_untrusted_malloc(tmp_size * sizeof(char)));
+  char *tmp = reinterpret_cast<char *>(asylo::UntrustedArenaMalloc(tmp_size));
   if (!tmp) {
     return false;
   }
@@ -365,7 +401,7 @@ ssize_t enc_untrusted_writev(int fd, const struct iovec *iov, int iovcnt) {
   if (!serialize_iov(iov, iovcnt, &buf, &size)) {
     return -1;
   }
-  asylo::UntrustedUniquePtr<char> tmp(buf);
+  asylo::UntrustedArenaUniquePtr<char> tmp(buf);
   bridge_ssize_t ret;
 
   sgx_status_t status =
@@ -388,7 +424,7 @@ ssize_t enc_untrusted_readv(int fd, const struct iovec *iov, int iovcnt) {
     return -1;
   }
 
-  asylo::UntrustedUniquePtr<char> tmp(buf);
+  asylo::UntrustedArenaUniquePtr<char> tmp(buf);
   bridge_ssize_t ret;
   sgx_status_t status =
       ocall_enc_untrusted_read_with_untrusted_ptr(&ret, fd, buf, size);
@@ -400,6 +436,110 @@ ssize_t enc_untrusted_readv(int fd, const struct iovec *iov, int iovcnt) {
   return static_cast<ssize_t>(ret);
 }
 
+// Converts |segments| to bridge segments and returns the total number of bytes
+// they cover, or -1 if there are none or the total overflows.
+ssize_t to_bridge_segments(const struct enc_untrusted_io_segment *segments,
+                           int segment_count,
+                           std::vector<struct bridge_io_segment> *out) {
+  if (segment_count <= 0) {
+    return -1;
+  }
+  size_t total = 0;
+  out->resize(segment_count);
+  for (int i = 0; i < segment_count; ++i) {
+    if (segments[i].length > SSIZE_MAX - total) {
+      return -1;
+    }
+    total += segments[i].length;
+    (*out)[i].offset = static_cast<int64_t>(segments[i].offset);
+    (*out)[i].length = static_cast<uint64_t>(segments[i].length);
+  }
+  return static_cast<ssize_t>(total);
+}
+
+ssize_t enc_untrusted_pwrite_segments(
+    int fd, const struct enc_untrusted_io_segment *segments,
+    int segment_count) {
+  std::vector<struct bridge_io_segment> bridge_segments;
+  ssize_t size =
+      to_bridge_segments(segments, segment_count, &bridge_segments);
+  if (size < 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  char *buf = reinterpret_cast<char *>(asylo::UntrustedArenaMalloc(size));
+  if (!buf) {
+    return -1;
+  }
+  asylo::UntrustedArenaUniquePtr<char> tmp(buf);
+  for (int i = 0; i < segment_count; ++i) {
+    memcpy(buf, segments[i].base, segments[i].length);
+    buf += segments[i].length;
+  }
+
+  bridge_ssize_t ret;
+  sgx_status_t status = ocall_enc_untrusted_pwrite_segments(
+      &ret, fd, tmp.get(), bridge_segments.data(), segment_count);
+  if (status != SGX_SUCCESS) {
+    errno = EINTR;
+    return -1;
+  }
+  if (ret > size) {
+    errno = EIO;
+    return -1;
+  }
+  return static_cast<ssize_t>(ret);
+}
+
+ssize_t enc_untrusted_pread_segments(int fd,
+                                     struct enc_untrusted_io_segment *segments,
+                                     int segment_count) {
+  std::vector<struct bridge_io_segment> bridge_segments;
+  ssize_t size =
+      to_bridge_segments(segments, segment_count, &bridge_segments);
+  if (size < 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  char *buf = reinterpret_cast<char *>(asylo::UntrustedArenaMalloc(size));
+  if (!buf) {
+    return -1;
+  }
+  asylo::UntrustedArenaUniquePtr<char> tmp(buf);
+
+  bridge_ssize_t ret;
+  sgx_status_t status = ocall_enc_untrusted_pread_segments(
+      &ret, fd, tmp.get(), bridge_segments.data(), segment_count);
+  if (status != SGX_SUCCESS) {
+    errno = EINTR;
+    return -1;
+  }
+  if (ret < 0) {
+    return -1;
+  }
+
+  // The segment lengths are reported by the host, so they are checked against
+  // the requested lengths before any data is copied into the enclave.
+  ssize_t total = 0;
+  for (int i = 0; i < segment_count; ++i) {
+    if (bridge_segments[i].length > segments[i].length) {
+      errno = EIO;
+      return -1;
+    }
+    total += bridge_segments[i].length;
+  }
+  if (total != ret) {
+    errno = EIO;
+    return -1;
+  }
+  for (int i = 0; i < segment_count; ++i) {
+    memcpy(segments[i].base, buf, bridge_segments[i].length);
+    buf += segments[i].length;
+    segments[i].length = bridge_segments[i].length;
+  }
+  return total;
+}
+
 //////////////////////////////////////
 //             Sockets              //
 //////////////////////////////////////
@@ -454,16 +594,15 @@ int enc_untrusted_connect(int sockfd, const struct sockaddr *addr,
 }
 
 ssize_t enc_untrusted_sendmsg(int sockfd, const struct msghdr *msg, int flags) {
-  bridge_ssize_t ret;
-  asylo::BridgeMsghdrWrapper tmp_wrapper(msg);
-  if (!tmp_wrapper.CopyAllBuffers()) {
+  asylo::UntrustedMsghdr untrusted_msg(msg, /*copy_in=*/true);
+  if (!untrusted_msg.get()) {
     errno = EFAULT;
     return -1;
   }
 
+  bridge_ssize_t ret;
   sgx_status_t status =
-      ocall_enc_untrusted_sendmsg(&ret, sockfd, tmp_wrapper.get_msg(), flags);
-
+      ocall_enc_untrusted_sendmsg(&ret, sockfd, untrusted_msg.get(), flags);
   if (status != SGX_SUCCESS) {
     errno = EINTR;
     return -1;
@@ -472,22 +611,28 @@ ssize_t enc_untrusted_sendmsg(int sockfd, const struct msghdr *msg, int flags) {
 }
 
 ssize_t enc_untrusted_recvmsg(int sockfd, struct msghdr *msg, int flags) {
-  bridge_ssize_t ret;
-  asylo::BridgeMsghdrWrapper tmp_wrapper(msg);
-  if (!tmp_wrapper.CopyAllBuffers()) {
+  asylo::UntrustedMsghdr untrusted_msg(msg, /*copy_in=*/false);
+  if (!untrusted_msg.get()) {
     errno = EFAULT;
     return -1;
   }
 
+  bridge_ssize_t ret;
   sgx_status_t status =
-      ocall_enc_untrusted_recvmsg(&ret, sockfd, tmp_wrapper.get_msg(), flags);
-
+      ocall_enc_untrusted_recvmsg(&ret, sockfd, untrusted_msg.get(), flags);
   if (status != SGX_SUCCESS) {
     errno = EINTR;
     return -1;
   }
-
-  FromBridgeIovecArray(tmp_wrapper.get_msg(), msg);
+  if (ret < 0) {
+    return -1;
+  }
+  // With MSG_TRUNC the host reports the full length of a datagram, which may
+  // exceed the buffers of |msg|.
+  if (!untrusted_msg.CopyOut(ret, msg) && !(flags & MSG_TRUNC)) {
+    errno = EFAULT;
+    return -1;
+  }
   return static_cast<ssize_t>(ret);
 }
 
@@ -635,6 +780,36 @@ int enc_untrusted_create_thread(const char *name) {
   return 0;
 }
 
+int enc_untrusted_sys_futex_wait(int32_t *futex, int32_t expected,
+                                 int64_t timeout_nanoseconds) {
+  if (!sgx_is_outside_enclave(futex, sizeof(*futex))) {
+    errno = EINVAL;
+    return -1;
+  }
+  int ret;
+  sgx_status_t status = ocall_enc_untrusted_sys_futex_wait(
+      &ret, futex, expected, timeout_nanoseconds);
+  if (status != SGX_SUCCESS) {
+    errno = EINTR;
+    return -1;
+  }
+  return ret;
+}
+
+int enc_untrusted_sys_futex_wake(int32_t *futex, int32_t num) {
+  if (!sgx_is_outside_enclave(futex, sizeof(*futex))) {
+    errno = EINVAL;
+    return -1;
+  }
+  int ret;
+  sgx_status_t status = ocall_enc_untrusted_sys_futex_wake(&ret, futex, num);
+  if (status != SGX_SUCCESS) {
+    errno = EINTR;
+    return -1;
+  }
+  return ret;
+}
+
 //////////////////////////////////////
 //           poll.h                 //
 //////////////////////////////////////
@@ -663,6 +838,68 @@ int enc_untrusted_poll(struct pollfd *fds, nfds_t nfds, int timeout) {
   return ret;
 }
 
+//////////////////////////////////////
+//           sys/epoll.h            //
+//////////////////////////////////////
+
+int enc_untrusted_epoll_create1(int flags) {
+  int ret;
+  int bridge_flags = (flags & EPOLL_CLOEXEC) ? ToBridgeFDFlags(FD_CLOEXEC) : 0;
+  sgx_status_t status = ocall_enc_untrusted_epoll_create1(&ret, bridge_flags);
+  if (status != SGX_SUCCESS) {
+    errno = EINTR;
+    return -1;
+  }
+  return ret;
+}
+
+int enc_untrusted_epoll_ctl(int epfd, int op, int fd,
+                            struct epoll_event *event) {
+  int bridge_op = ToBridgeEpollCtlOperation(op);
+  if (bridge_op == -1) {
+    errno = EINVAL;
+    return -1;
+  }
+  // The event is ignored by EPOLL_CTL_DEL, but the bridge always passes one.
+  struct epoll_event empty_event = {};
+  struct bridge_epoll_event bridge_event;
+  ToBridgeEpollEvent(event ? event : &empty_event, &bridge_event);
+
+  int ret;
+  sgx_status_t status =
+      ocall_enc_untrusted_epoll_ctl(&ret, epfd, bridge_op, fd, &bridge_event);
+  if (status != SGX_SUCCESS) {
+    errno = EINTR;
+    return -1;
+  }
+  return ret;
+}
+
+int enc_untrusted_epoll_wait(int epfd, struct epoll_event *events,
+                             int maxevents, int timeout) {
+  if (maxevents <= 0 || maxevents > kMaxEpollEvents) {
+    errno = EINVAL;
+    return -1;
+  }
+  const int fetched_events = std::min(maxevents, kMaxEpollEventsPerCall);
+  auto tmp = absl::make_unique<bridge_epoll_event[]>(fetched_events);
+  int ret;
+  sgx_status_t status = ocall_enc_untrusted_epoll_wait(
+      &ret, epfd, tmp.get(), fetched_events, timeout);
+  if (status != SGX_SUCCESS) {
+    errno = EINTR;
+    return -1;
+  }
+  if (ret > fetched_events) {
+    errno = EFAULT;
+    return -1;
+  }
+  for (int i = 0; i < ret; ++i) {
+    FromBridgeEpollEvent(&tmp[i], &events[i]);
+  }
+  return ret;
+}
+
 //////////////////////////////////////
 //           sched.h                //
 //////////////////////////////////////
@@ -0,0 +1,48 @@
+/*
+ *
+ * Copyright 2018 Asylo authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "asylo/platform/arch/include/trusted/memory.h"
+
+#include "asylo/platform/arch/include/trusted/host_calls.h"
+#include "asylo/platform/common/untrusted_arena.h"
+
+namespace asylo {
+namespace {
+
+// Returns the arena of untrusted memory of the enclave. Its slabs are
+// allocated with enc_untrusted_malloc(), which aborts unless the memory is
+// outside the enclave.
+UntrustedArena *GetUntrustedArena() {
+  static UntrustedArena *arena = new UntrustedArena(&enc_untrusted_malloc);
+  return arena;
+}
+
+}  // namespace
+
+void *UntrustedArenaMalloc(size_t size) {
+  void *ptr = GetUntrustedArena()->Allocate(size);
+  return ptr ? ptr : enc_untrusted_malloc(size);
+}
+
+void UntrustedArenaFree(void *ptr) {
+  if (ptr && !GetUntrustedArena()->Free(ptr)) {
+    enc_untrusted_free(ptr);
+  }
+}
+
+}  // namespace asylo
@@ -0,0 +1,111 @@
+/*
+ *
+ * Copyright 2018 Asylo authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "asylo/platform/arch/sgx/trusted/switchless_host_calls.h"
+
+#include <stdlib.h>
+
+#include <atomic>
+#include <string>
+
+#include "absl/strings/str_cat.h"
+#include "asylo/platform/arch/include/trusted/enclave_interface.h"
+#include "asylo/platform/arch/include/trusted/host_calls.h"
+#include "asylo/platform/common/bridge_types.h"
+#include "asylo/platform/core/shared_name_kind.h"
+
+namespace asylo {
+namespace {
+
+// The queue shared with the host workers, or nullptr if the enclave is not
+// attached to one.
+std::atomic<SwitchlessHostCallQueue *> switchless_queue(nullptr);
+
+}  // namespace
+
+bool TrySwitchlessHostCall(uint32_t function, const uint64_t *arguments,
+                           int64_t *result, int *host_errno) {
+  SwitchlessHostCallQueue *queue =
+      switchless_queue.load(std::memory_order_acquire);
+  if (!queue) {
+    return false;
+  }
+  SwitchlessHostCall *call = queue->Reserve();
+  if (!call) {
+    return false;
+  }
+
+  call->function = function;
+  for (int i = 0; i < kSwitchlessMaxArguments; i++) {
+    call->arguments[i] = arguments[i];
+  }
+  queue->Submit(call);
+
+  // Wait for a worker to claim the request, withdrawing it if none does in
+  // time. If the request can not be withdrawn, a worker claimed it in the
+  // meantime. Idle workers that went to sleep find the withdrawn request when
+  // they wake up and resume polling, so that the following calls are claimed
+  // in time.
+  int spins = 0;
+  while (call->state.load(std::memory_order_acquire) ==
+         SwitchlessHostCall::kSubmitted) {
+    if (++spins > kSwitchlessPickupPolls && queue->Cancel(call)) {
+      return false;
+    }
+    enc_pause();
+  }
+
+  while (call->state.load(std::memory_order_acquire) !=
+         SwitchlessHostCall::kDone) {
+    enc_pause();
+  }
+  *result = call->result;
+  *host_errno = FromBridgeErrno(call->bridge_errno);
+  queue->Release(call);
+  return true;
+}
+
+}  // namespace asylo
+
+extern "C" int enc_init_switchless_host_calls(const char *enclave_name) {
+  std::string name =
+      absl::StrCat(asylo::kSwitchlessHostCallQueuePrefix, enclave_name);
+  void *addr =
+      enc_untrusted_acquire_shared_resource(kAddressName, name.c_str());
+  if (!addr) {
+    return -1;
+  }
+
+  // The queue must live entirely in untrusted memory, otherwise the host could
+  // use it to have the enclave overwrite its own memory.
+  if (!enc_is_outside_enclave(addr, sizeof(asylo::SwitchlessHostCallQueue))) {
+    abort();
+  }
+  auto *queue = static_cast<asylo::SwitchlessHostCallQueue *>(addr);
+  bool valid = queue->InstanceVersion() ==
+               asylo::SwitchlessHostCallQueue::TypeVersion();
+
+  // The untrusted runtime keeps the queue alive until the enclave is destroyed,
+  // so the reference taken above need not be held.
+  enc_untrusted_release_shared_resource(kAddressName, name.c_str());
+  if (!valid) {
+    return -1;
+  }
+  asylo::switchless_queue.store(queue, std::memory_order_release);
+  return 0;
+}
@@ -0,0 +1,40 @@
+/*
+ *
+ * Copyright 2018 Asylo authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef ASYLO_PLATFORM_ARCH_SGX_TRUSTED_SWITCHLESS_HOST_CALLS_H_
+#define ASYLO_PLATFORM_ARCH_SGX_TRUSTED_SWITCHLESS_HOST_CALLS_H_
+
+#include <stdint.h>
+
+#include "asylo/platform/common/switchless_queue.h"
+
+namespace asylo {
+
+// Attempts to serve host call number |function| of the generated switchless
+// host call table through the switchless queue, passing it the first
+// kSwitchlessMaxArguments values of |arguments|. Returns true and stores the
+// return value and the host errno in |result| and |host_errno| if the call was
+// served. Returns false if the enclave is not attached to a switchless queue or
+// no host worker picked up the request in time, in which case the caller must
+// make the host call by exiting the enclave.
+bool TrySwitchlessHostCall(uint32_t function, const uint64_t *arguments,
+                           int64_t *result, int *host_errno);
+
+}  // namespace asylo
+
+#endif  // ASYLO_PLATFORM_ARCH_SGX_TRUSTED_SWITCHLESS_HOST_CALLS_H_
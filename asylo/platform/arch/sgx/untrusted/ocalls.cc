@@ -21,14 +21,17 @@
 #include <arpa/inet.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <linux/futex.h>
 #include <netdb.h>
 #include <poll.h>
 #include <sched.h>
 #include <signal.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <sys/epoll.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/time.h>
 #include <sys/wait.h>
 #include <syslog.h>
@@ -191,6 +194,58 @@ bridge_ssize_t ocall_enc_untrusted_read_with_untrusted_ptr(int fd, void *buf,
   return static_cast<bridge_ssize_t>(read(fd, buf, size));
 }
 
+bridge_ssize_t ocall_enc_untrusted_pwrite_segments(
+    int fd, const void *buf, const struct bridge_io_segment *segments,
+    int segment_count) {
+  const uint8_t *data = reinterpret_cast<const uint8_t *>(buf);
+  bridge_ssize_t total = 0;
+  for (int i = 0; i < segment_count; ++i) {
+    uint64_t written = 0;
+    while (written < segments[i].length) {
+      ssize_t ret = pwrite(fd, data + written, segments[i].length - written,
+                           segments[i].offset + written);
+      if (ret < 0 && errno == EINTR) {
+        continue;
+      }
+      if (ret <= 0) {
+        return ret < 0 ? -1 : total + written;
+      }
+      written += ret;
+    }
+    data += segments[i].length;
+    total += written;
+  }
+  return total;
+}
+
+bridge_ssize_t ocall_enc_untrusted_pread_segments(
+    int fd, void *buf, struct bridge_io_segment *segments, int segment_count) {
+  uint8_t *data = reinterpret_cast<uint8_t *>(buf);
+  bridge_ssize_t total = 0;
+  for (int i = 0; i < segment_count; ++i) {
+    uint64_t read_bytes = 0;
+    while (read_bytes < segments[i].length) {
+      ssize_t ret = pread(fd, data + read_bytes,
+                          segments[i].length - read_bytes,
+                          segments[i].offset + read_bytes);
+      if (ret < 0 && errno == EINTR) {
+        continue;
+      }
+      if (ret < 0) {
+        return -1;
+      }
+      if (ret == 0) {
+        break;
+      }
+      read_bytes += ret;
+    }
+    data += segments[i].length;
+    segments[i].length = read_bytes;
+    total += read_bytes;
+  }
+  return total;
+}
+
 //////////////////////////////////////
 //             Sockets              //
 //////////////////////////////////////
@@ -267,10 +322,14 @@ bridge_ssize_t ocall_enc_untrusted_recvmsg(int sockfd,
   tmp.msg_iov = buf.get();
   bridge_ssize_t ret =
       static_cast<bridge_ssize_t>(recvmsg(sockfd, &tmp, flags));
-  if (!ToBridgeIovecArray(&tmp, msg)) {
-    errno = EFAULT;
-    return -1;
+  if (ret == -1) {
+    return ret;
   }
+  // The payload is received directly into the buffers of |msg|, so only the
+  // lengths and flags set by recvmsg need to be passed back.
+  msg->msg_namelen = tmp.msg_namelen;
+  msg->msg_controllen = tmp.msg_controllen;
+  msg->msg_flags = tmp.msg_flags;
   return ret;
 }
 
@@ -382,6 +441,41 @@ int ocall_enc_untrusted_poll(struct bridge_pollfd *fds, unsigned int nfds,
   return ret;
 }
 
+//////////////////////////////////////
+//           sys/epoll.h            //
+//////////////////////////////////////
+
+int ocall_enc_untrusted_epoll_create1(int flags) {
+  int host_flags = 0;
+  if (FromBridgeFDFlags(flags) & FD_CLOEXEC) host_flags |= EPOLL_CLOEXEC;
+  return epoll_create1(host_flags);
+}
+
+int ocall_enc_untrusted_epoll_ctl(int epfd, int op, int fd,
+                                  struct bridge_epoll_event *event) {
+  int host_op = FromBridgeEpollCtlOperation(op);
+  if (host_op == -1) {
+    errno = EINVAL;
+    return -1;
+  }
+  struct epoll_event tmp;
+  return epoll_ctl(epfd, host_op, fd, FromBridgeEpollEvent(event, &tmp));
+}
+
+int ocall_enc_untrusted_epoll_wait(int epfd, struct bridge_epoll_event *events,
+                                   int maxevents, int timeout) {
+  if (maxevents <= 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  auto tmp = absl::make_unique<struct epoll_event[]>(maxevents);
+  int ret = epoll_wait(epfd, tmp.get(), maxevents, timeout);
+  for (int i = 0; i < ret; ++i) {
+    ToBridgeEpollEvent(&tmp[i], &events[i]);
+  }
+  return ret;
+}
+
 //////////////////////////////////////
 //           sched.h                //
 //////////////////////////////////////
@@ -588,3 +682,21 @@ int ocall_enc_untrusted_thread_create(const char *name) {
   __asylo_donate_thread(name);
   return 0;
 }
+
+int ocall_enc_untrusted_sys_futex_wait(int32_t *futex, int32_t expected,
+                                       int64_t timeout_nanoseconds) {
+  struct timespec timeout;
+  struct timespec *timeout_ptr = nullptr;
+  if (timeout_nanoseconds >= 0) {
+    timeout.tv_sec = timeout_nanoseconds / 1000000000;
+    timeout.tv_nsec = timeout_nanoseconds % 1000000000;
+    timeout_ptr = &timeout;
+  }
+  return syscall(SYS_futex, futex, FUTEX_WAIT_PRIVATE, expected, timeout_ptr,
+                 nullptr, 0);
+}
+
+int ocall_enc_untrusted_sys_futex_wake(int32_t *futex, int32_t num) {
+  return syscall(SYS_futex, futex, FUTEX_WAKE_PRIVATE, num, nullptr, nullptr,
+                 0);
+}
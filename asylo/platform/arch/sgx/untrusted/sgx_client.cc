@@ -25,6 +25,7 @@
 #include "asylo/util/logging.h"
 #include "asylo/platform/arch/sgx/untrusted/generated_bridge_u.h"
 #include "asylo/platform/arch/sgx/untrusted/sgx_error_space.h"
+#include "asylo/platform/arch/sgx/untrusted/switchless_host_calls.h"
 #include "asylo/platform/common/bridge_types.h"
 #include "asylo/util/posix_error_space.h"
 
@@ -300,6 +301,10 @@ Status SGXClient::DestroyEnclave() {
   return Status::OkStatus();
 }
 
+void SGXClient::DispatchSwitchlessHostCall(SwitchlessHostCall *call) {
+  ::asylo::DispatchSwitchlessHostCall(call);
+}
+
 bool SGXClient::IsTcsActive() { return (sgx_is_tcs_active(id_) != 0); }
 
 }  //  namespace asylo
@@ -46,6 +46,7 @@ class SGXClient : public EnclaveClient {
   Status EnterAndDonateThread() override;
   Status EnterAndHandleSignal(const EnclaveSignal &signal) override;
   Status DestroyEnclave() override;
+  void DispatchSwitchlessHostCall(SwitchlessHostCall *call) override;
   std::string path_;               // Path to enclave object file.
   sgx_launch_token_t token_;  // SGX SDK launch token.
   sgx_enclave_id_t id_;       // SGX SDK enclave identifier.
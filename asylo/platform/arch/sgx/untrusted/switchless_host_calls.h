@@ -0,0 +1,33 @@
+/*
+ *
+ * Copyright 2018 Asylo authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef ASYLO_PLATFORM_ARCH_SGX_UNTRUSTED_SWITCHLESS_HOST_CALLS_H_
+#define ASYLO_PLATFORM_ARCH_SGX_UNTRUSTED_SWITCHLESS_HOST_CALLS_H_
+
+#include "asylo/platform/common/switchless_queue.h"
+
+namespace asylo {
+
+// Serves a switchless host call request taken from the queue of an SGX
+// enclave, storing its result and the resulting host errno in |call|. Defined
+// in the generated ocalls translation unit.
+void DispatchSwitchlessHostCall(SwitchlessHostCall *call);
+
+}  // namespace asylo
+
+#endif  // ASYLO_PLATFORM_ARCH_SGX_UNTRUSTED_SWITCHLESS_HOST_CALLS_H_
@@ -18,12 +18,14 @@
 
 #include "asylo/platform/common/bridge_types.h"
 
+#include <errno.h>
 #include <fcntl.h>
 #include <netinet/in.h>
 #include <poll.h>
 #include <signal.h>
 #include <stdint.h>
 #include <string.h>
+#include <sys/epoll.h>
 #include <sys/stat.h>
 #include <sys/un.h>
 #include <unistd.h>
@@ -156,6 +158,7 @@ int FromBridgeSocketOptionName(int bridge_socket_option_name) {
   if (bridge_socket_option_name == BRIDGE_SO_LINGER) return SO_LINGER;
   if (bridge_socket_option_name == BRIDGE_SO_BSDCOMPAT) return SO_BSDCOMPAT;
   if (bridge_socket_option_name == BRIDGE_SO_REUSEPORT) return SO_REUSEPORT;
+  if (bridge_socket_option_name == BRIDGE_SO_PASSCRED) return SO_PASSCRED;
   return -1;
 }
 
@@ -179,9 +182,32 @@ int ToBridgeSocketOptionName(int socket_option_name) {
   if (socket_option_name == SO_LINGER) return BRIDGE_SO_LINGER;
   if (socket_option_name == SO_BSDCOMPAT) return BRIDGE_SO_BSDCOMPAT;
   if (socket_option_name == SO_REUSEPORT) return BRIDGE_SO_REUSEPORT;
+  if (socket_option_name == SO_PASSCRED) return BRIDGE_SO_PASSCRED;
   return -1;
 }
 
+// Errno values with a bridge representation. The bridge value of an errno is
+// one plus its index in this table, so the table may only be appended to.
+const int kBridgeErrnoTable[] = {
+    E2BIG, EACCES, EADDRINUSE, EADDRNOTAVAIL, EAFNOSUPPORT, EAGAIN, EALREADY,
+    EBADF, EBADMSG, EBUSY, ECANCELED, ECHILD, ECONNABORTED, ECONNREFUSED,
+    ECONNRESET, EDEADLK, EDESTADDRREQ, EDOM, EEXIST, EFAULT, EFBIG,
+    EHOSTUNREACH, EIDRM, EILSEQ, EINPROGRESS, EINTR, EINVAL, EIO, EISCONN,
+    EISDIR, ELOOP, EMFILE, EMLINK, EMSGSIZE, ENAMETOOLONG, ENETDOWN, ENETRESET,
+    ENETUNREACH, ENFILE, ENOBUFS, ENODEV, ENOENT, ENOEXEC, ENOLCK, ENOMEM,
+    ENOMSG, ENOPROTOOPT, ENOSPC, ENOSYS, ENOTCONN, ENOTDIR, ENOTEMPTY, ENOTSOCK,
+    ENOTSUP, ENOTTY, ENXIO, EOPNOTSUPP, EOVERFLOW, EPERM, EPIPE, EPROTO,
+    EPROTONOSUPPORT, EPROTOTYPE, ERANGE, EROFS, ESPIPE, ESRCH, ETIMEDOUT,
+    ETXTBSY, EWOULDBLOCK, EXDEV,
+};
+
+constexpr int kBridgeErrnoTableSize =
+    sizeof(kBridgeErrnoTable) / sizeof(kBridgeErrnoTable[0]);
+
+// Errno values without a bridge representation are passed through ORed with
+// this flag, following the convention of the errno translation in errno.edl.
+constexpr int kUntranslatedBridgeErrno = 0x8000;
+
 }  // namespace
 
 int FromSysconfConstants(enum SysconfConstants bridge_sysconf_constant) {
@@ -277,6 +303,23 @@ int FromBridgeSignalCode(int bridge_si_code) {
   return -1;
 }
 
+int FromBridgeErrno(int bridge_errno) {
+  if (bridge_errno == 0) return 0;
+  if (bridge_errno & kUntranslatedBridgeErrno) {
+    return bridge_errno & ~kUntranslatedBridgeErrno;
+  }
+  if (bridge_errno > kBridgeErrnoTableSize) return EINVAL;
+  return kBridgeErrnoTable[bridge_errno - 1];
+}
+
+int ToBridgeErrno(int error_number) {
+  if (error_number == 0) return 0;
+  for (int i = 0; i < kBridgeErrnoTableSize; ++i) {
+    if (kBridgeErrnoTable[i] == error_number) return i + 1;
+  }
+  return error_number | kUntranslatedBridgeErrno;
+}
+
 int ToBridgeSignalCode(int si_code) {
   if (si_code == SI_USER) return BRIDGE_SI_USER;
   if (si_code == SI_QUEUE) return BRIDGE_SI_QUEUE;
@@ -418,6 +461,60 @@ int ToBridgeFDFlags(int fd_flag) {
   return bridge_fd_flag;
 }
 
+uint32_t FromBridgeEpollEvents(uint32_t bridge_epoll_events) {
+  uint32_t epoll_events = 0;
+  if (bridge_epoll_events & BRIDGE_EPOLLIN) epoll_events |= EPOLLIN;
+  if (bridge_epoll_events & BRIDGE_EPOLLPRI) epoll_events |= EPOLLPRI;
+  if (bridge_epoll_events & BRIDGE_EPOLLOUT) epoll_events |= EPOLLOUT;
+  if (bridge_epoll_events & BRIDGE_EPOLLERR) epoll_events |= EPOLLERR;
+  if (bridge_epoll_events & BRIDGE_EPOLLHUP) epoll_events |= EPOLLHUP;
+  if (bridge_epoll_events & BRIDGE_EPOLLRDNORM) epoll_events |= EPOLLRDNORM;
+  if (bridge_epoll_events & BRIDGE_EPOLLRDBAND) epoll_events |= EPOLLRDBAND;
+  if (bridge_epoll_events & BRIDGE_EPOLLWRNORM) epoll_events |= EPOLLWRNORM;
+  if (bridge_epoll_events & BRIDGE_EPOLLWRBAND) epoll_events |= EPOLLWRBAND;
+  if (bridge_epoll_events & BRIDGE_EPOLLRDHUP) epoll_events |= EPOLLRDHUP;
+  if (bridge_epoll_events & BRIDGE_EPOLLEXCLUSIVE) {
+    epoll_events |= EPOLLEXCLUSIVE;
+  }
+  if (bridge_epoll_events & BRIDGE_EPOLLONESHOT) epoll_events |= EPOLLONESHOT;
+  if (bridge_epoll_events & BRIDGE_EPOLLET) epoll_events |= EPOLLET;
+  return epoll_events;
+}
+
+uint32_t ToBridgeEpollEvents(uint32_t epoll_events) {
+  uint32_t bridge_epoll_events = 0;
+  if (epoll_events & EPOLLIN) bridge_epoll_events |= BRIDGE_EPOLLIN;
+  if (epoll_events & EPOLLPRI) bridge_epoll_events |= BRIDGE_EPOLLPRI;
+  if (epoll_events & EPOLLOUT) bridge_epoll_events |= BRIDGE_EPOLLOUT;
+  if (epoll_events & EPOLLERR) bridge_epoll_events |= BRIDGE_EPOLLERR;
+  if (epoll_events & EPOLLHUP) bridge_epoll_events |= BRIDGE_EPOLLHUP;
+  if (epoll_events & EPOLLRDNORM) bridge_epoll_events |= BRIDGE_EPOLLRDNORM;
+  if (epoll_events & EPOLLRDBAND) bridge_epoll_events |= BRIDGE_EPOLLRDBAND;
+  if (epoll_events & EPOLLWRNORM) bridge_epoll_events |= BRIDGE_EPOLLWRNORM;
+  if (epoll_events & EPOLLWRBAND) bridge_epoll_events |= BRIDGE_EPOLLWRBAND;
+  if (epoll_events & EPOLLRDHUP) bridge_epoll_events |= BRIDGE_EPOLLRDHUP;
+  if (epoll_events & EPOLLEXCLUSIVE) {
+    bridge_epoll_events |= BRIDGE_EPOLLEXCLUSIVE;
+  }
+  if (epoll_events & EPOLLONESHOT) bridge_epoll_events |= BRIDGE_EPOLLONESHOT;
+  if (epoll_events & EPOLLET) bridge_epoll_events |= BRIDGE_EPOLLET;
+  return bridge_epoll_events;
+}
+
+int FromBridgeEpollCtlOperation(int bridge_op) {
+  if (bridge_op == BRIDGE_EPOLL_CTL_ADD) return EPOLL_CTL_ADD;
+  if (bridge_op == BRIDGE_EPOLL_CTL_DEL) return EPOLL_CTL_DEL;
+  if (bridge_op == BRIDGE_EPOLL_CTL_MOD) return EPOLL_CTL_MOD;
+  return -1;
+}
+
+int ToBridgeEpollCtlOperation(int op) {
+  if (op == EPOLL_CTL_ADD) return BRIDGE_EPOLL_CTL_ADD;
+  if (op == EPOLL_CTL_DEL) return BRIDGE_EPOLL_CTL_DEL;
+  if (op == EPOLL_CTL_MOD) return BRIDGE_EPOLL_CTL_MOD;
+  return -1;
+}
+
 int FromBridgeOptionName(int level, int bridge_option_name) {
   if (level == IPPROTO_TCP) {
     return FromBridgeTcpOptionName(bridge_option_name);
@@ -585,6 +682,22 @@ struct bridge_pollfd *ToBridgePollfd(const struct pollfd *fd,
   return bridge_fd;
 }
 
+struct epoll_event *FromBridgeEpollEvent(
+    const struct bridge_epoll_event *bridge_event, struct epoll_event *event) {
+  if (!bridge_event || !event) return nullptr;
+  event->events = FromBridgeEpollEvents(bridge_event->events);
+  event->data.u64 = bridge_event->data;
+  return event;
+}
+
+struct bridge_epoll_event *ToBridgeEpollEvent(
+    const struct epoll_event *event, struct bridge_epoll_event *bridge_event) {
+  if (!event || !bridge_event) return nullptr;
+  bridge_event->events = ToBridgeEpollEvents(event->events);
+  bridge_event->data = event->data.u64;
+  return bridge_event;
+}
+
 struct msghdr *FromBridgeMsgHdr(const struct bridge_msghdr *bridge_msg,
                                 struct msghdr *msg) {
   if (!bridge_msg || !msg) return nullptr;
@@ -139,6 +139,30 @@ enum FileDescriptorFlags {
   CLOEXEC = 0x01,
 };
 
+// All the epoll events supported inside the enclave.
+enum EpollEvents {
+  BRIDGE_EPOLLIN = 0x001,
+  BRIDGE_EPOLLPRI = 0x002,
+  BRIDGE_EPOLLOUT = 0x004,
+  BRIDGE_EPOLLERR = 0x008,
+  BRIDGE_EPOLLHUP = 0x010,
+  BRIDGE_EPOLLRDNORM = 0x040,
+  BRIDGE_EPOLLRDBAND = 0x080,
+  BRIDGE_EPOLLWRNORM = 0x100,
+  BRIDGE_EPOLLWRBAND = 0x200,
+  BRIDGE_EPOLLRDHUP = 0x2000,
+  BRIDGE_EPOLLEXCLUSIVE = 0x4000,
+  BRIDGE_EPOLLONESHOT = 0x8000,
+  BRIDGE_EPOLLET = 0x10000,
+};
+
+// The operations of epoll_ctl supported inside the enclave.
+enum EpollCtlOperations {
+  BRIDGE_EPOLL_CTL_ADD = 1,
+  BRIDGE_EPOLL_CTL_DEL = 2,
+  BRIDGE_EPOLL_CTL_MOD = 3,
+};
+
 // All the syslog options supported inside the enclave.
 enum SysLogOptions {
   BRIDGE_LOG_PID = 0x01,
@@ -200,6 +224,7 @@ enum SocketOptionNames {
   BRIDGE_SO_LINGER = 13,
   BRIDGE_SO_BSDCOMPAT = 14,
   BRIDGE_SO_REUSEPORT = 15,
+  BRIDGE_SO_PASSCRED = 16,
   BRIDGE_SO_RCVTIMEO = 20,
   BRIDGE_SO_SNDTIMEO = 21,
   BRIDGE_SO_SNDBUFFORCE = 32,
@@ -279,6 +304,11 @@ struct bridge_pollfd {
   int16_t revents;
 };
 
+struct bridge_epoll_event {
+  uint32_t events;
+  uint64_t data;
+} ABSL_ATTRIBUTE_PACKED;
+
 struct bridge_msghdr {
   void *msg_name;
   uint64_t msg_namelen;
@@ -294,6 +324,13 @@ struct bridge_iovec {
   uint64_t iov_len;
 };
 
+// A range of a file transferred by positioned I/O. The data of a list of
+// segments is packed back to back in a single buffer.
+struct bridge_io_segment {
+  int64_t offset;
+  uint64_t length;
+};
+
 struct bridge_siginfo_t {
   int32_t si_signo;
   int32_t si_code;
@@ -371,6 +408,14 @@ int FromBridgeSignalCode(int bridge_si_code);
 // Converts |si_code| to a bridge signal code. Returns -1 if unsuccessful.
 int ToBridgeSignalCode(int si_code);
 
+// Converts |bridge_errno| to a runtime errno value. Bridge errno values that do
+// not correspond to a known errno are converted to EINVAL.
+int FromBridgeErrno(int bridge_errno);
+
+// Converts |error_number| to a bridge errno value. Errno values without a
+// bridge representation are passed through ORed with 0x8000.
+int ToBridgeErrno(int error_number);
+
 // Converts |bridge_siginfo| to a runtime siginfo_t. Returns nullptr if
 // unsuccessful.
 siginfo_t *FromBridgeSigInfo(const struct bridge_siginfo_t *bridge_siginfo,
@@ -424,6 +469,19 @@ int FromBridgeFDFlags(int bridge_fd_flag);
 // Converts |fd_flag| to a bridge FD flag.
 int ToBridgeFDFlags(int fd_flag);
 
+// Converts |bridge_epoll_events| to runtime epoll events.
+uint32_t FromBridgeEpollEvents(uint32_t bridge_epoll_events);
+
+// Converts |epoll_events| to bridge epoll events.
+uint32_t ToBridgeEpollEvents(uint32_t epoll_events);
+
+// Converts |bridge_op| to a runtime epoll_ctl operation. Returns -1 if
+// unsuccessful.
+int FromBridgeEpollCtlOperation(int bridge_op);
+
+// Converts |op| to a bridge epoll_ctl operation. Returns -1 if unsuccessful.
+int ToBridgeEpollCtlOperation(int op);
+
 // Converts |bridge_option_name| to a runtime option name.
 int FromBridgeOptionName(int level, int bridge_option_name);
 
@@ -472,15 +530,24 @@ struct pollfd *FromBridgePollfd(const struct bridge_pollfd *bridge_fd,
 struct bridge_pollfd *ToBridgePollfd(const struct pollfd *fd,
                                      struct bridge_pollfd *bridge_fd);
 
+// Converts |bridge_event| to a runtime epoll_event. Returns nullptr if
+// unsuccessful.
+struct epoll_event *FromBridgeEpollEvent(
+    const struct bridge_epoll_event *bridge_event, struct epoll_event *event);
+
+// Converts |event| to a bridge epoll_event. Returns nullptr if unsuccessful.
+struct bridge_epoll_event *ToBridgeEpollEvent(
+    const struct epoll_event *event, struct bridge_epoll_event *bridge_event);
+
 // Converts |bridge_msg| to a runtime msghdr. This only does a shallow copy of
 // the pointers. A deep copy of the |iovec| array is done in a helper class
-// |BridgeMsghdrWrapper| in host_calls. Returns nullptr if unsuccessful.
+// |UntrustedMsghdr| in host_calls. Returns nullptr if unsuccessful.
 struct msghdr *FromBridgeMsgHdr(const struct bridge_msghdr *bridge_msg,
                                 struct msghdr *msg);
 
 // Converts |msg| to a bridge msghdr. This only does a shallow copy of the
 // pointers. A deep copy of the |iovec| array is done in a helper class
-// |BridgeMsghdrWrapper| in host_calls. Returns nullptr if unsuccessful.
+// |UntrustedMsghdr| in host_calls. Returns nullptr if unsuccessful.
 struct bridge_msghdr *ToBridgeMsgHdr(const struct msghdr *msg,
                                      struct bridge_msghdr *bridge_msg);
 
@@ -0,0 +1,281 @@
+/*
+ *
+ * Copyright 2018 Asylo authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef ASYLO_PLATFORM_COMMON_SWITCHLESS_QUEUE_H_
+#define ASYLO_PLATFORM_COMMON_SWITCHLESS_QUEUE_H_
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include "asylo/platform/common/ring_buffer.h"
+#include "asylo/platform/common/spin_lock.h"
+
+namespace asylo {
+
+// Prefix of the shared resource name under which the untrusted runtime
+// publishes the switchless host call queue of an enclave. The full name is the
+// prefix followed by the name the enclave was loaded under.
+constexpr char kSwitchlessHostCallQueuePrefix[] = "switchless_host_calls:";
+
+// Prefix of the shared resource name under which the untrusted runtime
+// publishes the queue of requests served by resident enclave threads.
+constexpr char kSwitchlessEntryQueuePrefix[] = "switchless_entries:";
+
+// Number of polls an enclave thread waits for a host worker to claim a
+// switchless host call before withdrawing it and exiting the enclave instead.
+// This is on the order of the cost of an enclave exit, so a saturated or absent
+// worker pool costs at most about twice an ordinary host call. Host workers
+// must keep polling at least this often while they expect calls.
+constexpr int kSwitchlessPickupPolls = 2048;
+
+// The maximum number of arguments of a host call served by the switchless
+// queue. Each argument is a scalar value widened to 64 bits.
+constexpr int kSwitchlessMaxArguments = 6;
+
+// A request passed between a thread inside an enclave and a thread outside of
+// it through a SwitchlessQueue. A request moves through the following states:
+//
+//   kFree -> kReserved      The submitter claims the slot and fills it in.
+//   kReserved -> kSubmitted The submitter publishes the slot to the servers.
+//   kSubmitted -> kRunning  A server claims the request.
+//   kRunning -> kDone       The server has stored the result.
+//   kDone -> kFree          The submitter has consumed the result.
+//
+// If no server claims a request in time, the submitter may move it from
+// kSubmitted to kCancelled and take another path. The server that eventually
+// dequeues a cancelled request returns it to kFree.
+struct SwitchlessRequest {
+  enum State : uint32_t {
+    kFree = 0,
+    kReserved = 1,
+    kSubmitted = 2,
+    kRunning = 3,
+    kDone = 4,
+    kCancelled = 5,
+  };
+
+  // Current state of the request.
+  std::atomic<uint32_t> state;
+};
+
+// A host call submitted by an enclave thread and served by a host worker.
+struct SwitchlessHostCall : public SwitchlessRequest {
+  // Index of the requested function in the table of switchless host calls
+  // emitted by the host call generator.
+  uint32_t function;
+
+  // Arguments to the host call.
+  uint64_t arguments[kSwitchlessMaxArguments];
+
+  // Return value of the host call, widened to 64 bits.
+  int64_t result;
+
+  // Value of errno on the host after the call, as a bridge errno value.
+  int32_t bridge_errno;
+};
+
+// A run request submitted by the host and served by a resident enclave thread.
+// All buffers are in untrusted memory.
+struct SwitchlessEnclaveEntry : public SwitchlessRequest {
+  // Address and size of the serialized EnclaveInput.
+  uint64_t input;
+  uint64_t input_size;
+
+  // Address and capacity of a buffer provided by the host for the serialized
+  // EnclaveOutput. If the output does not fit, the enclave replaces |output|
+  // with a buffer allocated with enc_untrusted_malloc and sets
+  // |output_allocated|, and the host must free that buffer.
+  uint64_t output;
+  uint64_t output_capacity;
+  uint64_t output_size;
+  uint32_t output_allocated;
+
+  // Zero if |output| holds a serialized EnclaveOutput, non-zero otherwise.
+  int32_t result;
+};
+
+// A fixed pool of requests together with a queue of submitted requests,
+// suitable for sharing between trusted and untrusted code.
+//
+// Any number of threads may reserve and submit requests, and any number of
+// threads may take them. The queue of submitted requests is a RingBuffer of
+// slot indices. RingBuffer supports only one reader and one writer, so each end
+// of the queue is serialized by a SpinLock.
+//
+// As with RingBuffer, the untrusted side may corrupt any field of this object.
+// Slot indices are always reduced modulo kSlots before use, so corruption can
+// never cause an access outside of the object itself. Trusted code must treat
+// every field of a request as untrusted input.
+template <typename Request, size_t kCapacity>
+class SwitchlessQueue {
+ public:
+  // Number of request slots. Slot indices are stored as single bytes.
+  static constexpr size_t kSlots = kCapacity;
+  static_assert(kSlots <= 256, "Slot indices must fit in a byte.");
+
+  SwitchlessQueue() : instance_version_(TypeVersion()), servers_(0) {
+    for (Request &request : requests_) {
+      request.state = SwitchlessRequest::kFree;
+    }
+  }
+
+  SwitchlessQueue(const SwitchlessQueue &) = delete;
+  SwitchlessQueue &operator=(const SwitchlessQueue &) = delete;
+
+  // Claims a free request slot. Returns nullptr if every slot is in use.
+  Request *Reserve() {
+    for (Request &request : requests_) {
+      uint32_t expected = SwitchlessRequest::kFree;
+      if (request.state.compare_exchange_strong(expected,
+                                                SwitchlessRequest::kReserved,
+                                                std::memory_order_acquire)) {
+        return &request;
+      }
+    }
+    return nullptr;
+  }
+
+  // Publishes a request previously returned by Reserve() to the servers.
+  void Submit(Request *request) {
+    uint8_t index = static_cast<uint8_t>(IndexOf(request));
+    request->state.store(SwitchlessRequest::kSubmitted,
+                         std::memory_order_release);
+    // There are never more submitted requests than slots, so the write can not
+    // block.
+    submit_lock_.Acquire();
+    pending_.Write(&index, 1);
+    submit_lock_.Release();
+  }
+
+  // Attempts to withdraw a submitted request that has not yet been claimed by a
+  // server. Returns true if the request was withdrawn, in which case the
+  // caller must not touch it again.
+  bool Cancel(Request *request) {
+    uint32_t expected = SwitchlessRequest::kSubmitted;
+    return request->state.compare_exchange_strong(
+        expected, SwitchlessRequest::kCancelled, std::memory_order_acq_rel);
+  }
+
+  // Releases a request in state kDone once its result has been consumed.
+  void Release(Request *request) {
+    request->state.store(SwitchlessRequest::kFree, std::memory_order_release);
+  }
+
+  // Dequeues the next submitted request and moves it to state kRunning.
+  // Returns nullptr if there is no request waiting to be served.
+  Request *Take() {
+    while (true) {
+      uint8_t index;
+      take_lock_.Acquire();
+      if (pending_.empty()) {
+        take_lock_.Release();
+        return nullptr;
+      }
+      pending_.Read(&index, 1);
+      take_lock_.Release();
+
+      Request *request = &requests_[index % kSlots];
+      uint32_t expected = SwitchlessRequest::kSubmitted;
+      if (request->state.compare_exchange_strong(expected,
+                                                 SwitchlessRequest::kRunning,
+                                                 std::memory_order_acq_rel)) {
+        return request;
+      }
+      if (expected == SwitchlessRequest::kCancelled) {
+        request->state.store(SwitchlessRequest::kFree,
+                             std::memory_order_release);
+      }
+    }
+  }
+
+  // Returns true if requests, including withdrawn ones, are waiting to be
+  // taken.
+  bool HasPending() const { return !pending_.empty(); }
+
+  // Marks a request returned by Take() as complete.
+  void Complete(Request *request) {
+    request->state.store(SwitchlessRequest::kDone, std::memory_order_release);
+  }
+
+  // Returns the request in slot |index|.
+  Request *slot(size_t index) { return &requests_[index % kSlots]; }
+
+  // Returns the slot index of |request|.
+  size_t IndexOf(const Request *request) const {
+    return (request - requests_.data()) % kSlots;
+  }
+
+  // Registers a thread serving the queue. A server must register before it
+  // first takes a request.
+  void AddServer() { servers_.fetch_add(1, std::memory_order_seq_cst); }
+
+  // Unregisters a thread serving the queue. A server leaving the queue must
+  // unregister before it takes the requests still pending for the last time.
+  // Paired with the check of servers() after Submit(), this guarantees that
+  // every submitted request is either served or seen unserved by its submitter,
+  // which can then withdraw it with Cancel().
+  void RemoveServer() {
+    servers_.fetch_sub(1, std::memory_order_seq_cst);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+  }
+
+  // Returns the number of threads serving the queue.
+  uint32_t servers() const {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    return servers_.load(std::memory_order_seq_cst);
+  }
+
+  // Returns a signature reflecting the layout of this concrete instance.
+  uint64_t InstanceVersion() const { return instance_version_; }
+
+  // Returns a signature reflecting the layout of this abstract type.
+  static uint64_t TypeVersion() {
+    return offsetof(SwitchlessQueue, pending_) << 0 |
+           offsetof(SwitchlessQueue, requests_) << 16 |
+           sizeof(Request) << 32 | (sizeof(SwitchlessQueue) & 0xffff) << 48;
+  }
+
+ private:
+  // Encodes the layout of the object for version sanity checking.
+  const uint64_t instance_version_;
+  // Number of threads serving the queue.
+  std::atomic<uint32_t> servers_;
+  // Serializes writers of pending_.
+  SpinLock submit_lock_;
+  // Serializes readers of pending_.
+  SpinLock take_lock_;
+  // Indices of submitted requests, in submission order.
+  RingBuffer<kSlots> pending_;
+  // Request slots.
+  std::array<Request, kSlots> requests_;
+};
+
+template <typename Request, size_t kCapacity>
+constexpr size_t SwitchlessQueue<Request, kCapacity>::kSlots;
+
+// Queue of host calls submitted by enclave threads.
+using SwitchlessHostCallQueue = SwitchlessQueue<SwitchlessHostCall, 64>;
+
+// Queue of run requests submitted by the host.
+using SwitchlessEntryQueue = SwitchlessQueue<SwitchlessEnclaveEntry, 64>;
+
+}  // namespace asylo
+
+#endif  // ASYLO_PLATFORM_COMMON_SWITCHLESS_QUEUE_H_
@@ -0,0 +1,145 @@
+/*
+ *
+ * Copyright 2018 Asylo authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "asylo/platform/common/switchless_queue.h"
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+namespace asylo {
+namespace {
+
+TEST(SwitchlessQueueTest, EmptyQueueHasNoWork) {
+  SwitchlessHostCallQueue queue;
+  EXPECT_EQ(queue.Take(), nullptr);
+  EXPECT_EQ(queue.InstanceVersion(), SwitchlessHostCallQueue::TypeVersion());
+}
+
+TEST(SwitchlessQueueTest, RequestRoundTrip) {
+  SwitchlessHostCallQueue queue;
+  SwitchlessHostCall *call = queue.Reserve();
+  ASSERT_NE(call, nullptr);
+  call->function = 7;
+  call->arguments[0] = 42;
+  queue.Submit(call);
+
+  SwitchlessHostCall *taken = queue.Take();
+  ASSERT_EQ(taken, call);
+  EXPECT_EQ(taken->state, SwitchlessHostCall::kRunning);
+  EXPECT_EQ(taken->function, 7);
+  EXPECT_EQ(taken->arguments[0], 42);
+  taken->result = 1;
+  queue.Complete(taken);
+  EXPECT_EQ(call->state, SwitchlessHostCall::kDone);
+  EXPECT_EQ(call->result, 1);
+
+  queue.Release(call);
+  EXPECT_EQ(call->state, SwitchlessHostCall::kFree);
+  EXPECT_EQ(queue.Take(), nullptr);
+}
+
+TEST(SwitchlessQueueTest, ReserveFailsWhenFull) {
+  SwitchlessHostCallQueue queue;
+  std::vector<SwitchlessHostCall *> calls;
+  for (int i = 0; i < SwitchlessHostCallQueue::kSlots; i++) {
+    SwitchlessHostCall *call = queue.Reserve();
+    ASSERT_NE(call, nullptr);
+    calls.push_back(call);
+  }
+  EXPECT_EQ(queue.Reserve(), nullptr);
+  queue.Submit(calls[0]);
+  queue.Complete(queue.Take());
+  queue.Release(calls[0]);
+  EXPECT_EQ(queue.Reserve(), calls[0]);
+}
+
+TEST(SwitchlessQueueTest, CancelledRequestIsSkippedAndFreed) {
+  SwitchlessHostCallQueue queue;
+  SwitchlessHostCall *first = queue.Reserve();
+  SwitchlessHostCall *second = queue.Reserve();
+  queue.Submit(first);
+  queue.Submit(second);
+  EXPECT_TRUE(queue.Cancel(first));
+
+  EXPECT_EQ(queue.Take(), second);
+  EXPECT_EQ(first->state, SwitchlessHostCall::kFree);
+  EXPECT_FALSE(queue.Cancel(second));
+}
+
+// Serve requests from several producers on several consumers and check that
+// every request is answered exactly once.
+TEST(SwitchlessQueueTest, ConcurrentProducersAndConsumers) {
+  constexpr int kProducers = 4;
+  constexpr int kConsumers = 3;
+  constexpr int kRequestsPerProducer = 10000;
+
+  SwitchlessHostCallQueue queue;
+  std::atomic<bool> done(false);
+  std::atomic<int64_t> served(0);
+
+  std::vector<std::thread> consumers;
+  for (int i = 0; i < kConsumers; i++) {
+    consumers.emplace_back([&queue, &done, &served] {
+      while (!done) {
+        SwitchlessHostCall *call = queue.Take();
+        if (!call) {
+          std::this_thread::yield();
+          continue;
+        }
+        call->result = call->arguments[0] * 2;
+        served++;
+        queue.Complete(call);
+      }
+    });
+  }
+
+  std::vector<std::thread> producers;
+  for (int i = 0; i < kProducers; i++) {
+    producers.emplace_back([&queue] {
+      for (int j = 0; j < kRequestsPerProducer; j++) {
+        SwitchlessHostCall *call;
+        while (!(call = queue.Reserve())) {
+          std::this_thread::yield();
+        }
+        call->arguments[0] = j;
+        queue.Submit(call);
+        while (call->state != SwitchlessHostCall::kDone) {
+          std::this_thread::yield();
+        }
+        EXPECT_EQ(call->result, 2 * j);
+        queue.Release(call);
+      }
+    });
+  }
+
+  for (auto &producer : producers) {
+    producer.join();
+  }
+  done = true;
+  for (auto &consumer : consumers) {
+    consumer.join();
+  }
+  EXPECT_EQ(served, kProducers * kRequestsPerProducer);
+}
+
+}  // namespace
+}  // namespace asylo
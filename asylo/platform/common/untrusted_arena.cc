@@ -0,0 +1,139 @@
+/*
+ *
+ * Copyright 2018 Asylo authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "asylo/platform/common/untrusted_arena.h"
+
+#include <cstdlib>
+
+namespace asylo {
+
+constexpr size_t UntrustedArena::kMinBlockSize;
+constexpr size_t UntrustedArena::kMaxBlockSize;
+constexpr size_t UntrustedArena::kSlabSize;
+constexpr size_t UntrustedArena::kMaxSlabs;
+constexpr size_t UntrustedArena::kThreadCacheCount;
+constexpr size_t UntrustedArena::kThreadCacheBlocks;
+constexpr size_t UntrustedArena::kClassCount;
+
+void *UntrustedArena::Allocate(size_t size) {
+  if (size == 0 || size > kMaxBlockSize) {
+    return nullptr;
+  }
+  const size_t size_class = SizeClassOf(size);
+
+  ThreadCache *cache = GetThreadCache();
+  absl::MutexLock lock(&cache->mu);
+  size_t &count = cache->block_counts[size_class];
+  if (count == 0 &&
+      !Refill(size_class, kThreadCacheBlocks / 2, cache)) {
+    return nullptr;
+  }
+  return cache->blocks[size_class][--count];
+}
+
+bool UntrustedArena::Free(void *ptr) {
+  const uintptr_t address = reinterpret_cast<uintptr_t>(ptr);
+  const size_t slab_count = slab_count_.load(std::memory_order_acquire);
+  const Slab *slab = nullptr;
+  for (size_t i = 0; i < slab_count; ++i) {
+    if (address - slabs_[i].base < kSlabSize) {
+      slab = &slabs_[i];
+      break;
+    }
+  }
+  if (!slab) {
+    return false;
+  }
+  const size_t size_class = slab->size_class;
+  if ((address - slab->base) % BlockSize(size_class) != 0) {
+    abort();
+  }
+
+  ThreadCache *cache = GetThreadCache();
+  absl::MutexLock lock(&cache->mu);
+  size_t &count = cache->block_counts[size_class];
+  if (count == kThreadCacheBlocks) {
+    Drain(size_class, kThreadCacheBlocks / 2, cache);
+  }
+  cache->blocks[size_class][count++] = ptr;
+  return true;
+}
+
+size_t UntrustedArena::SizeClassOf(size_t size) {
+  size_t size_class = 0;
+  while (BlockSize(size_class) < size) {
+    ++size_class;
+  }
+  return size_class;
+}
+
+UntrustedArena::ThreadCache *UntrustedArena::GetThreadCache() {
+  static std::atomic<size_t> next_index{0};
+  thread_local size_t index =
+      next_index.fetch_add(1, std::memory_order_relaxed) % kThreadCacheCount;
+  return &thread_caches_[index];
+}
+
+bool UntrustedArena::Refill(size_t size_class, size_t count,
+                            ThreadCache *cache) {
+  const size_t block_size = BlockSize(size_class);
+  size_t &cached = cache->block_counts[size_class];
+
+  absl::MutexLock lock(&central_mu_);
+  SizeClass &central = size_classes_[size_class];
+  while (cached < count) {
+    if (!central.free_blocks.empty()) {
+      cache->blocks[size_class][cached++] = central.free_blocks.back();
+      central.free_blocks.pop_back();
+      continue;
+    }
+    if (central.next == central.end) {
+      // Slabs are only added under |central_mu_|, so |slab_count_| cannot
+      // change until the new slab is published.
+      const size_t slab_count = slab_count_.load(std::memory_order_relaxed);
+      if (slab_count == kMaxSlabs) {
+        break;
+      }
+      uint8_t *slab = static_cast<uint8_t *>(allocate_slab_(kSlabSize));
+      if (!slab) {
+        break;
+      }
+      slabs_[slab_count].base = reinterpret_cast<uintptr_t>(slab);
+      slabs_[slab_count].size_class = size_class;
+      slab_count_.store(slab_count + 1, std::memory_order_release);
+      central.next = slab;
+      central.end = slab + kSlabSize;
+    }
+    cache->blocks[size_class][cached++] = central.next;
+    central.next += block_size;
+  }
+  return cached > 0;
+}
+
+void UntrustedArena::Drain(size_t size_class, size_t count,
+                           ThreadCache *cache) {
+  size_t &cached = cache->block_counts[size_class];
+
+  absl::MutexLock lock(&central_mu_);
+  SizeClass &central = size_classes_[size_class];
+  for (size_t i = 0; i < count; ++i) {
+    central.free_blocks.push_back(cache->blocks[size_class][--cached]);
+  }
+}
+
+}  // namespace asylo
@@ -0,0 +1,148 @@
+/*
+ *
+ * Copyright 2018 Asylo authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef ASYLO_PLATFORM_COMMON_UNTRUSTED_ARENA_H_
+#define ASYLO_PLATFORM_COMMON_UNTRUSTED_ARENA_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "absl/synchronization/mutex.h"
+
+namespace asylo {
+
+// An allocator of untrusted memory managed from inside the enclave. The arena
+// obtains large slabs of untrusted memory from the host and carves them into
+// blocks of a few size classes, so that temporary buffers shared with the host
+// are allocated and released without host calls.
+//
+// All of the allocator state is kept in the memory of the arena object, which
+// for an enclave is trusted memory; nothing is read back from the slabs, so the
+// host cannot corrupt the allocator by modifying them. Slabs are never returned
+// to the host.
+//
+// Freed blocks are kept in a small number of caches, which threads are spread
+// over, before they are returned to the central free list of their size class.
+// Blocks must only be freed once, and only while the host does not use them.
+class UntrustedArena {
+ public:
+  // Allocates a slab of untrusted memory, as enc_untrusted_malloc does.
+  using SlabAllocator = void *(*)(size_t size);
+
+  // Sizes of the smallest and largest blocks. Size classes are the powers of
+  // two in between.
+  static constexpr size_t kMinBlockSize = 64;
+  static constexpr size_t kMaxBlockSize = 64 * 1024;
+
+  // Size of a slab, each of which holds blocks of a single size class, and the
+  // maximum number of slabs in the arena.
+  static constexpr size_t kSlabSize = 256 * 1024;
+  static constexpr size_t kMaxSlabs = 64;
+
+  // Number of thread caches and number of blocks of each size class a cache
+  // holds.
+  static constexpr size_t kThreadCacheCount = 16;
+  static constexpr size_t kThreadCacheBlocks = 8;
+
+  explicit UntrustedArena(SlabAllocator allocate_slab)
+      : allocate_slab_{allocate_slab}, slab_count_{0} {}
+
+  UntrustedArena(const UntrustedArena &other) = delete;
+  UntrustedArena &operator=(const UntrustedArena &other) = delete;
+
+  // Returns a block of at least |size| bytes. Returns nullptr if |size| is zero
+  // or larger than kMaxBlockSize, or if the arena has run out of slabs, in which
+  // case the caller should allocate the memory from the host.
+  void *Allocate(size_t size);
+
+  // Returns |ptr| to the arena and returns true if it was allocated by the
+  // arena. Otherwise returns false and leaves |ptr| to the caller. Aborts if
+  // |ptr| points into the arena but not at the start of a block.
+  bool Free(void *ptr);
+
+  // Returns the number of slabs obtained from the host.
+  size_t SlabCount() const {
+    return slab_count_.load(std::memory_order_acquire);
+  }
+
+ private:
+  static constexpr size_t kClassCount = 11;
+  static_assert(kMinBlockSize << (kClassCount - 1) == kMaxBlockSize,
+                "Size classes do not span the block sizes");
+  static_assert(kSlabSize % kMaxBlockSize == 0,
+                "Slabs must hold whole blocks of every size class");
+
+  struct Slab {
+    uintptr_t base;
+    size_t size_class;
+  };
+
+  struct SizeClass {
+    // Freed blocks, and the range of the newest slab not yet carved into
+    // blocks.
+    std::vector<void *> free_blocks;
+    uint8_t *next = nullptr;
+    uint8_t *end = nullptr;
+  };
+
+  struct ThreadCache {
+    absl::Mutex mu;
+    void *blocks[kClassCount][kThreadCacheBlocks] GUARDED_BY(mu);
+    size_t block_counts[kClassCount] GUARDED_BY(mu) = {};
+  };
+
+  // Returns the size class of blocks of |size| bytes.
+  static size_t SizeClassOf(size_t size);
+
+  // Returns the size of the blocks of |size_class|.
+  static size_t BlockSize(size_t size_class) {
+    return kMinBlockSize << size_class;
+  }
+
+  // Returns the cache of the calling thread.
+  ThreadCache *GetThreadCache();
+
+  // Moves up to |count| blocks of |size_class| from the central free list to
+  // |cache|, carving a new slab if needed. Returns false if no block is left.
+  bool Refill(size_t size_class, size_t count, ThreadCache *cache)
+      EXCLUSIVE_LOCKS_REQUIRED(cache->mu) LOCKS_EXCLUDED(central_mu_);
+
+  // Moves |count| blocks of |size_class| from |cache| to the central free
+  // list.
+  void Drain(size_t size_class, size_t count, ThreadCache *cache)
+      EXCLUSIVE_LOCKS_REQUIRED(cache->mu) LOCKS_EXCLUDED(central_mu_);
+
+  const SlabAllocator allocate_slab_;
+
+  ThreadCache thread_caches_[kThreadCacheCount];
+
+  // Taken after the lock of a thread cache, when both are held.
+  absl::Mutex central_mu_;
+  SizeClass size_classes_[kClassCount] GUARDED_BY(central_mu_);
+
+  // Slabs are published by incrementing |slab_count_| after the slab is
+  // recorded, so that Free() can find them without taking a lock.
+  Slab slabs_[kMaxSlabs];
+  std::atomic<size_t> slab_count_;
+};
+
+}  // namespace asylo
+
+#endif  // ASYLO_PLATFORM_COMMON_UNTRUSTED_ARENA_H_
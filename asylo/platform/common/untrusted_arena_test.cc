@@ -0,0 +1,173 @@
+/*
+ *
+ * Copyright 2018 Asylo authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "asylo/platform/common/untrusted_arena.h"
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+namespace asylo {
+namespace {
+
+// Slabs handed out by AllocateSlab, which are freed at the end of each test.
+std::vector<void *> *slabs = new std::vector<void *>;
+
+void *AllocateSlab(size_t size) {
+  void *slab = malloc(size);
+  slabs->push_back(slab);
+  return slab;
+}
+
+void *FailToAllocateSlab(size_t size) { return nullptr; }
+
+class UntrustedArenaTest : public ::testing::Test {
+ protected:
+  ~UntrustedArenaTest() override {
+    for (void *slab : *slabs) {
+      free(slab);
+    }
+    slabs->clear();
+  }
+};
+
+TEST_F(UntrustedArenaTest, AllocatesBlocksOfRequestedSize) {
+  UntrustedArena arena(&AllocateSlab);
+  std::vector<std::pair<uint8_t *, size_t>> blocks;
+  for (size_t size = 1; size <= UntrustedArena::kMaxBlockSize; size = size * 3) {
+    for (int i = 0; i < 10; ++i) {
+      uint8_t *block = static_cast<uint8_t *>(arena.Allocate(size));
+      ASSERT_NE(block, nullptr);
+      memset(block, static_cast<int>(blocks.size()), size);
+      blocks.emplace_back(block, size);
+    }
+  }
+
+  // Blocks do not overlap, so each one still holds what was written to it.
+  for (size_t i = 0; i < blocks.size(); ++i) {
+    for (size_t j = 0; j < blocks[i].second; ++j) {
+      ASSERT_EQ(blocks[i].first[j], static_cast<uint8_t>(i));
+    }
+  }
+  for (const auto &block : blocks) {
+    EXPECT_TRUE(arena.Free(block.first));
+  }
+}
+
+TEST_F(UntrustedArenaTest, RejectsUnsupportedSizes) {
+  UntrustedArena arena(&AllocateSlab);
+  EXPECT_EQ(arena.Allocate(0), nullptr);
+  EXPECT_EQ(arena.Allocate(UntrustedArena::kMaxBlockSize + 1), nullptr);
+  EXPECT_EQ(arena.SlabCount(), 0);
+}
+
+TEST_F(UntrustedArenaTest, DoesNotFreeForeignMemory) {
+  UntrustedArena arena(&AllocateSlab);
+  ASSERT_NE(arena.Allocate(100), nullptr);
+
+  void *foreign = malloc(100);
+  EXPECT_FALSE(arena.Free(foreign));
+  free(foreign);
+  EXPECT_FALSE(arena.Free(nullptr));
+}
+
+TEST_F(UntrustedArenaTest, ReusesFreedBlocks) {
+  UntrustedArena arena(&AllocateSlab);
+  void *block = arena.Allocate(1000);
+  ASSERT_NE(block, nullptr);
+  ASSERT_TRUE(arena.Free(block));
+  EXPECT_EQ(arena.Allocate(1000), block);
+  ASSERT_TRUE(arena.Free(block));
+
+  for (int i = 0; i < 10000; ++i) {
+    std::vector<void *> blocks;
+    for (int j = 0; j < 20; ++j) {
+      blocks.push_back(arena.Allocate(1 + (i * 20 + j) % 4096));
+      ASSERT_NE(blocks.back(), nullptr);
+    }
+    for (void *block : blocks) {
+      ASSERT_TRUE(arena.Free(block));
+    }
+  }
+  EXPECT_LE(arena.SlabCount(), 7);
+}
+
+TEST_F(UntrustedArenaTest, ReturnsNullWhenOutOfSlabs) {
+  UntrustedArena failing_arena(&FailToAllocateSlab);
+  EXPECT_EQ(failing_arena.Allocate(100), nullptr);
+
+  UntrustedArena arena(&AllocateSlab);
+  const size_t block_count = UntrustedArena::kMaxSlabs *
+                             UntrustedArena::kSlabSize /
+                             UntrustedArena::kMaxBlockSize;
+  std::vector<void *> blocks;
+  for (size_t i = 0; i < block_count; ++i) {
+    blocks.push_back(arena.Allocate(UntrustedArena::kMaxBlockSize));
+    ASSERT_NE(blocks.back(), nullptr);
+  }
+  EXPECT_EQ(arena.SlabCount(), UntrustedArena::kMaxSlabs);
+  EXPECT_EQ(arena.Allocate(UntrustedArena::kMaxBlockSize), nullptr);
+  EXPECT_EQ(arena.Allocate(1), nullptr);
+
+  ASSERT_TRUE(arena.Free(blocks.back()));
+  EXPECT_EQ(arena.Allocate(UntrustedArena::kMaxBlockSize), blocks.back());
+}
+
+TEST_F(UntrustedArenaTest, ConcurrentAllocateAndFree) {
+  UntrustedArena arena(&AllocateSlab);
+  constexpr int kThreads = 8;
+  constexpr int kIterations = 2000;
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreads; ++t) {
+    threads.emplace_back([&arena, t] {
+      std::vector<std::pair<uint8_t *, size_t>> held;
+      for (int i = 0; i < kIterations; ++i) {
+        size_t size = 1 + (i * 131 + t * 17) % 8192;
+        uint8_t *block = static_cast<uint8_t *>(arena.Allocate(size));
+        ASSERT_NE(block, nullptr);
+        memset(block, t, size);
+        held.emplace_back(block, size);
+
+        if (held.size() > 16) {
+          for (const auto &block : held) {
+            for (size_t j = 0; j < block.second; ++j) {
+              ASSERT_EQ(block.first[j], t);
+            }
+            ASSERT_TRUE(arena.Free(block.first));
+          }
+          held.clear();
+        }
+      }
+      for (const auto &block : held) {
+        ASSERT_TRUE(arena.Free(block.first));
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+}
+
+}  // namespace
+}  // namespace asylo
@@ -0,0 +1,38 @@
+/*
+ *
+ * Copyright 2018 Asylo authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "asylo/platform/core/enclave_client.h"
+
+namespace asylo {
+
+std::future<Status> EnclaveClient::EnterAndRunAsync(const EnclaveInput &input,
+                                                    EnclaveOutput *output) {
+  // Requests are queued only while a resident thread serves them. If none
+  // could be started, or they all left, the request enters the enclave.
+  if (resident_entries_) {
+    std::future<Status> result = resident_entries_->Submit(input, output);
+    if (result.valid()) {
+      return result;
+    }
+  }
+  return std::async(std::launch::async, [this, input, output] {
+    return EnterAndRun(input, output);
+  });
+}
+
+}  // namespace asylo
@@ -19,10 +19,15 @@
 #ifndef ASYLO_PLATFORM_CORE_ENCLAVE_CLIENT_H_
 #define ASYLO_PLATFORM_CORE_ENCLAVE_CLIENT_H_
 
+#include <errno.h>
+#include <future>
 #include <unordered_map>
 
 #include "absl/memory/memory.h"
 #include "asylo/enclave.pb.h"  // IWYU pragma: export
+#include "asylo/platform/common/bridge_types.h"
+#include "asylo/platform/common/switchless_queue.h"
+#include "asylo/platform/core/resident_entry_queue.h"
 #include "asylo/platform/core/shared_name.h"
 #include "asylo/util/status.h"  // IWYU pragma: export
 
@@ -50,6 +55,22 @@ class EnclaveClient {
   virtual Status EnterAndRun(const EnclaveInput &input,
                              EnclaveOutput *output) = 0;
 
+  /// Invokes the enclave's execution entry point asynchronously.
+  ///
+  /// If the enclave was loaded with resident entry threads and at least one of
+  /// them is running, the request is handed to a thread already inside the
+  /// enclave and does not enter the enclave. Otherwise it is run by EnterAndRun
+  /// on a separate thread.
+  ///
+  /// \param input A protobuf message that may be extended with a user-defined
+  ///              message.
+  /// \param[out] output A nullable pointer to a protobuf message that can store
+  ///                    a response message. It must remain valid until the
+  ///                    returned future is ready.
+  /// \return A future receiving the status of the call.
+  virtual std::future<Status> EnterAndRunAsync(const EnclaveInput &input,
+                                               EnclaveOutput *output);
+
  protected:
   /// Returns the name of the enclave.
   ///
@@ -62,6 +83,7 @@ class EnclaveClient {
   explicit EnclaveClient(const std::string &name) : name_(name) {}
 
  private:
+  friend class EnclaveClientForTest;
   friend class EnclaveManager;
   friend class EnclaveSignalDispatcher;
   friend void donate(EnclaveClient *client);
@@ -83,7 +105,20 @@ class EnclaveClient {
   // client at the time the enclave is destroyed.
   virtual Status DestroyEnclave() = 0;
 
+  // Serves a switchless host call request submitted by the enclave. Invoked by
+  // the EnclaveManager on one of the untrusted worker threads started for the
+  // enclave. Backends without switchless host call support fail every request
+  // with ENOSYS.
+  virtual void DispatchSwitchlessHostCall(SwitchlessHostCall *call) {
+    call->result = -1;
+    call->bridge_errno = ToBridgeErrno(ENOSYS);
+  }
+
   std::string name_;
+
+  // Queue of requests served by resident enclave threads, owned by the
+  // EnclaveManager. Null if the enclave has no resident entry threads.
+  ResidentEntryQueue *resident_entries_ = nullptr;
 };
 
 }  // namespace asylo
@@ -0,0 +1,164 @@
+/*
+ *
+ * Copyright 2018 Asylo authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "asylo/platform/core/enclave_client.h"
+
+#include <string.h>
+
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <string>
+#include <thread>
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include "asylo/enclave.pb.h"
+#include "asylo/platform/core/resident_entry_queue.h"
+#include "asylo/test/util/status_matchers.h"
+#include "asylo/util/status.h"
+
+namespace asylo {
+
+// A client whose enclave entries only count the calls to EnterAndRun.
+class EnclaveClientForTest : public EnclaveClient {
+ public:
+  EnclaveClientForTest() : EnclaveClient("test"), entries_(0) {}
+
+  Status EnterAndRun(const EnclaveInput &input,
+                     EnclaveOutput *output) override {
+    entries_++;
+    return Status::OkStatus();
+  }
+
+  // Attaches a queue of requests for resident threads, as the EnclaveManager
+  // does for enclaves configured with resident entry threads.
+  void set_resident_entries(ResidentEntryQueue *entries) {
+    resident_entries_ = entries;
+  }
+
+  int entries() const { return entries_; }
+
+ private:
+  Status EnterAndInitialize(const EnclaveConfig &config) override {
+    return Status::OkStatus();
+  }
+  Status EnterAndFinalize(const EnclaveFinal &final_input) override {
+    return Status::OkStatus();
+  }
+  Status EnterAndDonateThread() override { return Status::OkStatus(); }
+  Status EnterAndHandleSignal(const EnclaveSignal &signal) override {
+    return Status::OkStatus();
+  }
+  Status DestroyEnclave() override { return Status::OkStatus(); }
+
+  std::atomic<int> entries_;
+};
+
+namespace {
+
+constexpr std::chrono::seconds kTimeout(10);
+
+// Stands in for a resident enclave thread, answering every request with an OK
+// status.
+class FakeResidentThread {
+ public:
+  explicit FakeResidentThread(SwitchlessEntryQueue *queue)
+      : queue_(queue), stop_(false) {
+    EnclaveOutput output;
+    Status::OkStatus().SaveTo(output.mutable_status());
+    output.SerializeToString(&output_);
+    queue_->AddServer();
+    thread_ = std::thread([this] { Serve(); });
+  }
+
+  ~FakeResidentThread() {
+    stop_ = true;
+    thread_.join();
+  }
+
+ private:
+  void Serve() {
+    while (!stop_) {
+      SwitchlessEnclaveEntry *entry = queue_->Take();
+      if (entry) {
+        Answer(entry);
+      } else {
+        std::this_thread::yield();
+      }
+    }
+    queue_->RemoveServer();
+    while (SwitchlessEnclaveEntry *entry = queue_->Take()) {
+      Answer(entry);
+    }
+  }
+
+  void Answer(SwitchlessEnclaveEntry *entry) {
+    memcpy(reinterpret_cast<char *>(entry->output), output_.data(),
+           output_.size());
+    entry->output_size = output_.size();
+    entry->result = 0;
+    queue_->Complete(entry);
+  }
+
+  SwitchlessEntryQueue *queue_;
+  std::string output_;
+  std::atomic<bool> stop_;
+  std::thread thread_;
+};
+
+TEST(EnclaveClientTest, RunsOnResidentThreads) {
+  ResidentEntryQueue entries;
+  FakeResidentThread server(entries.queue());
+  EnclaveClientForTest client;
+  client.set_resident_entries(&entries);
+
+  std::future<Status> result = client.EnterAndRunAsync(EnclaveInput(), nullptr);
+  ASSERT_EQ(result.wait_for(kTimeout), std::future_status::ready);
+  EXPECT_THAT(result.get(), IsOk());
+  EXPECT_EQ(client.entries(), 0);
+}
+
+// The queue is published before the enclave starts its resident threads. If
+// none could be started, requests must enter the enclave instead of waiting in
+// the queue until the enclave is destroyed.
+TEST(EnclaveClientTest, EntersEnclaveIfResidentThreadsFailToStart) {
+  ResidentEntryQueue entries;
+  EnclaveClientForTest client;
+  client.set_resident_entries(&entries);
+
+  std::future<Status> result = client.EnterAndRunAsync(EnclaveInput(), nullptr);
+  ASSERT_EQ(result.wait_for(kTimeout), std::future_status::ready);
+  EXPECT_THAT(result.get(), IsOk());
+  EXPECT_EQ(client.entries(), 1);
+}
+
+TEST(EnclaveClientTest, EntersEnclaveAfterResidentThreadsStop) {
+  ResidentEntryQueue entries;
+  EnclaveClientForTest client;
+  client.set_resident_entries(&entries);
+  { FakeResidentThread server(entries.queue()); }
+
+  std::future<Status> result = client.EnterAndRunAsync(EnclaveInput(), nullptr);
+  ASSERT_EQ(result.wait_for(kTimeout), std::future_status::ready);
+  EXPECT_THAT(result.get(), IsOk());
+  EXPECT_EQ(client.entries(), 1);
+}
+
+}  // namespace
+}  // namespace asylo
@@ -24,10 +24,12 @@
 #include <time.h>
 #include <thread>
 
+#include "absl/memory/memory.h"
 #include "absl/strings/str_cat.h"
 #include "absl/synchronization/mutex.h"
 
 #include "asylo/util/logging.h"
+#include "asylo/platform/common/switchless_queue.h"
 #include "asylo/platform/common/time_util.h"
 
 namespace asylo {
@@ -180,6 +182,7 @@ Status EnclaveManager::DestroyEnclave(EnclaveClient *client,
         EnclaveSignalDispatcher::GetInstance()->DeregisterAllSignalsForClient(
             client);
     const auto &name = name_by_client_[client];
+    StopSwitchlessServices(client, name);
     client_by_name_.erase(name);
     name_by_client_.erase(client);
   }
@@ -279,6 +282,10 @@ Status EnclaveManager::LoadEnclaveInternal(const std::string &name,
   client_by_name_.emplace(name, std::move(result).ValueOrDie());
   name_by_client_.emplace(client, name);
 
+  // The enclave attaches to its switchless queues during initialization, so
+  // they must be published before entering it.
+  StartSwitchlessServices(client, name, config);
+
   Status status = client->EnterAndInitialize(config);
   // If initialization fails, don't keep the enclave registered. GetClient will
   // return a nullptr rather than an enclave in a bad state.
@@ -288,12 +295,67 @@ Status EnclaveManager::LoadEnclaveInternal(const std::string &name,
       LOG(ERROR) << "DestroyEnclave failed after EnterAndInitialize failure: "
                  << destroy_status;
     }
+    StopSwitchlessServices(client, name);
     client_by_name_.erase(name);
     name_by_client_.erase(client);
   }
   return status;
 }
 
+void EnclaveManager::StartSwitchlessServices(EnclaveClient *client,
+                                             const std::string &name,
+                                             const EnclaveConfig &config) {
+  if (config.switchless_host_call_workers() > 0) {
+    auto pool = absl::make_unique<HostCallWorkerPool>(
+        config.switchless_host_call_workers(),
+        [client](SwitchlessHostCall *call) {
+          client->DispatchSwitchlessHostCall(call);
+        });
+    Status status = shared_resource_manager_.RegisterUnmanagedResource(
+        SharedName::Address(
+            absl::StrCat(kSwitchlessHostCallQueuePrefix, name)),
+        pool->queue());
+    if (status.ok()) {
+      host_call_workers_by_client_.emplace(client, std::move(pool));
+    } else {
+      LOG(WARNING) << "Switchless host calls disabled for enclave " << name
+                   << ": " << status;
+    }
+  }
+
+  if (config.resident_entry_threads() > 0) {
+    auto entries = absl::make_unique<ResidentEntryQueue>();
+    Status status = shared_resource_manager_.RegisterUnmanagedResource(
+        SharedName::Address(absl::StrCat(kSwitchlessEntryQueuePrefix, name)),
+        entries->queue());
+    if (status.ok()) {
+      client->resident_entries_ = entries.get();
+      resident_entries_by_client_.emplace(client, std::move(entries));
+    } else {
+      LOG(WARNING) << "Resident entry threads disabled for enclave " << name
+                   << ": " << status;
+    }
+  }
+}
+
+void EnclaveManager::StopSwitchlessServices(EnclaveClient *client,
+                                            const std::string &name) {
+  auto workers = host_call_workers_by_client_.find(client);
+  if (workers != host_call_workers_by_client_.end()) {
+    shared_resource_manager_.ReleaseResource(SharedName::Address(
+        absl::StrCat(kSwitchlessHostCallQueuePrefix, name)));
+    host_call_workers_by_client_.erase(workers);
+  }
+
+  auto entries = resident_entries_by_client_.find(client);
+  if (entries != resident_entries_by_client_.end()) {
+    client->resident_entries_ = nullptr;
+    shared_resource_manager_.ReleaseResource(SharedName::Address(
+        absl::StrCat(kSwitchlessEntryQueuePrefix, name)));
+    resident_entries_by_client_.erase(entries);
+  }
+}
+
 void EnclaveManager::SpawnWorkerThread() {
   std::mutex worker_init_lock;
   worker_init_lock.lock();
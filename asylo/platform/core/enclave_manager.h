@@ -36,6 +36,8 @@
 #include "asylo/enclave.pb.h"  // IWYU pragma: export
 #include "asylo/platform/core/enclave_client.h"
 #include "asylo/platform/core/enclave_config_util.h"
+#include "asylo/platform/core/host_call_worker_pool.h"
+#include "asylo/platform/core/resident_entry_queue.h"
 #include "asylo/platform/core/shared_resource_manager.h"
 #include "asylo/util/status.h"  // IWYU pragma: export
 #include "asylo/util/statusor.h"
@@ -264,6 +266,17 @@ class EnclaveManager {
   Status LoadEnclaveInternal(const std::string &name, const EnclaveLoader &loader,
                              const EnclaveConfig &config);
 
+  // Starts the switchless host call workers and the resident entry queue
+  // requested by |config| for |client|, and publishes their queues to the
+  // enclave loaded under |name|. The enclave runs without any of them that fail
+  // to start.
+  void StartSwitchlessServices(EnclaveClient *client, const std::string &name,
+                               const EnclaveConfig &config);
+
+  // Withdraws the switchless queues of |client|, if any, and stops the threads
+  // serving them. Must not be called before the enclave has been destroyed.
+  void StopSwitchlessServices(EnclaveClient *client, const std::string &name);
+
   // Create a thread to periodically update logic.
   void SpawnWorkerThread();
 
@@ -285,6 +298,18 @@ class EnclaveManager {
   std::unordered_map<std::string, std::unique_ptr<EnclaveClient>> client_by_name_;
   std::unordered_map<const EnclaveClient *, std::string> name_by_client_;
 
+  // Switchless host call workers of each enclave configured to use them. A
+  // pool is stopped only after its enclave has been destroyed, since enclave
+  // threads may be waiting on requests in its queue until then.
+  std::unordered_map<const EnclaveClient *, std::unique_ptr<HostCallWorkerPool>>
+      host_call_workers_by_client_;
+
+  // Resident entry queues of each enclave configured to use them. Like the
+  // host call workers, a queue is released only after its enclave has been
+  // destroyed.
+  std::unordered_map<const EnclaveClient *, std::unique_ptr<ResidentEntryQueue>>
+      resident_entries_by_client_;
+
   // A part of the configuration for enclaves launched by the enclave manager
   // comes from the Asylo daemon. This member caches such configuration.
   HostConfig host_config_;
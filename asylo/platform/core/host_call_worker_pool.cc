@@ -0,0 +1,87 @@
+/*
+ *
+ * Copyright 2018 Asylo authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "asylo/platform/core/host_call_worker_pool.h"
+
+#include <xmmintrin.h>
+
+#include <chrono>
+#include <utility>
+
+namespace asylo {
+namespace {
+
+// Number of consecutive empty polls after which an idle worker starts yielding
+// the processor instead of spinning. An enclave thread waits for
+// kSwitchlessPickupPolls polls before withdrawing a request, so a worker keeps
+// spinning at least as long after its last request.
+constexpr int kSpinPolls = 2 * kSwitchlessPickupPolls;
+
+// Number of consecutive empty polls after which an idle worker starts sleeping
+// between polls.
+constexpr int kYieldPolls = 1 << 14;
+
+// Time an idle worker sleeps between polls once it has stopped yielding.
+constexpr std::chrono::microseconds kIdleSleep(50);
+
+}  // namespace
+
+HostCallWorkerPool::HostCallWorkerPool(int num_workers, Dispatcher dispatcher)
+    : dispatcher_(std::move(dispatcher)), stopping_(false), served_(0) {
+  for (int i = 0; i < num_workers; i++) {
+    workers_.emplace_back([this] { WorkerLoop(); });
+  }
+}
+
+HostCallWorkerPool::~HostCallWorkerPool() {
+  stopping_ = true;
+  for (std::thread &worker : workers_) {
+    worker.join();
+  }
+}
+
+void HostCallWorkerPool::WorkerLoop() {
+  int idle_polls = 0;
+  while (!stopping_) {
+    SwitchlessHostCall *call = queue_.Take();
+    if (call) {
+      dispatcher_(call);
+      served_++;
+      queue_.Complete(call);
+      idle_polls = 0;
+      continue;
+    }
+    if (idle_polls < kSpinPolls) {
+      idle_polls++;
+      _mm_pause();
+    } else if (idle_polls < kYieldPolls) {
+      idle_polls++;
+      std::this_thread::yield();
+    } else {
+      std::this_thread::sleep_for(kIdleSleep);
+      // A sleeping worker can not claim a request before the enclave thread
+      // withdraws it. A request left in the queue after a sleep means calls are
+      // being made again, so resume polling to claim the next ones in time.
+      if (queue_.HasPending()) {
+        idle_polls = 0;
+      }
+    }
+  }
+}
+
+}  // namespace asylo
@@ -0,0 +1,78 @@
+/*
+ *
+ * Copyright 2018 Asylo authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef ASYLO_PLATFORM_CORE_HOST_CALL_WORKER_POOL_H_
+#define ASYLO_PLATFORM_CORE_HOST_CALL_WORKER_POOL_H_
+
+#include <atomic>
+#include <functional>
+#include <thread>
+#include <vector>
+
+#include "asylo/platform/common/switchless_queue.h"
+
+namespace asylo {
+
+/// A pool of untrusted worker threads serving switchless host calls.
+///
+/// The pool owns a SwitchlessHostCallQueue which is shared with an enclave.
+/// Enclave threads submit host call requests to the queue and the workers serve
+/// them by invoking a dispatcher, so the enclave threads never leave the
+/// enclave. An idle worker spins briefly, then yields, then sleeps, so an idle
+/// pool does not keep a core busy. Calls made while every worker sleeps are
+/// withdrawn by the enclave threads, which then leave the enclave; a worker
+/// finding such a call when it wakes up resumes polling, so that the following
+/// calls take the switchless path again.
+class HostCallWorkerPool {
+ public:
+  /// A function serving a single request in state kRunning.
+  using Dispatcher = std::function<void(SwitchlessHostCall *)>;
+
+  /// Starts a pool of workers serving requests with a dispatcher.
+  ///
+  /// \param num_workers The number of worker threads to start.
+  /// \param dispatcher The function invoked to serve each request.
+  HostCallWorkerPool(int num_workers, Dispatcher dispatcher);
+
+  HostCallWorkerPool(const HostCallWorkerPool &) = delete;
+  HostCallWorkerPool &operator=(const HostCallWorkerPool &) = delete;
+
+  /// Stops and joins the workers. The queue must no longer be in use by an
+  /// enclave.
+  ~HostCallWorkerPool();
+
+  /// Returns the queue served by this pool.
+  SwitchlessHostCallQueue *queue() { return &queue_; }
+
+  /// Returns the number of requests served so far.
+  uint64_t served() const { return served_; }
+
+ private:
+  // Top level loop run by each worker thread.
+  void WorkerLoop();
+
+  SwitchlessHostCallQueue queue_;
+  Dispatcher dispatcher_;
+  std::atomic<bool> stopping_;
+  std::atomic<uint64_t> served_;
+  std::vector<std::thread> workers_;
+};
+
+}  // namespace asylo
+
+#endif  // ASYLO_PLATFORM_CORE_HOST_CALL_WORKER_POOL_H_
@@ -0,0 +1,146 @@
+/*
+ *
+ * Copyright 2018 Asylo authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "asylo/platform/core/host_call_worker_pool.h"
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+namespace asylo {
+namespace {
+
+// Submits a request to |pool| and waits for its completion.
+int64_t Call(HostCallWorkerPool *pool, uint64_t argument) {
+  SwitchlessHostCallQueue *queue = pool->queue();
+  SwitchlessHostCall *call;
+  while (!(call = queue->Reserve())) {
+    std::this_thread::yield();
+  }
+  call->function = 0;
+  call->arguments[0] = argument;
+  queue->Submit(call);
+  while (call->state != SwitchlessHostCall::kDone) {
+    std::this_thread::yield();
+  }
+  int64_t result = call->result;
+  queue->Release(call);
+  return result;
+}
+
+// Submits a request to |pool| like an enclave thread making a switchless host
+// call, withdrawing it if no worker claims it within kSwitchlessPickupPolls
+// polls. Returns true and stores the result of the call in |*result| if the
+// request was served, and false if it was withdrawn.
+bool TryCall(HostCallWorkerPool *pool, uint64_t argument, int64_t *result) {
+  SwitchlessHostCallQueue *queue = pool->queue();
+  SwitchlessHostCall *call;
+  while (!(call = queue->Reserve())) {
+    std::this_thread::yield();
+  }
+  call->function = 0;
+  call->arguments[0] = argument;
+  queue->Submit(call);
+  int polls = 0;
+  while (call->state == SwitchlessHostCall::kSubmitted) {
+    if (++polls > kSwitchlessPickupPolls && queue->Cancel(call)) {
+      return false;
+    }
+    std::this_thread::yield();
+  }
+  while (call->state != SwitchlessHostCall::kDone) {
+    std::this_thread::yield();
+  }
+  *result = call->result;
+  queue->Release(call);
+  return true;
+}
+
+TEST(HostCallWorkerPoolTest, ServesRequests) {
+  HostCallWorkerPool pool(2, [](SwitchlessHostCall *call) {
+    call->result = call->arguments[0] + 1;
+  });
+  for (int i = 0; i < 1000; i++) {
+    EXPECT_EQ(Call(&pool, i), i + 1);
+  }
+  EXPECT_EQ(pool.served(), 1000);
+}
+
+TEST(HostCallWorkerPoolTest, ServesConcurrentCallers) {
+  constexpr int kCallers = 8;
+  constexpr int kCallsPerCaller = 2000;
+  HostCallWorkerPool pool(3, [](SwitchlessHostCall *call) {
+    call->result = call->arguments[0] * 3;
+  });
+
+  std::vector<std::thread> callers;
+  for (int i = 0; i < kCallers; i++) {
+    callers.emplace_back([&pool] {
+      for (int j = 0; j < kCallsPerCaller; j++) {
+        EXPECT_EQ(Call(&pool, j), 3 * j);
+      }
+    });
+  }
+  for (auto &caller : callers) {
+    caller.join();
+  }
+  EXPECT_EQ(pool.served(), kCallers * kCallsPerCaller);
+}
+
+// Once the workers of an idle pool have gone to sleep, calls are still claimed
+// before the caller gives up on them, possibly after the first few calls.
+TEST(HostCallWorkerPoolTest, ClaimsCallsAfterIdling) {
+  constexpr int kRounds = 3;
+  constexpr int kCalls = 100;
+  HostCallWorkerPool pool(1, [](SwitchlessHostCall *call) {
+    call->result = call->arguments[0] + 1;
+  });
+
+  uint64_t switchless_calls = 0;
+  for (int round = 0; round < kRounds; round++) {
+    // Long enough for the worker to stop spinning and yielding.
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    int claimed = 0;
+    for (int i = 0; i < kCalls; i++) {
+      int64_t result;
+      if (TryCall(&pool, i, &result)) {
+        EXPECT_EQ(result, i + 1);
+        claimed++;
+      }
+    }
+    EXPECT_GE(claimed, kCalls - 5) << "in round " << round;
+    switchless_calls += claimed;
+  }
+  EXPECT_EQ(pool.served(), switchless_calls);
+}
+
+TEST(HostCallWorkerPoolTest, StopsWhenIdle) {
+  std::atomic<int> dispatched(0);
+  {
+    HostCallWorkerPool pool(4, [&dispatched](SwitchlessHostCall *call) {
+      dispatched++;
+    });
+  }
+  EXPECT_EQ(dispatched, 0);
+}
+
+}  // namespace
+}  // namespace asylo
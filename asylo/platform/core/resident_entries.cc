@@ -0,0 +1,185 @@
+/*
+ *
+ * Copyright 2018 Asylo authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "asylo/platform/core/resident_entries.h"
+
+#include <pthread.h>
+#include <string.h>
+
+#include <atomic>
+#include <vector>
+
+#include "absl/strings/str_cat.h"
+#include "asylo/enclave.pb.h"
+#include "asylo/platform/arch/include/trusted/enclave_interface.h"
+#include "asylo/platform/arch/include/trusted/host_calls.h"
+#include "asylo/platform/common/switchless_queue.h"
+#include "asylo/platform/core/shared_name_kind.h"
+#include "asylo/platform/core/trusted_application.h"
+#include "asylo/util/posix_error_space.h"
+
+namespace asylo {
+namespace {
+
+// Number of consecutive empty polls after which an idle resident thread starts
+// sleeping on the host between polls.
+constexpr int kSpinPolls = 1 << 14;
+
+// Time in microseconds an idle resident thread sleeps between polls.
+constexpr uint32_t kIdleSleepMicros = 50;
+
+// The queue served by the resident threads.
+SwitchlessEntryQueue *entry_queue = nullptr;
+
+// Set to ask the resident threads to leave the enclave.
+std::atomic<bool> stop_requested(false);
+
+// The running resident threads. Only modified on enclave initialization and
+// finalization, which are never concurrent.
+std::vector<pthread_t> *resident_threads = new std::vector<pthread_t>();
+
+// Serves a single run request. Every field of |entry| is read once, since the
+// host may change it at any time.
+void ServeEntry(SwitchlessEnclaveEntry *entry) {
+  const char *input = reinterpret_cast<const char *>(entry->input);
+  size_t input_size = entry->input_size;
+  char *output = reinterpret_cast<char *>(entry->output);
+  size_t output_capacity = entry->output_capacity;
+  entry->output_allocated = 0;
+  if ((input_size > 0 && !enc_is_outside_enclave(input, input_size)) ||
+      (output_capacity > 0 &&
+       !enc_is_outside_enclave(output, output_capacity))) {
+    entry->result = 1;
+    return;
+  }
+
+  // Parse from a trusted copy so the input can not change while it is parsed.
+  std::string trusted_input(input, input_size);
+  EnclaveInput enclave_input;
+  EnclaveOutput enclave_output;
+  Status status;
+  TrustedApplication *trusted_application = GetApplicationInstance();
+  if (!enclave_input.ParseFromString(trusted_input)) {
+    status = Status(error::GoogleError::INVALID_ARGUMENT,
+                    "Failed to parse EnclaveInput");
+  } else if (trusted_application->GetState() !=
+             TrustedApplication::State::kRunning) {
+    status = Status(error::GoogleError::FAILED_PRECONDITION,
+                    "Enclave not in state RUNNING");
+  } else {
+    status = trusted_application->Run(enclave_input, &enclave_output);
+  }
+  status.SaveTo(enclave_output.mutable_status());
+
+  std::string serialized_output;
+  if (!enclave_output.SerializeToString(&serialized_output)) {
+    entry->result = 1;
+    return;
+  }
+  if (serialized_output.size() > output_capacity) {
+    output =
+        static_cast<char *>(enc_untrusted_malloc(serialized_output.size()));
+    entry->output = reinterpret_cast<uint64_t>(output);
+    entry->output_allocated = 1;
+  }
+  memcpy(output, serialized_output.data(), serialized_output.size());
+  entry->output_size = serialized_output.size();
+  entry->result = 0;
+}
+
+void *ResidentEntryLoop(void *) {
+  int idle_polls = 0;
+  while (!stop_requested) {
+    SwitchlessEnclaveEntry *entry = entry_queue->Take();
+    if (entry) {
+      ServeEntry(entry);
+      entry_queue->Complete(entry);
+      idle_polls = 0;
+    } else if (idle_polls < kSpinPolls) {
+      idle_polls++;
+      enc_pause();
+    } else {
+      enc_untrusted_usleep(kIdleSleepMicros);
+    }
+  }
+  // Leave the queue before draining it, so that the host withdraws any request
+  // submitted after the last server drained the queue instead of waiting for
+  // it to be served.
+  entry_queue->RemoveServer();
+  while (SwitchlessEnclaveEntry *entry = entry_queue->Take()) {
+    ServeEntry(entry);
+    entry_queue->Complete(entry);
+  }
+  return nullptr;
+}
+
+}  // namespace
+
+Status StartResidentEntryThreads(const std::string &enclave_name,
+                                 int num_threads) {
+  if (!entry_queue) {
+    std::string name = absl::StrCat(kSwitchlessEntryQueuePrefix, enclave_name);
+    void *addr =
+        enc_untrusted_acquire_shared_resource(kAddressName, name.c_str());
+    if (!addr) {
+      return Status(error::GoogleError::NOT_FOUND,
+                    "No resident entry queue published for the enclave");
+    }
+    if (!enc_is_outside_enclave(addr, sizeof(SwitchlessEntryQueue))) {
+      abort();
+    }
+    auto *queue = static_cast<SwitchlessEntryQueue *>(addr);
+    bool valid =
+        queue->InstanceVersion() == SwitchlessEntryQueue::TypeVersion();
+    // The untrusted runtime keeps the queue alive until the enclave is
+    // destroyed, so the reference taken above need not be held.
+    enc_untrusted_release_shared_resource(kAddressName, name.c_str());
+    if (!valid) {
+      return Status(error::GoogleError::FAILED_PRECONDITION,
+                    "Resident entry queue version mismatch");
+    }
+    entry_queue = queue;
+  }
+
+  stop_requested = false;
+  for (int i = 0; i < num_threads; i++) {
+    pthread_t thread;
+    // The host submits requests only while the queue has a server, so each
+    // thread is registered before it can take a request and unregisters itself
+    // when it leaves.
+    entry_queue->AddServer();
+    int ret = pthread_create(&thread, nullptr, ResidentEntryLoop, nullptr);
+    if (ret != 0) {
+      entry_queue->RemoveServer();
+      return Status(static_cast<error::PosixError>(ret),
+                    "Failed to start resident entry thread");
+    }
+    resident_threads->push_back(thread);
+  }
+  return Status::OkStatus();
+}
+
+void StopResidentEntryThreads() {
+  stop_requested = true;
+  for (pthread_t thread : *resident_threads) {
+    pthread_join(thread, nullptr);
+  }
+  resident_threads->clear();
+}
+
+}  // namespace asylo
@@ -0,0 +1,44 @@
+/*
+ *
+ * Copyright 2018 Asylo authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef ASYLO_PLATFORM_CORE_RESIDENT_ENTRIES_H_
+#define ASYLO_PLATFORM_CORE_RESIDENT_ENTRIES_H_
+
+#include <string>
+
+#include "asylo/util/status.h"
+
+namespace asylo {
+
+// Attaches the enclave to the queue of run requests published by the untrusted
+// runtime for the enclave named |enclave_name|, and starts |num_threads|
+// enclave threads which stay inside the enclave serving requests from it. The
+// threads are donated by the host like any other enclave thread, so the
+// enclave state must allow thread donation. If a thread can not be started,
+// an error is returned and the threads already started keep serving requests.
+// The host queues requests only while at least one thread serves the queue.
+Status StartResidentEntryThreads(const std::string &enclave_name,
+                                 int num_threads);
+
+// Stops the resident entry threads, if any, and waits for them to leave the
+// enclave. The threads serve the requests already queued before leaving.
+void StopResidentEntryThreads();
+
+}  // namespace asylo
+
+#endif  // ASYLO_PLATFORM_CORE_RESIDENT_ENTRIES_H_
@@ -0,0 +1,163 @@
+/*
+ *
+ * Copyright 2018 Asylo authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "asylo/platform/core/resident_entry_queue.h"
+
+#include <stdlib.h>
+#include <xmmintrin.h>
+
+#include <chrono>
+#include <utility>
+
+namespace asylo {
+namespace {
+
+// Number of consecutive empty polls after which the idle completion thread
+// starts sleeping between polls.
+constexpr int kSpinPolls = 1 << 12;
+
+// Time the idle completion thread sleeps between polls.
+constexpr std::chrono::microseconds kIdleSleep(20);
+
+}  // namespace
+
+constexpr size_t ResidentEntryQueue::kOutputCapacity;
+
+ResidentEntryQueue::ResidentEntryQueue() : stopping_(false) {
+  for (PendingRequest &request : pending_) {
+    request.active = false;
+    request.output_buffer.reset(new char[kOutputCapacity]);
+  }
+  completion_thread_ = std::thread([this] { CompletionLoop(); });
+}
+
+ResidentEntryQueue::~ResidentEntryQueue() {
+  stopping_ = true;
+  completion_thread_.join();
+  for (PendingRequest &request : pending_) {
+    if (request.active) {
+      request.promise.set_value(
+          Status(error::GoogleError::ABORTED,
+                 "Enclave destroyed before serving the request"));
+    }
+  }
+}
+
+std::future<Status> ResidentEntryQueue::Submit(const EnclaveInput &input,
+                                               EnclaveOutput *output) {
+  if (queue_.servers() == 0) {
+    return std::future<Status>();
+  }
+
+  std::promise<Status> promise;
+  std::future<Status> future = promise.get_future();
+  std::string serialized_input;
+  if (!input.SerializeToString(&serialized_input)) {
+    promise.set_value(Status(error::GoogleError::INVALID_ARGUMENT,
+                             "Failed to serialize EnclaveInput"));
+    return future;
+  }
+
+  SwitchlessEnclaveEntry *entry;
+  while (!(entry = queue_.Reserve())) {
+    if (queue_.servers() == 0) {
+      return std::future<Status>();
+    }
+    std::this_thread::yield();
+  }
+  PendingRequest &request = pending_[queue_.IndexOf(entry)];
+  request.input = std::move(serialized_input);
+  request.output = output;
+  request.promise = std::move(promise);
+
+  entry->input = reinterpret_cast<uint64_t>(request.input.data());
+  entry->input_size = request.input.size();
+  entry->output = reinterpret_cast<uint64_t>(request.output_buffer.get());
+  entry->output_capacity = kOutputCapacity;
+  entry->output_size = 0;
+  entry->output_allocated = 0;
+  entry->result = 0;
+  request.active.store(true, std::memory_order_release);
+  queue_.Submit(entry);
+
+  // If the last server left before it could see the request, withdraw it. The
+  // slot is freed by the next server to take the request, if any.
+  if (queue_.servers() == 0 && queue_.Cancel(entry)) {
+    request.active.store(false, std::memory_order_relaxed);
+    request.input.clear();
+    request.output = nullptr;
+    request.promise = std::promise<Status>();
+    return std::future<Status>();
+  }
+  return future;
+}
+
+void ResidentEntryQueue::CompletionLoop() {
+  int idle_polls = 0;
+  while (!stopping_) {
+    bool completed = false;
+    for (size_t i = 0; i < SwitchlessEntryQueue::kSlots; i++) {
+      if (pending_[i].active.load(std::memory_order_acquire) &&
+          queue_.slot(i)->state.load(std::memory_order_acquire) ==
+              SwitchlessRequest::kDone) {
+        Complete(i);
+        completed = true;
+      }
+    }
+    if (completed) {
+      idle_polls = 0;
+    } else if (idle_polls < kSpinPolls) {
+      idle_polls++;
+      _mm_pause();
+    } else {
+      std::this_thread::sleep_for(kIdleSleep);
+    }
+  }
+}
+
+void ResidentEntryQueue::Complete(size_t index) {
+  PendingRequest &request = pending_[index];
+  SwitchlessEnclaveEntry *entry = queue_.slot(index);
+
+  Status status;
+  if (entry->result) {
+    status = Status(error::GoogleError::INTERNAL, "No output from enclave");
+  } else {
+    EnclaveOutput local_output;
+    local_output.ParseFromArray(reinterpret_cast<const char *>(entry->output),
+                                entry->output_size);
+    status.RestoreFrom(local_output.status());
+    if (request.output) {
+      *request.output = std::move(local_output);
+    }
+  }
+  // Outputs which did not fit the provided buffer were allocated by the
+  // enclave with enc_untrusted_malloc().
+  if (entry->output_allocated) {
+    free(reinterpret_cast<void *>(entry->output));
+  }
+
+  std::promise<Status> promise = std::move(request.promise);
+  request.input.clear();
+  request.output = nullptr;
+  request.active.store(false, std::memory_order_relaxed);
+  queue_.Release(entry);
+  promise.set_value(status);
+}
+
+}  // namespace asylo
@@ -0,0 +1,98 @@
+/*
+ *
+ * Copyright 2018 Asylo authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef ASYLO_PLATFORM_CORE_RESIDENT_ENTRY_QUEUE_H_
+#define ASYLO_PLATFORM_CORE_RESIDENT_ENTRY_QUEUE_H_
+
+#include <array>
+#include <atomic>
+#include <future>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include "asylo/enclave.pb.h"
+#include "asylo/platform/common/switchless_queue.h"
+#include "asylo/util/status.h"
+
+namespace asylo {
+
+/// The untrusted end of a queue of run requests served by resident enclave
+/// threads.
+///
+/// Requests are serialized into untrusted memory and handed to threads which
+/// stay inside the enclave, so submitting a request does not enter the enclave.
+/// A completion thread collects the results and fulfills the future returned
+/// for each request.
+class ResidentEntryQueue {
+ public:
+  /// Size of the output buffer provided for each request. Larger outputs are
+  /// returned in a buffer allocated by the enclave.
+  static constexpr size_t kOutputCapacity = 4096;
+
+  ResidentEntryQueue();
+
+  ResidentEntryQueue(const ResidentEntryQueue &) = delete;
+  ResidentEntryQueue &operator=(const ResidentEntryQueue &) = delete;
+
+  /// Stops the completion thread. Requests that have not completed fail with
+  /// an ABORTED status. The queue must no longer be in use by an enclave.
+  ~ResidentEntryQueue();
+
+  /// Queues a run request. Blocks while every request slot is in use.
+  ///
+  /// A request is queued only while at least one resident thread serves the
+  /// queue. Otherwise no request is queued and the returned future has no
+  /// shared state, so that the caller can run the request another way.
+  ///
+  /// \param input The input to pass to the enclave's Run entry point.
+  /// \param[out] output A nullable pointer to a message receiving the output of
+  ///                    the request. It must remain valid until the returned
+  ///                    future is ready.
+  /// \return A future receiving the status of the request, or an invalid
+  ///         future if the request was not queued.
+  std::future<Status> Submit(const EnclaveInput &input, EnclaveOutput *output);
+
+  /// Returns the queue shared with the enclave.
+  SwitchlessEntryQueue *queue() { return &queue_; }
+
+ private:
+  // Untrusted state of a submitted request, indexed like the queue slots.
+  struct PendingRequest {
+    std::atomic<bool> active;
+    std::string input;
+    std::unique_ptr<char[]> output_buffer;
+    EnclaveOutput *output;
+    std::promise<Status> promise;
+  };
+
+  // Top level loop run by the completion thread.
+  void CompletionLoop();
+
+  // Collects the result of the completed request in slot |index|.
+  void Complete(size_t index);
+
+  SwitchlessEntryQueue queue_;
+  std::array<PendingRequest, SwitchlessEntryQueue::kSlots> pending_;
+  std::atomic<bool> stopping_;
+  std::thread completion_thread_;
+};
+
+}  // namespace asylo
+
+#endif  // ASYLO_PLATFORM_CORE_RESIDENT_ENTRY_QUEUE_H_
@@ -0,0 +1,172 @@
+/*
+ *
+ * Copyright 2018 Asylo authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "asylo/platform/core/resident_entry_queue.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include "absl/memory/memory.h"
+#include "asylo/enclave.pb.h"
+#include "asylo/test/util/status_matchers.h"
+#include "asylo/util/status.h"
+
+namespace asylo {
+namespace {
+
+// Stands in for the resident enclave threads, answering each request with
+// |status| and |padding| bytes of unknown output fields.
+class FakeResidentThread {
+ public:
+  FakeResidentThread(SwitchlessEntryQueue *queue, const Status &status,
+                     size_t padding)
+      : queue_(queue), stop_(false) {
+    EnclaveOutput output;
+    status.SaveTo(output.mutable_status());
+    output.SerializeToString(&output_);
+    output_.append(padding, '\0');
+    queue_->AddServer();
+    thread_ = std::thread([this] { Serve(); });
+  }
+
+  ~FakeResidentThread() {
+    stop_ = true;
+    thread_.join();
+  }
+
+ private:
+  void Serve() {
+    while (!stop_) {
+      SwitchlessEnclaveEntry *entry = queue_->Take();
+      if (!entry) {
+        std::this_thread::yield();
+        continue;
+      }
+      Answer(entry);
+    }
+    queue_->RemoveServer();
+    while (SwitchlessEnclaveEntry *entry = queue_->Take()) {
+      Answer(entry);
+    }
+  }
+
+  void Answer(SwitchlessEnclaveEntry *entry) {
+    char *output = reinterpret_cast<char *>(entry->output);
+    if (output_.size() > entry->output_capacity) {
+      output = static_cast<char *>(malloc(output_.size()));
+      entry->output = reinterpret_cast<uint64_t>(output);
+      entry->output_allocated = 1;
+    }
+    memcpy(output, output_.data(), output_.size());
+    entry->output_size = output_.size();
+    entry->result = 0;
+    queue_->Complete(entry);
+  }
+
+  SwitchlessEntryQueue *queue_;
+  std::string output_;
+  std::atomic<bool> stop_;
+  std::thread thread_;
+};
+
+TEST(ResidentEntryQueueTest, ServesRequests) {
+  ResidentEntryQueue entries;
+  FakeResidentThread server(entries.queue(), Status::OkStatus(), 0);
+  std::vector<std::future<Status>> futures;
+  std::vector<EnclaveOutput> outputs(200);
+  for (EnclaveOutput &output : outputs) {
+    futures.push_back(entries.Submit(EnclaveInput(), &output));
+  }
+  for (auto &future : futures) {
+    EXPECT_THAT(future.get(), IsOk());
+  }
+}
+
+TEST(ResidentEntryQueueTest, PropagatesEnclaveStatus) {
+  ResidentEntryQueue entries;
+  FakeResidentThread server(
+      entries.queue(), Status(error::GoogleError::INTERNAL, "failed"), 0);
+  EnclaveOutput output;
+  EXPECT_THAT(entries.Submit(EnclaveInput(), &output).get(),
+              StatusIs(error::GoogleError::INTERNAL));
+  EXPECT_EQ(output.status().code(), error::GoogleError::INTERNAL);
+}
+
+TEST(ResidentEntryQueueTest, AcceptsOutputAllocatedByEnclave) {
+  ResidentEntryQueue entries;
+  FakeResidentThread server(entries.queue(), Status::OkStatus(),
+                            2 * ResidentEntryQueue::kOutputCapacity);
+  EXPECT_THAT(entries.Submit(EnclaveInput(), nullptr).get(), IsOk());
+}
+
+TEST(ResidentEntryQueueTest, AbortsUnservedRequests) {
+  std::future<Status> future;
+  {
+    ResidentEntryQueue entries;
+    // A server which never takes a request.
+    entries.queue()->AddServer();
+    future = entries.Submit(EnclaveInput(), nullptr);
+  }
+  EXPECT_THAT(future.get(), StatusIs(error::GoogleError::ABORTED));
+}
+
+TEST(ResidentEntryQueueTest, QueuesNothingWithoutServers) {
+  ResidentEntryQueue entries;
+  EXPECT_FALSE(entries.Submit(EnclaveInput(), nullptr).valid());
+
+  { FakeResidentThread server(entries.queue(), Status::OkStatus(), 0); }
+  EXPECT_EQ(entries.queue()->servers(), 0);
+  EXPECT_FALSE(entries.Submit(EnclaveInput(), nullptr).valid());
+}
+
+// Requests submitted while the last server leaves are either served or not
+// queued, but never left waiting.
+TEST(ResidentEntryQueueTest, ServesOrRejectsRequestsWhileServerLeaves) {
+  for (int i = 0; i < 100; i++) {
+    ResidentEntryQueue entries;
+    std::vector<std::future<Status>> futures;
+    auto server = absl::make_unique<FakeResidentThread>(
+        entries.queue(), Status::OkStatus(), 0);
+    std::thread submitter([&entries, &futures] {
+      for (int j = 0; j < 20; j++) {
+        futures.push_back(entries.Submit(EnclaveInput(), nullptr));
+      }
+    });
+    server.reset();
+    submitter.join();
+    for (auto &future : futures) {
+      if (future.valid()) {
+        ASSERT_EQ(future.wait_for(std::chrono::seconds(10)),
+                  std::future_status::ready);
+        EXPECT_THAT(future.get(), IsOk());
+      }
+    }
+  }
+}
+
+}  // namespace
+}  // namespace asylo
@@ -33,6 +33,7 @@
 #include "asylo/platform/arch/include/trusted/host_calls.h"
 #include "asylo/platform/arch/include/trusted/time.h"
 #include "asylo/platform/common/bridge_types.h"
+#include "asylo/platform/core/resident_entries.h"
 #include "asylo/platform/core/shared_name_kind.h"
 #include "asylo/platform/core/trusted_global_state.h"
 #include "asylo/platform/posix/io/io_manager.h"
@@ -40,6 +41,8 @@
 #include "asylo/platform/posix/io/random_devices.h"
 #include "asylo/platform/posix/signal/signal_manager.h"
 #include "asylo/platform/posix/threading/thread_manager.h"
+#include "asylo/platform/storage/secure/aead_handler.h"
+#include "asylo/platform/storage/secure/block_worker_pool.h"
 #include "asylo/util/posix_error_space.h"
 #include "asylo/util/status.h"
 
@@ -190,11 +193,23 @@ Status TrustedApplication::InitializeInternal(const EnclaveConfig &config) {
   if(!InitLogging(log_directory, GetEnclaveName().c_str(), vlog_level)) {
     fprintf(stderr, "Initialization of enclave logging failed\n");
   }
+  set_log_to_stdout(config.logging_config().log_to_stdout());
+  set_log_buffering(config.logging_config().buffer_size(),
+                    config.logging_config().flush_interval_ms());
   if (!status.ok()) {
     LOG(WARNING) << "Initialization of enclave environment variables failed: "
                  << status;
   }
   SetEnclaveConfig(config);
+  if (config.secure_storage_block_cache_pages() > 0) {
+    platform::storage::AeadHandler::GetInstance().SetBlockCacheCapacity(
+        config.secure_storage_block_cache_pages());
+  }
+  if (config.switchless_host_call_workers() > 0 &&
+      enc_init_switchless_host_calls(GetEnclaveName().c_str()) != 0) {
+    LOG(WARNING) << "Switchless host calls unavailable, host calls will exit "
+                    "the enclave";
+  }
   // This call can fail, but it should not stop the enclave from running.
   status = InitializeEnclaveAssertionAuthorities(
       config.enclave_assertion_authority_configs().begin(),
@@ -210,6 +225,39 @@ Status TrustedApplication::InitializeInternal(const EnclaveConfig &config) {
     return status;
   }
 
+  // The log flusher is a thread of its own, which can only be donated once the
+  // enclave is in state kUserInitializing.
+  if (config.logging_config().async_buffer_size() > 0 &&
+      !StartAsyncLogging(config.logging_config().async_buffer_size(),
+                         config.logging_config().flush_interval_ms())) {
+    LOG(WARNING) << "Failed to start asynchronous enclave logging";
+  }
+  if (config.logging_config().buffer_size() > 0 &&
+      !StartLogFlusher(config.logging_config().flush_interval_ms())) {
+    LOG(WARNING) << "Log flusher unavailable, buffered log messages are "
+                    "written once the buffer fills up";
+  }
+
+  // Resident threads can only be donated once the enclave is in state
+  // kUserInitializing. They serve no request before the enclave is running.
+  if (config.resident_entry_threads() > 0) {
+    status = StartResidentEntryThreads(GetEnclaveName(),
+                                       config.resident_entry_threads());
+    if (!status.ok()) {
+      LOG(WARNING) << "Resident entry threads unavailable: " << status;
+    }
+  }
+
+  if (config.thread_pool_min_threads() > 0 ||
+      config.thread_pool_max_threads() > 0) {
+    if (ThreadManager::GetInstance()->StartThreadPool(
+            config.thread_pool_min_threads(),
+            config.thread_pool_max_threads()) != 0) {
+      LOG(WARNING) << "Thread pool could not be filled, pthread_create will "
+                      "donate threads on demand";
+    }
+  }
+
   return Initialize(config);
 }
 
@@ -280,6 +328,12 @@ int __asylo_user_init(const char *name, const char *config, size_t config_len,
   // Invoke the enclave entry-point.
   status = trusted_application->InitializeInternal(enclave_config);
   if (!status.ok()) {
+    // Resident threads may have been started before the failure. They must
+    // leave the enclave so that the next initialization can start them again.
+    StopResidentEntryThreads();
+    StopAsyncLogging();
+    platform::storage::BlockWorkerPool::GetInstance()->Stop();
+    ThreadManager::GetInstance()->StopThreadPool();
     trusted_application->SetState(EnclaveState::kUninitialized);
     return status_serializer.Serialize(status);
   }
@@ -341,13 +395,46 @@ int __asylo_user_fini(const char *input, size_t input_len, char **output,
     return status_serializer.Serialize(status);
   }
 
+  // Resident threads must not run requests concurrently with Finalize.
+  StopResidentEntryThreads();
+
   // Invoke the enclave entry-point.
   status = trusted_application->Finalize(enclave_final);
   if (!status.ok()) {
     trusted_application->SetState(EnclaveState::kRunning);
+    auto config_result = GetEnclaveConfig();
+    int resident_entry_threads = 0;
+    if (config_result.ok()) {
+      resident_entry_threads =
+          config_result.ValueOrDie()->resident_entry_threads();
+    }
+    if (resident_entry_threads > 0) {
+      Status restart_status =
+          StartResidentEntryThreads(GetEnclaveName(), resident_entry_threads);
+      if (!restart_status.ok()) {
+        LOG(WARNING) << "Resident entry threads unavailable: "
+                     << restart_status;
+      }
+    }
     return status_serializer.Serialize(status);
   }
 
+  // Stop the log flusher and the secure storage block workers before releasing
+  // the pooled threads, so that they can return to the pool and leave the
+  // enclave with them.
+  StopAsyncLogging();
+  platform::storage::BlockWorkerPool::GetInstance()->Stop();
+
+  // Release the idle pooled threads so that they leave the enclave.
+  ThreadManager *thread_manager = ThreadManager::GetInstance();
+  thread_manager->StopThreadPool();
+  ThreadManager::ThreadPoolStats stats = thread_manager->GetThreadPoolStats();
+  VLOG(1) << "Thread pool ran " << stats.reused << " of "
+          << stats.reused + stats.donated << " threads without an exit";
+
+  // Write out log messages still buffered inside the enclave.
+  FlushLog();
+
   trusted_application->SetState(EnclaveState::kFinalized);
   return status_serializer.Serialize(status);
 }
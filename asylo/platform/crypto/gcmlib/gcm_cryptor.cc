@@ -24,6 +24,7 @@
 #include <openssl/evp.h>
 #include <openssl/mem.h>
 #include <openssl/rand.h>
+#include <algorithm>
 #include <cstdlib>
 #include <cstring>
 #include <ctime>
@@ -87,6 +88,13 @@ bool GenerateDerivedKey(const GcmCryptorKey &wrapping_key,
 
 }  // namespace
 
+struct GcmCryptor::AeadContext {
+  AeadContext() { EVP_AEAD_CTX_zero(&ctx); }
+  ~AeadContext() { EVP_AEAD_CTX_cleanup(&ctx); }
+
+  EVP_AEAD_CTX ctx;
+};
+
 GcmCryptor::GcmCryptor(size_t block_length, const GcmCryptorKey &gcm_key,
                        const GcmCryptorKey &cmac_key)
     : kBlockLength(block_length),
@@ -150,52 +158,191 @@ bool GcmCryptor::EncryptBlock(const uint8_t *plaintext_data, uint8_t *token,
     return false;
   }
 
-  absl::MutexLock lock(&mu_);
+  std::vector<EncryptionRun> runs;
+  if (!ReserveKeyIds(1, &runs)) {
+    return false;
+  }
+  return SealBlock(*runs[0].context, runs[0].key_id, plaintext_data, token,
+                   ciphertext_data);
+}
 
-  if (1 != RAND_bytes(next_token_.nonce, kNonceLength)) {
-    LOG(ERROR)
-        << "Failed to generate random nonce for GcmCryptor::EncryptBlock: "
-        << BsslLastErrorString();
+bool GcmCryptor::DecryptBlock(const uint8_t *ciphertext_data,
+                              const uint8_t *token, uint8_t *plaintext_data) {
+  if (ciphertext_data == nullptr || token == nullptr ||
+      plaintext_data == nullptr) {
+    LOG(ERROR) << "Invalid input to GcmCryptor::DecryptBlock.";
     return false;
   }
 
-  if (key_id_counter_ % kKeyIdCycle == 0) {
-    key_id_counter_ = 0;
+  return OpenBlock(ciphertext_data, token, plaintext_data);
+}
 
-    if (1 != RAND_bytes(next_token_.key_id, kKeyIdLength)) {
-      LOG(ERROR)
-          << "Failed to generate random token for GcmCryptor::EncryptBlock: "
-          << BsslLastErrorString();
+bool GcmCryptor::EncryptBlocks(const uint8_t *const *plaintext_data,
+                               size_t count, uint8_t *output, size_t stride) {
+  if (plaintext_data == nullptr || output == nullptr ||
+      stride < kBlockLength + kTagLength + kTokenLength) {
+    LOG(ERROR) << "Invalid input to GcmCryptor::EncryptBlocks.";
+    return false;
+  }
+  for (size_t i = 0; i < count; ++i) {
+    if (plaintext_data[i] == nullptr) {
+      LOG(ERROR) << "Invalid input to GcmCryptor::EncryptBlocks.";
       return false;
     }
+  }
+
+  std::vector<EncryptionRun> runs;
+  if (!ReserveKeyIds(count, &runs)) {
+    return false;
+  }
+
+  size_t block = 0;
+  for (const EncryptionRun &run : runs) {
+    for (size_t i = 0; i < run.count; ++i, ++block) {
+      uint8_t *ciphertext_data = output + block * stride;
+      if (!SealBlock(*run.context, run.key_id, plaintext_data[block],
+                     ciphertext_data + kBlockLength + kTagLength,
+                     ciphertext_data)) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
 
-    if (!GenerateDerivedGcmKey(next_token_.key_id, &next_derived_key_)) {
-      LOG(ERROR) << "Failed to derive key for GcmCryptor::EncryptBlock: "
-                 << BsslLastErrorString();
+bool GcmCryptor::DecryptBlocks(const uint8_t *input, size_t stride,
+                               size_t count, uint8_t *const *plaintext_data) {
+  if (input == nullptr || plaintext_data == nullptr ||
+      stride < kBlockLength + kTagLength + kTokenLength) {
+    LOG(ERROR) << "Invalid input to GcmCryptor::DecryptBlocks.";
+    return false;
+  }
+
+  for (size_t i = 0; i < count; ++i) {
+    if (plaintext_data[i] == nullptr) {
+      continue;
+    }
+    const uint8_t *ciphertext_data = input + i * stride;
+    if (!OpenBlock(ciphertext_data, ciphertext_data + kBlockLength + kTagLength,
+                   plaintext_data[i])) {
       return false;
     }
   }
+  return true;
+}
 
-  // Increment the key reuse counter only if the key was successfully generated.
-  key_id_counter_++;
+std::shared_ptr<const GcmCryptor::AeadContext> GcmCryptor::CreateContext(
+    const uint8_t *key_id) {
+  GcmCryptorKey derived_key;
+  if (!GenerateDerivedGcmKey(key_id, &derived_key)) {
+    LOG(ERROR) << "Failed to derive key for GcmCryptor: "
+               << BsslLastErrorString();
+    return nullptr;
+  }
 
-  EVP_AEAD_CTX context;
-  if (!EVP_AEAD_CTX_init(
-          &context, EVP_aead_aes_256_gcm(),
-          reinterpret_cast<const uint8_t *>(next_derived_key_.data()),
-          kKeyLength, kTagLength, nullptr)) {
+  auto context = std::make_shared<AeadContext>();
+  if (!EVP_AEAD_CTX_init(&context->ctx, EVP_aead_aes_256_gcm(),
+                         reinterpret_cast<const uint8_t *>(derived_key.data()),
+                         kKeyLength, kTagLength, nullptr)) {
     LOG(ERROR) << "EVP_AEAD_CTX_init failed: " << BsslLastErrorString();
-    EVP_AEAD_CTX_cleanup(&context);
+    return nullptr;
+  }
+  return context;
+}
+
+std::shared_ptr<const GcmCryptor::AeadContext> GcmCryptor::GetContext(
+    const uint8_t *key_id) {
+  {
+    absl::MutexLock lock(&contexts_mu_);
+    auto it = contexts_.find(
+        std::string(reinterpret_cast<const char *>(key_id), kKeyIdLength));
+    if (it != contexts_.end()) {
+      return it->second;
+    }
+  }
+
+  // Derive the key outside of the lock. If another thread races to create a
+  // context for the same key ID, the first one cached is kept.
+  std::shared_ptr<const AeadContext> context = CreateContext(key_id);
+  if (context) {
+    CacheContext(key_id, context);
+  }
+  return context;
+}
+
+void GcmCryptor::CacheContext(const uint8_t *key_id,
+                              std::shared_ptr<const AeadContext> context) {
+  std::string key(reinterpret_cast<const char *>(key_id), kKeyIdLength);
+  absl::MutexLock lock(&contexts_mu_);
+  if (!contexts_.emplace(key, std::move(context)).second) {
+    return;
+  }
+  context_order_.push_back(std::move(key));
+  if (context_order_.size() > kMaxCachedContexts) {
+    // Contexts are shared, so an evicted context stays valid for as long as a
+    // thread is still using it.
+    contexts_.erase(context_order_.front());
+    context_order_.pop_front();
+  }
+}
+
+bool GcmCryptor::ReserveKeyIds(size_t count,
+                               std::vector<EncryptionRun> *runs) {
+  absl::MutexLock lock(&mu_);
+
+  while (count > 0) {
+    if (key_id_counter_ % kKeyIdCycle == 0) {
+      key_id_counter_ = 0;
+
+      if (1 != RAND_bytes(current_key_id_, kKeyIdLength)) {
+        LOG(ERROR) << "Failed to generate random token for GcmCryptor: "
+                   << BsslLastErrorString();
+        return false;
+      }
+
+      current_context_ = CreateContext(current_key_id_);
+      if (!current_context_) {
+        return false;
+      }
+
+      // Blocks written under the new key ID are likely to be read back soon.
+      CacheContext(current_key_id_, current_context_);
+    }
+
+    // Increment the key reuse counter only if the key was successfully
+    // generated.
+    size_t run_length =
+        std::min<size_t>(count, kKeyIdCycle - key_id_counter_);
+    key_id_counter_ += run_length;
+    count -= run_length;
+
+    runs->emplace_back();
+    EncryptionRun &run = runs->back();
+    run.context = current_context_;
+    memcpy(run.key_id, current_key_id_, kKeyIdLength);
+    run.count = run_length;
+  }
+  return true;
+}
+
+bool GcmCryptor::SealBlock(const AeadContext &context, const uint8_t *key_id,
+                           const uint8_t *plaintext_data, uint8_t *token,
+                           uint8_t *ciphertext_data) const {
+  Token next_token;
+  if (1 != RAND_bytes(next_token.nonce, kNonceLength)) {
+    LOG(ERROR)
+        << "Failed to generate random nonce for GcmCryptor::EncryptBlock: "
+        << BsslLastErrorString();
     return false;
   }
+  memcpy(next_token.key_id, key_id, kKeyIdLength);
 
   size_t ciphertext_length;
   size_t max_ciphertext_length = kBlockLength + kTagLength;
-  if (!EVP_AEAD_CTX_seal(&context, ciphertext_data, &ciphertext_length,
-                         max_ciphertext_length, next_token_.nonce, kNonceLength,
+  if (!EVP_AEAD_CTX_seal(&context.ctx, ciphertext_data, &ciphertext_length,
+                         max_ciphertext_length, next_token.nonce, kNonceLength,
                          plaintext_data, kBlockLength, nullptr, 0)) {
     LOG(ERROR) << "EVP_AEAD_CTX_seal failed: " << BsslLastErrorString();
-    EVP_AEAD_CTX_cleanup(&context);
     return false;
   }
 
@@ -203,49 +350,30 @@ bool GcmCryptor::EncryptBlock(const uint8_t *plaintext_data, uint8_t *token,
     LOG(ERROR) << "EVP_AEAD_CTX_seal failed to encrypt complete plaintext, "
                << "expected ciphertext_length = " << max_ciphertext_length
                << ", encountered ciphertext_length = " << ciphertext_length;
-    EVP_AEAD_CTX_cleanup(&context);
     return false;
   }
 
-  memcpy(token, next_token_.data(), kTokenLength);
-
-  EVP_AEAD_CTX_cleanup(&context);
+  memcpy(token, next_token.data(), kTokenLength);
   return true;
 }
 
-bool GcmCryptor::DecryptBlock(const uint8_t *ciphertext_data,
-                              const uint8_t *token, uint8_t *plaintext_data) {
-  if (ciphertext_data == nullptr || token == nullptr ||
-      plaintext_data == nullptr) {
-    LOG(ERROR) << "Invalid input to GcmCryptor::DecryptBlock.";
-    return false;
-  }
-
+bool GcmCryptor::OpenBlock(const uint8_t *ciphertext_data,
+                           const uint8_t *token, uint8_t *plaintext_data) {
   const Token *tok = reinterpret_cast<const Token *>(token);
 
-  GcmCryptorKey derived_key;
-  if (!GenerateDerivedGcmKey(tok->key_id, &derived_key)) {
+  std::shared_ptr<const AeadContext> context = GetContext(tok->key_id);
+  if (!context) {
     LOG(ERROR) << "Failed to derive key for GcmCryptor::DecryptBlock: "
                << BsslLastErrorString();
     return false;
   }
 
-  EVP_AEAD_CTX context;
-  if (!EVP_AEAD_CTX_init(&context, EVP_aead_aes_256_gcm(),
-                         reinterpret_cast<const uint8_t *>(derived_key.data()),
-                         kKeyLength, kTagLength, nullptr)) {
-    LOG(ERROR) << "EVP_AEAD_CTX_init failed: " << BsslLastErrorString();
-    EVP_AEAD_CTX_cleanup(&context);
-    return false;
-  }
-
   size_t plaintext_length;
-  if (!EVP_AEAD_CTX_open(&context, plaintext_data, &plaintext_length,
+  if (!EVP_AEAD_CTX_open(&context->ctx, plaintext_data, &plaintext_length,
                          kBlockLength, tok->nonce, kNonceLength,
                          ciphertext_data, kBlockLength + kTagLength, nullptr,
                          0)) {
     LOG(ERROR) << "EVP_AEAD_CTX_open failed: " << BsslLastErrorString();
-    EVP_AEAD_CTX_cleanup(&context);
     return false;
   }
 
@@ -253,11 +381,8 @@ bool GcmCryptor::DecryptBlock(const uint8_t *ciphertext_data,
     LOG(ERROR) << "EVP_AEAD_CTX_open failed to decrypt complete ciphertext, "
                << "expected plaintext_length = " << kBlockLength
                << ", encountered plaintext_length = " << plaintext_length;
-    EVP_AEAD_CTX_cleanup(&context);
     return false;
   }
-
-  EVP_AEAD_CTX_cleanup(&context);
   return true;
 }
 
@@ -287,13 +412,13 @@ GcmCryptor *GcmCryptorRegistry::GetGcmCryptor(size_t block_length,
                                               const GcmCryptorKey &key) {
   absl::MutexLock lock(&mu_);
 
-  auto it = cryptor_registry_.find(key);
-  if (it != cryptor_registry_.end()) {
+  auto &cryptors = cryptor_registry_[block_length];
+  auto it = cryptors.find(key);
+  if (it != cryptors.end()) {
     return it->second.get();
   }
 
-  auto result =
-      cryptor_registry_.emplace(key, GcmCryptor::Create(block_length, key));
+  auto result = cryptors.emplace(key, GcmCryptor::Create(block_length, key));
   return result.first->second.get();
 }
 
@@ -20,6 +20,7 @@
 #define ASYLO_PLATFORM_CRYPTO_GCMLIB_GCM_CRYPTOR_H_
 
 #include <openssl/evp.h>
+#include <deque>
 #include <memory>
 #include <string>
 #include <unordered_map>
@@ -67,6 +68,21 @@ class GcmCryptor {
   bool DecryptBlock(const uint8_t *ciphertext_data, const uint8_t *token,
                     uint8_t *plaintext_data);
 
+  // Encrypts |count| plaintext blocks, block i being read from
+  // |plaintext_data[i]|. The ciphertext of block i, followed by its token, is
+  // written to |output| + i * |stride|, where |stride| is at least the block
+  // length plus kTagLength plus kTokenLength. Returns true on success, false
+  // otherwise.
+  bool EncryptBlocks(const uint8_t *const *plaintext_data, size_t count,
+                     uint8_t *output, size_t stride);
+
+  // Decrypts |count| blocks laid out as written by EncryptBlocks, the plaintext
+  // of block i being written to |plaintext_data[i]|. Blocks with a null
+  // plaintext pointer are skipped. Returns true on success, or false if any
+  // block fails to decrypt.
+  bool DecryptBlocks(const uint8_t *input, size_t stride, size_t count,
+                     uint8_t *const *plaintext_data);
+
   // Generates auth tag, in particular CMAC, for the specified data. Returns
   // true on success, false on failure.
   bool GetAuthTag(uint8_t out[16], const uint8_t *in, size_t in_len) const;
@@ -75,6 +91,9 @@ class GcmCryptor {
   static constexpr size_t kNonceLength = 12;
   static constexpr size_t kKeyIdCycle = 256;
 
+  // Maximum number of AEAD contexts kept for decryption.
+  static constexpr size_t kMaxCachedContexts = 64;
+
   struct Token {
     uint8_t nonce[kNonceLength];
     uint8_t key_id[kKeyIdLength];
@@ -83,18 +102,68 @@ class GcmCryptor {
     uint8_t *data() { return nonce; }
   };
 
+  // An AEAD context initialized with the GCM key derived for one key ID. A
+  // context is not modified after initialization, so it can be used by several
+  // threads at once.
+  struct AeadContext;
+
+  // A run of consecutive blocks encrypted under the same key ID.
+  struct EncryptionRun {
+    std::shared_ptr<const AeadContext> context;
+    uint8_t key_id[kKeyIdLength];
+    size_t count;
+  };
+
   GcmCryptor(size_t block_length, const GcmCryptorKey &gcm_key,
              const GcmCryptorKey &cmac_key);
   bool GenerateDerivedGcmKey(const uint8_t *key_id, GcmCryptorKey *dk);
 
+  // Derives the GCM key for |key_id| and returns a context initialized with
+  // it, or nullptr on failure.
+  std::shared_ptr<const AeadContext> CreateContext(const uint8_t *key_id);
+
+  // Returns the context for |key_id|, creating and caching it if needed.
+  std::shared_ptr<const AeadContext> GetContext(const uint8_t *key_id)
+      LOCKS_EXCLUDED(contexts_mu_);
+
+  // Adds |context| for |key_id| to the cache, evicting the oldest entry if the
+  // cache is full.
+  void CacheContext(const uint8_t *key_id,
+                    std::shared_ptr<const AeadContext> context)
+      LOCKS_EXCLUDED(contexts_mu_);
+
+  // Assigns key IDs to the next |count| blocks to encrypt, rotating the key ID
+  // every kKeyIdCycle blocks. Returns false on failure.
+  bool ReserveKeyIds(size_t count, std::vector<EncryptionRun> *runs)
+      LOCKS_EXCLUDED(mu_);
+
+  // Encrypts one block with |context| under a fresh random nonce.
+  bool SealBlock(const AeadContext &context, const uint8_t *key_id,
+                 const uint8_t *plaintext_data, uint8_t *token,
+                 uint8_t *ciphertext_data) const;
+
+  // Decrypts one block, returning false on failure.
+  bool OpenBlock(const uint8_t *ciphertext_data, const uint8_t *token,
+                 uint8_t *plaintext_data);
+
   const size_t kBlockLength;
   const GcmCryptorKey kGcmKey;
   const GcmCryptorKey kCmacKey;
-  Token next_token_ GUARDED_BY(mu_);
-  uint64_t key_id_counter_;
-  GcmCryptorKey next_derived_key_ GUARDED_BY(mu_);
+
+  // Key ID and context of the blocks currently being encrypted, and the number
+  // of blocks encrypted under them.
+  uint8_t current_key_id_[kKeyIdLength] GUARDED_BY(mu_);
+  std::shared_ptr<const AeadContext> current_context_ GUARDED_BY(mu_);
+  uint64_t key_id_counter_ GUARDED_BY(mu_);
   absl::Mutex mu_;
 
+  // Contexts for recently used key IDs, keyed on the key ID, and the order in
+  // which they were added.
+  std::unordered_map<std::string, std::shared_ptr<const AeadContext>> contexts_
+      GUARDED_BY(contexts_mu_);
+  std::deque<std::string> context_order_ GUARDED_BY(contexts_mu_);
+  absl::Mutex contexts_mu_;
+
   GcmCryptor(const GcmCryptor &) = delete;
   GcmCryptor &operator=(const GcmCryptor &) = delete;
 };
@@ -108,7 +177,8 @@ class GcmCryptorRegistry {
     return *instance;
   }
 
-  // Accessor to the instance of GCM cryptor associated with a given key.
+  // Accessor to the instance of GCM cryptor associated with a given block length
+  // and key.
   GcmCryptor *GetGcmCryptor(size_t block_length, const GcmCryptorKey &key)
       LOCKS_EXCLUDED(mu_);
 
@@ -134,8 +204,10 @@ class GcmCryptorRegistry {
   GcmCryptorRegistry() = default;
   GcmCryptorRegistry(GcmCryptorRegistry const &) = delete;
   void operator=(GcmCryptorRegistry const &) = delete;
-  std::unordered_map<GcmCryptorKey, std::unique_ptr<GcmCryptor>,
-                     SafeBytesHasher>
+  // Cryptors keyed on the block length, then on the key.
+  std::unordered_map<
+      size_t, std::unordered_map<GcmCryptorKey, std::unique_ptr<GcmCryptor>,
+                                 SafeBytesHasher>>
       cryptor_registry_ GUARDED_BY(mu_);
   absl::Mutex mu_;
 };
@@ -19,6 +19,7 @@
 // Test suite for the GcmCryptor class.
 
 #include <openssl/rand.h>
+#include <vector>
 
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
@@ -195,6 +196,73 @@ TEST(GcmCryptorTest, DecryptWithAlteredCiphertextFails) {
       decryptor->DecryptBlock(encryptor_buffer, token, decryptor_buffer));
 }
 
+// Tests encryption and decryption of runs of blocks spanning several key IDs.
+TEST(GcmCryptorTest, DecryptBlocksAfterEncryptBlocksReturnsOriginalTexts) {
+  constexpr size_t kNumBlocks = kKeyIdCycle + 10;
+  constexpr size_t kStride = kBlockLength + kTagLength + kTokenLength;
+  std::vector<uint8_t> plaintext(kNumBlocks * kBlockLength);
+  std::vector<uint8_t> secure_blocks(kNumBlocks * kStride);
+  std::vector<uint8_t> decrypted(kNumBlocks * kBlockLength, 0);
+  GcmCryptorKey key;
+  ASSERT_EQ(RAND_bytes(key.data(), key.size()), 1);
+  ASSERT_EQ(RAND_bytes(plaintext.data(), plaintext.size()), 1);
+  auto encryptor = GcmCryptor::Create(kBlockLength, key);
+  auto decryptor = GcmCryptor::Create(kBlockLength, key);
+
+  // Start in the middle of a key ID cycle so that the run crosses a rotation.
+  uint8_t token[kTokenLength];
+  uint8_t ciphertext[kBlockLength + kTagLength];
+  for (size_t i = 0; i < 5; ++i) {
+    ASSERT_TRUE(encryptor->EncryptBlock(plaintext.data(), token, ciphertext));
+  }
+
+  std::vector<const uint8_t *> sources;
+  std::vector<uint8_t *> targets;
+  for (size_t i = 0; i < kNumBlocks; ++i) {
+    sources.push_back(&plaintext[i * kBlockLength]);
+    // Leave every tenth block undecrypted.
+    targets.push_back(i % 10 == 0 ? nullptr : &decrypted[i * kBlockLength]);
+  }
+  ASSERT_TRUE(encryptor->EncryptBlocks(sources.data(), kNumBlocks,
+                                       secure_blocks.data(), kStride));
+  ASSERT_TRUE(decryptor->DecryptBlocks(secure_blocks.data(), kStride,
+                                       kNumBlocks, targets.data()));
+
+  const uint8_t *first_token = &secure_blocks[kBlockLength + kTagLength];
+  const uint8_t *last_token = first_token + (kNumBlocks - 1) * kStride;
+  EXPECT_EQ(memcmp(token + kNonceLength, first_token + kNonceLength,
+                   kKeyIdLength),
+            0);
+  EXPECT_NE(memcmp(first_token + kNonceLength, last_token + kNonceLength,
+                   kKeyIdLength),
+            0);
+
+  std::vector<uint8_t> block(kBlockLength);
+  for (size_t i = 0; i < kNumBlocks; ++i) {
+    const uint8_t *secure_block = &secure_blocks[i * kStride];
+    if (i % 10 == 0) {
+      EXPECT_NE(memcmp(&plaintext[i * kBlockLength],
+                       &decrypted[i * kBlockLength], kBlockLength),
+                0);
+    } else {
+      EXPECT_EQ(memcmp(&plaintext[i * kBlockLength],
+                       &decrypted[i * kBlockLength], kBlockLength),
+                0);
+    }
+
+    // Blocks of a run decrypt individually as well.
+    ASSERT_TRUE(decryptor->DecryptBlock(
+        secure_block, secure_block + kBlockLength + kTagLength, block.data()));
+    EXPECT_EQ(memcmp(&plaintext[i * kBlockLength], block.data(), kBlockLength),
+              0);
+  }
+
+  // A corrupted block fails the whole run.
+  secure_blocks[3 * kStride] ^= 1;
+  EXPECT_FALSE(decryptor->DecryptBlocks(secure_blocks.data(), kStride,
+                                        kNumBlocks, targets.data()));
+}
+
 // Tests GCM cryptor registry returns consistent instance of GCM cryptor.
 TEST(GcmCryptorTest, GetGcmCryptorIsConsistent) {
   GcmCryptorKey key;
@@ -209,5 +277,20 @@ TEST(GcmCryptorTest, GetGcmCryptorIsConsistent) {
   EXPECT_EQ(c1, c2);
 }
 
+// Tests GCM cryptor registry keeps separate cryptors per block length.
+TEST(GcmCryptorTest, GetGcmCryptorDistinguishesBlockLength) {
+  GcmCryptorKey key;
+  ASSERT_EQ(RAND_bytes(key.data(), key.size()), 1);
+  GcmCryptor* c1 =
+      GcmCryptorRegistry::GetInstance().GetGcmCryptor(kBlockLength, key);
+  GcmCryptor* c2 =
+      GcmCryptorRegistry::GetInstance().GetGcmCryptor(kBlockLength * 2, key);
+
+  EXPECT_NE(c1, nullptr);
+  EXPECT_NE(c2, nullptr);
+
+  EXPECT_NE(c1, c2);
+}
+
 }  // namespace
 }  // namespace asylo
@@ -0,0 +1,60 @@
+/*
+ *
+ * Copyright 2018 Asylo authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef ASYLO_PLATFORM_POSIX_INCLUDE_SEMAPHORE_H_
+#define ASYLO_PLATFORM_POSIX_INCLUDE_SEMAPHORE_H_
+
+#include <pthread.h>
+#include <time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// The maximum value of a semaphore.
+#define SEM_VALUE_MAX 0x7fffffff
+
+// An unnamed counting semaphore. Threads blocked on the semaphore wait in the
+// same kind of queue as the waiters of a pthread_mutex_t.
+typedef struct {
+  pthread_spinlock_t _lock;
+  unsigned int _value;
+  __pthread_list_t _queue;
+} sem_t;
+
+// Initializes |sem| with |value|. Semaphores shared between processes are not
+// supported, so |pshared| must be zero.
+int sem_init(sem_t *sem, int pshared, unsigned int value);
+
+int sem_destroy(sem_t *sem);
+
+int sem_wait(sem_t *sem);
+
+int sem_trywait(sem_t *sem);
+
+int sem_timedwait(sem_t *sem, const struct timespec *abstime);
+
+int sem_post(sem_t *sem);
+
+int sem_getvalue(sem_t *sem, int *value);
+
+#ifdef __cplusplus
+}  // extern "C"
+#endif
+
+#endif  // ASYLO_PLATFORM_POSIX_INCLUDE_SEMAPHORE_H_
@@ -31,6 +31,26 @@
 // IOCTL to set a key on a secure file.
 #define ENCLAVE_STORAGE_SET_KEY (ENCLAVE_STORAGE_IOCTL_TYPE | 0x00000001)
 
+// IOCTL to set the digest write-back policy of a secure file.
+#define ENCLAVE_STORAGE_SET_DIGEST_WRITE_BACK \
+  (ENCLAVE_STORAGE_IOCTL_TYPE | 0x00000002)
+
+// IOCTL to set the block length of a newly created secure file. Must be issued
+// before ENCLAVE_STORAGE_SET_KEY. The argument points to a uint32_t holding a
+// power of two between 128 and 65536.
+#define ENCLAVE_STORAGE_SET_BLOCK_LENGTH \
+  (ENCLAVE_STORAGE_IOCTL_TYPE | 0x00000003)
+
+// IOCTL to set how many enclave threads encrypt and decrypt the blocks of a
+// single read or write on a secure file.
+#define ENCLAVE_STORAGE_SET_PARALLELISM \
+  (ENCLAVE_STORAGE_IOCTL_TYPE | 0x00000004)
+
+// IOCTL to read the usage statistics of the cache of verified plaintext blocks
+// shared by all secure files. The argument points to a block_cache_stats.
+#define ENCLAVE_STORAGE_GET_BLOCK_CACHE_STATS \
+  (ENCLAVE_STORAGE_IOCTL_TYPE | 0x00000005)
+
 #define TIOCGWINSZ 0x5413
 
 struct winsize {
@@ -45,6 +65,41 @@ struct key_info {
   uint8_t *data;
 } __attribute__((packed));
 
+// Digest write-back policy of a secure file. If both fields are zero, the file
+// digest is persisted after every write. Otherwise the digest is persisted on
+// fsync and close, and once the data written since it was last persisted
+// reaches |max_dirty_bytes| or is older than |max_dirty_interval_ms|. Either
+// field may be zero to disable that threshold.
+//
+// Until the digest is persisted, it does not match the blocks already written
+// to the host file. If the enclave stops in that window, the whole file fails
+// integrity verification when it is next opened and is lost, including the
+// contents persisted before. Call fsync to bound that window.
+struct digest_write_back_info {
+  uint64_t max_dirty_bytes;
+  uint64_t max_dirty_interval_ms;
+} __attribute__((packed));
+
+// Block processing parallelism of a secure file. Reads and writes covering at
+// least |min_bytes| of file blocks are encrypted and decrypted by up to
+// |max_threads| threads, including the calling thread. If |max_threads| is at
+// most one, all blocks are processed by the calling thread.
+struct parallelism_info {
+  uint32_t max_threads;
+  uint64_t min_bytes;
+} __attribute__((packed));
+
+// Usage statistics of the secure file block cache. Lookups are counted as
+// |hits| or |misses|, and blocks dropped to make room for others as
+// |evictions|. |cached_bytes| is the plaintext held, out of |capacity_bytes|.
+struct block_cache_stats {
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t evictions;
+  uint64_t cached_bytes;
+  uint64_t capacity_bytes;
+} __attribute__((packed));
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -36,11 +36,17 @@ extern "C" {
 
 #define MAP_FAILED ((void *)-1)
 
+#define MS_ASYNC 0x0001
+#define MS_INVALIDATE 0x0002
+#define MS_SYNC 0x0004
+
 void *mmap(void *addr, size_t length, int prot, int flags, int fd,
            off_t offset);
 
 int munmap(void *addr, size_t length);
 
+int msync(void *addr, size_t length, int flags);
+
 #ifdef __cplusplus
 }  // extern "C"
 #endif
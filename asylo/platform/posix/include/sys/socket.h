@@ -121,6 +121,7 @@ int socket(int domain, int type, int protocol);
 #define SO_LINGER 13
 #define SO_BSDCOMPAT 14
 #define SO_REUSEPORT 15
+#define SO_PASSCRED 16
 #define SO_RCVTIMEO 20
 #define SO_SNDTIMEO 21
 #define SO_SNDBUFFORCE 32
@@ -29,87 +29,188 @@
 #include "asylo/platform/arch/include/trusted/host_calls.h"
 #include "asylo/platform/posix/io/native_paths.h"
 #include "asylo/platform/posix/io/util.h"
+#include "asylo/platform/storage/secure/memory_mapper.h"
 #include "asylo/util/posix_error_space.h"
 #include "asylo/util/statusor.h"
 
 namespace asylo {
 namespace io {
 
+constexpr uint32_t IOManager::FileDescriptorTable::kReserved;
+constexpr uint32_t IOManager::FileDescriptorTable::kPublished;
+constexpr uint32_t IOManager::FileDescriptorTable::kReferenceMask;
+
+IOManager::FileDescriptorTable::Reference &
+IOManager::FileDescriptorTable::Reference::operator=(Reference &&other) {
+  if (this != &other) {
+    if (slot_) {
+      FileDescriptorTable::Release(slot_);
+    }
+    slot_ = other.slot_;
+    other.slot_ = nullptr;
+  }
+  return *this;
+}
+
+IOManager::FileDescriptorTable::Reference::~Reference() {
+  if (slot_) {
+    FileDescriptorTable::Release(slot_);
+  }
+}
+
+IOManager::IOContext *IOManager::FileDescriptorTable::Reference::get() const {
+  return slot_ ? slot_->context.get() : nullptr;
+}
+
+thread_local int *IOManager::FileDescriptorTable::ContextCloser::close_result =
+    nullptr;
+
+void IOManager::FileDescriptorTable::ContextCloser::operator()(
+    IOContext *context) const {
+  int result = context->Close();
+  if (close_result) {
+    *close_result = result;
+  }
+  delete context;
+}
+
 IOManager::FileDescriptorTable::FileDescriptorTable()
     : maximum_fd_soft_limit(kMaxOpenFiles),
       maximum_fd_hard_limit(kMaxOpenFiles) {}
 
-IOManager::IOContext *IOManager::FileDescriptorTable::Get(int fd) {
-  if (!IsFileDescriptorValid(fd)) return nullptr;
-  absl::MutexLock lock(&fd_table_lock_);
-  return fd_table_[fd].get();
+IOManager::FileDescriptorTable::Reference
+IOManager::FileDescriptorTable::Acquire(Slot *slot) {
+  uint32_t state = slot->state.load(std::memory_order_relaxed);
+  do {
+    if (!(state & kPublished)) {
+      return Reference();
+    }
+  } while (!slot->state.compare_exchange_weak(state, state + 1,
+                                              std::memory_order_acquire,
+                                              std::memory_order_relaxed));
+  return Reference(slot);
 }
 
-bool IOManager::FileDescriptorTable::HasSharedIOContext(int fd) {
-  if (!IsFileDescriptorValid(fd)) return false;
-  absl::MutexLock lock(&fd_table_lock_);
-  return !fd_table_[fd].unique();
+std::shared_ptr<IOManager::IOContext> IOManager::FileDescriptorTable::Release(
+    Slot *slot) {
+  uint32_t state = slot->state.fetch_sub(1, std::memory_order_acq_rel) - 1;
+  if ((state & kReferenceMask) != 0) {
+    return nullptr;
+  }
+  // The file descriptor was closed and this was the last reference, so the
+  // slot can be emptied and freed.
+  std::shared_ptr<IOContext> context = std::move(slot->context);
+  slot->state.store(0, std::memory_order_release);
+  return context;
+}
+
+bool IOManager::FileDescriptorTable::ReserveSlot(int fd) {
+  uint32_t free_state = 0;
+  return slots_[fd].state.compare_exchange_strong(free_state, kReserved,
+                                                  std::memory_order_acquire,
+                                                  std::memory_order_relaxed);
+}
+
+int IOManager::FileDescriptorTable::ReserveNextFreeFileDescriptor(
+    int startfd) {
+  if (startfd < 0) {
+    return -1;
+  }
+  const int limit = maximum_fd_soft_limit.load(std::memory_order_relaxed);
+  for (int fd = startfd; fd < limit; ++fd) {
+    if (ReserveSlot(fd)) {
+      return fd;
+    }
+  }
+  return -1;
 }
 
-void IOManager::FileDescriptorTable::Delete(int fd) {
-  if (!IsFileDescriptorValid(fd)) return;
-  absl::MutexLock lock(&fd_table_lock_);
-  fd_table_[fd] = nullptr;
+void IOManager::FileDescriptorTable::Publish(
+    int fd, std::shared_ptr<IOContext> context) {
+  Slot *slot = &slots_[fd];
+  slot->context = std::move(context);
+  slot->state.store(kReserved | kPublished | 1, std::memory_order_release);
+}
+
+IOManager::FileDescriptorTable::Reference IOManager::FileDescriptorTable::Get(
+    int fd) {
+  if (!IsFileDescriptorValid(fd)) return Reference();
+  return Acquire(&slots_[fd]);
+}
+
+bool IOManager::FileDescriptorTable::Delete(int fd, int *close_result) {
+  *close_result = 0;
+  if (!IsFileDescriptorValid(fd)) return false;
+  Slot *slot = &slots_[fd];
+  // Unpublishes the slot and drops the reference held by the table in one
+  // step, so that only one caller can delete it.
+  uint32_t state = slot->state.load(std::memory_order_relaxed);
+  do {
+    if (!(state & kPublished)) {
+      return false;
+    }
+  } while (!slot->state.compare_exchange_weak(
+      state, state & ~kPublished, std::memory_order_acq_rel,
+      std::memory_order_relaxed));
+  std::shared_ptr<IOContext> context = Release(slot);
+  // Slots sharing the IOContext may be deleted concurrently, so only dropping
+  // the copy taken from the slot tells whether this was the last owner. If it
+  // was, the IOContext is closed on this thread and the result reported here.
+  int *const outer_close_result = ContextCloser::close_result;
+  ContextCloser::close_result = close_result;
+  context.reset();
+  ContextCloser::close_result = outer_close_result;
+  return true;
 }
 
 bool IOManager::FileDescriptorTable::IsFileDescriptorUnused(int fd) {
   if (!IsFileDescriptorValid(fd)) return false;
-  absl::MutexLock lock(&fd_table_lock_);
-  return !fd_table_[fd];
+  return slots_[fd].state.load(std::memory_order_acquire) == 0;
 }
 
 int IOManager::FileDescriptorTable::Insert(IOContext *context) {
-  absl::MutexLock lock(&fd_table_lock_);
-  int fd = GetNextFreeFileDescriptor(0);
+  int fd = ReserveNextFreeFileDescriptor(0);
   if (fd < 0) {
     return -1;
   }
-  fd_table_[fd] = std::shared_ptr<IOContext>(context);
-  fd_to_lock_[fd];
+  Publish(fd, std::shared_ptr<IOContext>(context, ContextCloser()));
   return fd;
 }
 
 int IOManager::FileDescriptorTable::CopyFileDescriptor(int oldfd, int startfd) {
-  absl::MutexLock lock(&fd_table_lock_);
-  int newfd = GetNextFreeFileDescriptor(startfd);
-  if (!IsFileDescriptorValid(oldfd) || newfd == -1) {
+  Reference reference = Get(oldfd);
+  if (!reference) {
     return -1;
   }
-  fd_table_[newfd] = fd_table_[oldfd];
-  // Insert a new Mutex lock corresponding to |newfd|.
-  fd_to_lock_[newfd];
+  int newfd = ReserveNextFreeFileDescriptor(startfd);
+  if (newfd < 0) {
+    return -1;
+  }
+  Publish(newfd, reference.slot_->context);
   return newfd;
 }
 
 int IOManager::FileDescriptorTable::CopyFileDescriptorToSpecifiedTarget(
     int oldfd, int newfd) {
-  absl::MutexLock lock(&fd_table_lock_);
-  if (!IsFileDescriptorValid(oldfd) || !IsFileDescriptorValid(newfd) ||
-      fd_table_[newfd]) {
+  if (!IsFileDescriptorValid(newfd)) {
     return -1;
   }
-  fd_table_[newfd] = fd_table_[oldfd];
-  // Insert a new Mutex lock corresponding to |newfd|.
-  fd_to_lock_[newfd];
+  Reference reference = Get(oldfd);
+  if (!reference || !ReserveSlot(newfd)) {
+    return -1;
+  }
+  Publish(newfd, reference.slot_->context);
   return newfd;
 }
 
 absl::Mutex *IOManager::FileDescriptorTable::GetLock(int fd) {
   if (!IsFileDescriptorValid(fd)) return nullptr;
-  absl::MutexLock lock(&fd_table_lock_);
-  auto it = fd_to_lock_.find(fd);
-  if (it == fd_to_lock_.end()) return nullptr;
-  return &(it->second);
+  return &slots_[fd].lock;
 }
 
 bool IOManager::FileDescriptorTable::SetFileDescriptorLimits(
     const struct rlimit *rlim) {
-  absl::MutexLock lock(&fd_table_lock_);
+  absl::MutexLock lock(&limits_lock_);
   // The new limit should not exceed the absolute max file limit, and
   // unprivileged process should not be allowed to increase the hard limit.
   if (rlim->rlim_cur > rlim->rlim_max || rlim->rlim_max > kMaxOpenFiles ||
@@ -136,27 +237,13 @@ bool IOManager::FileDescriptorTable::IsFileDescriptorValid(int fd) {
 
 int IOManager::FileDescriptorTable::GetHighestFileDescriptorUsed() {
   for (int i = kMaxOpenFiles - 1; i >= 0; --i) {
-    if (fd_table_[i]) {
+    if (slots_[i].state.load(std::memory_order_acquire) & kPublished) {
       return i;
     }
   }
   return -1;
 }
 
-int IOManager::FileDescriptorTable::GetNextFreeFileDescriptor(int startfd) {
-  if (startfd < 0) {
-    return -1;
-  }
-  int fd = -1;
-  for (int i = startfd; i < maximum_fd_soft_limit; ++i) {
-    if (!fd_table_[i]) {
-      fd = i;
-      break;
-    }
-  }
-  return fd;
-}
-
 int IOManager::Access(const char *path, int mode) {
   return CallWithHandler(
       path, [mode](VirtualPathHandler *handler, const char *canonical_path) {
@@ -168,15 +255,10 @@ int IOManager::Close(int fd) {
   absl::Mutex *fd_lock = fd_table_.GetLock(fd);
   if (fd_lock) {
     absl::MutexLock lock(fd_lock);
-    IOContext *context = fd_table_.Get(fd);
-    if (context) {
-      int ret = 0;
-      // Only close the host file descriptor if this is the last reference to
-      // it.
-      if (!fd_table_.HasSharedIOContext(fd)) {
-        ret = context->Close();
-      }
-      fd_table_.Delete(fd);
+    // The stream itself is only closed once no other file descriptor refers to
+    // it and no operation on it is in progress.
+    int ret;
+    if (fd_table_.Delete(fd, &ret)) {
       return ret;
     }
   }
@@ -256,7 +338,7 @@ int IOManager::Dup(int oldfd) {
   absl::Mutex *fd_lock = fd_table_.GetLock(oldfd);
   if (fd_lock) {
     absl::MutexLock lock(fd_lock);
-    if (!fd_table_.IsFileDescriptorUnused(oldfd)) {
+    if (fd_table_.Get(oldfd)) {
       int ret = fd_table_.CopyFileDescriptor(oldfd, 0);
       if (ret < 0) {
         errno = EINVAL;
@@ -272,16 +354,20 @@ int IOManager::Dup2(int oldfd, int newfd) {
   absl::Mutex *fd_lock = fd_table_.GetLock(oldfd);
   if (fd_lock) {
     absl::MutexLock lock(fd_lock);
-    if (!fd_table_.IsFileDescriptorUnused(oldfd)) {
+    if (fd_table_.Get(oldfd)) {
       if (oldfd == newfd) {
         return newfd;
       }
-      if (!fd_table_.IsFileDescriptorUnused(newfd) && Close(newfd) == -1) {
+      // Close fails with EBADF if |newfd| is reserved but not open.
+      if (!fd_table_.IsFileDescriptorUnused(newfd) && Close(newfd) == -1 &&
+          errno != EBADF) {
         return -1;
       }
       int ret = fd_table_.CopyFileDescriptorToSpecifiedTarget(oldfd, newfd);
       if (ret < 0) {
-        errno = EINVAL;
+        // A valid |newfd| is still reserved, either by an open or dup in
+        // progress, or by operations that were in progress when it was closed.
+        errno = fd_table_.GetLock(newfd) ? EBUSY : EBADF;
       }
       return ret;
     }
@@ -304,21 +390,103 @@ int IOManager::Pipe(int pipefd[2]) {
 }
 
 int IOManager::Poll(struct pollfd *fds, nfds_t nfds, int timeout) {
+  // Translates every enclave file descriptor to its host file descriptor in
+  // one pass. Descriptors the host cannot poll are answered here: unknown ones
+  // are invalid, and ones without a host file descriptor, such as secure files,
+  // are always ready like regular files.
   std::vector<int> enclave_fd(nfds);
+  std::vector<int16_t> enclave_revents(nfds, 0);
+  // The references keep each host file descriptor open until the host poll
+  // returns, even if its enclave file descriptor is closed meanwhile.
+  std::vector<FileDescriptorTable::Reference> contexts(nfds);
+  int enclave_ready = 0;
   for (int i = 0; i < nfds; ++i) {
     enclave_fd[i] = fds[i].fd;
-    IOContext *context = fd_table_.Get(enclave_fd[i]);
+    if (fds[i].fd < 0) {
+      continue;
+    }
+    FileDescriptorTable::Reference &context = contexts[i];
+    context = fd_table_.Get(enclave_fd[i]);
     if (context) {
       fds[i].fd = context->GetHostFileDescriptor();
+      if (fds[i].fd == -1) {
+        enclave_revents[i] =
+            fds[i].events & (POLLIN | POLLRDNORM | POLLOUT | POLLWRNORM);
+      }
     } else {
       fds[i].fd = -1;
+      enclave_revents[i] = POLLNVAL;
+    }
+    if (enclave_revents[i]) {
+      ++enclave_ready;
     }
   }
-  int ret = enc_untrusted_poll(fds, nfds, timeout);
+  int ret = enc_untrusted_poll(fds, nfds, enclave_ready > 0 ? 0 : timeout);
   for (int i = 0; i < nfds; ++i) {
     fds[i].fd = enclave_fd[i];
+    if (enclave_revents[i]) {
+      fds[i].revents = enclave_revents[i];
+    }
   }
-  return ret;
+  return ret == -1 ? ret : ret + enclave_ready;
+}
+
+int IOManager::EpollCreate(int flags) {
+  if (flags & ~EPOLL_CLOEXEC) {
+    errno = EINVAL;
+    return -1;
+  }
+  int host_fd = enc_untrusted_epoll_create1(flags);
+  if (host_fd == -1) {
+    return -1;
+  }
+  auto context = ::absl::make_unique<IOContextEpoll>(host_fd);
+  int fd = fd_table_.Insert(context.get());
+  if (fd < 0) {
+    enc_untrusted_close(host_fd);
+    errno = EMFILE;
+    return -1;
+  }
+  context.release();
+  return fd;
+}
+
+int IOManager::EpollCtl(int epfd, int op, int fd, struct epoll_event *event) {
+  if (epfd == fd) {
+    errno = EINVAL;
+    return -1;
+  }
+  FileDescriptorTable::Reference context = fd_table_.Get(fd);
+  if (!context) {
+    errno = EBADF;
+    return -1;
+  }
+  // Watching secure files and virtual devices would need events raised inside
+  // the enclave, which is not supported.
+  int host_fd = context->GetHostFileDescriptor();
+  if (host_fd == -1) {
+    errno = EPERM;
+    return -1;
+  }
+  return LockAndRoll(epfd, [op, fd, host_fd, event](IOContext *context) {
+    return context->EpollCtl(op, fd, host_fd, event);
+  });
+}
+
+int IOManager::EpollWait(int epfd, struct epoll_event *events, int maxevents,
+                         int timeout) {
+  if (!events || maxevents <= 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  // Like Poll, the wait does not take the lock of |epfd|, so that other threads
+  // can change the interest set while it blocks.
+  FileDescriptorTable::Reference context = fd_table_.Get(epfd);
+  if (!context) {
+    errno = EBADF;
+    return -1;
+  }
+  return context->EpollWait(events, maxevents, timeout);
 }
 
 template <typename IOAction>
@@ -326,9 +494,9 @@ int IOManager::LockAndRoll(int fd, IOAction action) {
   absl::Mutex *fd_lock = fd_table_.GetLock(fd);
   if (fd_lock) {
     absl::MutexLock lock(fd_lock);
-    IOContext *context = fd_table_.Get(fd);
+    FileDescriptorTable::Reference context = fd_table_.Get(fd);
     if (context) {
-      return action(context);
+      return action(context.get());
     }
   }
   errno = EBADF;
@@ -541,7 +709,7 @@ int IOManager::FCntl(int fd, int cmd, int64_t arg) {
     absl::Mutex *fd_lock = fd_table_.GetLock(fd);
     if (fd_lock) {
       absl::MutexLock lock(fd_lock);
-      if (!fd_table_.IsFileDescriptorUnused(fd)) {
+      if (fd_table_.Get(fd)) {
         int ret = fd_table_.CopyFileDescriptor(fd, arg);
         if (ret < 0) {
           errno = EINVAL;
@@ -595,6 +763,30 @@ ssize_t IOManager::Readv(int fd, const struct iovec *iov, int iovcnt) {
   });
 }
 
+void *IOManager::Mmap(int fd, size_t length, int prot, int flags,
+                      off_t offset) {
+  absl::Mutex *fd_lock = fd_table_.GetLock(fd);
+  if (fd_lock) {
+    absl::MutexLock lock(fd_lock);
+    FileDescriptorTable::Reference context = fd_table_.Get(fd);
+    if (context) {
+      return context->Mmap(length, prot, flags, offset);
+    }
+  }
+  errno = EBADF;
+  return MAP_FAILED;
+}
+
+// All mappings of files are held by the MemoryMapper.
+int IOManager::Munmap(void *addr, size_t length) {
+  return platform::storage::MemoryMapper::GetInstance().Unmap(addr, length);
+}
+
+int IOManager::Msync(void *addr, size_t length, int flags) {
+  return platform::storage::MemoryMapper::GetInstance().Sync(addr, length,
+                                                             flags);
+}
+
 mode_t IOManager::Umask(mode_t mask) { return enc_untrusted_umask(mask); }
 
 int IOManager::GetRLimit(int resource, struct rlimit *rlim) {
@@ -20,20 +20,23 @@
 #define ASYLO_PLATFORM_POSIX_IO_IO_MANAGER_H_
 
 #include <errno.h>
+#include <sys/epoll.h>
 #include <sys/resource.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 
 #include <poll.h>
 #include <stdint.h>
+#include <array>
+#include <atomic>
 #include <cstdlib>
 #include <functional>
 #include <map>
 #include <memory>
 #include <queue>
 #include <type_traits>
-#include <unordered_map>
 
 #include "absl/memory/memory.h"
 #include "absl/strings/string_view.h"
@@ -67,7 +70,8 @@ class IOManager {
     // Implements IOManager::Write.
     virtual ssize_t Write(const void *buf, size_t count) = 0;
 
-    // Implements IOManager::Close.
+    // Implements IOManager::Close. Called once, when the last file descriptor
+    // referring to the stream is closed and no operation on it is in progress.
     virtual int Close() = 0;
 
     // Implements IOManager::LSeek.
@@ -117,6 +121,12 @@ class IOManager {
       return -1;
     }
 
+    // Implements IOManager::Mmap.
+    virtual void *Mmap(size_t length, int prot, int flags, off_t offset) {
+      errno = ENODEV;
+      return MAP_FAILED;
+    }
+
     // Implements setsockopt.
     virtual int SetSockOpt(int level, int option_name, const void *option_value,
                            socklen_t option_len) {
@@ -191,6 +201,21 @@ class IOManager {
       return -1;
     }
 
+    // Implements IOManager::EpollCtl, where |host_fd| is the host file
+    // descriptor of |fd|.
+    virtual int EpollCtl(int op, int fd, int host_fd,
+                         struct epoll_event *event) {
+      errno = EINVAL;
+      return -1;
+    }
+
+    // Implements IOManager::EpollWait.
+    virtual int EpollWait(struct epoll_event *events, int maxevents,
+                          int timeout) {
+      errno = EINVAL;
+      return -1;
+    }
+
     virtual int GetHostFileDescriptor() { return -1; }
 
    private:
@@ -257,25 +282,63 @@ class IOManager {
   };
 
   // A table of virtual file descriptors managed by the IOManager.
+  //
+  // Each file descriptor has a slot of its own, which holds its IOContext, its
+  // lock and a reference count. Slots are claimed and published atomically, so
+  // operations on different file descriptors never contend. An IOContext is
+  // closed and destroyed only once no file descriptor refers to it and the last
+  // reference to it is released, so operations in progress never use a closed
+  // stream.
   class FileDescriptorTable {
+   private:
+    struct Slot;
+
    public:
-    FileDescriptorTable();
+    // A counted reference to the IOContext of a file descriptor, which keeps
+    // the IOContext alive while it is used even if the file descriptor is
+    // closed concurrently.
+    class Reference {
+     public:
+      Reference() : slot_(nullptr) {}
+      Reference(Reference &&other) : slot_(other.slot_) {
+        other.slot_ = nullptr;
+      }
+      Reference &operator=(Reference &&other);
+      ~Reference();
+
+      Reference(const Reference &other) = delete;
+      Reference &operator=(const Reference &other) = delete;
 
-    // Returns the IOContext associated with a file descriptor, or nullptr if
-    // no such context exists.
-    IOContext *Get(int fd) LOCKS_EXCLUDED(fd_table_lock_);
+      IOContext *get() const;
+      IOContext *operator->() const { return get(); }
+      explicit operator bool() const { return slot_ != nullptr; }
 
-    // Returns whether the IOContext for |fd| is shared by more than one
-    // fd_table_ entry. Returns false if |fd| is not  valid.
-    bool HasSharedIOContext(int fd) LOCKS_EXCLUDED(fd_table_lock_);
+     private:
+      friend class FileDescriptorTable;
+
+      explicit Reference(Slot *slot) : slot_(slot) {}
+
+      Slot *slot_;
+    };
+
+    FileDescriptorTable();
 
-    // Removes an entry from the table, destroying the associated IOContext if
-    // this is the last reference to the IOContext, and returns the file
-    // descriptor to the free list.
-    void Delete(int fd) LOCKS_EXCLUDED(fd_table_lock_);
+    // Returns a reference to the IOContext associated with a file descriptor,
+    // which is empty if no such context exists.
+    Reference Get(int fd);
 
-    // Returns true if a specified file descriptor is available.
-    bool IsFileDescriptorUnused(int fd) LOCKS_EXCLUDED(fd_table_lock_);
+    // Removes an entry from the table, returning false if |fd| is not open.
+    // The file descriptor returns to the free list once no references to it
+    // remain. The associated IOContext is closed and destroyed once no file
+    // descriptor or reference uses it. If that happens here, |*close_result| is
+    // set to the value returned by IOContext::Close, and to 0 otherwise.
+    bool Delete(int fd, int *close_result);
+
+    // Returns true if a specified file descriptor is available, that is, it is
+    // neither open nor reserved. A slot stays reserved while a file descriptor
+    // is being opened, and after it is closed until the last reference to it is
+    // released.
+    bool IsFileDescriptorUnused(int fd);
 
     // Inserts an I/O context into the table, assigning it the next available
     // file descriptor value and taking ownership of the pointer. Returns the
@@ -283,61 +346,99 @@ class IOManager {
     //
     // If the file descriptor table is full and the context can not be inserted,
     // returns -1 and does not take ownership of the passed context.
-    int Insert(IOContext *context) LOCKS_EXCLUDED(fd_table_lock_);
+    int Insert(IOContext *context);
 
     // Creates a copy of |oldfd| using the next available file descriptor value
     // greater than or equal to |startfd|.
     // The two file descriptors will reference the same I/O context. Returns the
     // new file descriptor on success, returns -1 if |oldfd| is not valid or no
     // file descriptor is available.
-    int CopyFileDescriptor(int oldfd, int startfd)
-        LOCKS_EXCLUDED(fd_table_lock_);
+    int CopyFileDescriptor(int oldfd, int startfd);
 
     // Creates a copy of |oldfd| using |newfd| for the new descriptor. The two
     // file descriptors will reference the same I/O context. Returns |newfd| on
     // success, returns -1 if either |oldfd| or |newfd| is not valid, or |newfd|
     // is already used.
-    int CopyFileDescriptorToSpecifiedTarget(int oldfd, int newfd)
-        LOCKS_EXCLUDED(fd_table_lock_);
+    int CopyFileDescriptorToSpecifiedTarget(int oldfd, int newfd);
 
+    // Returns the lock which needs to be held while manipulating the file, or
+    // nullptr if |fd| is out of range.
     absl::Mutex *GetLock(int fd);
 
     bool SetFileDescriptorLimits(const struct rlimit *rlim)
-        LOCKS_EXCLUDED(fd_table_lock_);
+        LOCKS_EXCLUDED(limits_lock_);
 
     int get_maximum_fd_soft_limit();
 
     int get_maximum_fd_hard_limit();
 
    private:
+    // Bits of Slot::state. A slot is free when its state is zero. A reserved
+    // slot is being filled, emptied, or has references left after its file
+    // descriptor was closed. The low bits count the references to a published
+    // slot, including the one held by the table itself.
+    static constexpr uint32_t kReserved = 1u << 31;
+    static constexpr uint32_t kPublished = 1u << 30;
+    static constexpr uint32_t kReferenceMask = kPublished - 1;
+
+    // Deleter of the IOContexts held by slots, which closes each IOContext
+    // when the last file descriptor or reference to it is dropped.
+    struct ContextCloser {
+      void operator()(IOContext *context) const;
+
+      // Receives the value returned by IOContext::Close when the IOContext is
+      // closed on the calling thread, if not nullptr. The deleter runs on the
+      // thread dropping the last owner, so this reports the result to that
+      // thread only.
+      static thread_local int *close_result;
+    };
+
+    struct Slot {
+      // The lock held while manipulating the file.
+      absl::Mutex lock;
+
+      // Claims and references to the slot, in the bits described above.
+      std::atomic<uint32_t> state{0};
+
+      // Written only while the slot is reserved and unpublished, or by the
+      // holder of its last reference.
+      std::shared_ptr<IOContext> context;
+    };
+
     // Returns whether |fd| is in expected range.
     bool IsFileDescriptorValid(int fd);
 
-    // Returns current highest file descriptor number. Returns -1 if no file
-    // descriptors are used.
-    int GetHighestFileDescriptorUsed() EXCLUSIVE_LOCKS_REQUIRED(fd_table_lock_);
+    // Takes a reference to the IOContext of |slot| if it is published.
+    static Reference Acquire(Slot *slot);
 
-    // Returns the lowest available file descriptor greater than or equal to
-    // |startfd|. Returns -1 if there is no file descriptor available.
-    int GetNextFreeFileDescriptor(int startfd)
-        EXCLUSIVE_LOCKS_REQUIRED(fd_table_lock_);
+    // Drops a reference to |slot|, freeing the slot if it was the last one.
+    // Returns the IOContext taken from a freed slot, and nullptr otherwise.
+    static std::shared_ptr<IOContext> Release(Slot *slot);
 
-    std::array<std::shared_ptr<IOContext>, kMaxOpenFiles> fd_table_
-        GUARDED_BY(fd_table_lock_);
+    // Reserves the slot of |fd| if it is free. Returns false otherwise.
+    bool ReserveSlot(int fd);
 
-    // A mutex that locks the fd_table_ and fd_to_lock_. This lock needs to be
-    // obtained before manipulating either of the tables.
-    absl::Mutex fd_table_lock_;
+    // Reserves the lowest free slot greater than or equal to |startfd|. Returns
+    // its file descriptor, or -1 if there is no free slot.
+    int ReserveNextFreeFileDescriptor(int startfd);
+
+    // Stores |context| in the reserved slot of |fd| and publishes it.
+    void Publish(int fd, std::shared_ptr<IOContext> context);
+
+    // Returns current highest file descriptor number. Returns -1 if no file
+    // descriptors are used.
+    int GetHighestFileDescriptorUsed();
 
-    // A map from a fd to a lock. The corresponding lock needs to be owned
-    // before manipulating the file.
-    std::unordered_map<int, absl::Mutex> fd_to_lock_ GUARDED_BY(fd_table_lock_);
+    std::array<Slot, kMaxOpenFiles> slots_;
+
+    // Serializes changes to the file descriptor limits.
+    absl::Mutex limits_lock_;
 
     // The maximum file descriptor number allowed.
-    int maximum_fd_soft_limit;
+    std::atomic<int> maximum_fd_soft_limit;
 
     // The ceiling for |maximum_fd_soft_limit|.
-    int maximum_fd_hard_limit;
+    std::atomic<int> maximum_fd_hard_limit;
   };
 
   // Accessor to the singleton instance.
@@ -428,6 +529,17 @@ class IOManager {
   // Implements poll(2).
   int Poll(struct pollfd *fds, nfds_t nfds, int timeout);
 
+  // Implements epoll_create1(2). The epoll instance is created on the host.
+  int EpollCreate(int flags);
+
+  // Implements epoll_ctl(2). Only file descriptors backed by a host file
+  // descriptor can be watched.
+  int EpollCtl(int epfd, int op, int fd, struct epoll_event *event);
+
+  // Implements epoll_wait(2).
+  int EpollWait(int epfd, struct epoll_event *events, int maxevents,
+                int timeout);
+
   // Implements mkdir(2).
   int Mkdir(const char *pathname, mode_t mode);
 
@@ -437,6 +549,16 @@ class IOManager {
   // Implements readv(2).
   ssize_t Readv(int fd, const struct iovec *iov, int iovcnt);
 
+  // Implements mmap(2) for file mappings.
+  void *Mmap(int fd, size_t length, int prot, int flags, off_t offset);
+
+  // Implements munmap(2) for whole mappings. Unmapping part of a mapping fails
+  // with EINVAL.
+  int Munmap(void *addr, size_t length);
+
+  // Implements msync(2).
+  int Msync(void *addr, size_t length, int flags);
+
   // Implements umask(2).
   mode_t Umask(mode_t mask);
 
@@ -19,9 +19,11 @@
 #include "asylo/platform/posix/io/native_paths.h"
 
 #include <fcntl.h>
+#include <limits.h>
 
 #include "asylo/platform/arch/include/trusted/host_calls.h"
 #include "asylo/platform/posix/io/secure_paths.h"
+#include "asylo/platform/storage/secure/memory_mapper.h"
 
 namespace asylo {
 namespace io {
@@ -60,6 +62,12 @@ ssize_t IOContextNative::Readv(const struct iovec *iov, int iovcnt) {
   return enc_untrusted_readv(host_fd_, iov, iovcnt);
 }
 
+void *IOContextNative::Mmap(size_t length, int prot, int flags,
+                            off_t offset) {
+  return platform::storage::MemoryMapper::GetInstance().MapHostFile(
+      host_fd_, length, prot, flags, offset);
+}
+
 int IOContextNative::SetSockOpt(int level, int option_name,
                                 const void *option_value,
                                 socklen_t option_len) {
@@ -114,6 +122,64 @@ int IOContextNative::GetPeerName(struct sockaddr *addr, socklen_t *addrlen) {
 
 int IOContextNative::GetHostFileDescriptor() { return host_fd_; }
 
+int IOContextEpoll::EpollCtl(int op, int fd, int host_fd,
+                             struct epoll_event *event) {
+  struct epoll_event host_event = {};
+  if (op != EPOLL_CTL_DEL) {
+    if (!event) {
+      errno = EFAULT;
+      return -1;
+    }
+    host_event.events = event->events;
+    host_event.data.u64 = static_cast<uint64_t>(fd);
+  }
+
+  absl::MutexLock lock(&mu_);
+  if (enc_untrusted_epoll_ctl(GetHostFileDescriptor(), op, host_fd,
+                              &host_event) == -1) {
+    return -1;
+  }
+  if (op == EPOLL_CTL_DEL) {
+    data_.erase(fd);
+  } else {
+    data_[fd] = event->data;
+  }
+  return 0;
+}
+
+int IOContextEpoll::EpollWait(struct epoll_event *events, int maxevents,
+                              int timeout) {
+  while (true) {
+    int ret = enc_untrusted_epoll_wait(GetHostFileDescriptor(), events,
+                                       maxevents, timeout);
+    if (ret <= 0) {
+      return ret;
+    }
+
+    // Replaces the enclave file descriptor reported by the host with the data
+    // of the caller, dropping events for file descriptors no longer watched.
+    int count = 0;
+    {
+      absl::MutexLock lock(&mu_);
+      for (int i = 0; i < ret; ++i) {
+        auto it = events[i].data.u64 <= INT_MAX
+                      ? data_.find(static_cast<int>(events[i].data.u64))
+                      : data_.end();
+        if (it == data_.end()) {
+          continue;
+        }
+        events[count].events = events[i].events;
+        events[count].data = it->second;
+        ++count;
+      }
+    }
+    // A blocking wait only returns once it has events to report.
+    if (count > 0 || timeout >= 0) {
+      return count;
+    }
+  }
+}
+
 std::unique_ptr<IOManager::IOContext> NativePathHandler::Open(const char *path,
                                                               int flags,
                                                               mode_t mode) {
@@ -19,6 +19,11 @@
 #ifndef ASYLO_PLATFORM_POSIX_IO_NATIVE_PATHS_H_
 #define ASYLO_PLATFORM_POSIX_IO_NATIVE_PATHS_H_
 
+#include <sys/epoll.h>
+
+#include <unordered_map>
+
+#include "absl/synchronization/mutex.h"
 #include "asylo/platform/posix/io/io_manager.h"
 
 namespace asylo {
@@ -39,6 +44,7 @@ class IOContextNative : public IOManager::IOContext {
   int Close() override;
   ssize_t Writev(const struct iovec *iov, int iovcnt) override;
   ssize_t Readv(const struct iovec *iov, int iovcnt) override;
+  void *Mmap(size_t length, int prot, int flags, off_t offset) override;
   int SetSockOpt(int level, int option_name, const void *option_value,
                  socklen_t option_len) override;
   int Connect(const struct sockaddr *addr, socklen_t addrlen) override;
@@ -60,6 +66,25 @@ class IOContextNative : public IOManager::IOContext {
   int host_fd_;
 };
 
+// IOContext implementation wrapping a host epoll instance. File descriptors are
+// registered with the host under their enclave file descriptor, while the data
+// supplied by the caller stays in the enclave, so the host can only report
+// events for file descriptors in the interest set.
+class IOContextEpoll : public IOContextNative {
+ public:
+  explicit IOContextEpoll(int host_fd) : IOContextNative(host_fd) {}
+  int EpollCtl(int op, int fd, int host_fd, struct epoll_event *event) override;
+  int EpollWait(struct epoll_event *events, int maxevents,
+                int timeout) override;
+
+ private:
+  // Serializes changes to the interest set, so that it matches the host's.
+  absl::Mutex mu_;
+
+  // The caller's data for each enclave file descriptor in the interest set.
+  std::unordered_map<int, epoll_data_t> data_ GUARDED_BY(mu_);
+};
+
 // VirtualPathHandler implementation handling paths to be forwarded to the host.
 class NativePathHandler : public io::IOManager::VirtualPathHandler {
  public:
@@ -18,8 +18,10 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <stdio.h>
 #include <unistd.h>
+#include <chrono>
 #include <future>
 #include <sstream>
 #include <string>
@@ -121,5 +123,97 @@ TEST(ReadWriteMultiThreadTest, MultiThreadTest) {
   }
 }
 
+// Reads from |fd| until it is closed by another thread.
+Status ReadUntilClosed(int fd) {
+  char buf[64];
+  while (true) {
+    ssize_t rc = read(fd, buf, sizeof(buf));
+    if (rc < 0) {
+      if (errno == EBADF) {
+        return Status::OkStatus();
+      }
+      return GenerateErrorStatusFromErrno("Failed to read from file");
+    }
+    if (lseek(fd, 0, SEEK_SET) == -1 && errno != EBADF) {
+      return GenerateErrorStatusFromErrno("Failed to seek in file");
+    }
+  }
+}
+
+TEST(ReadWriteMultiThreadTest, CloseWhileReading) {
+  std::string path = absl::StrCat(FLAGS_test_tmpdir, "/close_while_reading");
+  int fd = open(path.c_str(), O_CREAT | O_RDWR | O_TRUNC, 0644);
+  ASSERT_GE(fd, 0);
+  const std::string message = GenerateRandomString();
+  ASSERT_EQ(write(fd, message.c_str(), message.size()), message.size());
+
+  std::vector<std::future<Status>> futures;
+  for (int i = 0; i < kNumThreads; ++i) {
+    futures.push_back(std::async(std::launch::async, &ReadUntilClosed, fd));
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  EXPECT_EQ(close(fd), 0);
+  for (auto &result : futures) {
+    EXPECT_THAT(result.get(), IsOk());
+  }
+  EXPECT_EQ(close(fd), -1);
+  EXPECT_EQ(errno, EBADF);
+}
+
+// Closes both file descriptors of the write end of a pipe while another thread
+// polls one of them. The host write end stays open until the poll returns, and
+// is closed then, so the read end sees the end of the stream.
+TEST(ReadWriteMultiThreadTest, CloseWhilePolling) {
+  int pipefd[2];
+  ASSERT_EQ(pipe(pipefd), 0);
+  ASSERT_EQ(fcntl(pipefd[1], F_SETFL, O_NONBLOCK), 0);
+  size_t buffered = 0;
+  char chunk[4096] = {};
+  while (true) {
+    ssize_t rc = write(pipefd[1], chunk, sizeof(chunk));
+    if (rc < 0) {
+      ASSERT_EQ(errno, EAGAIN);
+      break;
+    }
+    buffered += rc;
+  }
+  int write_fd = dup(pipefd[1]);
+  ASSERT_GE(write_fd, 0);
+
+  // The full pipe blocks the poll until it is drained.
+  std::future<int> poller = std::async(std::launch::async, [write_fd] {
+    struct pollfd write_pollfd = {write_fd, POLLOUT, 0};
+    return poll(&write_pollfd, 1, 10000);
+  });
+  // Gives the poll time to start, so that it is still in progress when both
+  // file descriptors are closed.
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  EXPECT_EQ(close(write_fd), 0);
+  EXPECT_EQ(close(pipefd[1]), 0);
+
+  // The number of a closed file descriptor stays reserved while an operation
+  // on it is in progress.
+  int rc = dup2(pipefd[0], write_fd);
+  if (rc == -1) {
+    EXPECT_EQ(errno, EBUSY);
+  } else {
+    EXPECT_EQ(close(rc), 0);
+  }
+
+  std::vector<char> buf(buffered);
+  for (size_t drained = 0; drained < buffered;) {
+    ssize_t rc = read(pipefd[0], buf.data(), buffered - drained);
+    ASSERT_GT(rc, 0);
+    drained += rc;
+  }
+  EXPECT_EQ(poller.get(), 1);
+
+  struct pollfd read_pollfd = {pipefd[0], POLLIN, 0};
+  ASSERT_EQ(poll(&read_pollfd, 1, 10000), 1);
+  EXPECT_TRUE(read_pollfd.revents & POLLHUP);
+  EXPECT_EQ(read(pipefd[0], buf.data(), 1), 0);
+  EXPECT_EQ(close(pipefd[0]), 0);
+}
+
 }  // namespace
 }  // namespace asylo
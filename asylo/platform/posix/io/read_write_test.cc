@@ -20,6 +20,7 @@
 #include <openssl/rand.h>
 #include <stdio.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <unistd.h>
 #include <string>
 #include <vector>
@@ -176,5 +177,65 @@ TEST_F(ReadWriteTest, ReadWriteSecureTest) {
   EXPECT_EQ(close(fd), 0);
 }
 
+TEST_F(ReadWriteTest, MmapUntrustedTest) {
+  EXPECT_THAT(PrepareFileAndKey(), IsOk());
+  int fd = open(test_file_.c_str(), O_CREAT | O_RDWR, 0644);
+  ASSERT_GE(fd, 0);
+  size_t length = strlen(kUntrustedTestText);
+  EXPECT_EQ(write(fd, kUntrustedTestText, length), length);
+
+  // Check that the file can be mapped privately, but not shared writable.
+  EXPECT_EQ(mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0),
+            MAP_FAILED);
+  char *mapped = static_cast<char *>(
+      mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0));
+  ASSERT_NE(mapped, MAP_FAILED);
+
+  // Check that mapping does not move the cursor, and that the mapping outlives
+  // the file descriptor.
+  EXPECT_EQ(lseek(fd, 0, SEEK_CUR), length);
+  EXPECT_EQ(close(fd), 0);
+  EXPECT_EQ(strncmp(mapped, kUntrustedTestText, length), 0);
+  EXPECT_EQ(mapped[length], '\0');
+
+  EXPECT_EQ(munmap(mapped, length), 0);
+  EXPECT_EQ(munmap(mapped, length), -1);
+}
+
+TEST_F(ReadWriteTest, MmapUntrustedLargeFileTest) {
+  EXPECT_THAT(PrepareFileAndKey(), IsOk());
+  int fd = open(test_file_.c_str(), O_CREAT | O_RDWR, 0644);
+  ASSERT_GE(fd, 0);
+
+  // The file spans many of the chunks in which it is read, and ends in the
+  // middle of a page.
+  std::vector<uint8_t> contents(4 * 1024 * 1024 + 1000);
+  for (size_t i = 0; i < contents.size(); i++) {
+    contents[i] = static_cast<uint8_t>(i * 7 + i / 4096);
+  }
+  ASSERT_EQ(write(fd, contents.data(), contents.size()), contents.size());
+
+  uint8_t *mapped = static_cast<uint8_t *>(
+      mmap(nullptr, contents.size(), PROT_READ, MAP_PRIVATE, fd, 0));
+  ASSERT_NE(mapped, MAP_FAILED);
+  EXPECT_EQ(memcmp(mapped, contents.data(), contents.size()), 0);
+  EXPECT_EQ(mapped[contents.size()], 0);
+  EXPECT_EQ(munmap(mapped, contents.size()), 0);
+
+  // A mapping at an offset, extending past the end of the file, reads the rest
+  // of the file followed by zeros.
+  constexpr off_t kOffset = 1024 * 1024;
+  const size_t length = contents.size() - kOffset + 8192;
+  mapped = static_cast<uint8_t *>(
+      mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, kOffset));
+  ASSERT_NE(mapped, MAP_FAILED);
+  const size_t mapped_file_length = contents.size() - kOffset;
+  EXPECT_EQ(memcmp(mapped, contents.data() + kOffset, mapped_file_length), 0);
+  const std::vector<uint8_t> zeros(length - mapped_file_length);
+  EXPECT_EQ(memcmp(mapped + mapped_file_length, zeros.data(), zeros.size()), 0);
+  EXPECT_EQ(munmap(mapped, length), 0);
+  EXPECT_EQ(close(fd), 0);
+}
+
 }  // namespace
 }  // namespace asylo
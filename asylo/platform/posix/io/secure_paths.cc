@@ -27,6 +27,7 @@
 #include "asylo/platform/posix/io/io_manager.h"
 #include "asylo/platform/storage/secure/aead_handler.h"
 #include "asylo/platform/storage/secure/enclave_storage_secure.h"
+#include "asylo/platform/storage/secure/memory_mapper.h"
 
 using asylo::platform::crypto::gcmlib::kKeyLength;
 using asylo::platform::storage::AeadHandler;
@@ -50,7 +51,9 @@ int IOContextSecure::LSeek(off_t offset, int whence) {
   return platform::storage::secure_lseek(host_fd_, offset, whence);
 }
 
-int IOContextSecure::FSync() { return enc_untrusted_fsync(host_fd_); }
+int IOContextSecure::FSync() {
+  return platform::storage::secure_fsync(host_fd_);
+}
 
 int IOContextSecure::FStat(struct stat *st) {
   return enc_untrusted_fstat(host_fd_, st);
@@ -65,6 +68,36 @@ int IOContextSecure::Ioctl(int request, void *argp) {
       return AeadHandler::GetInstance().SetMasterKey(
           host_fd_, ioctl_param->data, ioctl_param->length);
     }
+    case ENCLAVE_STORAGE_SET_DIGEST_WRITE_BACK: {
+      struct digest_write_back_info *ioctl_param =
+          reinterpret_cast<struct digest_write_back_info *>(argp);
+      return AeadHandler::GetInstance().SetDigestWriteBack(
+          host_fd_, ioctl_param->max_dirty_bytes,
+          ioctl_param->max_dirty_interval_ms);
+    }
+    case ENCLAVE_STORAGE_SET_BLOCK_LENGTH: {
+      uint32_t *block_length = reinterpret_cast<uint32_t *>(argp);
+      return AeadHandler::GetInstance().SetBlockLength(host_fd_,
+                                                       *block_length);
+    }
+    case ENCLAVE_STORAGE_SET_PARALLELISM: {
+      struct parallelism_info *ioctl_param =
+          reinterpret_cast<struct parallelism_info *>(argp);
+      return AeadHandler::GetInstance().SetParallelism(
+          host_fd_, ioctl_param->max_threads, ioctl_param->min_bytes);
+    }
+    case ENCLAVE_STORAGE_GET_BLOCK_CACHE_STATS: {
+      struct block_cache_stats *ioctl_param =
+          reinterpret_cast<struct block_cache_stats *>(argp);
+      platform::storage::BlockCache::Stats stats =
+          AeadHandler::GetInstance().GetBlockCacheStats();
+      ioctl_param->hits = stats.hits;
+      ioctl_param->misses = stats.misses;
+      ioctl_param->evictions = stats.evictions;
+      ioctl_param->cached_bytes = stats.cached_bytes;
+      ioctl_param->capacity_bytes = stats.capacity_bytes;
+      return 0;
+    }
     default:
       errno = ENOSYS;
   }
@@ -72,5 +105,10 @@ int IOContextSecure::Ioctl(int request, void *argp) {
   return -1;
 }
 
+void *IOContextSecure::Mmap(size_t length, int prot, int flags, off_t offset) {
+  return platform::storage::MemoryMapper::GetInstance().Map(
+      host_fd_, length, prot, flags, offset);
+}
+
 }  // namespace io
 }  // namespace asylo
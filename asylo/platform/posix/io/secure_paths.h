@@ -43,6 +43,7 @@ class IOContextSecure : public IOManager::IOContext {
   int FStat(struct stat *st) override;
   int Isatty() override;
   int Ioctl(int request, void *argp) override;
+  void *Mmap(size_t length, int prot, int flags, off_t offset) override;
 
  private:
   explicit IOContextSecure(int host_fd) : host_fd_(host_fd) {}
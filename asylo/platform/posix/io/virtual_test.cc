@@ -16,10 +16,14 @@
  *
  */
 
+#include <errno.h>
 #include <fcntl.h>
 #include <stdio.h>
 #include <unistd.h>
+
+#include <atomic>
 #include <string>
+#include <thread>
 
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
@@ -38,10 +42,12 @@ using ::testing::Not;
 
 class VirtualHandlerTest : public ::testing::Test {
  public:
-  void RegisterVirtualPathHandler(const std::string &path, const std::string &label) {
+  void RegisterVirtualPathHandler(const std::string &path,
+                                  const std::string &label,
+                                  int close_result = 0) {
     io::IOManager &mgr = io::IOManager::GetInstance();
-    mgr.RegisterVirtualPathHandler(path,
-                                   ::absl::make_unique<TestHandler>(label));
+    mgr.RegisterVirtualPathHandler(
+        path, ::absl::make_unique<TestHandler>(label, close_result));
   }
 
   void DeregisterVirtualPathHandler(const std::string &path) {
@@ -69,7 +75,8 @@ class VirtualHandlerTest : public ::testing::Test {
  private:
   class TestContext : public io::IOManager::IOContext {
    public:
-    TestContext(std::string label) : label_(label) {}
+    TestContext(std::string label, int close_result)
+        : label_(label), close_result_(close_result) {}
     virtual ~TestContext() = default;
 
     // Copy the label into the provided buffer
@@ -83,25 +90,33 @@ class VirtualHandlerTest : public ::testing::Test {
     // Write is not allowed
     ssize_t Write(const void *buf, size_t count) override { return -1; }
 
-    // Nothing to do for close
-    int Close() override { return 0; }
+    // Nothing to do for close, which fails with EIO if so configured
+    int Close() override {
+      if (close_result_ == -1) {
+        errno = EIO;
+      }
+      return close_result_;
+    }
 
    private:
     std::string label_;
+    int close_result_;
   };
 
   class TestHandler : public io::IOManager::VirtualPathHandler {
    public:
-    TestHandler(std::string label) : label_(label) {}
+    TestHandler(std::string label, int close_result)
+        : label_(label), close_result_(close_result) {}
     virtual ~TestHandler() = default;
 
     std::unique_ptr<io::IOManager::IOContext> Open(const char *path, int flags,
                                                    mode_t mode) override {
-      return ::absl::make_unique<TestContext>(label_);
+      return ::absl::make_unique<TestContext>(label_, close_result_);
     }
 
    private:
     std::string label_;
+    int close_result_;
   };
 };
 
@@ -248,5 +263,39 @@ TEST_F(VirtualHandlerTest, SiblingMatch) {
   DeregisterVirtualPathHandler(path2);
 }
 
+// Closing the last two file descriptors of a stream concurrently reports the
+// failure to close the stream to exactly one of the callers.
+TEST_F(VirtualHandlerTest, ConcurrentCloseReportsFailureOnce) {
+  const std::string path = "/test/failing_close";
+  RegisterVirtualPathHandler(path, "FailingClose", /*close_result=*/-1);
+
+  for (int i = 0; i < 1000; i++) {
+    int fd = open(path.c_str(), O_RDONLY);
+    ASSERT_GE(fd, 0);
+    int copy = dup(fd);
+    ASSERT_GE(copy, 0);
+
+    // Both threads start closing at the same time.
+    std::atomic<int> waiting(2);
+    std::atomic<int> failures(0);
+    auto close_and_count = [&waiting, &failures](int fd) {
+      waiting--;
+      while (waiting > 0) {
+        std::this_thread::yield();
+      }
+      if (close(fd) == -1) {
+        EXPECT_EQ(errno, EIO);
+        failures++;
+      }
+    };
+    std::thread other(close_and_count, fd);
+    close_and_count(copy);
+    other.join();
+    EXPECT_EQ(failures, 1);
+  }
+
+  DeregisterVirtualPathHandler(path);
+}
+
 }  // namespace
 }  // namespace asylo
@@ -0,0 +1,53 @@
+/*
+ *
+ * Copyright 2018 Asylo authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <errno.h>
+#include <sys/epoll.h>
+
+#include "asylo/platform/posix/io/io_manager.h"
+
+using asylo::io::IOManager;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int epoll_create(int size) {
+  if (size <= 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  return IOManager::GetInstance().EpollCreate(0);
+}
+
+int epoll_create1(int flags) {
+  return IOManager::GetInstance().EpollCreate(flags);
+}
+
+int epoll_ctl(int epfd, int op, int fd, struct epoll_event *event) {
+  return IOManager::GetInstance().EpollCtl(epfd, op, fd, event);
+}
+
+int epoll_wait(int epfd, struct epoll_event *events, int maxevents,
+               int timeout) {
+  return IOManager::GetInstance().EpollWait(epfd, events, maxevents, timeout);
+}
+
+#ifdef __cplusplus
+}  // extern "C"
+#endif
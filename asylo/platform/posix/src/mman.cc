@@ -20,13 +20,26 @@
 
 #include <stdlib.h>
 
+#include "asylo/platform/posix/io/io_manager.h"
+
+using asylo::io::IOManager;
+
 extern "C" {
 
 void *mmap(void *addr, size_t length, int prot, int flags, int fd,
            off_t offset) {
-  abort();
+  if (flags & MAP_ANON) {
+    abort();
+  }
+  return IOManager::GetInstance().Mmap(fd, length, prot, flags, offset);
 }
 
-int munmap(void *addr, size_t length) { abort(); }
+int munmap(void *addr, size_t length) {
+  return IOManager::GetInstance().Munmap(addr, length);
+}
+
+int msync(void *addr, size_t length, int flags) {
+  return IOManager::GetInstance().Msync(addr, length, flags);
+}
 
 }  // extern "C"
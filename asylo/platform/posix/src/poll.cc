@@ -18,7 +18,12 @@
 
 #include <poll.h>
 
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
 #include <sys/select.h>
+#include <sys/time.h>
+#include <time.h>
 #include <cstdlib>
 
 #include "asylo/platform/arch/include/trusted/host_calls.h"
@@ -26,6 +31,97 @@
 
 using asylo::io::IOManager;
 
+namespace {
+
+// Converts |timeout| to a poll timeout in milliseconds, rounding up so that
+// select does not return before |timeout| has expired. A null |timeout| waits
+// indefinitely. Returns false if |timeout| is invalid.
+bool ToPollTimeout(const struct timespec *timeout, int *poll_timeout) {
+  if (!timeout) {
+    *poll_timeout = -1;
+    return true;
+  }
+  if (timeout->tv_sec < 0 || timeout->tv_nsec < 0 ||
+      timeout->tv_nsec >= 1000000000) {
+    return false;
+  }
+  if (timeout->tv_sec >= INT_MAX / 1000) {
+    *poll_timeout = INT_MAX;
+    return true;
+  }
+  *poll_timeout = static_cast<int>(timeout->tv_sec * 1000 +
+                                   (timeout->tv_nsec + 999999) / 1000000);
+  return true;
+}
+
+// Implements select and pselect with a single call to IOManager::Poll, which
+// translates the file descriptors and exits the enclave once.
+int Select(int nfds, fd_set *readfds, fd_set *writefds, fd_set *exceptfds,
+           const struct timespec *timeout) {
+  int poll_timeout;
+  if (nfds < 0 || nfds > FD_SETSIZE || !ToPollTimeout(timeout, &poll_timeout)) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  struct pollfd fds[FD_SETSIZE];
+  nfds_t count = 0;
+  for (int fd = 0; fd < nfds; ++fd) {
+    int events = 0;
+    if (readfds && FD_ISSET(fd, readfds)) events |= POLLIN;
+    if (writefds && FD_ISSET(fd, writefds)) events |= POLLOUT;
+    if (exceptfds && FD_ISSET(fd, exceptfds)) events |= POLLPRI;
+    if (events) {
+      fds[count].fd = fd;
+      fds[count].events = events;
+      fds[count].revents = 0;
+      ++count;
+    }
+  }
+
+  if (IOManager::GetInstance().Poll(fds, count, poll_timeout) == -1) {
+    return -1;
+  }
+  for (nfds_t i = 0; i < count; ++i) {
+    if (fds[i].revents & POLLNVAL) {
+      errno = EBADF;
+      return -1;
+    }
+  }
+
+  // The sets are only modified once the call is known to succeed, and then
+  // hold just the ready file descriptors.
+  int ready = 0;
+  for (nfds_t i = 0; i < count; ++i) {
+    const int fd = fds[i].fd;
+    const int revents = fds[i].revents;
+    if (readfds && FD_ISSET(fd, readfds)) {
+      if (revents & (POLLIN | POLLRDNORM | POLLRDBAND | POLLHUP | POLLERR)) {
+        ++ready;
+      } else {
+        FD_CLR(fd, readfds);
+      }
+    }
+    if (writefds && FD_ISSET(fd, writefds)) {
+      if (revents & (POLLOUT | POLLWRNORM | POLLWRBAND | POLLERR)) {
+        ++ready;
+      } else {
+        FD_CLR(fd, writefds);
+      }
+    }
+    if (exceptfds && FD_ISSET(fd, exceptfds)) {
+      if (revents & POLLPRI) {
+        ++ready;
+      } else {
+        FD_CLR(fd, exceptfds);
+      }
+    }
+  }
+  return ready;
+}
+
+}  // namespace
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -34,9 +130,36 @@ int poll(struct pollfd *fds, nfds_t nfds, int timeout) {
   return IOManager::GetInstance().Poll(fds, nfds, timeout);
 }
 
-int select(int __n, fd_set *__readfds, fd_set *__writefds, fd_set *__exceptfds,
-           struct timeval *__timeout) {
-  abort();
+int select(int nfds, fd_set *readfds, fd_set *writefds, fd_set *exceptfds,
+           struct timeval *timeout) {
+  if (!timeout) {
+    return Select(nfds, readfds, writefds, exceptfds, nullptr);
+  }
+  if (timeout->tv_usec < 0 || timeout->tv_usec >= 1000000) {
+    errno = EINVAL;
+    return -1;
+  }
+  struct timespec ts;
+  ts.tv_sec = timeout->tv_sec;
+  ts.tv_nsec = timeout->tv_usec * 1000;
+  return Select(nfds, readfds, writefds, exceptfds, &ts);
+}
+
+// The signal mask is replaced around the wait rather than atomically with it,
+// so a signal delivered just before the wait may not interrupt it.
+int pselect(int nfds, fd_set *readfds, fd_set *writefds, fd_set *exceptfds,
+            const struct timespec *timeout, const sigset_t *sigmask) {
+  sigset_t old_mask;
+  if (sigmask && sigprocmask(SIG_SETMASK, sigmask, &old_mask) == -1) {
+    return -1;
+  }
+  int ret = Select(nfds, readfds, writefds, exceptfds, timeout);
+  if (sigmask) {
+    int saved_errno = errno;
+    sigprocmask(SIG_SETMASK, &old_mask, nullptr);
+    errno = saved_errno;
+  }
+  return ret;
 }
 
 #ifdef __cplusplus
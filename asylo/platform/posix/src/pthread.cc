@@ -18,8 +18,10 @@
 
 #include <pthread.h>
 
+#include <semaphore.h>
 #include <signal.h>
 #include <sys/reent.h>
+#include <time.h>
 #include <cerrno>
 #include <cstdio>
 #include <cstdlib>
@@ -28,6 +30,7 @@
 
 #include "asylo/platform/arch/include/trusted/enclave_interface.h"
 #include "asylo/platform/arch/include/trusted/host_calls.h"
+#include "asylo/platform/common/time_util.h"
 #include "asylo/platform/core/trusted_global_state.h"
 #include "asylo/platform/posix/threading/thread_manager.h"
 
@@ -68,7 +71,9 @@ inline int pthread_spin_lock(pthread_spinlock_t *lock) {
 }
 
 inline int pthread_spin_unlock(pthread_spinlock_t *lock) {
-  *lock = 0;
+  // Release semantics keep writes made under the lock from being reordered
+  // past the unlock.
+  __sync_lock_release(lock);
   return 0;
 }
 
@@ -94,109 +99,291 @@ pthread_t pthread_list_first(const __pthread_list_t &list) {
   return list._first->_thread_id;
 }
 
-
-// Should be set to max number of threads in enclave.
-constexpr int kMaxNodes = 200;
-// Storage associated with each enclave thread. This is implemented as static
-// data to support mutual exclusion early during enclave initialization before
-// malloc() is available.
-static __pthread_list_node_t pthread_list_nodes[kMaxNodes];
-// Sentry value of |free_node|.
-constexpr __pthread_list_node_t *kFreeNodeSentry = pthread_list_nodes - 1;
-// Pointer to first item in pthread_list_nodes free list. Must be initialized to
-// a bad value to allow for setup.
-static __pthread_list_node_t *free_node = kFreeNodeSentry;
-// Last entry in pthread_list_nodes.
-constexpr __pthread_list_node_t *kEndOfListSentry =
-    &pthread_list_nodes[kMaxNodes - 1];
-// Spinlock to guard pthread_list_nodes free list. Cannot use a mutex because
-// these primitives are used to implemented mutex.
-static pthread_spinlock_t storage_lock = 0x00;
-
-// Setups up the free list used to allocate pthread_list_nodes.
-void set_up_free_list() {
-  free_node = &pthread_list_nodes[0];
-  for (int i = 0; i < kMaxNodes - 1; ++i) {
-    pthread_list_nodes[i]._next = &pthread_list_nodes[i + 1];
-  }
-  kEndOfListSentry->_next = nullptr;
-}
-
-__pthread_list_node_t *alloc_list_node(pthread_t thread_id) {
-  SpinLock spin_lock(&storage_lock);
-  if (free_node == kFreeNodeSentry) {
-    set_up_free_list();
-  }
-
-  // If 'pthread_list_nodes' filled abort.
-  if (!free_node) {
-    printf("kMaxNodes <= # of threads\n");
+// Appends |node| to the end of the |list|.
+void pthread_list_insert_last(__pthread_list_t *list,
+                              __pthread_list_node_t *node) {
+  if (!list) {
     abort();
   }
 
-  __pthread_list_node_t *node = free_node;
-  free_node = free_node->_next;
-  node->_thread_id = thread_id;
   node->_next = nullptr;
-  return node;
+  if (!list->_last) {
+    list->_first = node;
+  } else {
+    list->_last->_next = node;
+  }
+  list->_last = node;
 }
 
-void free_list_node(__pthread_list_node_t *node) {
-  if (node > kEndOfListSentry || node < &pthread_list_nodes[0]) {
-    printf("free_list_node() called on non pthread_list_nodes node\n");
+// Removes and returns the first node of the |list|.
+__pthread_list_node_t *pthread_list_remove_first(__pthread_list_t *list) {
+  if (!list) {
+    abort();
+  }
+
+  if (!list->_first) {
     abort();
   }
 
-  SpinLock spin_lock(&storage_lock);
-  node->_next = free_node;
-  free_node = node;
+  __pthread_list_node_t *old_first = list->_first;
+  list->_first = old_first->_next;
+  if (!list->_first) {
+    list->_last = nullptr;
+  }
+  old_first->_next = nullptr;
+  return old_first;
 }
 
-// Inserts |thread_id| at the end of the |list|, allocating a new
-// __pthread_list_t.
-void pthread_list_insert_last(__pthread_list_t *list, pthread_t thread_id) {
+// Removes |node| from the |list|. Returns false if |node| is not in the |list|.
+bool pthread_list_remove(__pthread_list_t *list, __pthread_list_node_t *node) {
   if (!list) {
     abort();
   }
 
-  __pthread_list_node_t *last = alloc_list_node(thread_id);
+  __pthread_list_node_t *previous = nullptr;
+  __pthread_list_node_t *current = list->_first;
+  while (current && current != node) {
+    previous = current;
+    current = current->_next;
+  }
+  if (!current) {
+    return false;
+  }
 
-  if (!list->_first) {
-    list->_first = last;
-    return;
+  if (previous) {
+    previous->_next = node->_next;
+  } else {
+    list->_first = node->_next;
   }
+  if (list->_last == node) {
+    list->_last = previous;
+  }
+  node->_next = nullptr;
+  return true;
+}
 
-  __pthread_list_node_t *current = list->_first;
-  while (current->_next) {
-    current = current->_next;
+// Number of times a thread polls a queue it is waiting in before it blocks
+// outside the enclave.
+constexpr int kSpinCount = 1000;
+
+// Per-thread record used to wait in the queue of a mutex or condition
+// variable. Each thread waits in at most one queue at a time.
+struct Waiter {
+  // Link in the queue the thread waits in. Must be the first member.
+  __pthread_list_node_t node;
+
+  // Whether |node| is linked into a queue. Guarded by the lock of that queue.
+  bool queued;
+
+  // Whether the thread is blocked outside the enclave, as opposed to spinning.
+  // Guarded by the lock of the queue the thread waits in.
+  bool parked;
+
+  // Word in untrusted memory the thread blocks on. Zero while the thread may
+  // block and non-zero once it has been woken. If nullptr, the thread spins
+  // instead of blocking.
+  int32_t *wait_word;
+};
+
+// Should be set to max number of threads in enclave.
+constexpr int kMaxWaiters = 200;
+// Waiter records, claimed by threads on first use and never released. This is
+// implemented as static data to support mutual exclusion early during enclave
+// initialization before malloc() is available.
+static Waiter waiters[kMaxWaiters];
+// Spinlock to guard claiming of |waiters|. Cannot use a mutex because these
+// primitives are used to implement mutex.
+static pthread_spinlock_t waiters_lock = 0x00;
+// Waiter record of the current thread.
+static thread_local Waiter *current_waiter = nullptr;
+
+// Returns the Waiter record of the calling thread, claiming one if needed.
+Waiter *GetCurrentWaiter() {
+  if (current_waiter) {
+    return current_waiter;
+  }
+
+  pthread_t self = pthread_self();
+  Waiter *claimed = nullptr;
+  {
+    SpinLock spin_lock(&waiters_lock);
+    Waiter *free_waiter = nullptr;
+    for (Waiter &waiter : waiters) {
+      if (waiter.node._thread_id == self) {
+        current_waiter = &waiter;
+        return current_waiter;
+      }
+      if (!free_waiter && waiter.node._thread_id == PTHREAD_T_NULL) {
+        free_waiter = &waiter;
+      }
+    }
+
+    // If |waiters| is filled abort.
+    if (!free_waiter) {
+      printf("kMaxWaiters <= # of threads\n");
+      abort();
+    }
+    claimed = free_waiter;
+    claimed->node._thread_id = self;
   }
-  current->_next = last;
+
+  // The wait word is allocated outside of |waiters_lock| since it requires an
+  // exit. If the host hands back memory that is not untrusted, the thread falls
+  // back to spinning.
+  void *word = enc_untrusted_malloc(sizeof(int32_t));
+  if (word && enc_is_outside_enclave(word, sizeof(int32_t))) {
+    claimed->wait_word = static_cast<int32_t *>(word);
+  }
+  current_waiter = claimed;
+  return current_waiter;
 }
 
-void pthread_list_remove_first(__pthread_list_t *list) {
-  if (!list) {
-    abort();
+// Appends |waiter|, the record of the calling thread, to |queue|. The caller
+// must hold the lock guarding |queue|. |waiter| must have been claimed without
+// holding that lock, with GetCurrentWaiter or GetCurrentWaiterLocked, since
+// claiming a record may exit the enclave.
+void EnqueueWaiter(Waiter *waiter, __pthread_list_t *queue) {
+  waiter->queued = true;
+  waiter->parked = false;
+  pthread_list_insert_last(queue, &waiter->node);
+}
+
+// Returns the Waiter record of the calling thread if it has already been
+// claimed. Otherwise claims it with |lock| released, since claiming may exit
+// the enclave, and returns nullptr; the caller must then check again whether it
+// still needs to wait. |lock| must be held on entry and is held on return.
+Waiter *GetCurrentWaiterLocked(pthread_spinlock_t *lock) {
+  if (current_waiter) {
+    return current_waiter;
   }
+  pthread_spin_unlock(lock);
+  GetCurrentWaiter();
+  pthread_spin_lock(lock);
+  return nullptr;
+}
 
-  if (!list->_first) {
-    abort();
+// Returns the number of nanoseconds from now until the CLOCK_REALTIME time
+// |deadline|, which is negative once the deadline has passed.
+int64_t NanosecondsUntil(const struct timespec *deadline) {
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  return asylo::TimeSpecToNanoseconds(deadline) -
+         asylo::TimeSpecToNanoseconds(&now);
+}
+
+// Blocks until |waiter| has been removed from its queue by DequeueWaiter, or
+// until the CLOCK_REALTIME time |deadline| if it is not nullptr. |lock| guards
+// the queue; it must be held on entry, is released while the thread waits, and
+// is held again on return. The thread first spins, then blocks outside the
+// enclave. Returns false if the deadline passed while |waiter| was still queued.
+bool WaitUntilDequeued(Waiter *waiter, pthread_spinlock_t *lock,
+                       const struct timespec *deadline = nullptr) {
+  for (int spins = 0; waiter->queued; ++spins) {
+    int64_t timeout = -1;
+    if (deadline) {
+      timeout = NanosecondsUntil(deadline);
+      if (timeout <= 0) {
+        return false;
+      }
+    }
+
+    if (spins < kSpinCount || !waiter->wait_word) {
+      pthread_spin_unlock(lock);
+      enc_pause();
+      pthread_spin_lock(lock);
+      continue;
+    }
+
+    // A wake can only be delivered by a thread holding |lock|, so the wait
+    // word can be rearmed without losing one.
+    waiter->parked = true;
+    *waiter->wait_word = 0;
+    pthread_spin_unlock(lock);
+    enc_untrusted_sys_futex_wait(waiter->wait_word, 0, timeout);
+    pthread_spin_lock(lock);
+    waiter->parked = false;
   }
+  return true;
+}
 
-  __pthread_list_node_t *old_first = list->_first;
-  list->_first = old_first->_next;
-  free_list_node(old_first);
+// Removes the first waiter from |queue|, which must be non-empty, and lets it
+// proceed. The caller must hold the lock guarding |queue|. Returns the wait
+// word to pass to WakeWaiter once the lock is released, or nullptr if the
+// waiter is spinning and no wake is needed.
+int32_t *DequeueWaiter(__pthread_list_t *queue) {
+  Waiter *waiter =
+      reinterpret_cast<Waiter *>(pthread_list_remove_first(queue));
+  waiter->queued = false;
+  if (!waiter->parked) {
+    return nullptr;
+  }
+  *waiter->wait_word = 1;
+  return waiter->wait_word;
+}
+
+// Wakes the thread blocked on |wait_word|, as returned by DequeueWaiter.
+void WakeWaiter(int32_t *wait_word) {
+  if (wait_word) {
+    enc_untrusted_sys_futex_wake(wait_word, 1);
+  }
+}
+
+// Same as WaitUntilDequeued, but if the deadline passes first, removes
+// |waiter| from |queue| and returns ETIMEDOUT. Returns 0 once |waiter| has been
+// dequeued by another thread.
+int WaitUntilDequeuedOrTimeout(Waiter *waiter, __pthread_list_t *queue,
+                               pthread_spinlock_t *lock,
+                               const struct timespec *deadline) {
+  if (WaitUntilDequeued(waiter, lock, deadline)) {
+    return 0;
+  }
+  if (pthread_list_remove(queue, &waiter->node)) {
+    waiter->queued = false;
+    return ETIMEDOUT;
+  }
+  // The waiter has been detached by a concurrent DequeueAllWaiters, which is
+  // about to wake it.
+  WaitUntilDequeued(waiter, lock);
+  return 0;
 }
 
-// Returns whether the given |list| contains |thread_id|.
-bool pthread_list_contains(const __pthread_list_t &list, pthread_t thread_id) {
-  __pthread_list_node_t *current = list._first;
-  while (current) {
-    if (current->_thread_id == thread_id) {
-      return true;
+// Dequeues and wakes every thread waiting in |queue|. |lock| guards |queue|; it
+// must be held on entry, is released while the wakes are issued, and is held
+// again on return. Threads queued after the call started are not woken.
+void DequeueAllWaiters(__pthread_list_t *queue, pthread_spinlock_t *lock) {
+  // The current waiters are moved to a private list and dequeued in batches,
+  // so that the wakes, which require exits, are issued without holding |lock|.
+  constexpr int kBatchSize = 16;
+  int32_t *wait_words[kBatchSize];
+  __pthread_list_t waking = *queue;
+  *queue = PTHREAD_LIST_INITIALIZER;
+  while (pthread_list_first(waking) != PTHREAD_T_NULL) {
+    int count = 0;
+    while (count < kBatchSize && pthread_list_first(waking) != PTHREAD_T_NULL) {
+      int32_t *wait_word = DequeueWaiter(&waking);
+      if (wait_word) {
+        wait_words[count++] = wait_word;
+      }
     }
-    current = current->_next;
+    pthread_spin_unlock(lock);
+
+    for (int i = 0; i < count; ++i) {
+      WakeWaiter(wait_words[i]);
+    }
+    pthread_spin_lock(lock);
+  }
+}
+
+// Validates the CLOCK_REALTIME deadline |abstime| and stores it in |deadline|.
+// A deadline too far away to be represented is treated as no deadline, and is
+// stored as nullptr. Returns EINVAL if |abstime| is malformed.
+int check_deadline(const struct timespec *abstime,
+                   const struct timespec **deadline) {
+  if (!abstime || abstime->tv_nsec < 0 || abstime->tv_nsec >= 1000000000) {
+    return EINVAL;
   }
-  return false;
+  *deadline = asylo::IsRepresentableAsNanoseconds(abstime) ? abstime : nullptr;
+  return 0;
 }
 
 int pthread_mutex_check_parameter(pthread_mutex_t *mutex) {
@@ -212,8 +399,8 @@ int pthread_mutex_check_parameter(pthread_mutex_t *mutex) {
   return 0;
 }
 
-// Returns locks the mutex and returns 0 if possible. Returns EBUSY if the mutex
-// is taken.
+// Locks the mutex and returns 0 if possible. Returns EBUSY if the mutex is
+// taken.
 int pthread_mutex_lock_internal(pthread_mutex_t *mutex) {
   pthread_t self = pthread_self();
 
@@ -222,13 +409,7 @@ int pthread_mutex_lock_internal(pthread_mutex_t *mutex) {
     return 0;
   }
 
-  pthread_t first_waiter = pthread_list_first(mutex->_queue);
-  if (mutex->_owner == PTHREAD_T_NULL &&
-      (first_waiter == self || first_waiter == PTHREAD_T_NULL)) {
-    if (first_waiter == self) {
-      pthread_list_remove_first(&mutex->_queue);
-    }
-
+  if (mutex->_owner == PTHREAD_T_NULL) {
     mutex->_owner = self;
     mutex->_refcount++;
     return 0;
@@ -237,6 +418,137 @@ int pthread_mutex_lock_internal(pthread_mutex_t *mutex) {
   return EBUSY;
 }
 
+// Implements pthread_cond_wait, and pthread_cond_timedwait if |deadline| is not
+// nullptr.
+int pthread_cond_wait_internal(pthread_cond_t *cond, pthread_mutex_t *mutex,
+                               const struct timespec *deadline) {
+  int ret = check_parameter<pthread_cond_t>(cond);
+  if (ret != 0) {
+    return ret;
+  }
+
+  ret = pthread_mutex_check_parameter(mutex);
+  if (ret != 0) {
+    return ret;
+  }
+
+  pthread_t self = pthread_self();
+  if (mutex->_owner != self) {
+    return EPERM;
+  }
+
+  // The thread is queued before |mutex| is released so that a signal sent by
+  // a thread that acquires |mutex| afterwards is not missed.
+  Waiter *waiter = GetCurrentWaiter();
+  pthread_spin_lock(&cond->_lock);
+  EnqueueWaiter(waiter, &cond->_queue);
+  pthread_spin_unlock(&cond->_lock);
+
+  ret = pthread_mutex_unlock(mutex);
+  if (ret != 0) {
+    abort();
+  }
+
+  pthread_spin_lock(&cond->_lock);
+  ret = WaitUntilDequeuedOrTimeout(waiter, &cond->_queue, &cond->_lock,
+                                   deadline);
+  pthread_spin_unlock(&cond->_lock);
+
+  int lock_ret = pthread_mutex_lock(mutex);
+  return lock_ret != 0 ? lock_ret : ret;
+}
+
+// Implements the read-lock functions, waiting until the CLOCK_REALTIME time
+// |deadline| if it is not nullptr. Readers wait while a writer holds or is
+// waiting for |rwlock|, so that a stream of readers cannot starve writers.
+int pthread_rwlock_rdlock_internal(pthread_rwlock_t *rwlock,
+                                   const struct timespec *deadline) {
+  int ret = check_parameter<pthread_rwlock_t>(rwlock);
+  if (ret != 0) {
+    return ret;
+  }
+
+  pthread_spin_lock(&rwlock->_lock);
+  while (ret == 0 && (rwlock->_write_owner != PTHREAD_T_NULL ||
+                      rwlock->_writers_waiting > 0)) {
+    Waiter *waiter = GetCurrentWaiterLocked(&rwlock->_lock);
+    if (waiter) {
+      EnqueueWaiter(waiter, &rwlock->_reader_queue);
+      ret = WaitUntilDequeuedOrTimeout(waiter, &rwlock->_reader_queue,
+                                       &rwlock->_lock, deadline);
+    }
+  }
+  if (ret == 0) {
+    ++rwlock->_reader_count;
+  }
+  pthread_spin_unlock(&rwlock->_lock);
+  return ret;
+}
+
+// Implements the write-lock functions, waiting until the CLOCK_REALTIME time
+// |deadline| if it is not nullptr.
+int pthread_rwlock_wrlock_internal(pthread_rwlock_t *rwlock,
+                                   const struct timespec *deadline) {
+  int ret = check_parameter<pthread_rwlock_t>(rwlock);
+  if (ret != 0) {
+    return ret;
+  }
+
+  pthread_t self = pthread_self();
+  pthread_spin_lock(&rwlock->_lock);
+  if (rwlock->_write_owner == self) {
+    pthread_spin_unlock(&rwlock->_lock);
+    return EDEADLK;
+  }
+
+  ++rwlock->_writers_waiting;
+  while (ret == 0 && (rwlock->_write_owner != PTHREAD_T_NULL ||
+                      rwlock->_reader_count > 0)) {
+    Waiter *waiter = GetCurrentWaiterLocked(&rwlock->_lock);
+    if (waiter) {
+      EnqueueWaiter(waiter, &rwlock->_writer_queue);
+      ret = WaitUntilDequeuedOrTimeout(waiter, &rwlock->_writer_queue,
+                                       &rwlock->_lock, deadline);
+    }
+  }
+  --rwlock->_writers_waiting;
+
+  if (ret == 0) {
+    rwlock->_write_owner = self;
+  } else if (rwlock->_writers_waiting == 0 &&
+             rwlock->_write_owner == PTHREAD_T_NULL) {
+    // This was the last writer holding the waiting readers back.
+    DequeueAllWaiters(&rwlock->_reader_queue, &rwlock->_lock);
+  }
+  pthread_spin_unlock(&rwlock->_lock);
+  return ret;
+}
+
+// Implements sem_wait and sem_timedwait, waiting until the CLOCK_REALTIME time
+// |deadline| if it is not nullptr. Returns an errno value rather than setting
+// errno.
+int sem_wait_internal(sem_t *sem, const struct timespec *deadline) {
+  int ret = check_parameter<sem_t>(sem);
+  if (ret != 0) {
+    return ret;
+  }
+
+  pthread_spin_lock(&sem->_lock);
+  while (ret == 0 && sem->_value == 0) {
+    Waiter *waiter = GetCurrentWaiterLocked(&sem->_lock);
+    if (waiter) {
+      EnqueueWaiter(waiter, &sem->_queue);
+      ret = WaitUntilDequeuedOrTimeout(waiter, &sem->_queue, &sem->_lock,
+                                       deadline);
+    }
+  }
+  if (ret == 0) {
+    --sem->_value;
+  }
+  pthread_spin_unlock(&sem->_lock);
+  return ret;
+}
+
 }  //  namespace
 
 using asylo::ThreadManager;
@@ -260,6 +572,11 @@ int pthread_join(pthread_t thread, void **value_ptr) {
   return thread_manager->JoinThread(thread, value_ptr);
 }
 
+int pthread_detach(pthread_t thread) {
+  ThreadManager *thread_manager = ThreadManager::GetInstance();
+  return thread_manager->DetachThread(thread);
+}
+
 int pthread_key_create(pthread_key_t *key, void (*destructor)(void *)) {
   static pthread_key_t next_key = 0;
   static pthread_mutex_t next_key_lock = PTHREAD_MUTEX_INITIALIZER;
@@ -335,17 +652,16 @@ int pthread_mutex_lock(pthread_mutex_t *mutex) {
     return ret;
   }
 
-  while (true) {
-    {
-      SpinLock lock(&mutex->_lock);
-      ret = pthread_mutex_lock_internal(mutex);
-    }
-    if (ret == 0) {
-      return ret;
+  pthread_spin_lock(&mutex->_lock);
+  while (pthread_mutex_lock_internal(mutex) != 0) {
+    Waiter *waiter = GetCurrentWaiterLocked(&mutex->_lock);
+    if (waiter) {
+      EnqueueWaiter(waiter, &mutex->_queue);
+      WaitUntilDequeued(waiter, &mutex->_lock);
     }
-
-    enc_pause();
   }
+  pthread_spin_unlock(&mutex->_lock);
+  return 0;
 }
 
 int pthread_mutex_trylock(pthread_mutex_t *mutex) {
@@ -369,22 +685,29 @@ int pthread_mutex_unlock(pthread_mutex_t *mutex) {
   }
 
   pthread_t self = pthread_self();
+  int32_t *wait_word = nullptr;
 
-  SpinLock lock(&mutex->_lock);
+  {
+    SpinLock lock(&mutex->_lock);
 
-  if (mutex->_owner == PTHREAD_T_NULL) {
-    return EINVAL;
-  }
+    if (mutex->_owner == PTHREAD_T_NULL) {
+      return EINVAL;
+    }
 
-  if (mutex->_owner != self) {
-    return EPERM;
-  }
+    if (mutex->_owner != self) {
+      return EPERM;
+    }
 
-  --mutex->_refcount;
-  if (mutex->_refcount == 0) {
-    mutex->_owner = PTHREAD_T_NULL;
+    --mutex->_refcount;
+    if (mutex->_refcount == 0) {
+      mutex->_owner = PTHREAD_T_NULL;
+      if (pthread_list_first(mutex->_queue) != PTHREAD_T_NULL) {
+        wait_word = DequeueWaiter(&mutex->_queue);
+      }
+    }
   }
 
+  WakeWaiter(wait_word);
   return 0;
 }
 
@@ -435,88 +758,291 @@ int pthread_cond_destroy(pthread_cond_t *cond) {
 // Blocks until the given |cond| is signaled or broadcasted. |mutex| must  be
 // locked before called, and will be locked on return.
 int pthread_cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex) {
-  int ret = check_parameter<pthread_cond_t>(cond);
+  return pthread_cond_wait_internal(cond, mutex, nullptr);
+}
+
+// Same as pthread_cond_wait, but returns ETIMEDOUT if |cond| has not been
+// signaled or broadcasted by the CLOCK_REALTIME time |abstime|.
+int pthread_cond_timedwait(pthread_cond_t *cond, pthread_mutex_t *mutex,
+                           const struct timespec *abstime) {
+  const struct timespec *deadline;
+  int ret = check_deadline(abstime, &deadline);
   if (ret != 0) {
     return ret;
   }
+  return pthread_cond_wait_internal(cond, mutex, deadline);
+}
 
-  ret = check_parameter<pthread_mutex_t>(mutex);
+int pthread_condattr_init(pthread_condattr_t *attr) { return 0; }
+
+int pthread_condattr_destroy(pthread_condattr_t *attr) { return 0; }
+
+// Wakes the first waiting thread on |cond|.
+int pthread_cond_signal(pthread_cond_t *cond) {
+  int ret = check_parameter<pthread_cond_t>(cond);
   if (ret != 0) {
     return ret;
   }
 
-  pthread_t self = pthread_self();
-
+  int32_t *wait_word = nullptr;
   pthread_spin_lock(&cond->_lock);
-  if (!pthread_list_contains(cond->_queue, self)) {
-    pthread_list_insert_last(&cond->_queue, self);
+  if (pthread_list_first(cond->_queue) != PTHREAD_T_NULL) {
+    wait_word = DequeueWaiter(&cond->_queue);
   }
+  pthread_spin_unlock(&cond->_lock);
 
-  ret = pthread_mutex_unlock(mutex);
+  WakeWaiter(wait_word);
+  return 0;
+}
+
+// Wakes all the waiting threads on |cond|.
+int pthread_cond_broadcast(pthread_cond_t *cond) {
+  int ret = check_parameter<pthread_cond_t>(cond);
   if (ret != 0) {
-    pthread_spin_unlock(&cond->_lock);
     return ret;
   }
 
-  while (true) {
-    pthread_spin_unlock(&cond->_lock);
-    enc_pause();
-    pthread_spin_lock(&cond->_lock);
+  pthread_spin_lock(&cond->_lock);
+  DequeueAllWaiters(&cond->_queue, &cond->_lock);
+  pthread_spin_unlock(&cond->_lock);
+  return 0;
+}
 
-    if (!pthread_list_contains(cond->_queue, self)) {
-      break;
-    }
+int pthread_rwlockattr_init(pthread_rwlockattr_t *attr) { return 0; }
+
+int pthread_rwlockattr_destroy(pthread_rwlockattr_t *attr) { return 0; }
+
+// Initializes |rwlock|, |attr| is unused.
+int pthread_rwlock_init(pthread_rwlock_t *rwlock,
+                        const pthread_rwlockattr_t *attr) {
+  int ret = check_parameter<pthread_rwlock_t>(rwlock);
+  if (ret != 0) {
+    return ret;
   }
 
-  pthread_spin_unlock(&cond->_lock);
-  return pthread_mutex_lock(mutex);
+  *rwlock = PTHREAD_RWLOCK_INITIALIZER;
+  return 0;
 }
 
-int pthread_cond_timedwait(pthread_cond_t *cond, pthread_mutex_t *mutex,
-                           const struct timespec *abstime) {
+// Destroys |rwlock|, returns error if |rwlock| is held or there are threads
+// waiting on it.
+int pthread_rwlock_destroy(pthread_rwlock_t *rwlock) {
+  int ret = check_parameter<pthread_rwlock_t>(rwlock);
+  if (ret != 0) {
+    return ret;
+  }
+
+  SpinLock spin_lock(&rwlock->_lock);
+  if (rwlock->_write_owner != PTHREAD_T_NULL || rwlock->_reader_count > 0 ||
+      rwlock->_writers_waiting > 0 ||
+      pthread_list_first(rwlock->_reader_queue) != PTHREAD_T_NULL) {
+    return EBUSY;
+  }
   return 0;
 }
 
-int pthread_condattr_init(pthread_condattr_t *attr) { return 0; }
+// Locks |rwlock| for reading.
+int pthread_rwlock_rdlock(pthread_rwlock_t *rwlock) {
+  return pthread_rwlock_rdlock_internal(rwlock, nullptr);
+}
 
-int pthread_condattr_destroy(pthread_condattr_t *attr) { return 0; }
+// Locks |rwlock| for reading, or returns ETIMEDOUT if that is not possible by
+// the CLOCK_REALTIME time |abstime|.
+int pthread_rwlock_timedrdlock(pthread_rwlock_t *rwlock,
+                               const struct timespec *abstime) {
+  const struct timespec *deadline;
+  int ret = check_deadline(abstime, &deadline);
+  if (ret != 0) {
+    return ret;
+  }
+  return pthread_rwlock_rdlock_internal(rwlock, deadline);
+}
 
-// Wakes the first waiting thread on |cond|.
-int pthread_cond_signal(pthread_cond_t *cond) {
-  int ret = check_parameter<pthread_cond_t>(cond);
+int pthread_rwlock_tryrdlock(pthread_rwlock_t *rwlock) {
+  int ret = check_parameter<pthread_rwlock_t>(rwlock);
   if (ret != 0) {
     return ret;
   }
 
-  pthread_spin_lock(&cond->_lock);
-  pthread_t first = pthread_list_first(cond->_queue);
-  if (first == PTHREAD_T_NULL) {
-    pthread_spin_unlock(&cond->_lock);
-    return 0;
+  SpinLock spin_lock(&rwlock->_lock);
+  if (rwlock->_write_owner != PTHREAD_T_NULL || rwlock->_writers_waiting > 0) {
+    return EBUSY;
   }
+  ++rwlock->_reader_count;
+  return 0;
+}
 
-  pthread_list_remove_first(&cond->_queue);
+// Locks |rwlock| for writing.
+int pthread_rwlock_wrlock(pthread_rwlock_t *rwlock) {
+  return pthread_rwlock_wrlock_internal(rwlock, nullptr);
+}
 
-  pthread_spin_unlock(&cond->_lock);
+// Locks |rwlock| for writing, or returns ETIMEDOUT if that is not possible by
+// the CLOCK_REALTIME time |abstime|.
+int pthread_rwlock_timedwrlock(pthread_rwlock_t *rwlock,
+                               const struct timespec *abstime) {
+  const struct timespec *deadline;
+  int ret = check_deadline(abstime, &deadline);
+  if (ret != 0) {
+    return ret;
+  }
+  return pthread_rwlock_wrlock_internal(rwlock, deadline);
+}
 
+int pthread_rwlock_trywrlock(pthread_rwlock_t *rwlock) {
+  int ret = check_parameter<pthread_rwlock_t>(rwlock);
+  if (ret != 0) {
+    return ret;
+  }
 
+  SpinLock spin_lock(&rwlock->_lock);
+  if (rwlock->_write_owner != PTHREAD_T_NULL || rwlock->_reader_count > 0) {
+    return EBUSY;
+  }
+  rwlock->_write_owner = pthread_self();
   return 0;
 }
 
-// Wakes all the waiting threads on |cond|.
-int pthread_cond_broadcast(pthread_cond_t *cond) {
-  int ret = check_parameter<pthread_cond_t>(cond);
+// Releases |rwlock|, held either for reading or for writing. The last holder
+// to leave wakes one waiting writer if there is one, and all waiting readers
+// otherwise.
+int pthread_rwlock_unlock(pthread_rwlock_t *rwlock) {
+  int ret = check_parameter<pthread_rwlock_t>(rwlock);
   if (ret != 0) {
     return ret;
   }
 
-  pthread_spin_lock(&cond->_lock);
+  int32_t *wait_word = nullptr;
+  pthread_spin_lock(&rwlock->_lock);
+  if (rwlock->_write_owner != PTHREAD_T_NULL) {
+    if (rwlock->_write_owner != pthread_self()) {
+      pthread_spin_unlock(&rwlock->_lock);
+      return EPERM;
+    }
+    rwlock->_write_owner = PTHREAD_T_NULL;
+  } else if (rwlock->_reader_count > 0) {
+    --rwlock->_reader_count;
+  } else {
+    pthread_spin_unlock(&rwlock->_lock);
+    return EPERM;
+  }
 
-  while (pthread_list_first(cond->_queue) != PTHREAD_T_NULL) {
-    pthread_list_remove_first(&cond->_queue);
+  if (rwlock->_write_owner == PTHREAD_T_NULL && rwlock->_reader_count == 0) {
+    if (pthread_list_first(rwlock->_writer_queue) != PTHREAD_T_NULL) {
+      wait_word = DequeueWaiter(&rwlock->_writer_queue);
+    } else if (rwlock->_writers_waiting == 0) {
+      DequeueAllWaiters(&rwlock->_reader_queue, &rwlock->_lock);
+    }
   }
+  pthread_spin_unlock(&rwlock->_lock);
+  WakeWaiter(wait_word);
+  return 0;
+}
 
-  pthread_spin_unlock(&cond->_lock);
+// Functions available via <semaphore.h>
+
+int sem_init(sem_t *sem, int pshared, unsigned int value) {
+  int ret = check_parameter<sem_t>(sem);
+  if (ret == 0 && (pshared != 0 || value > SEM_VALUE_MAX)) {
+    ret = pshared != 0 ? ENOSYS : EINVAL;
+  }
+  if (ret != 0) {
+    errno = ret;
+    return -1;
+  }
+
+  sem->_lock = PTHREAD_SPINLOCK_INITIALIZER;
+  sem->_value = value;
+  sem->_queue = PTHREAD_LIST_INITIALIZER;
+  return 0;
+}
+
+int sem_destroy(sem_t *sem) {
+  int ret = check_parameter<sem_t>(sem);
+  if (ret != 0) {
+    errno = ret;
+    return -1;
+  }
+
+  SpinLock spin_lock(&sem->_lock);
+  if (pthread_list_first(sem->_queue) != PTHREAD_T_NULL) {
+    errno = EBUSY;
+    return -1;
+  }
+  return 0;
+}
+
+int sem_wait(sem_t *sem) {
+  int ret = sem_wait_internal(sem, nullptr);
+  if (ret != 0) {
+    errno = ret;
+    return -1;
+  }
+  return 0;
+}
+
+int sem_timedwait(sem_t *sem, const struct timespec *abstime) {
+  const struct timespec *deadline;
+  int ret = check_deadline(abstime, &deadline);
+  if (ret == 0) {
+    ret = sem_wait_internal(sem, deadline);
+  }
+  if (ret != 0) {
+    errno = ret;
+    return -1;
+  }
+  return 0;
+}
+
+int sem_trywait(sem_t *sem) {
+  int ret = check_parameter<sem_t>(sem);
+  if (ret != 0) {
+    errno = ret;
+    return -1;
+  }
+
+  SpinLock spin_lock(&sem->_lock);
+  if (sem->_value == 0) {
+    errno = EAGAIN;
+    return -1;
+  }
+  --sem->_value;
+  return 0;
+}
+
+// Increments |sem| and wakes one waiting thread, if any.
+int sem_post(sem_t *sem) {
+  int ret = check_parameter<sem_t>(sem);
+  if (ret != 0) {
+    errno = ret;
+    return -1;
+  }
+
+  int32_t *wait_word = nullptr;
+  {
+    SpinLock spin_lock(&sem->_lock);
+    if (sem->_value >= SEM_VALUE_MAX) {
+      errno = EOVERFLOW;
+      return -1;
+    }
+    ++sem->_value;
+    if (pthread_list_first(sem->_queue) != PTHREAD_T_NULL) {
+      wait_word = DequeueWaiter(&sem->_queue);
+    }
+  }
+  WakeWaiter(wait_word);
+  return 0;
+}
+
+int sem_getvalue(sem_t *sem, int *value) {
+  int ret = check_parameter<sem_t>(sem);
+  if (ret != 0) {
+    errno = ret;
+    return -1;
+  }
+
+  SpinLock spin_lock(&sem->_lock);
+  *value = static_cast<int>(sem->_value);
   return 0;
 }
 
@@ -19,6 +19,7 @@
 #include "asylo/platform/posix/threading/thread_manager.h"
 
 #include <algorithm>
+#include <cerrno>
 #include <cstdlib>
 #include <memory>
 
@@ -30,6 +31,7 @@ namespace asylo {
 ThreadManager::Thread::Thread() {
   this->lock = PTHREAD_MUTEX_INITIALIZER;
   this->state_change_cond = PTHREAD_COND_INITIALIZER;
+  this->detached = false;
 }
 
 int ThreadManager::Thread::UpdateThreadState(pthread_t thread_id,
@@ -50,6 +52,7 @@ int ThreadManager::Thread::UpdateThreadState(pthread_t thread_id,
 ThreadManager::ThreadManager() {
   this->threads_lock_ = PTHREAD_MUTEX_INITIALIZER;
   this->scheduled_lock_ = PTHREAD_MUTEX_INITIALIZER;
+  this->pool_cond_ = PTHREAD_COND_INITIALIZER;
 }
 
 ThreadManager *ThreadManager::GetInstance() {
@@ -58,7 +61,7 @@ ThreadManager *ThreadManager::GetInstance() {
 }
 
 std::shared_ptr<ThreadManager::Thread> ThreadManager::QueueThread(
-    const std::function<void *(void *)> &function, void *arg) {
+    const std::function<void *(void *)> &function, void *arg, bool *reused) {
   LockQueuedThreads();
   queued_threads_.emplace(std::make_shared<Thread>());
   std::shared_ptr<Thread> thread = queued_threads_.back();
@@ -71,6 +74,19 @@ std::shared_ptr<ThreadManager::Thread> ThreadManager::QueueThread(
   thread->start_routine = function;
   thread->arg = arg;
   thread->lock = PTHREAD_MUTEX_INITIALIZER;
+
+  // Hand the start_routine to an idle pooled thread if one is not already
+  // claimed by an earlier start_routine.
+  *reused = idle_threads_ > static_cast<int>(pending_wakeups_);
+  if (*reused) {
+    ++pending_wakeups_;
+    ++reused_threads_;
+    if (pthread_cond_signal(&pool_cond_) != 0) {
+      abort();
+    }
+  } else {
+    ++donated_threads_;
+  }
   UnlockQueuedThreads();
   return thread;
 }
@@ -78,7 +94,8 @@ std::shared_ptr<ThreadManager::Thread> ThreadManager::QueueThread(
 int ThreadManager::CreateThread(const std::function<void *(void *)> &function,
                                 void *arg, pthread_t *thread_id) {
   // Add thread entry point to queue of waiting jobs.
-  std::shared_ptr<Thread> thread = QueueThread(function, arg);
+  bool reused;
+  std::shared_ptr<Thread> thread = QueueThread(function, arg, &reused);
   if (!thread) {
     return -1;
   }
@@ -87,8 +104,9 @@ int ThreadManager::CreateThread(const std::function<void *(void *)> &function,
     return ret;
   }
 
-  // Exit and create a thread to enter with EnterAndDonateThread().
-  if (enc_untrusted_create_thread(GetEnclaveName().c_str())) {
+  // Exit and create a thread to enter with EnterAndDonateThread(), unless an
+  // idle pooled thread has been woken to run the job.
+  if (!reused && enc_untrusted_create_thread(GetEnclaveName().c_str())) {
     return -1;
   }
 
@@ -108,22 +126,65 @@ int ThreadManager::CreateThread(const std::function<void *(void *)> &function,
 
 int ThreadManager::StartThread() {
   LockQueuedThreads();
-  // If there are no jobs waiting to be executed, abort.
-  if (queued_threads_.empty()) {
-    UnlockQueuedThreads();
-    abort();
+  // A donated thread runs the first job not handed to an idle pooled thread.
+  // If there is none, it was donated to the pool. Otherwise, abort.
+  bool pooled = false;
+  if (queued_threads_.size() <= pending_wakeups_) {
+    if (pending_pool_threads_ == 0) {
+      UnlockQueuedThreads();
+      abort();
+    }
+    --pending_pool_threads_;
+    pooled = true;
   }
 
-  LockThreadsList();
-  // Move Thread from queued_threads_ onto threads_.
-  std::shared_ptr<Thread> thread = AllocateThread(queued_threads_.front());
-  queued_threads_.pop();
-  UnlockQueuedThreads();
-  UnlockThreadsList();
-  if (!thread) {
-    return -1;
+  while (true) {
+    if (pooled) {
+      // Wait until a job is handed to an idle pooled thread.
+      ++idle_threads_;
+      while (pending_wakeups_ == 0 && !pool_stopped_) {
+        if (pthread_cond_wait(&pool_cond_, &scheduled_lock_)) {
+          abort();
+        }
+      }
+      --idle_threads_;
+      if (pending_wakeups_ == 0) {
+        --pool_threads_;
+        UnlockQueuedThreads();
+        return 0;
+      }
+      --pending_wakeups_;
+    }
+
+    LockThreadsList();
+    // Move Thread from queued_threads_ onto threads_.
+    std::shared_ptr<Thread> thread = AllocateThread(queued_threads_.front());
+    queued_threads_.pop();
+    UnlockQueuedThreads();
+    UnlockThreadsList();
+    if (!thread) {
+      return -1;
+    }
+
+    int ret = RunThread(thread);
+    if (ret != 0) {
+      return ret;
+    }
+
+    // Stay in the pool if it has room for this thread, otherwise leave.
+    LockQueuedThreads();
+    if (!pooled && !pool_stopped_ && pool_threads_ < max_pool_threads_) {
+      ++pool_threads_;
+      pooled = true;
+    }
+    if (!pooled) {
+      UnlockQueuedThreads();
+      return 0;
+    }
   }
+}
 
+int ThreadManager::RunThread(const std::shared_ptr<Thread> &thread) {
   pthread_t self = pthread_self();
   int ret = thread->UpdateThreadState(self, Thread::ThreadState::RUNNING);
   if (ret != 0) {
@@ -138,18 +199,18 @@ int ThreadManager::StartThread() {
     return ret;
   }
 
-  // Wait until the thread is joined.
+  // Wait until the thread is joined or detached.
   ret = pthread_mutex_lock(&thread->lock);
   if (ret != 0) {
     return ret;
   }
-  while (thread->state != Thread::ThreadState::JOINED) {
+  while (thread->state != Thread::ThreadState::JOINED && !thread->detached) {
     if (pthread_cond_wait(&thread->state_change_cond, &thread->lock)) {
       abort();
     }
   }
 
-  return 0;
+  return pthread_mutex_unlock(&thread->lock);
 }
 
 int ThreadManager::JoinThread(pthread_t thread_id, void **return_value) {
@@ -165,6 +226,10 @@ int ThreadManager::JoinThread(pthread_t thread_id, void **return_value) {
   if (ret != 0) {
     return ret;
   }
+  if (thread->detached) {
+    pthread_mutex_unlock(&thread->lock);
+    return EINVAL;
+  }
   while (thread->state != Thread::ThreadState::DONE) {
     if (pthread_cond_wait(&thread->state_change_cond, &thread->lock)) {
       abort();
@@ -188,6 +253,67 @@ int ThreadManager::JoinThread(pthread_t thread_id, void **return_value) {
   return 0;
 }
 
+int ThreadManager::DetachThread(pthread_t thread_id) {
+  LockThreadsList();
+  std::shared_ptr<Thread> thread = GetThread(thread_id);
+  UnlockThreadsList();
+  if (!thread) {
+    return ESRCH;
+  }
+
+  int ret = pthread_mutex_lock(&thread->lock);
+  if (ret != 0) {
+    return ret;
+  }
+  thread->detached = true;
+  ret = pthread_cond_broadcast(&thread->state_change_cond);
+  if (ret != 0) {
+    return ret;
+  }
+  return pthread_mutex_unlock(&thread->lock);
+}
+
+int ThreadManager::StartThreadPool(int min_threads, int max_threads) {
+  LockQueuedThreads();
+  max_pool_threads_ = std::max(min_threads, max_threads);
+  pool_stopped_ = false;
+  pending_pool_threads_ += min_threads;
+  pool_threads_ += min_threads;
+  UnlockQueuedThreads();
+
+  for (int i = 0; i < min_threads; ++i) {
+    if (enc_untrusted_create_thread(GetEnclaveName().c_str())) {
+      LockQueuedThreads();
+      pending_pool_threads_ -= min_threads - i;
+      pool_threads_ -= min_threads - i;
+      UnlockQueuedThreads();
+      return -1;
+    }
+  }
+  return 0;
+}
+
+void ThreadManager::StopThreadPool() {
+  LockQueuedThreads();
+  pool_stopped_ = true;
+  max_pool_threads_ = 0;
+  if (pthread_cond_broadcast(&pool_cond_) != 0) {
+    abort();
+  }
+  UnlockQueuedThreads();
+}
+
+ThreadManager::ThreadPoolStats ThreadManager::GetThreadPoolStats() {
+  LockQueuedThreads();
+  ThreadPoolStats stats;
+  stats.reused = reused_threads_;
+  stats.donated = donated_threads_;
+  stats.pool_threads = pool_threads_;
+  stats.idle_threads = idle_threads_;
+  UnlockQueuedThreads();
+  return stats;
+}
+
 std::shared_ptr<ThreadManager::Thread> ThreadManager::AllocateThread(
     std::shared_ptr<Thread> thread) {
   pthread_t thread_id = pthread_self();
@@ -20,6 +20,7 @@
 #define ASYLO_PLATFORM_POSIX_THREADING_THREAD_MANAGER_H_
 
 #include <pthread.h>
+#include <cstdint>
 #include <functional>
 #include <memory>
 #include <queue>
@@ -30,8 +31,26 @@ namespace asylo {
 
 // ThreadManager class is a singleton responsible for:
 // - Maintaining a queue of thread start_routine functions.
+// - Maintaining a pool of donated threads which stay inside the enclave between
+//   start_routines, so that creating a thread does not require an exit.
 class ThreadManager {
  public:
+  // Statistics on the use of the thread pool by CreateThread().
+  struct ThreadPoolStats {
+    // Number of threads created by handing the start_routine to an idle pooled
+    // thread.
+    uint64_t reused;
+
+    // Number of threads created by donating a new thread to the enclave.
+    uint64_t donated;
+
+    // Number of threads in the pool, either running a start_routine or idle.
+    int pool_threads;
+
+    // Number of pooled threads waiting for a start_routine.
+    int idle_threads;
+  };
+
   static ThreadManager *GetInstance();
 
   // Adds the given |function| to a start_routine queue of functions waiting to
@@ -49,6 +68,24 @@ class ThreadManager {
   // |return_value|.
   int JoinThread(pthread_t thread_id, void **return_value);
 
+  // Marks |thread_id| as detached, so that it does not wait to be joined once
+  // its start_routine returns and can go back to the pool right away. Returns 0
+  // on success, or ESRCH if there is no such thread.
+  int DetachThread(pthread_t thread_id);
+
+  // Donates |min_threads| threads to the pool. A thread that has run a
+  // start_routine and been joined stays in the pool while the pool holds fewer
+  // than |max_threads| threads, and otherwise leaves the enclave. Returns 0 on
+  // success, or -1 if a thread could not be donated.
+  int StartThreadPool(int min_threads, int max_threads);
+
+  // Releases the idle pooled threads and stops retaining threads. Threads
+  // running a start_routine leave the enclave once they are joined.
+  void StopThreadPool();
+
+  // Returns statistics on the use of the thread pool.
+  ThreadPoolStats GetThreadPoolStats();
+
  private:
   ThreadManager();
   ThreadManager(ThreadManager const &) = delete;
@@ -75,15 +112,24 @@ class ThreadManager {
     pthread_t thread_id;
     ThreadState state;
 
+    // Whether pthread_detach() has been called for the thread.
+    bool detached;
+
     // Requires lock is held. Updates the state and broadcasts to
     // state_change_cond and releases the lock.
     int UpdateThreadState(pthread_t thread_id, ThreadState state);
   };
 
   // Creates a Thread for the given parameters, adds it to the queued_threads_
-  // queue then returns a pointer to it.
+  // queue then returns a pointer to it. Sets |reused| to whether an idle pooled
+  // thread has been woken to run it, in which case no thread needs to be
+  // donated.
   std::shared_ptr<Thread> QueueThread(
-      const std::function<void *(void *)> &function, void *arg);
+      const std::function<void *(void *)> &function, void *arg, bool *reused);
+
+  // Runs the start_routine of |thread| and waits until it is joined or
+  // detached.
+  int RunThread(const std::shared_ptr<Thread> &thread);
 
   // Adds given |thread| to the threads_ list, sets its state to RUNNING, and
   // returns its thread_id.
@@ -113,6 +159,36 @@ class ThreadManager {
   // a refcount instead of using a mutex.
   std::queue<std::shared_ptr<Thread>> queued_threads_;
 
+  // The following members describe the thread pool and are guarded by
+  // scheduled_lock_.
+
+  // Signaled when a start_routine is handed to an idle pooled thread, or when
+  // the pool is stopped.
+  pthread_cond_t pool_cond_;
+
+  // Number of start_routines in queued_threads_ handed to idle pooled threads
+  // that have not yet dequeued them.
+  size_t pending_wakeups_ = 0;
+
+  // Number of threads donated to the pool that have not yet entered.
+  int pending_pool_threads_ = 0;
+
+  // Number of threads in the pool, including pending_pool_threads_.
+  int pool_threads_ = 0;
+
+  // Number of pooled threads waiting for a start_routine.
+  int idle_threads_ = 0;
+
+  // Maximum number of threads retained by the pool.
+  int max_pool_threads_ = 0;
+
+  // Whether StopThreadPool() has been called.
+  bool pool_stopped_ = false;
+
+  // Counters reported by GetThreadPoolStats().
+  uint64_t reused_threads_ = 0;
+  uint64_t donated_threads_ = 0;
+
   // Guards threads_.
   pthread_mutex_t threads_lock_;
 
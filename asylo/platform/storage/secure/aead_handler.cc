@@ -22,14 +22,21 @@
 
 // IO syscall interface constants.
 #include <fcntl.h>
+#include <sys/stat.h>
+#include <time.h>
 
+#include <algorithm>
 #include <iomanip>
+#include <limits>
+#include <tuple>
+#include <utility>
 
 #include "absl/strings/escaping.h"
 #include "absl/synchronization/mutex.h"
 #include "asylo/crypto/util/byte_container_view.h"
 #include "asylo/crypto/util/bytes.h"
 #include "asylo/platform/arch/include/trusted/host_calls.h"
+#include "asylo/platform/storage/secure/block_worker_pool.h"
 #include "asylo/platform/storage/utils/fd_closer.h"
 
 namespace asylo {
@@ -41,6 +48,11 @@ using crypto::gcmlib::GcmCryptorRegistry;
 
 namespace {
 
+// Number of runs of blocks handed to each thread processing a read or write in
+// parallel. More runs than threads balance the load when some threads start
+// late or are unavailable.
+constexpr size_t kBlockRunsPerThread = 4;
+
 // Perform a weak validation that the path is canonical.
 bool IsPathNameValid(const char* path_name) {
   return path_name && strlen(path_name) && path_name[0] == '/';
@@ -48,6 +60,12 @@ bool IsPathNameValid(const char* path_name) {
 
 bool is_transient_error(int err) { return (err == EAGAIN) || (err == EINTR); }
 
+int64_t MonotonicNanoseconds() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return static_cast<int64_t>(now.tv_sec) * 1000000000 + now.tv_nsec;
+}
+
 // Returns -1 on failure, or min(|len|, bytes to EOF) on success.
 ssize_t read_all(int fd, void* buf, size_t len) {
   size_t bytes_to_read = len;
@@ -73,16 +91,18 @@ ssize_t read_all(int fd, void* buf, size_t len) {
   return offset;
 }
 
-// Returns -1 on failure, or |len| on success.
-ssize_t write_all(int fd, const void* buf, size_t len) {
+// Writes at |file_offset| without moving the cursor of |fd|. Returns -1 on
+// failure, or |len| on success.
+ssize_t pwrite_all(int fd, const void* buf, size_t len, off_t file_offset) {
   size_t bytes_to_write = len;
   size_t offset = 0;
 
   while (bytes_to_write > 0) {
     ssize_t bytes_written;
     do {
-      bytes_written = enc_untrusted_write(
-          fd, static_cast<const uint8_t*>(buf) + offset, bytes_to_write);
+      bytes_written = enc_untrusted_pwrite(
+          fd, static_cast<const uint8_t*>(buf) + offset, bytes_to_write,
+          file_offset + offset);
     } while ((bytes_written == -1) && is_transient_error(errno));
     if (bytes_written == -1) {
       return -1;
@@ -100,9 +120,109 @@ ssize_t write_all(int fd, const void* buf, size_t len) {
   return offset;
 }
 
+// Node storage of the Merkle tree of a secure file, in the tree file next to
+// the secure file.
+class TreeFileStorage : public NodeStorage {
+ public:
+  TreeFileStorage(const std::string& path, int fd) : path_(path), fd_(fd) {}
+
+  ~TreeFileStorage() override { enc_untrusted_close(fd_); }
+
+  bool Read(const std::vector<Segment>& segments) override {
+    std::vector<struct enc_untrusted_io_segment> io_segments =
+        ToIoSegments(segments);
+    ssize_t bytes_read;
+    do {
+      bytes_read = enc_untrusted_pread_segments(fd_, io_segments.data(),
+                                                io_segments.size());
+    } while ((bytes_read == -1) && is_transient_error(errno));
+    return bytes_read == TotalLength(segments);
+  }
+
+  bool Write(const std::vector<Segment>& segments) override {
+    std::vector<struct enc_untrusted_io_segment> io_segments =
+        ToIoSegments(segments);
+    ssize_t bytes_written;
+    do {
+      bytes_written = enc_untrusted_pwrite_segments(fd_, io_segments.data(),
+                                                    io_segments.size());
+    } while ((bytes_written == -1) && is_transient_error(errno));
+    if (bytes_written == -1 && errno == EBADF) {
+      // The tree file was opened for reading with a file that was only read,
+      // and the file was written through a file descriptor opened since.
+      int write_fd = enc_untrusted_open(path_.c_str(), O_RDWR);
+      if (write_fd == -1) {
+        LOG(ERROR) << "Failed to open Merkle tree file for writing, path="
+                   << path_ << ", errno = " << errno;
+        return false;
+      }
+      enc_untrusted_close(fd_);
+      fd_ = write_fd;
+      do {
+        bytes_written = enc_untrusted_pwrite_segments(fd_, io_segments.data(),
+                                                      io_segments.size());
+      } while ((bytes_written == -1) && is_transient_error(errno));
+    }
+    return bytes_written == TotalLength(segments);
+  }
+
+ private:
+  static std::vector<struct enc_untrusted_io_segment> ToIoSegments(
+      const std::vector<Segment>& segments) {
+    std::vector<struct enc_untrusted_io_segment> io_segments(segments.size());
+    for (size_t i = 0; i < segments.size(); i++) {
+      io_segments[i].offset = segments[i].offset;
+      io_segments[i].base = segments[i].data;
+      io_segments[i].length = segments[i].length;
+    }
+    return io_segments;
+  }
+
+  static ssize_t TotalLength(const std::vector<Segment>& segments) {
+    size_t length = 0;
+    for (const Segment& segment : segments) {
+      length += segment.length;
+    }
+    return length;
+  }
+
+  const std::string path_;
+  int fd_;
+};
+
+// Opens the tree file of the secure file at |path|, emptying it if
+// |is_new_file|. The tree file is only created or emptied if the secure file
+// is |writable|, and is otherwise opened read-only. The tree file of an
+// existing file is also opened read-only if it cannot be opened for writing.
+// Returns nullptr if the tree file cannot be opened, in which case the Merkle
+// tree of the file is kept in memory.
+std::unique_ptr<NodeStorage> OpenTreeStorage(const std::string& path,
+                                             bool is_new_file, bool writable) {
+  const std::string tree_path = path + kTreeFileSuffix;
+  int fd = -1;
+  if (writable) {
+    fd = enc_untrusted_open(tree_path.c_str(),
+                            O_RDWR | O_CREAT | (is_new_file ? O_TRUNC : 0),
+                            S_IRUSR | S_IWUSR);
+  } else if (is_new_file) {
+    // The tree is rebuilt in memory, leaving the tree file as it is.
+    return nullptr;
+  }
+  if (fd == -1 && !is_new_file) {
+    fd = enc_untrusted_open(tree_path.c_str(), O_RDONLY);
+  }
+  if (fd == -1) {
+    LOG(WARNING) << "Failed to open Merkle tree file, path=" << tree_path
+                 << ", errno = " << errno;
+    return nullptr;
+  }
+  return absl::make_unique<TreeFileStorage>(tree_path, fd);
+}
+
 // Returns offset to the plaintext buffer associated with the |block_index| of
-// a full block.
-const uint8_t* GetPlaintextBuffer(size_t first_partial_block_bytes_count,
+// a full block of |block_length| bytes.
+const uint8_t* GetPlaintextBuffer(size_t block_length,
+                                  size_t first_partial_block_bytes_count,
                                   int64_t block_index, const void* buf) {
   const uint8_t* plaintext_data = reinterpret_cast<const uint8_t*>(buf);
   if (first_partial_block_bytes_count > 0) {
@@ -110,29 +230,32 @@ const uint8_t* GetPlaintextBuffer(size_t first_partial_block_bytes_count,
       plaintext_data += first_partial_block_bytes_count;
     }
     if (block_index > 1) {
-      plaintext_data += (block_index - 1) * kBlockLength;
+      plaintext_data += (block_index - 1) * block_length;
     }
   } else {
-    plaintext_data += block_index * kBlockLength;
+    plaintext_data += block_index * block_length;
   }
 
   return plaintext_data;
 }
 
-uint8_t* GetPlaintextBuffer(size_t first_partial_block_bytes_count,
+uint8_t* GetPlaintextBuffer(size_t block_length,
+                            size_t first_partial_block_bytes_count,
                             int64_t block_index, void* buf) {
   return const_cast<uint8_t*>(
-      GetPlaintextBuffer(first_partial_block_bytes_count, block_index,
-                         const_cast<const void*>(buf)));
+      GetPlaintextBuffer(block_length, first_partial_block_bytes_count,
+                         block_index, const_cast<const void*>(buf)));
+}
+
+// Returns true if |block_length| is a supported block length.
+bool IsBlockLengthValid(size_t block_length) {
+  return block_length >= kMinBlockLength && block_length <= kMaxBlockLength &&
+         (block_length & (block_length - 1)) == 0;
 }
 
 }  // namespace
 
 using Tag = UnsafeBytes<kTagLength>;
-using Token = UnsafeBytes<kTokenLength>;
-using Block = UnsafeBytes<kBlockLength>;
-using Ciphertext = UnsafeBytes<kCipherBlockLength>;
-using SecureBlock = UnsafeBytes<kSecureBlockLength>;
 
 using TagView = ByteContainerView;
 using TokenView = ByteContainerView;
@@ -140,11 +263,71 @@ using BlockView = ByteContainerView;
 using CiphertextView = ByteContainerView;
 using SecureBlockView = ByteContainerView;
 
-AeadHandler::AeadHandler()
-    : offset_translator_(OffsetTranslator::Create(
-          sizeof(FileHeader), kBlockLength, kSecureBlockLength)) {}
+std::shared_ptr<OffsetTranslator> AeadHandler::CreateOffsetTranslator(
+    size_t block_length) {
+  return std::shared_ptr<OffsetTranslator>(OffsetTranslator::Create(
+      sizeof(FileHeader), block_length,
+      block_length + kTagLength + kTokenLength));
+}
+
+size_t AeadHandler::EncodeFileSize(size_t logical_size, size_t block_length) {
+  if (block_length == kBlockLength) {
+    return logical_size;
+  }
+
+  size_t block_length_log2 = 0;
+  while ((static_cast<size_t>(1) << block_length_log2) < block_length) {
+    block_length_log2++;
+  }
+  return logical_size | (block_length_log2 << kBlockLengthShift);
+}
+
+bool AeadHandler::DecodeFileSize(size_t file_size, size_t* logical_size,
+                                 size_t* block_length) {
+  const size_t size_mask = (static_cast<size_t>(1) << kBlockLengthShift) - 1;
+  const size_t block_length_log2 = file_size >> kBlockLengthShift;
+  *logical_size = file_size & size_mask;
+  if (block_length_log2 == 0) {
+    *block_length = kBlockLength;
+  } else if (block_length_log2 < kBlockLengthShift) {
+    *block_length = static_cast<size_t>(1) << block_length_log2;
+  } else {
+    return false;
+  }
+  return IsBlockLengthValid(*block_length);
+}
+
+bool AeadHandler::ReadBlockLength(const char* path_name, size_t* block_length) {
+  int fd = enc_untrusted_open(path_name, O_RDONLY);
+  if (fd == -1) {
+    LOG(ERROR) << "Failed to open file to read its block length, path="
+               << path_name << ", errno = " << errno;
+    return false;
+  }
+
+  FdCloser fd_closer(fd, &enc_untrusted_close);
+
+  // The header is not authenticated until the master key is known. The block
+  // length read here is confirmed when the header is validated.
+  FileHeader file_header;
+  ssize_t bytes_read = read_all(fd, file_header.data(), sizeof(FileHeader));
+  if (bytes_read != sizeof(FileHeader)) {
+    LOG(ERROR) << "Failed to read the file header, bytes read = " << bytes_read;
+    return false;
+  }
+
+  size_t logical_size;
+  if (!DecodeFileSize(file_header.file_size, &logical_size, block_length)) {
+    LOG(ERROR) << "Unsupported block length in the header of file, path="
+               << path_name;
+    errno = EINVAL;
+    return false;
+  }
+
+  return true;
+}
 
-bool AeadHandler::Deserialize(FileControl* file_ctrl) {
+bool AeadHandler::Deserialize(int fd, FileControl* file_ctrl) {
   if (!file_ctrl) {
     errno = EINVAL;
     return false;
@@ -156,7 +339,10 @@ bool AeadHandler::Deserialize(FileControl* file_ctrl) {
   }
 
   if (file_ctrl->is_new) {
-    if (!UpdateDigest(file_ctrl, *cryptor)) {
+    file_ctrl->ad = absl::make_unique<PersistentAuthenticatedDictionary>(
+        OpenTreeStorage(file_ctrl->path, /*is_new_file=*/true,
+                        file_ctrl->writable));
+    if (!UpdateDigest(fd, file_ctrl, *cryptor)) {
       LOG(ERROR) << "Failed to update header on a new file, path="
                  << file_ctrl->path << ", errno = " << errno;
       return false;
@@ -168,19 +354,19 @@ bool AeadHandler::Deserialize(FileControl* file_ctrl) {
     return true;
   }
 
-  // Rebuild the Merkle tree.
-  int fd = enc_untrusted_open(file_ctrl->path.c_str(), O_RDONLY);
-  if (fd == -1) {
+  // Read the header with digest.
+  int metadata_fd = enc_untrusted_open(file_ctrl->path.c_str(), O_RDONLY);
+  if (metadata_fd == -1) {
     LOG(ERROR) << "Failed to open file for collecting security metadata, path="
                << file_ctrl->path << ", errno = " << errno;
     return false;
   }
 
-  FdCloser fd_closer(fd, &enc_untrusted_close);
+  FdCloser fd_closer(metadata_fd, &enc_untrusted_close);
 
-  // Read the header with digest.
   FileHeader file_header;
-  ssize_t bytes_read = read_all(fd, file_header.data(), sizeof(FileHeader));
+  ssize_t bytes_read =
+      read_all(metadata_fd, file_header.data(), sizeof(FileHeader));
   if (bytes_read != sizeof(FileHeader)) {
     LOG(ERROR) << "Failed to read the file header, bytes read = " << bytes_read;
     return false;
@@ -189,19 +375,48 @@ bool AeadHandler::Deserialize(FileControl* file_ctrl) {
   // In order to validate the integrity metadata and the file size have to first
   // collect integrity metadata across the file using the initially untrusted
   // value of the file size - then validation of the hash of the file digest
-  // confirms validity of both the file size and the integrity metadata.
-  const int64_t blocks_count =
-      (file_header.file_size + kBlockLength - 1) / kBlockLength;
+  // confirms validity of both the file size and the integrity metadata. The
+  // same holds for the block length encoded with the file size.
+  size_t logical_size;
+  size_t block_length;
+  if (!DecodeFileSize(file_header.file_size, &logical_size, &block_length) ||
+      block_length != file_ctrl->block_length) {
+    LOG(ERROR) << "Unexpected block length in the header of file, path="
+               << file_ctrl->path;
+    return false;
+  }
+
+  // Load the Merkle tree from the tree file. Only the roots of its perfect
+  // subtrees are read - the rest of the tree is read and verified against them
+  // as it is used.
+  const int64_t blocks_count = (logical_size + block_length - 1) / block_length;
+  file_ctrl->ad = absl::make_unique<PersistentAuthenticatedDictionary>(
+      OpenTreeStorage(file_ctrl->path, /*is_new_file=*/false,
+                      file_ctrl->writable));
+  if (file_ctrl->ad->Load(blocks_count) &&
+      VerifyDigest(*file_ctrl, *cryptor, file_header)) {
+    file_ctrl->logical_size = logical_size;
+    return true;
+  }
+
+  // The tree file does not hold the tree of the current contents of the file,
+  // for example if the enclave stopped while the file was open. Rebuild the
+  // Merkle tree.
+  VLOG(2) << "Rebuilding Merkle tree of file " << file_ctrl->path;
+  file_ctrl->ad = absl::make_unique<PersistentAuthenticatedDictionary>(
+      OpenTreeStorage(file_ctrl->path, /*is_new_file=*/true,
+                      file_ctrl->writable));
+
   Tag tag;
   for (int64_t block_index = 0; block_index < blocks_count; block_index++) {
-    off_t offset = enc_untrusted_lseek(fd, kBlockLength, SEEK_CUR);
+    off_t offset = enc_untrusted_lseek(metadata_fd, block_length, SEEK_CUR);
     if (offset == -1) {
       LOG(ERROR)
           << "Failed lseek past block when collecting integrity metadata.";
       return false;
     }
 
-    bytes_read = read_all(fd, tag.data(), kTagLength);
+    bytes_read = read_all(metadata_fd, tag.data(), kTagLength);
     if (bytes_read != kTagLength) {
       LOG(ERROR) << "Failed to read integrity metadata, bytes_read="
                  << bytes_read;
@@ -213,7 +428,7 @@ bool AeadHandler::Deserialize(FileControl* file_ctrl) {
             << absl::BytesToHexString(tag_string);
     file_ctrl->ad->AddLeaf(tag_string);
 
-    offset = enc_untrusted_lseek(fd, kTokenLength, SEEK_CUR);
+    offset = enc_untrusted_lseek(metadata_fd, kTokenLength, SEEK_CUR);
     if (offset == -1) {
       LOG(ERROR)
           << "Failed lseek past token when collecting integrity metadata.";
@@ -223,35 +438,49 @@ bool AeadHandler::Deserialize(FileControl* file_ctrl) {
 
   VLOG(2) << "Pushed block auth tags on initialization.";
 
+  if (!VerifyDigest(*file_ctrl, *cryptor, file_header)) {
+    LOG(ERROR) << "Failure validating integrity root for file "
+               << file_ctrl->path << ", current root: "
+               << absl::BytesToHexString(file_ctrl->ad->CurrentRoot());
+    return false;
+  }
+
+  // Store the rebuilt tree, so that it is loaded when the file is next opened.
+  // The tree is kept in memory if it cannot be stored, or if the file is only
+  // read.
+  if (!file_ctrl->ad->Commit()) {
+    LOG(WARNING) << "Failed to store the Merkle tree of file "
+                 << file_ctrl->path;
+  }
+
+  file_ctrl->logical_size = logical_size;
+  return true;
+}
+
+bool AeadHandler::VerifyDigest(const FileControl& file_ctrl,
+                               const GcmCryptor& cryptor,
+                               const FileHeader& file_header) {
   // Prepare file data digest.
+  const std::string root = file_ctrl.ad->CurrentRoot();
   DataDigest data_digest;
-  std::copy_n(
-      reinterpret_cast<const uint8_t*>(file_ctrl->ad->CurrentRoot().data()),
-      kRootHashLength, data_digest.data());
+  std::copy_n(reinterpret_cast<const uint8_t*>(root.data()), kRootHashLength,
+              data_digest.data());
   data_digest.file_size = file_header.file_size;
 
   // Validate AD root and the file size.
   FileHash new_hash;
-  if (!cryptor->GetAuthTag(new_hash.data(), data_digest.data(),
-                           sizeof(DataDigest))) {
+  if (!cryptor.GetAuthTag(new_hash.data(), data_digest.data(),
+                          sizeof(DataDigest))) {
     LOG(ERROR) << "Failed to generate CMAC for integrity verification, root="
-               << file_ctrl->ad->CurrentRoot();
-    return false;
-  }
-
-  if (new_hash != file_header.file_hash) {
-    LOG(ERROR) << "Failure validating integrity root for file "
-               << file_ctrl->path << ", current root: "
-               << absl::BytesToHexString(file_ctrl->ad->CurrentRoot());
+               << root;
     return false;
   }
 
-  file_ctrl->logical_size = file_header.file_size;
-  return true;
+  return new_hash == file_header.file_hash;
 }
 
 bool AeadHandler::InitializeFile(int fd, const char* path_name,
-                                 bool is_new_file) {
+                                 bool is_new_file, int flags) {
   if (!IsPathNameValid(path_name)) {
     LOG(ERROR) << "Invalid input when initializing file, path_name="
                << path_name;
@@ -259,47 +488,49 @@ bool AeadHandler::InitializeFile(int fd, const char* path_name,
     return false;
   }
 
-  absl::MutexLock global_lock(&mu_);
-
-  auto fd_it = fmap_.find(fd);
-  if (fd_it != fmap_.end()) {
-    LOG(ERROR) << "Attempt made to initialize already initialized file, fd="
-               << fd << ", path_name = " << path_name
-               << ", is_new_file = " << is_new_file;
-    errno = EEXIST;
-    return false;
-  }
-
-  VLOG(2) << "Initializing secure file, fd = " << fd
-          << ", path_name = " << path_name;
-  auto path_it = opened_files_.find(path_name);
-  std::shared_ptr<FileControl> file_ctrl =
-      (path_it == opened_files_.end())
-          ? std::make_shared<FileControl>(path_name, is_new_file)
-          : path_it->second;
-  fmap_.emplace(fd, file_ctrl);
-  opened_files_.emplace(path_name, file_ctrl);
-
-  return true;
-}
+  std::shared_ptr<FileControl> file_ctrl;
+  {
+    absl::MutexLock global_lock(&mu_);
 
-bool AeadHandler::RetrieveLogicalOffset(int fd, off_t* logical_offset) const {
-  if (fd < 0) {
-    errno = EINVAL;
-    return false;
-  }
+    auto fd_it = fmap_.find(fd);
+    if (fd_it != fmap_.end()) {
+      LOG(ERROR) << "Attempt made to initialize already initialized file, fd="
+                 << fd << ", path_name = " << path_name
+                 << ", is_new_file = " << is_new_file;
+      errno = EEXIST;
+      return false;
+    }
 
-  off_t physical_offset = enc_untrusted_lseek(fd, 0, SEEK_CUR);
-  if (physical_offset == -1) {
-    LOG(ERROR) << "Failed to retrieve SEEK_CUR offset on descriptor: " << fd;
-    return false;
+    VLOG(2) << "Initializing secure file, fd = " << fd
+            << ", path_name = " << path_name;
+    auto path_it = opened_files_.find(path_name);
+    if (path_it == opened_files_.end()) {
+      // The block length of an existing file is needed to translate offsets,
+      // so it is read before any operation on the file.
+      size_t block_length = kBlockLength;
+      if (!is_new_file && !ReadBlockLength(path_name, &block_length)) {
+        return false;
+      }
+      file_ctrl =
+          std::make_shared<FileControl>(path_name, is_new_file, block_length);
+      opened_files_.emplace(path_name, file_ctrl);
+    } else {
+      file_ctrl = path_it->second;
+    }
+    fmap_.emplace(fd, file_ctrl);
+    file_ctrl->open_count++;
   }
 
-  *logical_offset = offset_translator_->PhysicalToLogical(physical_offset);
-  if (*logical_offset == OffsetTranslator::kInvalidOffset) {
-    LOG(ERROR) << "The file is corrupted, fd = " << fd;
-    return false;
+  // The file may be in use through other file descriptors, so its lock is
+  // waited on without holding the global mutex. Operations through |fd| fail
+  // until its cursor is added.
+  absl::MutexLock file_lock(&file_ctrl->mu);
+  if ((flags & O_ACCMODE) != O_RDONLY) {
+    file_ctrl->writable = true;
   }
+  file_ctrl->cursors.emplace(std::piecewise_construct,
+                             std::forward_as_tuple(fd),
+                             std::forward_as_tuple());
 
   return true;
 }
@@ -311,7 +542,7 @@ GcmCryptor* AeadHandler::GetGcmCryptor(const FileControl& file_ctrl) const {
   }
 
   GcmCryptor* cryptor = GcmCryptorRegistry::GetInstance().GetGcmCryptor(
-      kBlockLength, *file_ctrl.master_key);
+      file_ctrl.block_length, *file_ctrl.master_key);
   if (!cryptor) {
     LOG(ERROR) << "Unable to instantiate GCM cryptor.";
   }
@@ -319,34 +550,57 @@ GcmCryptor* AeadHandler::GetGcmCryptor(const FileControl& file_ctrl) const {
   return cryptor;
 }
 
+bool AeadHandler::ProcessBlocks(
+    const FileControl& file_ctrl, size_t block_count,
+    const std::function<bool(size_t run_start, size_t run_length)>& process) {
+  const size_t max_threads =
+      std::min<size_t>(file_ctrl.max_threads, BlockWorkerPool::kMaxWorkers + 1);
+  if (max_threads <= 1 || block_count < 2 ||
+      block_count * file_ctrl.block_length < file_ctrl.parallel_min_bytes) {
+    return process(0, block_count);
+  }
+
+  const size_t run_count =
+      std::min(block_count, max_threads * kBlockRunsPerThread);
+  return BlockWorkerPool::GetInstance()->Run(
+      run_count, max_threads, [&](size_t run) {
+        // Spread the remainder of the division over the first runs.
+        const size_t run_start = run * block_count / run_count;
+        const size_t run_end = (run + 1) * block_count / run_count;
+        return process(run_start, run_end - run_start);
+      });
+}
+
 ssize_t AeadHandler::DecryptAndVerify(int fd, void* buf, size_t count) {
   if (!buf) {
     errno = EINVAL;
     return -1;
   }
 
-  off_t logical_offset;
-  if (!RetrieveLogicalOffset(fd, &logical_offset)) {
+  std::shared_ptr<FileControl> file_ctrl = GetFileControl(fd);
+  if (!file_ctrl) {
+    LOG(ERROR) << "Attempt made to read from an unopened file, fd = " << fd;
+    errno = ENOENT;
+    return -1;
+  }
+  absl::ReaderMutexLock file_lock(&file_ctrl->mu);
+  FileControl::Cursor* cursor = file_ctrl->GetCursor(fd);
+  if (!cursor) {
+    // The file descriptor was finalized after it was looked up.
+    errno = ENOENT;
     return -1;
   }
 
-  FileControl* file_ctrl;
-  std::unique_ptr<absl::MutexLock> file_lock;
-  {
-    absl::MutexLock global_lock(&mu_);
-
-    auto entry = fmap_.find(fd);
-    if (entry == fmap_.end()) {
-      LOG(ERROR) << "Attempt made to read from an unopened file, fd = " << fd;
-      errno = ENOENT;
-      return -1;
-    }
-
-    file_ctrl = entry->second.get();
-    file_lock = absl::make_unique<absl::MutexLock>(&file_ctrl->mu);
+  // Reads through the same file descriptor serialize on its cursor.
+  absl::MutexLock cursor_lock(&cursor->mu);
+  off_t& logical_offset = cursor->offset;
+  ssize_t read_count =
+      DecryptAndVerifyInternal(fd, buf, count, *file_ctrl, logical_offset);
+  if (read_count > 0) {
+    logical_offset += read_count;
   }
 
-  return DecryptAndVerifyInternal(fd, buf, count, *file_ctrl, logical_offset);
+  return read_count;
 }
 
 ssize_t AeadHandler::DecryptAndVerifyInternal(int fd, void* buf, size_t count,
@@ -356,6 +610,11 @@ ssize_t AeadHandler::DecryptAndVerifyInternal(int fd, void* buf, size_t count,
     return 0;
   }
 
+  const size_t block_length = file_ctrl.block_length;
+  const size_t cipher_block_length = file_ctrl.cipher_block_length();
+  const size_t secure_block_length = file_ctrl.secure_block_length();
+  OffsetTranslator* offset_translator = file_ctrl.offset_translator.get();
+
   // Check for logical EOF.
   if (logical_offset >= file_ctrl.logical_size) {
     return 0;
@@ -370,68 +629,105 @@ ssize_t AeadHandler::DecryptAndVerifyInternal(int fd, void* buf, size_t count,
   size_t first_partial_block_bytes_count;
   size_t last_partial_block_bytes_count;
   size_t full_inclusive_blocks_bytes_count;
-  offset_translator_->ReduceLogicalRangeToFullLogicalBlocks(
+  offset_translator->ReduceLogicalRangeToFullLogicalBlocks(
       logical_offset, count, &first_partial_block_bytes_count,
       &last_partial_block_bytes_count, &full_inclusive_blocks_bytes_count);
 
-  // Use single read buffer to minimize the number of read calls to the host.
-  std::vector<uint8_t> buffer;
-  const size_t physical_bytes_count =
-      (full_inclusive_blocks_bytes_count / kBlockLength) * kSecureBlockLength;
-  buffer.resize(physical_bytes_count);
+  // Offset of the range in its first block. The range may end before the end
+  // of that block.
+  const size_t in_block_offset = logical_offset % block_length;
 
-  // Move cursor to the first full block to read.
-  const off_t first_logical_block_offset =
-      (first_partial_block_bytes_count > 0)
-          ? (logical_offset + first_partial_block_bytes_count - kBlockLength)
-          : logical_offset;
+  const off_t first_logical_block_offset = logical_offset - in_block_offset;
   const off_t first_physical_block_offset =
-      offset_translator_->LogicalToPhysical(first_logical_block_offset);
-  if (first_partial_block_bytes_count > 0) {
-    off_t offset =
-        enc_untrusted_lseek(fd, first_physical_block_offset, SEEK_SET);
-    if (offset == -1) {
-      LOG(ERROR)
-          << "Failed lseek to the fist block offset when reading file data.";
-      return -1;
+      offset_translator->LogicalToPhysical(first_logical_block_offset);
+  const int64_t blocks_count = full_inclusive_blocks_bytes_count / block_length;
+  const size_t first_block_index = first_logical_block_offset / block_length;
+
+  // Returns the part of the range covered by a block - its offset in the block,
+  // the number of bytes, and the position in the supplied buffer.
+  auto block_range = [&](int64_t block_index, size_t* offset, size_t* length) {
+    *offset = 0;
+    *length = block_length;
+    if (block_index == 0 && first_partial_block_bytes_count > 0) {
+      *offset = in_block_offset;
+      *length = first_partial_block_bytes_count;
+    } else if (block_index == blocks_count - 1 &&
+               last_partial_block_bytes_count > 0) {
+      *length = last_partial_block_bytes_count;
     }
-  }
-
-  // Perform the read. Read may have been requested beyond EOF - cannot require
-  // that bytes_read is equal to physical_bytes_count. The read was not
-  // requested at EOF - checked this above.
-  ssize_t bytes_read =
-      enc_untrusted_read(fd, buffer.data(), physical_bytes_count);
-  if (bytes_read <= 0) {
-    LOG(ERROR) << "Cannot verify data - data has not been read, fd = " << fd;
+    return GetPlaintextBuffer(block_length, first_partial_block_bytes_count,
+                              block_index, buf);
+  };
+
+  // Load the hashes of the blocks from the Merkle tree together.
+  if (!file_ctrl.ad->LoadLeaves(first_block_index + 1, blocks_count)) {
+    LOG(ERROR) << "Cannot verify data - integrity metadata has not been read, "
+                  "fd = "
+               << fd;
     return -1;
   }
 
-  // Process only complete blocks read, since need per-block metadata to decrypt
-  // the block.
-  bytes_read = (bytes_read / kSecureBlockLength) * kSecureBlockLength;
-  if (bytes_read == 0) {
-    LOG(ERROR) << "Cannot verify data - data has not been read, fd = " << fd;
-    return -1;
+  // Blocks in sparse regions need not be read, and cached blocks are copied
+  // from the cache. Only the span from the first to the last remaining block is
+  // read from the host.
+  enum class BlockSource { kSparse, kCache, kFile };
+  std::vector<BlockSource> sources(blocks_count, BlockSource::kFile);
+  int64_t first_file_block = blocks_count;
+  int64_t last_file_block = -1;
+  for (int64_t block_index = 0; block_index < blocks_count; block_index++) {
+    const std::string leaf_hash =
+        file_ctrl.ad->LeafHash(first_block_index + block_index + 1);
+    size_t offset;
+    size_t length;
+    uint8_t* plaintext_data = block_range(block_index, &offset, &length);
+    if (leaf_hash == file_ctrl.zero_hash) {
+      VLOG(2) << "A sparse region block detected.";
+      sources[block_index] = BlockSource::kSparse;
+    } else if (block_cache_.Lookup(file_ctrl.path,
+                                   first_block_index + block_index, leaf_hash,
+                                   offset, length, plaintext_data)) {
+      sources[block_index] = BlockSource::kCache;
+    } else {
+      first_file_block = std::min(first_file_block, block_index);
+      last_file_block = block_index;
+    }
   }
 
-  // Move cursor to the position of the end of the read range.
-  off_t new_cur_logical_offset = logical_offset + count;
-  if (bytes_read != physical_bytes_count) {
-    int64_t blocks_not_read =
-        (physical_bytes_count - bytes_read) / kSecureBlockLength;
-    if (last_partial_block_bytes_count > 0) {
-      new_cur_logical_offset -= last_partial_block_bytes_count;
-      blocks_not_read--;
+  // Number of blocks at the start of the range available to the reader.
+  int64_t blocks_available = blocks_count;
+  int64_t blocks_read = 0;
+  std::vector<uint8_t> buffer;
+  if (last_file_block >= first_file_block) {
+    // Use single read buffer to minimize the number of read calls to the host.
+    const size_t physical_bytes_count =
+        (last_file_block - first_file_block + 1) * secure_block_length;
+    buffer.resize(physical_bytes_count);
+
+    // Perform the read, which leaves the cursor of the host file descriptor in
+    // place. Read may have been requested beyond EOF - cannot require that
+    // bytes_read is equal to physical_bytes_count. The read was not requested
+    // at EOF - checked this above.
+    ssize_t bytes_read;
+    do {
+      bytes_read = enc_untrusted_pread(
+          fd, buffer.data(), physical_bytes_count,
+          first_physical_block_offset + first_file_block * secure_block_length);
+    } while ((bytes_read == -1) && is_transient_error(errno));
+    if (bytes_read <= 0) {
+      LOG(ERROR) << "Cannot verify data - data has not been read, fd = " << fd;
+      return -1;
+    }
+
+    // Process only complete blocks read, since need per-block metadata to
+    // decrypt the block.
+    blocks_read = bytes_read / secure_block_length;
+    if (blocks_read == 0) {
+      LOG(ERROR) << "Cannot verify data - data has not been read, fd = " << fd;
+      return -1;
+    }
+    if (first_file_block + blocks_read <= last_file_block) {
+      blocks_available = first_file_block + blocks_read;
     }
-    new_cur_logical_offset -= blocks_not_read * kBlockLength;
-  }
-  const off_t new_cur_physical_offset =
-      offset_translator_->LogicalToPhysical(new_cur_logical_offset);
-  off_t offset = enc_untrusted_lseek(fd, new_cur_physical_offset, SEEK_SET);
-  if (offset == -1) {
-    LOG(ERROR) << "Failed lseek to the end of read range.";
-    return -1;
   }
 
   GcmCryptor* cryptor = GetGcmCryptor(file_ctrl);
@@ -439,43 +735,36 @@ ssize_t AeadHandler::DecryptAndVerifyInternal(int fd, void* buf, size_t count,
     return -1;
   }
 
-  // Cycle through blocks.
-  const int64_t blocks_read = bytes_read / kSecureBlockLength;
-  const int64_t blocks_read_max = physical_bytes_count / kSecureBlockLength;
-  const off_t first_block_index =
-      (first_physical_block_offset - sizeof(FileHeader)) / kSecureBlockLength;
-  size_t read_count = 0;
-  for (int64_t block_index = 0; block_index < blocks_read; block_index++) {
-    const size_t merkle_block_idx = first_block_index + block_index + 1;
-
-    uint8_t* plaintext_data =
-        GetPlaintextBuffer(first_partial_block_bytes_count, block_index, buf);
-
-    // Detect full blocks that belong to sparse regions in the file - no need to
-    // decrypt.
-    if (file_ctrl.ad->LeafHash(merkle_block_idx) == file_ctrl.zero_hash) {
-      VLOG(2) << "A sparse region block detected.";
-      memset(plaintext_data, 0, kBlockLength);
-      read_count += kBlockLength;
+  // Cycle through the blocks read.
+  // Bounce blocks for reading partial blocks at the ends of the full range.
+  std::vector<uint8_t> first_bounce_block;
+  std::vector<uint8_t> last_bounce_block;
+  // Target for decryption of each block read - a bounce block, the supplied
+  // buffer, or none for blocks not taken from the file.
+  std::vector<uint8_t*> decrypt_targets(blocks_read);
+  for (int64_t read_index = 0; read_index < blocks_read; read_index++) {
+    const int64_t block_index = first_file_block + read_index;
+    if (sources[block_index] != BlockSource::kFile) {
+      decrypt_targets[read_index] = nullptr;
       continue;
     }
 
-    CiphertextView ciphertext(buffer.data() + block_index * kSecureBlockLength,
-                              kCipherBlockLength);
+    const size_t merkle_block_idx = first_block_index + block_index + 1;
+    const uint8_t* secure_block =
+        buffer.data() + read_index * secure_block_length;
+
+    CiphertextView ciphertext(secure_block, cipher_block_length);
     VLOG(2) << "Ciphertext read: "
             << absl::BytesToHexString(absl::string_view(
                    reinterpret_cast<const char*>(ciphertext.data()),
-                   kCipherBlockLength));
+                   cipher_block_length));
 
-    TagView tag(buffer.data() + block_index * kSecureBlockLength + kBlockLength,
-                kTagLength);
+    TagView tag(secure_block + block_length, kTagLength);
     VLOG(2) << "Auth tag read: "
             << absl::BytesToHexString(absl::string_view(
                    reinterpret_cast<const char*>(tag.data()), kTagLength));
 
-    TokenView token(
-        buffer.data() + block_index * kSecureBlockLength + kCipherBlockLength,
-        kTokenLength);
+    TokenView token(secure_block + cipher_block_length, kTokenLength);
     VLOG(2) << "Token read: "
             << absl::BytesToHexString(absl::string_view(
                    reinterpret_cast<const char*>(token.data()), kTokenLength));
@@ -490,65 +779,66 @@ ssize_t AeadHandler::DecryptAndVerifyInternal(int fd, void* buf, size_t count,
       return -1;
     }
 
-    // Bounce block for reading partial blocks at the ends of the full range.
-    Block bounce_block;
-    // Target for decryption - bounce block or the supplied buffer.
-    uint8_t* decrypt_target;
     // Determine the target depending on whether the read block is at the end of
     // the full range.
-    if ((block_index == 0 && first_partial_block_bytes_count > 0) ||
-        (block_index == blocks_read_max - 1 &&
-         last_partial_block_bytes_count > 0)) {
-      decrypt_target = bounce_block.data();
-    } else {
-      decrypt_target = plaintext_data;
-    }
-
-    // Decrypt the block.
-    if (!cryptor->DecryptBlock(ciphertext.data(), token.data(),
-                               decrypt_target)) {
-      LOG(ERROR) << "Decryption failed, fd = " << fd;
-      return -1;
-    }
-
-    // Copy content from the bounce buffer, if used. Increment the count of read
-    // bytes.
     if (block_index == 0 && first_partial_block_bytes_count > 0) {
-      std::copy_n(
-          bounce_block.begin() + kBlockLength - first_partial_block_bytes_count,
-          first_partial_block_bytes_count, plaintext_data);
-      read_count += first_partial_block_bytes_count;
-    } else if (block_index == blocks_read_max - 1 &&
+      first_bounce_block.resize(block_length);
+      decrypt_targets[read_index] = first_bounce_block.data();
+    } else if (block_index == blocks_count - 1 &&
                last_partial_block_bytes_count > 0) {
-      std::copy_n(bounce_block.begin(), last_partial_block_bytes_count,
-                  plaintext_data);
-      read_count += last_partial_block_bytes_count;
+      last_bounce_block.resize(block_length);
+      decrypt_targets[read_index] = last_bounce_block.data();
     } else {
-      read_count += kBlockLength;
+      decrypt_targets[read_index] = GetPlaintextBuffer(
+          block_length, first_partial_block_bytes_count, block_index, buf);
     }
   }
 
-  VLOG(2) << "Verified read blocks, blocks_read = " << blocks_read
-          << ", bytes_read = " << bytes_read;
-  return read_count;
-}
-
-bool AeadHandler::UpdateDigest(FileControl* file_ctrl,
-                               const GcmCryptor& cryptor) const {
-  if (!file_ctrl) {
-    errno = EINVAL;
-    return false;
+  // Decrypt the verified blocks in runs, so that the cryptor sets up each key
+  // once for each run.
+  if (blocks_read > 0 &&
+      !ProcessBlocks(file_ctrl, blocks_read,
+                     [&](size_t run_start, size_t run_length) {
+                       return cryptor->DecryptBlocks(
+                           buffer.data() + run_start * secure_block_length,
+                           secure_block_length, run_length,
+                           decrypt_targets.data() + run_start);
+                     })) {
+    LOG(ERROR) << "Decryption failed, fd = " << fd;
+    return -1;
   }
 
-  int fd = enc_untrusted_open(file_ctrl->path.c_str(), O_WRONLY);
-  if (fd == -1) {
-    LOG(ERROR) << "Failed to open file to save data digest, path="
-               << file_ctrl->path << ", errno = " << errno;
-    return false;
+  // Copy content from the bounce blocks, if used, zero-fill the sparse blocks,
+  // cache the decrypted blocks, and count the read bytes.
+  size_t read_count = 0;
+  for (int64_t block_index = 0; block_index < blocks_available;
+       block_index++) {
+    size_t offset;
+    size_t length;
+    uint8_t* plaintext_data = block_range(block_index, &offset, &length);
+    if (sources[block_index] == BlockSource::kSparse) {
+      memset(plaintext_data, 0, length);
+    } else if (sources[block_index] == BlockSource::kFile) {
+      const uint8_t* block = decrypt_targets[block_index - first_file_block];
+      if (block != plaintext_data) {
+        std::copy_n(block + offset, length, plaintext_data);
+      }
+      block_cache_.Insert(
+          file_ctrl.path, first_block_index + block_index,
+          file_ctrl.ad->LeafHash(first_block_index + block_index + 1), block,
+          block_length);
+    }
+    read_count += length;
   }
 
-  FdCloser fd_closer(fd, &enc_untrusted_close);
+  VLOG(2) << "Verified read blocks, blocks_read = " << blocks_read
+          << ", bytes_read = " << read_count;
+  return read_count;
+}
 
+bool AeadHandler::PrepareHeader(FileControl* file_ctrl,
+                                const GcmCryptor& cryptor,
+                                FileHeader* header) const {
   std::string root = file_ctrl->ad->CurrentRoot();
   if (root.size() != kRootHashLength) {
     LOG(ERROR) << "Unexpected size of root hash encountered, size="
@@ -560,65 +850,209 @@ bool AeadHandler::UpdateDigest(FileControl* file_ctrl,
   DataDigest data_digest;
   std::copy_n(reinterpret_cast<const uint8_t*>(root.data()), kRootHashLength,
               data_digest.data());
-  data_digest.file_size = file_ctrl->logical_size;
+  data_digest.file_size =
+      EncodeFileSize(file_ctrl->logical_size, file_ctrl->block_length);
 
-  FileHeader header;
-  if (!cryptor.GetAuthTag(header.data(), data_digest.data(),
+  if (!cryptor.GetAuthTag(header->data(), data_digest.data(),
                           sizeof(DataDigest))) {
     LOG(ERROR) << "Failed to generate CMAC, root = " << root;
     return false;
   }
-  header.file_size = file_ctrl->logical_size;
+  header->file_size = data_digest.file_size;
 
   VLOG(2) << "Updating the digest for file: " << file_ctrl->path
           << ", root hash: " << absl::BytesToHexString(root);
-  ssize_t bytes_written = write_all(fd, header.data(), sizeof(FileHeader));
+  return true;
+}
+
+bool AeadHandler::UpdateDigest(int fd, FileControl* file_ctrl,
+                               const GcmCryptor& cryptor) const {
+  if (!file_ctrl) {
+    errno = EINVAL;
+    return false;
+  }
+
+  FileHeader header;
+  if (!PrepareHeader(file_ctrl, cryptor, &header)) {
+    return false;
+  }
+
+  ssize_t bytes_written =
+      pwrite_all(fd, header.data(), sizeof(FileHeader), /*file_offset=*/0);
+  if (bytes_written == -1 && errno == EBADF) {
+    // The file descriptor is not open for writing.
+    int write_fd = enc_untrusted_open(file_ctrl->path.c_str(), O_WRONLY);
+    if (write_fd == -1) {
+      LOG(ERROR) << "Failed to open file to save data digest, path="
+                 << file_ctrl->path << ", errno = " << errno;
+      return false;
+    }
+
+    FdCloser fd_closer(write_fd, &enc_untrusted_close);
+    bytes_written = pwrite_all(write_fd, header.data(), sizeof(FileHeader),
+                               /*file_offset=*/0);
+    if (bytes_written == sizeof(FileHeader) && !fd_closer.reset()) {
+      LOG(ERROR) << "Failed to close the file after digest update, path="
+                 << file_ctrl->path;
+      return false;
+    }
+  }
+
   if (bytes_written != sizeof(FileHeader)) {
     LOG(ERROR) << "Failed to write full digest to file, path="
                << file_ctrl->path << ", bytes written = " << bytes_written;
     return false;
   }
 
-  if (!fd_closer.reset()) {
-    LOG(ERROR) << "Failed to close the file after digest update, path="
-               << file_ctrl->path;
+  file_ctrl->digest_dirty = false;
+  return true;
+}
+
+bool AeadHandler::FlushDirtyDigest(int fd, FileControl* file_ctrl) const {
+  if (!file_ctrl->digest_dirty) {
+    return true;
+  }
+
+  const GcmCryptor* cryptor = GetGcmCryptor(*file_ctrl);
+  if (!cryptor) {
     return false;
   }
 
-  return true;
+  return UpdateDigest(fd, file_ctrl, *cryptor);
 }
 
-bool AeadHandler::ReadFullBlock(const FileControl& file_ctrl,
-                                off_t logical_offset, Block* block) const {
-  if (logical_offset < 0 || logical_offset % kBlockLength != 0) {
-    errno = EINVAL;
-    return false;
+bool AeadHandler::RecordWrite(FileControl* file_ctrl, size_t count) const {
+  if (!file_ctrl->write_back) {
+    return true;
   }
 
-  int fd = enc_untrusted_open(file_ctrl.path.c_str(), O_RDONLY);
-  if (fd == -1) {
-    LOG(ERROR) << "Failed to open file to read a block, path=" << file_ctrl.path
-               << ", errno = " << errno;
+  // Reading the clock may exit the enclave, so only do so if the interval
+  // threshold is in use.
+  int64_t now = (file_ctrl->max_dirty_ns > 0) ? MonotonicNanoseconds() : 0;
+  if (!file_ctrl->digest_dirty) {
+    file_ctrl->digest_dirty = true;
+    file_ctrl->dirty_bytes = 0;
+    file_ctrl->dirty_since_ns = now;
+  }
+  file_ctrl->dirty_bytes += count;
+
+  if ((file_ctrl->max_dirty_bytes > 0 &&
+       file_ctrl->dirty_bytes >= file_ctrl->max_dirty_bytes) ||
+      (file_ctrl->max_dirty_ns > 0 &&
+       now - file_ctrl->dirty_since_ns >= file_ctrl->max_dirty_ns)) {
+    VLOG(2) << "Writing back the digest for file: " << file_ctrl->path
+            << ", dirty bytes: " << file_ctrl->dirty_bytes;
+    return true;
+  }
+
+  return false;
+}
+
+bool AeadHandler::ReadFullBlocks(int fd, const FileControl& file_ctrl,
+                                 size_t count, const off_t* logical_offsets,
+                                 uint8_t* const* blocks) const {
+  const size_t block_length = file_ctrl.block_length;
+  const size_t secure_block_length = file_ctrl.secure_block_length();
+
+  // Collect the blocks stored in the file, and zero-fill the others.
+  std::vector<uint8_t> buffer(count * secure_block_length);
+  std::vector<struct enc_untrusted_io_segment> segments;
+  std::vector<size_t> merkle_block_indices;
+  std::vector<uint8_t*> decrypt_targets;
+  for (size_t i = 0; i < count; i++) {
+    const off_t logical_offset = logical_offsets[i];
+    if (logical_offset < 0 || logical_offset % block_length != 0) {
+      errno = EINVAL;
+      return false;
+    }
+
+    const size_t merkle_block_idx = logical_offset / block_length + 1;
+    if (logical_offset >= file_ctrl.logical_size ||
+        merkle_block_idx > file_ctrl.ad->LeafCount() ||
+        file_ctrl.ad->LeafHash(merkle_block_idx) == file_ctrl.zero_hash) {
+      memset(blocks[i], 0, block_length);
+      continue;
+    }
+
+    if (block_cache_.Lookup(file_ctrl.path, merkle_block_idx - 1,
+                            file_ctrl.ad->LeafHash(merkle_block_idx),
+                            /*offset=*/0, block_length, blocks[i])) {
+      continue;
+    }
+
+    struct enc_untrusted_io_segment segment;
+    segment.offset =
+        file_ctrl.offset_translator->LogicalToPhysical(logical_offset);
+    segment.base = buffer.data() + segments.size() * secure_block_length;
+    segment.length = secure_block_length;
+    segments.push_back(segment);
+    merkle_block_indices.push_back(merkle_block_idx);
+    decrypt_targets.push_back(blocks[i]);
+  }
+
+  if (segments.empty()) {
+    return true;
+  }
+
+  ssize_t bytes_read =
+      enc_untrusted_pread_segments(fd, segments.data(), segments.size());
+  if (bytes_read == -1 && errno == EBADF) {
+    // The file descriptor is not open for reading.
+    int read_fd = enc_untrusted_open(file_ctrl.path.c_str(), O_RDONLY);
+    if (read_fd == -1) {
+      LOG(ERROR) << "Failed to open file to read a block, path="
+                 << file_ctrl.path << ", errno = " << errno;
+      return false;
+    }
+
+    FdCloser fd_closer(read_fd, &enc_untrusted_close);
+    bytes_read =
+        enc_untrusted_pread_segments(read_fd, segments.data(), segments.size());
+  }
+
+  if (bytes_read != segments.size() * secure_block_length) {
+    LOG(ERROR) << "Failed to read full blocks, path=" << file_ctrl.path
+               << ", bytes read = " << bytes_read;
     return false;
   }
 
-  FdCloser fd_closer(fd, &enc_untrusted_close);
+  // Verify the blocks against the integrity metadata before decrypting them.
+  for (size_t i = 0; i < segments.size(); i++) {
+    const uint8_t* tag =
+        static_cast<const uint8_t*>(segments[i].base) + block_length;
+    if (file_ctrl.ad->LeafHash(merkle_block_indices[i]) !=
+        file_ctrl.ad->LeafHash(
+            std::string(reinterpret_cast<const char*>(tag), kTagLength))) {
+      LOG(ERROR) << "Integrity verification failed, path=" << file_ctrl.path;
+      return false;
+    }
+  }
 
-  off_t physical_offset = offset_translator_->LogicalToPhysical(logical_offset);
-  off_t offset = enc_untrusted_lseek(fd, physical_offset, SEEK_SET);
-  if (offset == -1) {
-    LOG(ERROR) << "Failed lseek when reading a full block.";
+  GcmCryptor* cryptor = GetGcmCryptor(file_ctrl);
+  if (!cryptor) {
     return false;
   }
 
-  ssize_t bytes_read = DecryptAndVerifyInternal(fd, block->data(), kBlockLength,
-                                                file_ctrl, logical_offset);
-  if (bytes_read == -1) {
-    return -1;
+  if (!cryptor->DecryptBlocks(buffer.data(), secure_block_length,
+                              decrypt_targets.size(), decrypt_targets.data())) {
+    LOG(ERROR) << "Decryption failed, path=" << file_ctrl.path;
+    return false;
   }
 
-  if (bytes_read < kBlockLength) {
-    memset(block->data() + bytes_read, 0, kBlockLength - bytes_read);
+  for (size_t i = 0; i < decrypt_targets.size(); i++) {
+    block_cache_.Insert(file_ctrl.path, merkle_block_indices[i] - 1,
+                        file_ctrl.ad->LeafHash(merkle_block_indices[i]),
+                        decrypt_targets[i], block_length);
+  }
+
+  // Only the bytes within the logical size of the file are valid.
+  for (size_t i = 0; i < count; i++) {
+    const size_t logical_offset = logical_offsets[i];
+    if (logical_offset < file_ctrl.logical_size &&
+        logical_offset + block_length > file_ctrl.logical_size) {
+      const size_t valid_bytes = file_ctrl.logical_size - logical_offset;
+      memset(blocks[i] + valid_bytes, 0, block_length - valid_bytes);
+    }
   }
 
   return true;
@@ -630,98 +1064,112 @@ ssize_t AeadHandler::EncryptAndPersist(int fd, const void* buf, size_t count) {
     return -1;
   }
 
-  off_t logical_offset;
-  if (!RetrieveLogicalOffset(fd, &logical_offset)) {
+  std::shared_ptr<FileControl> file_ctrl = GetFileControl(fd);
+  if (!file_ctrl) {
+    LOG(ERROR) << "Attempt made to write to an unopened file, fd = " << fd;
+    errno = ENOENT;
     return -1;
   }
-
-  FileControl* file_ctrl;
-  std::unique_ptr<absl::MutexLock> file_lock;
-  {
-    absl::MutexLock global_lock(&mu_);
-
-    auto entry = fmap_.find(fd);
-    if (entry == fmap_.end()) {
-      LOG(ERROR) << "Attempt made to write to an unopened file, fd = " << fd;
-      errno = ENOENT;
-      return -1;
-    }
-
-    file_ctrl = entry->second.get();
-    file_lock = absl::make_unique<absl::MutexLock>(&file_ctrl->mu);
+  absl::MutexLock file_lock(&file_ctrl->mu);
+  FileControl::Cursor* cursor = file_ctrl->GetCursor(fd);
+  if (!cursor) {
+    // The file descriptor was finalized after it was looked up.
+    errno = ENOENT;
+    return -1;
   }
 
   if (count == 0) {
     return 0;
   }
 
+  absl::MutexLock cursor_lock(&cursor->mu);
+  off_t& logical_offset = cursor->offset;
+  const size_t block_length = file_ctrl->block_length;
+  const size_t cipher_block_length = file_ctrl->cipher_block_length();
+  const size_t secure_block_length = file_ctrl->secure_block_length();
+  OffsetTranslator* offset_translator = file_ctrl->offset_translator.get();
+
   // Determine data breakdown into logical blocks.
   size_t first_partial_block_bytes_count;
   size_t last_partial_block_bytes_count;
   size_t full_inclusive_blocks_bytes_count;
-  offset_translator_->ReduceLogicalRangeToFullLogicalBlocks(
+  offset_translator->ReduceLogicalRangeToFullLogicalBlocks(
       logical_offset, count, &first_partial_block_bytes_count,
       &last_partial_block_bytes_count, &full_inclusive_blocks_bytes_count);
 
-  // Bounce block for writing the first partial block in the range, if any.
-  Block first_block;
-  if (first_partial_block_bytes_count > 0) {
-    if (!ReadFullBlock(
-            *file_ctrl,
-            logical_offset + first_partial_block_bytes_count - kBlockLength,
-            &first_block)) {
-      LOG(ERROR)
-          << "failed to read the first misaligned block when writing, fd = "
-          << fd;
-      return -1;
-    }
-
-    std::copy_n(
-        reinterpret_cast<const uint8_t*>(buf), first_partial_block_bytes_count,
-        first_block.data() + kBlockLength - first_partial_block_bytes_count);
+  // Offset of the range in its first block. The range may end before the end
+  // of that block.
+  const size_t in_block_offset = logical_offset % block_length;
+
+  // Load the hashes of the existing blocks in the range from the Merkle tree
+  // together, to verify the partial blocks and to update the tree.
+  const size_t first_block_index =
+      (logical_offset - in_block_offset) / block_length;
+  const size_t range_blocks_count =
+      full_inclusive_blocks_bytes_count / block_length;
+  if (first_block_index < file_ctrl->ad->LeafCount() &&
+      !file_ctrl->ad->LoadLeaves(
+          first_block_index + 1,
+          std::min(range_blocks_count,
+                   file_ctrl->ad->LeafCount() - first_block_index))) {
+    LOG(ERROR) << "Failed to load integrity metadata when writing, fd = "
+               << fd;
+    return -1;
   }
 
-  // Bounce block for writing the last partial block in the range, if any.
-  Block last_block;
+  // Bounce blocks for writing the partial blocks at the ends of the range, if
+  // any. Their current contents are read together.
+  std::vector<uint8_t> first_block;
+  std::vector<uint8_t> last_block;
+  std::vector<off_t> partial_block_offsets;
+  std::vector<uint8_t*> partial_blocks;
+  if (first_partial_block_bytes_count > 0) {
+    first_block.resize(block_length);
+    partial_block_offsets.push_back(logical_offset - in_block_offset);
+    partial_blocks.push_back(first_block.data());
+  }
   if (last_partial_block_bytes_count > 0) {
-    if (!ReadFullBlock(*file_ctrl,
-                       logical_offset + count - last_partial_block_bytes_count,
-                       &last_block)) {
-      LOG(ERROR)
-          << "failed to read the last misaligned block when writing, fd = "
-          << fd;
-      return -1;
-    }
+    last_block.resize(block_length);
+    partial_block_offsets.push_back(logical_offset + count -
+                                    last_partial_block_bytes_count);
+    partial_blocks.push_back(last_block.data());
+  }
+  if (!partial_blocks.empty() &&
+      !ReadFullBlocks(fd, *file_ctrl, partial_blocks.size(),
+                      partial_block_offsets.data(), partial_blocks.data())) {
+    LOG(ERROR) << "failed to read the misaligned blocks when writing, fd = "
+               << fd;
+    return -1;
+  }
 
+  if (first_partial_block_bytes_count > 0) {
+    std::copy_n(reinterpret_cast<const uint8_t*>(buf),
+                first_partial_block_bytes_count,
+                first_block.data() + in_block_offset);
+  }
+  if (last_partial_block_bytes_count > 0) {
     std::copy_n(reinterpret_cast<const uint8_t*>(buf) + count -
                     last_partial_block_bytes_count,
                 last_partial_block_bytes_count, last_block.data());
   }
 
-  const off_t first_logical_block_offset =
-      (first_partial_block_bytes_count > 0)
-          ? (logical_offset + first_partial_block_bytes_count - kBlockLength)
-          : logical_offset;
+  const off_t first_logical_block_offset = logical_offset - in_block_offset;
   const off_t first_physical_block_offset =
-      offset_translator_->LogicalToPhysical(first_logical_block_offset);
+      offset_translator->LogicalToPhysical(first_logical_block_offset);
   const int64_t eof_block_index = file_ctrl->ad->LeafCount();
+  int64_t sparse_blocks_count = 0;
   int64_t start_block_to_write = 0;
   if (first_physical_block_offset > file_ctrl->physical_size()) {
-    // Append leafs to the Merkle Tree to account for sparse region blocks.
-    int64_t sparse_blocks_count =
+    // Leafs are appended to the Merkle Tree to account for sparse region
+    // blocks.
+    sparse_blocks_count =
         (first_physical_block_offset - file_ctrl->physical_size()) /
-        kSecureBlockLength;
-    for (int64_t idx = 0; idx < sparse_blocks_count; idx++) {
-      VLOG(2) << "Adding an empty auth tag to AD for a block "
-                 "from a sparse region: "
-              << absl::BytesToHexString(file_ctrl->zero_hash);
-      file_ctrl->ad->AddLeafHash(file_ctrl->zero_hash);
-    }
+        secure_block_length;
     start_block_to_write = eof_block_index + sparse_blocks_count;
   } else {
     int64_t blocks_to_eof =
         (file_ctrl->physical_size() - first_physical_block_offset) /
-        kSecureBlockLength;
+        secure_block_length;
     start_block_to_write = eof_block_index - blocks_to_eof;
   }
 
@@ -735,64 +1183,127 @@ ssize_t AeadHandler::EncryptAndPersist(int fd, const void* buf, size_t count) {
   // Use single write buffer to minimize the number of write calls to the host.
   std::vector<uint8_t> buffer;
   const int64_t blocks_to_write =
-      full_inclusive_blocks_bytes_count / kBlockLength;
-  const size_t physical_bytes_count = blocks_to_write * kSecureBlockLength;
+      full_inclusive_blocks_bytes_count / block_length;
+  const size_t physical_bytes_count = blocks_to_write * secure_block_length;
   buffer.resize(physical_bytes_count);
 
-  // Cycle through blocks.
-  std::vector<Tag> tags;
+  // Collect the source of each block - bounce block or the supplied buffer -
+  // depending on whether the written block is at the end of the full range.
+  std::vector<const uint8_t*> encrypt_sources(blocks_to_write);
   for (int64_t block_index = 0; block_index < blocks_to_write; block_index++) {
-    const uint8_t* plaintext_data =
-        GetPlaintextBuffer(first_partial_block_bytes_count, block_index, buf);
-
-    // Source for encryption - bounce block or the supplied buffer.
-    const uint8_t* encrypt_source;
-    // Determine the source depending on whether the written block is at the end
-    // of the full range.
     if (block_index == 0 && first_partial_block_bytes_count > 0) {
-      encrypt_source = first_block.data();
+      encrypt_sources[block_index] = first_block.data();
     } else if (block_index == blocks_to_write - 1 &&
                last_partial_block_bytes_count > 0) {
-      encrypt_source = last_block.data();
+      encrypt_sources[block_index] = last_block.data();
     } else {
-      encrypt_source = plaintext_data;
+      encrypt_sources[block_index] =
+          GetPlaintextBuffer(block_length, first_partial_block_bytes_count,
+                             block_index, buf);
     }
+  }
 
-    Ciphertext* ciphertext =
-        Ciphertext::Place(&buffer, block_index * kSecureBlockLength);
-    Token* token = Token::Place(
-        &buffer, block_index * kSecureBlockLength + kCipherBlockLength);
+  // Encrypt the blocks in runs, so that the cryptor sets up its key once for
+  // each run.
+  if (!ProcessBlocks(*file_ctrl, blocks_to_write,
+                     [&](size_t run_start, size_t run_length) {
+                       return cryptor->EncryptBlocks(
+                           encrypt_sources.data() + run_start, run_length,
+                           buffer.data() + run_start * secure_block_length,
+                           secure_block_length);
+                     })) {
+    LOG(ERROR) << "Encryption failed, fd = " << fd;
+    return -1;
+  }
 
-    // Encrypt the block.
-    if (!cryptor->EncryptBlock(encrypt_source, token->data(),
-                               ciphertext->data())) {
-      LOG(ERROR) << "Encryption failed, fd = " << fd;
-      return -1;
+  // The header written together with the blocks holds the digest of the file
+  // after the write, so the Merkle tree, the logical size and the digest state
+  // are updated ahead of the write. They are restored unless all the bytes are
+  // written, so that a failed write leaves them describing the persisted file.
+  std::vector<std::pair<int64_t, std::string>> replaced_leaf_hashes;
+  const size_t previous_logical_size = file_ctrl->logical_size;
+  const bool previous_digest_dirty = file_ctrl->digest_dirty;
+  const uint64_t previous_dirty_bytes = file_ctrl->dirty_bytes;
+  const int64_t previous_dirty_since_ns = file_ctrl->dirty_since_ns;
+  auto restore_file_state = [&]() {
+    if (!file_ctrl->ad->Truncate(eof_block_index)) {
+      LOG(ERROR) << "Failed to restore integrity metadata, fd = " << fd;
+    }
+    for (auto it = replaced_leaf_hashes.rbegin();
+         it != replaced_leaf_hashes.rend(); ++it) {
+      if (!file_ctrl->ad->UpdateLeafHash(it->first, it->second)) {
+        LOG(ERROR) << "Failed to restore integrity metadata, fd = " << fd;
+      }
     }
+    file_ctrl->logical_size = previous_logical_size;
+    file_ctrl->digest_dirty = previous_digest_dirty;
+    file_ctrl->dirty_bytes = previous_dirty_bytes;
+    file_ctrl->dirty_since_ns = previous_dirty_since_ns;
+  };
+
+  for (int64_t idx = 0; idx < sparse_blocks_count; idx++) {
+    VLOG(2) << "Adding an empty auth tag to AD for a block "
+               "from a sparse region: "
+            << absl::BytesToHexString(file_ctrl->zero_hash);
+    file_ctrl->ad->AddLeafHash(file_ctrl->zero_hash);
+  }
+
+  // Cycle through blocks.
+  for (int64_t block_index = 0; block_index < blocks_to_write; block_index++) {
+    uint8_t* ciphertext = buffer.data() + block_index * secure_block_length;
+    TokenView token(ciphertext + cipher_block_length, kTokenLength);
     VLOG(2) << "Ciphertext generated: "
             << absl::BytesToHexString(absl::string_view(
-                   reinterpret_cast<const char*>(ciphertext->data()),
-                   kBlockLength));
+                   reinterpret_cast<const char*>(ciphertext), block_length));
     VLOG(2) << "Token generated: "
             << absl::BytesToHexString(absl::string_view(
-                   reinterpret_cast<const char*>(token->data()), kTokenLength));
+                   reinterpret_cast<const char*>(token.data()), kTokenLength));
 
-    TagView tag(ciphertext->data() + kBlockLength, kTagLength);
-    tags.push_back(tag);
-    VLOG(2) << "Auth tag generated: "
-            << absl::BytesToHexString(absl::string_view(
-                   reinterpret_cast<const char*>(tag.data()), kTagLength));
+    std::string tag_string(reinterpret_cast<char*>(ciphertext + block_length),
+                           kTagLength);
+    int64_t merkle_block_index = start_block_to_write + block_index;
+    if (merkle_block_index < eof_block_index) {
+      VLOG(2) << "Updating auth tag on AD: "
+              << absl::BytesToHexString(tag_string);
+      std::string replaced_hash =
+          file_ctrl->ad->LeafHash(merkle_block_index + 1);
+      if (replaced_hash.empty() ||
+          !file_ctrl->ad->UpdateLeaf(merkle_block_index + 1, tag_string)) {
+        LOG(ERROR) << "Failed to update integrity metadata, fd = " << fd;
+        restore_file_state();
+        return -1;
+      }
+      replaced_leaf_hashes.emplace_back(merkle_block_index + 1,
+                                        std::move(replaced_hash));
+    } else {
+      VLOG(2) << "Appending auth tag to AD: "
+              << absl::BytesToHexString(tag_string);
+      file_ctrl->ad->AddLeaf(tag_string);
+    }
   }
 
-  // Move cursor to the first full block to write.
-  if (first_partial_block_bytes_count > 0) {
-    off_t offset =
-        enc_untrusted_lseek(fd, first_physical_block_offset, SEEK_SET);
-    if (offset == -1) {
-      LOG(ERROR)
-          << "Failed lseek to the fist block offset when writing file data.";
+  // Writes within the file do not truncate it.
+  file_ctrl->logical_size = std::max<size_t>(file_ctrl->logical_size,
+                                             logical_offset + count);
+
+  // The encrypted blocks and, unless the write-back policy of the file allows
+  // deferring it, the updated file header are written with a single call to
+  // the host. The header follows the data, as when it is updated separately.
+  std::vector<struct enc_untrusted_io_segment> segments(1);
+  segments[0].offset = first_physical_block_offset;
+  segments[0].base = buffer.data();
+  segments[0].length = physical_bytes_count;
+  FileHeader header;
+  const bool update_digest = RecordWrite(file_ctrl.get(), count);
+  if (update_digest) {
+    if (!PrepareHeader(file_ctrl.get(), *cryptor, &header)) {
+      restore_file_state();
       return -1;
     }
+    segments.resize(2);
+    segments[1].offset = 0;
+    segments[1].base = header.data();
+    segments[1].length = sizeof(FileHeader);
   }
 
   // Note: with block alignment constraint in place, partial block writes are
@@ -803,81 +1314,148 @@ ssize_t AeadHandler::EncryptAndPersist(int fd, const void* buf, size_t count) {
   //    on error or when all data has been written, following the POSIX model -
   //    this may lead to "long" writes when "large" amount of data is written.
   // In this code optimize operation for full writes - i.e. the option #2.
-  ssize_t bytes_written = write_all(fd, buffer.data(), physical_bytes_count);
-  if (bytes_written != physical_bytes_count) {
+  const size_t bytes_to_write =
+      physical_bytes_count + (update_digest ? sizeof(FileHeader) : 0);
+  ssize_t bytes_written =
+      enc_untrusted_pwrite_segments(fd, segments.data(), segments.size());
+  if (bytes_written != bytes_to_write) {
     LOG(ERROR) << "Failed to write encrypted data to file, path="
                << file_ctrl->path << ", bytes written = " << bytes_written;
+    restore_file_state();
     return -1;
   }
 
-  // Move cursor to the position of the end of the write range.
-  if (last_partial_block_bytes_count > 0) {
-    off_t new_cur_logical_offset = logical_offset + count;
-    off_t new_cur_physical_offset =
-        offset_translator_->LogicalToPhysical(new_cur_logical_offset);
-    off_t offset = enc_untrusted_lseek(fd, new_cur_physical_offset, SEEK_SET);
-    if (offset == -1) {
-      LOG(ERROR)
-          << "Failed lseek to the last block offset when reading file data.";
-      return -1;
-    }
+  if (update_digest) {
+    file_ctrl->digest_dirty = false;
   }
 
-  for (int64_t idx = 0; idx < tags.size(); idx++) {
-    std::string tag_string(reinterpret_cast<char*>(tags[idx].data()), kTagLength);
-    int64_t block_index = start_block_to_write + idx;
-    if (block_index < eof_block_index) {
-      VLOG(2) << "Updating auth tag on AD: "
-              << absl::BytesToHexString(tag_string);
-      file_ctrl->ad->UpdateLeaf(block_index + 1, tag_string);
-    } else {
-      VLOG(2) << "Appending auth tag to AD: "
-              << absl::BytesToHexString(tag_string);
-      file_ctrl->ad->AddLeaf(tag_string);
-    }
+  // Updated nodes of the Merkle tree are written to the tree file once there
+  // are enough of them, and otherwise when the file is closed. Nodes that
+  // cannot be written stay in memory until the next attempt.
+  if (file_ctrl->ad->DirtyNodeCount() > kMaxDirtyTreeNodes &&
+      !file_ctrl->ad->Flush()) {
+    LOG(WARNING) << "Failed to write the Merkle tree, path="
+                 << file_ctrl->path;
   }
 
-  file_ctrl->logical_size = logical_offset + count;
-
-  if (!UpdateDigest(file_ctrl, *cryptor)) {
-    return -1;
+  // Written blocks replace their cached copies.
+  for (int64_t block_index = 0; block_index < blocks_to_write; block_index++) {
+    const int64_t merkle_block_index = start_block_to_write + block_index;
+    block_cache_.Insert(file_ctrl->path, merkle_block_index,
+                        file_ctrl->ad->LeafHash(merkle_block_index + 1),
+                        encrypt_sources[block_index], block_length);
   }
 
+  // Move cursor to the position of the end of the write range.
+  logical_offset += count;
+
   VLOG(2) << "Wrote data to file, bytes_written = " << bytes_written;
 
   return count;
 }
 
 bool AeadHandler::FinalizeFile(int fd) {
-  absl::MutexLock global_lock(&mu_);
-
   if (fd < 0) {
     errno = EINVAL;
     return false;
   }
 
-  auto entry = fmap_.find(fd);
-  if (entry == fmap_.end()) {
+  std::shared_ptr<FileControl> file_ctrl = GetFileControl(fd);
+  if (!file_ctrl) {
     LOG(ERROR) << "Attempt made to finalize uninitialized file, fd = " << fd;
     errno = ENOENT;
     return false;
   }
 
-  FileControl* file_ctrl = entry->second.get();
+  bool digest_persisted;
   {
-    // Wait until the file is not operated on - once that is the case, it will
-    // remain the case throughout this function, as guaranteed by global_lock.
+    // Wait until the file is not operated on. Operations through |fd| that
+    // look the file up afterwards fail once its cursor is removed.
     absl::MutexLock file_lock(&file_ctrl->mu);
+    if (!file_ctrl->GetCursor(fd)) {
+      // The file descriptor was finalized after it was looked up.
+      errno = ENOENT;
+      return false;
+    }
+    digest_persisted = FlushDirtyDigest(fd, file_ctrl.get());
+    if (digest_persisted) {
+      file_ctrl->cursors.erase(fd);
+
+      // Store the Merkle tree once the file is closed, so that it is loaded
+      // when the file is next opened. Otherwise the tree is rebuilt then.
+      if (file_ctrl->cursors.empty() && !file_ctrl->ad->Commit()) {
+        LOG(WARNING) << "Failed to store the Merkle tree of file "
+                     << file_ctrl->path;
+      }
+    }
+  }
+
+  // Keep the file open if its digest could not be persisted, so that the
+  // caller can retry.
+  if (!digest_persisted) {
+    LOG(ERROR) << "Failed to persist the digest when finalizing file, path="
+               << file_ctrl->path;
+    return false;
   }
 
   VLOG(2) << "Finalizing secure file, fd = " << fd
           << ", pathname = " << file_ctrl->path;
-  opened_files_.erase(file_ctrl->path);
+  absl::MutexLock global_lock(&mu_);
   fmap_.erase(fd);
+  // Other file descriptors opened on the file keep sharing its state.
+  if (--file_ctrl->open_count == 0) {
+    opened_files_.erase(file_ctrl->path);
+  }
 
   return true;
 }
 
+bool AeadHandler::FlushDigest(int fd) {
+  std::shared_ptr<FileControl> file_ctrl = GetFileControl(fd);
+  if (!file_ctrl) {
+    LOG(ERROR) << "Attempt made to flush an unopened file, fd = " << fd;
+    errno = ENOENT;
+    return false;
+  }
+  absl::MutexLock file_lock(&file_ctrl->mu);
+  if (!file_ctrl->GetCursor(fd)) {
+    // The file descriptor was finalized after it was looked up.
+    errno = ENOENT;
+    return false;
+  }
+
+  return FlushDirtyDigest(fd, file_ctrl.get());
+}
+
+int AeadHandler::SetDigestWriteBack(int fd, uint64_t max_dirty_bytes,
+                                    uint64_t max_dirty_interval_ms) {
+  std::shared_ptr<FileControl> file_ctrl = GetFileControl(fd);
+  if (!file_ctrl) {
+    LOG(ERROR) << "Attempt made to set write-back on an unopened file, fd = "
+               << fd;
+    errno = ENOENT;
+    return -1;
+  }
+  absl::MutexLock file_lock(&file_ctrl->mu);
+  if (!file_ctrl->GetCursor(fd)) {
+    // The file descriptor was finalized after it was looked up.
+    errno = ENOENT;
+    return -1;
+  }
+
+  file_ctrl->write_back = (max_dirty_bytes > 0 || max_dirty_interval_ms > 0);
+  file_ctrl->max_dirty_bytes = max_dirty_bytes;
+  file_ctrl->max_dirty_ns =
+      static_cast<int64_t>(max_dirty_interval_ms) * 1000000;
+
+  // Leaving write-back mode persists any deferred digest update.
+  if (!file_ctrl->write_back && !FlushDirtyDigest(fd, file_ctrl.get())) {
+    return -1;
+  }
+
+  return 0;
+}
+
 // Note: questionable whether to allow setting the key only on newly opened
 // files, and only if not set yet - arguably, such intelligence may need to
 // reside outside of AeadHandler on the side of the IOCTL client. If not done
@@ -890,20 +1468,17 @@ int AeadHandler::SetMasterKey(int fd, const uint8_t* key_data,
     return -1;
   }
 
-  FileControl* file_ctrl;
-  std::unique_ptr<absl::MutexLock> file_lock;
-  {
-    absl::MutexLock global_lock(&mu_);
-
-    auto entry = fmap_.find(fd);
-    if (entry == fmap_.end()) {
-      LOG(ERROR) << "Attempt made to set key on an unopened file, fd = " << fd;
-      errno = ENOENT;
-      return -1;
-    }
-
-    file_ctrl = entry->second.get();
-    file_lock = absl::make_unique<absl::MutexLock>(&file_ctrl->mu);
+  std::shared_ptr<FileControl> file_ctrl = GetFileControl(fd);
+  if (!file_ctrl) {
+    LOG(ERROR) << "Attempt made to set key on an unopened file, fd = " << fd;
+    errno = ENOENT;
+    return -1;
+  }
+  absl::MutexLock file_lock(&file_ctrl->mu);
+  if (!file_ctrl->GetCursor(fd)) {
+    // The file descriptor was finalized after it was looked up.
+    errno = ENOENT;
+    return -1;
   }
 
   if (file_ctrl->is_deserialized) {
@@ -918,7 +1493,7 @@ int AeadHandler::SetMasterKey(int fd, const uint8_t* key_data,
 
   file_ctrl->master_key =
       absl::make_unique<GcmCryptorKey>(key_data, key_length);
-  if (!Deserialize(file_ctrl)) {
+  if (!Deserialize(fd, file_ctrl.get())) {
     LOG(ERROR) << "Failed to deserialize integrity metadata for file, path="
                << file_ctrl->path;
     return -1;
@@ -928,8 +1503,135 @@ int AeadHandler::SetMasterKey(int fd, const uint8_t* key_data,
   return 0;
 }
 
-const OffsetTranslator& AeadHandler::GetOffsetTranslator() const {
-  return *offset_translator_;
+int AeadHandler::SetBlockLength(int fd, size_t block_length) {
+  if (!IsBlockLengthValid(block_length)) {
+    LOG(ERROR) << "Attempt made to set an unsupported block length: "
+               << block_length;
+    errno = EINVAL;
+    return -1;
+  }
+
+  std::shared_ptr<FileControl> file_ctrl = GetFileControl(fd);
+  if (!file_ctrl) {
+    LOG(ERROR) << "Attempt made to set block length on an unopened file, fd = "
+               << fd;
+    errno = ENOENT;
+    return -1;
+  }
+  absl::MutexLock file_lock(&file_ctrl->mu);
+  if (!file_ctrl->GetCursor(fd)) {
+    // The file descriptor was finalized after it was looked up.
+    errno = ENOENT;
+    return -1;
+  }
+
+  if (file_ctrl->block_length == block_length) {
+    return 0;
+  }
+
+  // The header of the file records the block length once the key is set.
+  if (!file_ctrl->is_new || file_ctrl->is_deserialized) {
+    LOG(ERROR) << "Attempt made to change the block length of an existing file"
+               << ", fd = " << fd;
+    errno = EINVAL;
+    return -1;
+  }
+
+  file_ctrl->block_length = block_length;
+  file_ctrl->offset_translator = CreateOffsetTranslator(block_length);
+  return 0;
+}
+
+int AeadHandler::SetParallelism(int fd, uint32_t max_threads,
+                                uint64_t min_bytes) {
+  std::shared_ptr<FileControl> file_ctrl = GetFileControl(fd);
+  if (!file_ctrl) {
+    LOG(ERROR) << "Attempt made to set parallelism on an unopened file, fd = "
+               << fd;
+    errno = ENOENT;
+    return -1;
+  }
+  absl::MutexLock file_lock(&file_ctrl->mu);
+  if (!file_ctrl->GetCursor(fd)) {
+    // The file descriptor was finalized after it was looked up.
+    errno = ENOENT;
+    return -1;
+  }
+
+  file_ctrl->max_threads = max_threads;
+  file_ctrl->parallel_min_bytes = min_bytes;
+  return 0;
+}
+
+void AeadHandler::SetBlockCacheCapacity(size_t pages) {
+  block_cache_.SetCapacity(pages);
+}
+
+BlockCache::Stats AeadHandler::GetBlockCacheStats() const {
+  return block_cache_.GetStats();
+}
+
+off_t AeadHandler::Seek(int fd, off_t offset, int whence) {
+  std::shared_ptr<FileControl> file_ctrl = GetFileControl(fd);
+  if (!file_ctrl) {
+    LOG(ERROR) << "Attempt made to seek on an unopened file, fd = " << fd;
+    errno = ENOENT;
+    return -1;
+  }
+  absl::ReaderMutexLock file_lock(&file_ctrl->mu);
+  FileControl::Cursor* cursor = file_ctrl->GetCursor(fd);
+  if (!cursor) {
+    // The file descriptor was finalized after it was looked up.
+    errno = ENOENT;
+    return -1;
+  }
+
+  absl::MutexLock cursor_lock(&cursor->mu);
+  off_t& logical_offset = cursor->offset;
+
+  // The logical offset relative to which lseek has been requested.
+  off_t base_offset;
+  switch (whence) {
+    case SEEK_SET:
+      base_offset = 0;
+      break;
+    case SEEK_CUR:
+      base_offset = logical_offset;
+      break;
+    case SEEK_END:
+      base_offset = file_ctrl->logical_size;
+      break;
+    default:
+      errno = EINVAL;
+      return -1;
+  }
+
+  if (offset > std::numeric_limits<off_t>::max() - base_offset ||
+      base_offset + offset < 0) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  logical_offset = base_offset + offset;
+  return logical_offset;
+}
+
+std::string AeadHandler::GetPathName(int fd) {
+  // The path of a file never changes, so it is read without the file lock.
+  std::shared_ptr<FileControl> file_ctrl = GetFileControl(fd);
+  if (!file_ctrl) {
+    errno = ENOENT;
+    return "";
+  }
+
+  return file_ctrl->path;
+}
+
+std::shared_ptr<AeadHandler::FileControl> AeadHandler::GetFileControl(int fd) {
+  absl::ReaderMutexLock global_lock(&mu_);
+
+  auto entry = fmap_.find(fd);
+  return entry == fmap_.end() ? nullptr : entry->second;
 }
 
 }  // namespace storage
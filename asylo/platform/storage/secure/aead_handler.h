@@ -20,16 +20,18 @@
 #define ASYLO_PLATFORM_STORAGE_SECURE_AEAD_HANDLER_H_
 
 #include <stdint.h>
+#include <functional>
 #include <memory>
 #include <string>
 #include <unordered_map>
 
 #include "absl/base/attributes.h"
+#include "absl/memory/memory.h"
 #include "absl/synchronization/mutex.h"
 #include "asylo/crypto/util/bytes.h"
 #include "asylo/platform/crypto/gcmlib/gcm_cryptor.h"
-#include "asylo/platform/storage/secure/authenticated_dictionary.h"
-#include "asylo/platform/storage/secure/ctmmt_authenticated_dictionary.h"
+#include "asylo/platform/storage/secure/block_cache.h"
+#include "asylo/platform/storage/secure/persistent_authenticated_dictionary.h"
 #include "asylo/platform/storage/utils/offset_translator.h"
 
 namespace asylo {
@@ -42,9 +44,18 @@ using crypto::gcmlib::kKeyLength;
 using crypto::gcmlib::kTagLength;
 using crypto::gcmlib::kTokenLength;
 
-// Length of file blocks to encrypt/decrypt.
+// Default length of file blocks to encrypt/decrypt. Also the length of the
+// blocks of files whose header does not record a block length.
 constexpr size_t kBlockLength = 128;
-using Block = UnsafeBytes<kBlockLength>;
+
+// Range of supported block lengths. Block lengths are powers of two.
+constexpr size_t kMinBlockLength = kBlockLength;
+constexpr size_t kMaxBlockLength = 64 * 1024;
+
+// The logical file size stored in the file header carries the base-2 logarithm
+// of the block length in its top byte. A zero top byte stands for kBlockLength,
+// so files using the default block length keep the original header layout.
+constexpr int kBlockLengthShift = 56;
 
 // Length of the file digest (of the AD root).
 constexpr int64_t kRootHashLength = 32;
@@ -54,10 +65,19 @@ constexpr int64_t kFileHashLength = 16;
 
 // Constants for the secure block structure - the secure block consists of
 // the ciphertext of the same length as the original plaintext, followed by the
-// integrity tag, followed by the encryption token.
+// integrity tag, followed by the encryption token. These describe blocks of the
+// default length.
 constexpr size_t kCipherBlockLength = kBlockLength + kTagLength;
 constexpr size_t kSecureBlockLength = kCipherBlockLength + kTokenLength;
 
+// Suffix of the path of the file next to a secure file that stores the Merkle
+// tree of the secure file.
+constexpr char kTreeFileSuffix[] = ".mtree";
+
+// Number of updated Merkle tree nodes of a file kept in memory, above which
+// they are written to its tree file.
+constexpr size_t kMaxDirtyTreeNodes = 4096;
+
 using FileHash = UnsafeBytes<kFileHashLength>;
 using FileDigest = UnsafeBytes<kRootHashLength>;
 
@@ -67,6 +87,13 @@ using FileDigest = UnsafeBytes<kRootHashLength>;
 // supplied file data. Uses enclave-to-host IO delegates to propagate IO calls
 // over the enclave boundary to access file storage outside the enclave.
 //
+// Reads of a file, and seeks on it, hold the lock of the file shared, so they
+// proceed in parallel with each other - reads through the same file descriptor
+// only serialize on its cursor. Writes and other operations that modify the
+// state of a file hold its lock exclusively. The global mutex guarding the maps
+// of opened files is only held while a file is looked up, opened or closed, and
+// is never held while waiting on the lock of a file.
+//
 // Tracked feature work:
 //
 class AeadHandler {
@@ -77,31 +104,88 @@ class AeadHandler {
   }
 
   // Loads integrity metadata, initializes integrity assurance for a newly
-  // opened file, returns false on failure. Does not modify the state of the
-  // file descriptor. By contract, absolute (canonical) |path_name| is expected.
-  // The function performs a weak validation that the path is canonical.
-  bool InitializeFile(int fd, const char* path_name, bool is_new_file)
-      LOCKS_EXCLUDED(mu_);
-
-  // Decrypts read data in-place, verifies data has not been tampered with,
-  // returns the size of data verified, or -1 on failure.
+  // opened file, returns false on failure. Sets the logical cursor of the file
+  // descriptor to the logical offset of 0. By contract, absolute (canonical)
+  // |path_name| is expected. The function performs a weak validation that the
+  // path is canonical. |flags| are the flags the file descriptor was opened
+  // with. The tree file of the Merkle tree of the file is only created or
+  // modified once the file is opened for writing.
+  bool InitializeFile(int fd, const char* path_name, bool is_new_file,
+                      int flags) LOCKS_EXCLUDED(mu_);
+
+  // Reads data at the logical cursor of the file descriptor, decrypts it,
+  // verifies data has not been tampered with, and advances the cursor. Returns
+  // the size of data verified, or -1 on failure.
   ssize_t DecryptAndVerify(int fd, void* buf, size_t count) LOCKS_EXCLUDED(mu_);
 
   // Encrypts data and generates integrity metadata for it in memory, writes
-  // encrypted data to disk, returns the size of data written, or -1 on failure.
+  // encrypted data to disk at the logical cursor of the file descriptor and
+  // advances the cursor, returns the size of data written, or -1 on failure.
   ssize_t EncryptAndPersist(int fd, const void* buf, size_t count)
       LOCKS_EXCLUDED(mu_);
 
+  // Moves the logical cursor of the file descriptor as lseek does. SEEK_END is
+  // relative to the logical size of the file. Returns the new logical offset,
+  // or -1 on failure.
+  off_t Seek(int fd, off_t offset, int whence) LOCKS_EXCLUDED(mu_);
+
+  // Returns the path with which the file descriptor was initialized, or an
+  // empty string if it is not initialized.
+  std::string GetPathName(int fd) LOCKS_EXCLUDED(mu_);
+
   // Frees resources used to assure integrity of an opened file, persists
   // integrity metadata to a designated location on disk, returns false on
-  // failure. Does not modify the state of the file descriptor.
+  // failure. The file stays initialized if its integrity metadata could not be
+  // persisted. Does not modify the state of the host file descriptor.
   bool FinalizeFile(int fd) LOCKS_EXCLUDED(mu_);
 
+  // Persists the file digest if it has changed since it was last persisted,
+  // returns false on failure.
+  bool FlushDigest(int fd) LOCKS_EXCLUDED(mu_);
+
+  // Sets the digest write-back policy of an opened file. If both thresholds
+  // are zero, the digest is persisted after every write. Otherwise it is kept
+  // in memory and persisted by FlushDigest, by FinalizeFile, and once the bytes
+  // written since it was last persisted reach |max_dirty_bytes| or the oldest
+  // of those writes is older than |max_dirty_interval_ms|. A zero threshold is
+  // not applied. Returns 0 on success, or -1 on failure.
+  //
+  // Write-back leaves the digest in the file header stale until it is
+  // persisted, while the written blocks reach the host file right away. If the
+  // enclave stops before the digest is persisted, the blocks no longer match
+  // it, so opening the file fails integrity verification. The whole file is
+  // lost then, including the contents persisted before the unflushed writes,
+  // not only the data written since. Callers that cannot afford that must call
+  // fsync at the points they need to survive a crash.
+  int SetDigestWriteBack(int fd, uint64_t max_dirty_bytes,
+                         uint64_t max_dirty_interval_ms) LOCKS_EXCLUDED(mu_);
+
   // Sets the master key for a newly opened file.
   int SetMasterKey(int fd, const uint8_t* key_data, uint32_t key_length)
       LOCKS_EXCLUDED(mu_);
 
-  const OffsetTranslator& GetOffsetTranslator() const;
+  // Sets the block length of a newly created file. Must be called before the
+  // master key is set. The block length of an existing file is read from its
+  // header and cannot be changed. Returns 0 on success, or -1 on failure.
+  int SetBlockLength(int fd, size_t block_length) LOCKS_EXCLUDED(mu_);
+
+  // Sets how many threads encrypt and decrypt the blocks of a single read or
+  // write on an opened file. Reads and writes spanning at least |min_bytes| of
+  // whole blocks are split across up to |max_threads| threads, including the
+  // calling thread, taken from the BlockWorkerPool. Smaller I/O, and all I/O if
+  // |max_threads| is at most one, is processed on the calling thread. Returns 0
+  // on success, or -1 on failure.
+  int SetParallelism(int fd, uint32_t max_threads, uint64_t min_bytes)
+      LOCKS_EXCLUDED(mu_);
+
+  // Sets the capacity of the cache of verified plaintext blocks shared by all
+  // secure files to |pages| EPC pages. Reads served from the cache neither exit
+  // the enclave nor decrypt. Written blocks replace their cached copies. A
+  // capacity of zero, the default, disables the cache.
+  void SetBlockCacheCapacity(size_t pages);
+
+  // Returns the usage statistics of the block cache.
+  BlockCache::Stats GetBlockCacheStats() const;
 
  private:
   // Structure represents the file header layout.
@@ -109,8 +193,8 @@ class AeadHandler {
     // Hash of the DataDigest.
     FileHash file_hash;
 
-    // Logical file size - is incorporated into DataDigest and is protected by
-    // FileHash.
+    // Logical file size combined with the block length, see kBlockLengthShift
+    // - is incorporated into DataDigest and is protected by FileHash.
     size_t file_size;
 
     // Returns the address of the FileHeader instance.
@@ -123,7 +207,7 @@ class AeadHandler {
     // AD digest of the file data.
     FileDigest file_digest;
 
-    // Logical file size.
+    // Logical file size combined with the block length, as in FileHeader.
     size_t file_size;
 
     // Returns the address of the DataDigest instance.
@@ -134,64 +218,190 @@ class AeadHandler {
   struct FileControl {
     const std::string path;
     size_t logical_size;
+    size_t block_length;
+    std::shared_ptr<OffsetTranslator> offset_translator;
     bool is_new;
     bool is_deserialized;
-    std::unique_ptr<AuthenticatedDictionary> ad;
+
+    // Whether the file was opened for writing through any file descriptor.
+    bool writable;
+
+    // Merkle tree of the file. Kept in memory until the file is deserialized,
+    // and then in the tree file of the file.
+    std::unique_ptr<PersistentAuthenticatedDictionary> ad;
     std::string zero_hash;
     std::unique_ptr<GcmCryptorKey> master_key;
 
-    // Mutex for protecting FileControl instance.
+    // Digest write-back policy - see SetDigestWriteBack.
+    bool write_back;
+    uint64_t max_dirty_bytes;
+    int64_t max_dirty_ns;
+
+    // Whether |ad| and |logical_size| differ from the persisted digest.
+    bool digest_dirty;
+
+    // Bytes written since the digest was last persisted.
+    uint64_t dirty_bytes;
+
+    // Time of the first write since the digest was last persisted.
+    int64_t dirty_since_ns;
+
+    // Block processing parallelism - see SetParallelism.
+    uint32_t max_threads;
+    uint64_t parallel_min_bytes;
+
+    // Logical cursor of a file descriptor. Readers holding |mu| shared move
+    // the cursor under its own mutex.
+    struct Cursor {
+      absl::Mutex mu;
+      off_t offset GUARDED_BY(mu) = 0;
+    };
+
+    // Logical cursors of the file descriptors opened on the file. The cursors
+    // are kept in the enclave, so that I/O on the file uses positioned host
+    // calls and does not move the host cursors. Entries are only added and
+    // removed with |mu| held exclusively.
+    std::unordered_map<int, Cursor> cursors;
+
+    // Number of file descriptors opened on the file, guarded by the global
+    // mutex of AeadHandler. The file is removed from the opened files when the
+    // last one is finalized.
+    int open_count;
+
+    // Mutex for protecting FileControl instance. Held shared by operations that
+    // only read the state of the file, and exclusively by the others.
     absl::Mutex mu;
 
-    FileControl(const char* path_name, bool is_new_file)
+    FileControl(const char* path_name, bool is_new_file, size_t block_len)
         : path(path_name),
           logical_size(0),
+          block_length(block_len),
+          offset_translator(CreateOffsetTranslator(block_len)),
           is_new(is_new_file),
           is_deserialized(false),
-          ad(absl::make_unique<CTMMTAuthenticatedDictionary>()) {
+          writable(false),
+          ad(absl::make_unique<PersistentAuthenticatedDictionary>(nullptr)),
+          write_back(false),
+          max_dirty_bytes(0),
+          max_dirty_ns(0),
+          digest_dirty(false),
+          dirty_bytes(0),
+          dirty_since_ns(0),
+          max_threads(1),
+          parallel_min_bytes(0),
+          open_count(0) {
       UnsafeBytes<kTagLength> tag;
       memset(tag.data(), 0, kTagLength);
       std::string tag_string(reinterpret_cast<char*>(tag.data()), kTagLength);
       zero_hash = ad->LeafHash(tag_string);
     }
 
+    // Length of the ciphertext of a block, including the integrity tag.
+    size_t cipher_block_length() const { return block_length + kTagLength; }
+
+    // Length of a block as stored in the file.
+    size_t secure_block_length() const {
+      return cipher_block_length() + kTokenLength;
+    }
+
     // NOTE: The physical_size is on block granularity because the block
     // metadata is placed after the block data, hence, only full blocks are
     // written - there are no partial blocks.
     size_t physical_size() {
-      return sizeof(FileHeader) + ad->LeafCount() * kSecureBlockLength;
+      return sizeof(FileHeader) + ad->LeafCount() * secure_block_length();
+    }
+
+    // Returns the cursor of the file descriptor |fd|, or nullptr if |fd| has
+    // been finalized. |mu| must be held.
+    Cursor* GetCursor(int fd) {
+      auto entry = cursors.find(fd);
+      return entry == cursors.end() ? nullptr : &entry->second;
     }
   };
 
-  AeadHandler();
-  AeadHandler(AeadHandler const&) = delete;
-  void operator=(AeadHandler const&) = delete;
+  // Creates an offset translator for files with blocks of |block_length|.
+  static std::shared_ptr<OffsetTranslator> CreateOffsetTranslator(
+      size_t block_length);
 
-  // Loads and validates integrity metadata, returns false on failure.
-  bool Deserialize(FileControl* file_ctrl);
+  // Returns the value stored as the file size in the header of a file with
+  // |logical_size| bytes in blocks of |block_length|.
+  static size_t EncodeFileSize(size_t logical_size, size_t block_length);
 
-  // Retrieves logical cursor offset associated with a file descriptor |fd|.
-  // Returns false on failure.
-  bool RetrieveLogicalOffset(int fd, off_t* logical_offset) const;
+  // Splits the file size stored in a file header into the logical size and the
+  // block length. Returns false if the block length is not supported.
+  static bool DecodeFileSize(size_t file_size, size_t* logical_size,
+                             size_t* block_length);
+
+  // Reads the block length from the header of an existing file. Returns false
+  // on failure.
+  static bool ReadBlockLength(const char* path_name, size_t* block_length);
+
+  AeadHandler() = default;
+  AeadHandler(AeadHandler const&) = delete;
+  void operator=(AeadHandler const&) = delete;
 
-  // Updates digest of the file data in the secure file header.
-  bool UpdateDigest(FileControl* file_ctrl, const GcmCryptor& cryptor) const;
+  // Returns the control of the file opened as |fd|, or nullptr if |fd| is not
+  // opened. The global mutex is released on return, so the caller locks the
+  // file without holding it, and must check that |fd| has not been finalized
+  // in the meantime.
+  std::shared_ptr<FileControl> GetFileControl(int fd) LOCKS_EXCLUDED(mu_);
+
+  // Loads and validates integrity metadata for the file opened as |fd|,
+  // returns false on failure. The Merkle tree of the file is loaded from its
+  // tree file, or rebuilt from the integrity tags of all blocks of the file if
+  // the tree file does not hold the tree of the current contents of the file.
+  bool Deserialize(int fd, FileControl* file_ctrl);
+
+  // Returns whether the Merkle tree of |file_ctrl| matches the digest in
+  // |file_header|.
+  static bool VerifyDigest(const FileControl& file_ctrl,
+                           const GcmCryptor& cryptor,
+                           const FileHeader& file_header);
+
+  // Prepares the secure file header holding the digest of the file data.
+  bool PrepareHeader(FileControl* file_ctrl, const GcmCryptor& cryptor,
+                     FileHeader* header) const;
+
+  // Updates digest of the file data in the secure file header, writing it
+  // through |fd|, or through a new descriptor if |fd| is not open for writing.
+  bool UpdateDigest(int fd, FileControl* file_ctrl,
+                    const GcmCryptor& cryptor) const;
+
+  // Updates the digest in the secure file header if it is dirty.
+  bool FlushDirtyDigest(int fd, FileControl* file_ctrl) const;
+
+  // Records a write of |count| bytes. Returns true if the digest in the secure
+  // file header must be updated with the write, or false if the write-back
+  // policy of the file allows deferring it.
+  bool RecordWrite(FileControl* file_ctrl, size_t count) const;
+
+  // Calls |process| with the index of the first block and the number of blocks
+  // of consecutive runs covering |block_count| blocks of a single read or write
+  // on a file. Splits the blocks across threads according to the parallelism
+  // of the file. Returns false if any call to |process| returned false.
+  static bool ProcessBlocks(
+      const FileControl& file_ctrl, size_t block_count,
+      const std::function<bool(size_t run_start, size_t run_length)>& process);
 
   // Returns an instance of GcmCryptor associated with a file, or nullptr if was
   // not able to retrieve. The caller does not own the instance.
   GcmCryptor* GetGcmCryptor(const FileControl& file_ctrl) const;
 
   // Similar to DecryptAndVerify, but is called by internal implementation, and
-  // as such does not take a file lock. The cursor associated with the file
-  // descriptor |fd| is expected to be at the position of |logical_offset|.
+  // as such does not take a file lock. Reads at |logical_offset| and does not
+  // move the cursor of the file descriptor |fd|.
   ssize_t DecryptAndVerifyInternal(int fd, void* buf, size_t count,
                                    const FileControl& file_ctrl,
                                    off_t logical_offset) const;
 
-  // Reads a single full block of a file at a specified logical offset. Returns
-  // false on failure.
-  bool ReadFullBlock(const FileControl& file_ctrl, off_t logical_offset,
-                     Block* block) const;
+  // Reads |count| full blocks of a file at the specified logical offsets into
+  // |blocks|, each of which must hold |file_ctrl.block_length| bytes, with a
+  // single read from the host. Blocks and bytes beyond the logical end of the
+  // file are zero-filled. Reads through |fd|, or through a new descriptor if
+  // |fd| is not open for reading. Returns false on failure.
+  bool ReadFullBlocks(int fd, const FileControl& file_ctrl, size_t count,
+                      const off_t* logical_offsets,
+                      uint8_t* const* blocks) const;
 
   // Map of file (data set) controls for opened files keyed on int identity of
   // files.
@@ -199,12 +409,15 @@ class AeadHandler {
 
   // Map of file (data set) controls for opened files keyed on string paths of
   // files.
-  std::unordered_map<std::string, std::shared_ptr<FileControl>> opened_files_;
+  std::unordered_map<std::string, std::shared_ptr<FileControl>> opened_files_
+      GUARDED_BY(mu_);
 
-  // An instance that performs operations on untrusted file offset.
-  std::unique_ptr<OffsetTranslator> offset_translator_;
+  // Cache of verified plaintext blocks of all files. The cache synchronizes
+  // itself, and is used by const methods reading file blocks.
+  mutable BlockCache block_cache_;
 
-  // Mutex for protecting map members of the class.
+  // Mutex for protecting map members of the class. Held shared to look files
+  // up, and exclusively to open and close them.
   absl::Mutex mu_;
 };
 
@@ -0,0 +1,120 @@
+/*
+ *
+ * Copyright 2018 Asylo authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "asylo/platform/storage/secure/block_cache.h"
+
+#include <algorithm>
+#include <functional>
+#include <iterator>
+#include <utility>
+
+#include "asylo/platform/common/hash_combine.h"
+
+namespace asylo {
+namespace platform {
+namespace storage {
+
+constexpr size_t BlockCache::kPageLength;
+
+size_t BlockCache::KeyHash::operator()(const Key& key) const {
+  return HashCombine(std::hash<std::string>()(key.path), key.block_index);
+}
+
+void BlockCache::SetCapacity(size_t pages) {
+  absl::MutexLock lock(&mu_);
+  capacity_bytes_ = pages * kPageLength;
+  while (cached_bytes_ > capacity_bytes_) {
+    Erase(std::prev(entries_.end()));
+    evictions_++;
+  }
+}
+
+bool BlockCache::Lookup(const std::string& path, size_t block_index,
+                        const std::string& leaf_hash, size_t offset,
+                        size_t length, uint8_t* output) {
+  absl::MutexLock lock(&mu_);
+  if (capacity_bytes_ == 0) {
+    return false;
+  }
+
+  auto it = index_.find(Key{path, block_index});
+  if (it == index_.end()) {
+    misses_++;
+    return false;
+  }
+
+  // The block has changed since it was cached.
+  EntryList::iterator entry = it->second;
+  if (entry->leaf_hash != leaf_hash ||
+      offset + length > entry->plaintext.size()) {
+    Erase(entry);
+    misses_++;
+    return false;
+  }
+
+  std::copy_n(entry->plaintext.begin() + offset, length, output);
+  entries_.splice(entries_.begin(), entries_, entry);
+  hits_++;
+  return true;
+}
+
+void BlockCache::Insert(const std::string& path, size_t block_index,
+                        const std::string& leaf_hash, const uint8_t* block,
+                        size_t block_length) {
+  absl::MutexLock lock(&mu_);
+  if (block_length > capacity_bytes_) {
+    return;
+  }
+
+  Key key{path, block_index};
+  auto it = index_.find(key);
+  if (it != index_.end()) {
+    Erase(it->second);
+  }
+
+  while (cached_bytes_ + block_length > capacity_bytes_) {
+    Erase(std::prev(entries_.end()));
+    evictions_++;
+  }
+
+  entries_.push_front(Entry{key, leaf_hash,
+                            std::vector<uint8_t>(block, block + block_length)});
+  index_.emplace(std::move(key), entries_.begin());
+  cached_bytes_ += block_length;
+}
+
+BlockCache::Stats BlockCache::GetStats() const {
+  absl::MutexLock lock(&mu_);
+  Stats stats;
+  stats.hits = hits_;
+  stats.misses = misses_;
+  stats.evictions = evictions_;
+  stats.cached_bytes = cached_bytes_;
+  stats.capacity_bytes = capacity_bytes_;
+  return stats;
+}
+
+void BlockCache::Erase(EntryList::iterator it) {
+  cached_bytes_ -= it->plaintext.size();
+  index_.erase(it->key);
+  entries_.erase(it);
+}
+
+}  // namespace storage
+}  // namespace platform
+}  // namespace asylo
@@ -0,0 +1,136 @@
+/*
+ *
+ * Copyright 2018 Asylo authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef ASYLO_PLATFORM_STORAGE_SECURE_BLOCK_CACHE_H_
+#define ASYLO_PLATFORM_STORAGE_SECURE_BLOCK_CACHE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "absl/synchronization/mutex.h"
+
+namespace asylo {
+namespace platform {
+namespace storage {
+
+// A bounded cache of verified plaintext blocks of secure files, evicting the
+// least recently used blocks first. Blocks are keyed by the path of their file
+// and their index in the file. Each block is stored with the integrity hash it
+// was verified against, and is only returned while the caller presents the same
+// hash, so a block that has since changed is never served from the cache.
+//
+// The cache is disabled until it is given a capacity.
+class BlockCache {
+ public:
+  // Length of an EPC page. The capacity of the cache is set in pages.
+  static constexpr size_t kPageLength = 4096;
+
+  // Cache usage statistics.
+  struct Stats {
+    // Number of lookups that found a valid block.
+    uint64_t hits;
+
+    // Number of lookups that found no valid block.
+    uint64_t misses;
+
+    // Number of blocks evicted to make room for other blocks.
+    uint64_t evictions;
+
+    // Number of bytes of plaintext held by the cache.
+    uint64_t cached_bytes;
+
+    // Capacity of the cache in bytes.
+    uint64_t capacity_bytes;
+  };
+
+  BlockCache() = default;
+  BlockCache(const BlockCache&) = delete;
+  BlockCache& operator=(const BlockCache&) = delete;
+
+  // Sets the capacity of the cache to |pages| EPC pages of plaintext, evicting
+  // blocks that no longer fit. A capacity of zero disables the cache and frees
+  // all blocks.
+  void SetCapacity(size_t pages) LOCKS_EXCLUDED(mu_);
+
+  // Copies |length| bytes at |offset| in block |block_index| of the file at
+  // |path| to |output|, if the block is cached with |leaf_hash|. Returns false
+  // if it is not.
+  bool Lookup(const std::string& path, size_t block_index,
+              const std::string& leaf_hash, size_t offset, size_t length,
+              uint8_t* output) LOCKS_EXCLUDED(mu_);
+
+  // Caches |block_length| bytes of |block| as block |block_index| of the file
+  // at |path|, verified against |leaf_hash|. Replaces any block cached under
+  // the same key.
+  void Insert(const std::string& path, size_t block_index,
+              const std::string& leaf_hash, const uint8_t* block,
+              size_t block_length) LOCKS_EXCLUDED(mu_);
+
+  // Returns the usage statistics of the cache.
+  Stats GetStats() const LOCKS_EXCLUDED(mu_);
+
+ private:
+  // Identifies a block of a file.
+  struct Key {
+    std::string path;
+    size_t block_index;
+
+    bool operator==(const Key& other) const {
+      return block_index == other.block_index && path == other.path;
+    }
+  };
+
+  struct KeyHash {
+    size_t operator()(const Key& key) const;
+  };
+
+  struct Entry {
+    Key key;
+    std::string leaf_hash;
+    std::vector<uint8_t> plaintext;
+  };
+
+  using EntryList = std::list<Entry>;
+
+  // Removes the entry at |it|.
+  void Erase(EntryList::iterator it) EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  mutable absl::Mutex mu_;
+
+  // Cached entries, the most recently used first.
+  EntryList entries_ GUARDED_BY(mu_);
+
+  // Index of |entries_| by key.
+  std::unordered_map<Key, EntryList::iterator, KeyHash> index_ GUARDED_BY(mu_);
+
+  size_t capacity_bytes_ GUARDED_BY(mu_) = 0;
+  size_t cached_bytes_ GUARDED_BY(mu_) = 0;
+  uint64_t hits_ GUARDED_BY(mu_) = 0;
+  uint64_t misses_ GUARDED_BY(mu_) = 0;
+  uint64_t evictions_ GUARDED_BY(mu_) = 0;
+};
+
+}  // namespace storage
+}  // namespace platform
+}  // namespace asylo
+
+#endif  // ASYLO_PLATFORM_STORAGE_SECURE_BLOCK_CACHE_H_
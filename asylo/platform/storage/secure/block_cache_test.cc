@@ -0,0 +1,154 @@
+/*
+ *
+ * Copyright 2018 Asylo authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "asylo/platform/storage/secure/block_cache.h"
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+namespace asylo {
+namespace platform {
+namespace storage {
+namespace {
+
+constexpr size_t kBlockLength = BlockCache::kPageLength;
+constexpr char kPath[] = "/tmp/block_cache_test";
+constexpr char kHash[] = "hash";
+
+class BlockCacheTest : public ::testing::Test {
+ protected:
+  BlockCacheTest() : block_(kBlockLength), output_(kBlockLength) {
+    for (size_t i = 0; i < block_.size(); i++) {
+      block_[i] = static_cast<uint8_t>(i);
+    }
+  }
+
+  bool Lookup(size_t block_index, const std::string& leaf_hash = kHash) {
+    return cache_.Lookup(kPath, block_index, leaf_hash, 0, kBlockLength,
+                         output_.data());
+  }
+
+  void Insert(size_t block_index, const std::string& leaf_hash = kHash) {
+    cache_.Insert(kPath, block_index, leaf_hash, block_.data(), kBlockLength);
+  }
+
+  BlockCache cache_;
+  std::vector<uint8_t> block_;
+  std::vector<uint8_t> output_;
+};
+
+TEST_F(BlockCacheTest, DisabledByDefault) {
+  Insert(0);
+  EXPECT_FALSE(Lookup(0));
+
+  BlockCache::Stats stats = cache_.GetStats();
+  EXPECT_EQ(stats.hits, 0);
+  EXPECT_EQ(stats.misses, 0);
+  EXPECT_EQ(stats.cached_bytes, 0);
+  EXPECT_EQ(stats.capacity_bytes, 0);
+}
+
+TEST_F(BlockCacheTest, LookupHitAndMiss) {
+  cache_.SetCapacity(4);
+  EXPECT_FALSE(Lookup(0));
+  Insert(0);
+  EXPECT_TRUE(Lookup(0));
+  EXPECT_EQ(output_, block_);
+  EXPECT_FALSE(Lookup(1));
+
+  BlockCache::Stats stats = cache_.GetStats();
+  EXPECT_EQ(stats.hits, 1);
+  EXPECT_EQ(stats.misses, 2);
+  EXPECT_EQ(stats.cached_bytes, kBlockLength);
+  EXPECT_EQ(stats.capacity_bytes, 4 * BlockCache::kPageLength);
+}
+
+TEST_F(BlockCacheTest, LookupPartialBlock) {
+  cache_.SetCapacity(1);
+  Insert(0);
+
+  uint8_t output[16];
+  EXPECT_TRUE(cache_.Lookup(kPath, 0, kHash, 100, sizeof(output), output));
+  EXPECT_EQ(memcmp(output, block_.data() + 100, sizeof(output)), 0);
+}
+
+TEST_F(BlockCacheTest, StaleLeafHashMisses) {
+  cache_.SetCapacity(4);
+  Insert(0);
+  EXPECT_FALSE(Lookup(0, "other hash"));
+
+  // The stale block is dropped.
+  EXPECT_FALSE(Lookup(0));
+  EXPECT_EQ(cache_.GetStats().cached_bytes, 0);
+}
+
+TEST_F(BlockCacheTest, InsertReplacesBlock) {
+  cache_.SetCapacity(4);
+  Insert(0);
+  block_[0] ^= 0xff;
+  Insert(0, "new hash");
+  EXPECT_TRUE(Lookup(0, "new hash"));
+  EXPECT_EQ(output_, block_);
+  EXPECT_EQ(cache_.GetStats().cached_bytes, kBlockLength);
+}
+
+TEST_F(BlockCacheTest, EvictsLeastRecentlyUsed) {
+  cache_.SetCapacity(2);
+  Insert(0);
+  Insert(1);
+  EXPECT_TRUE(Lookup(0));
+
+  // Block 1 is now the least recently used.
+  Insert(2);
+  EXPECT_TRUE(Lookup(0));
+  EXPECT_FALSE(Lookup(1));
+  EXPECT_TRUE(Lookup(2));
+
+  BlockCache::Stats stats = cache_.GetStats();
+  EXPECT_EQ(stats.evictions, 1);
+  EXPECT_EQ(stats.cached_bytes, 2 * kBlockLength);
+}
+
+TEST_F(BlockCacheTest, BlockLargerThanCapacityNotCached) {
+  cache_.SetCapacity(1);
+  std::vector<uint8_t> block(2 * kBlockLength);
+  cache_.Insert(kPath, 0, kHash, block.data(), block.size());
+  EXPECT_EQ(cache_.GetStats().cached_bytes, 0);
+}
+
+TEST_F(BlockCacheTest, SetCapacityEvicts) {
+  cache_.SetCapacity(4);
+  for (size_t i = 0; i < 4; i++) {
+    Insert(i);
+  }
+  cache_.SetCapacity(1);
+  EXPECT_EQ(cache_.GetStats().cached_bytes, kBlockLength);
+  EXPECT_TRUE(Lookup(3));
+
+  cache_.SetCapacity(0);
+  EXPECT_EQ(cache_.GetStats().cached_bytes, 0);
+  EXPECT_FALSE(Lookup(3));
+}
+
+}  // namespace
+}  // namespace storage
+}  // namespace platform
+}  // namespace asylo
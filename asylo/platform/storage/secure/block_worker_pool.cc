@@ -0,0 +1,157 @@
+/*
+ *
+ * Copyright 2018 Asylo authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "asylo/platform/storage/secure/block_worker_pool.h"
+
+#include <algorithm>
+#include <atomic>
+
+#include "asylo/util/logging.h"
+
+namespace asylo {
+namespace platform {
+namespace storage {
+
+struct BlockWorkerPool::Job {
+  Job(size_t count, const std::function<bool(size_t)>* fn)
+      : task_count(count), task(fn), next_task(0), failed(false), finished(0) {}
+
+  const size_t task_count;
+
+  // The task function, owned by the caller of Run(), which does not return
+  // before all tasks have finished.
+  const std::function<bool(size_t)>* const task;
+
+  // Index of the next task to start.
+  std::atomic<size_t> next_task;
+
+  // Whether a task has failed.
+  std::atomic<bool> failed;
+
+  absl::Mutex mu;
+
+  // Signalled when the last task finishes.
+  absl::CondVar all_finished;
+
+  // Number of tasks finished or skipped.
+  size_t finished GUARDED_BY(mu);
+};
+
+constexpr size_t BlockWorkerPool::kMaxWorkers;
+
+BlockWorkerPool* BlockWorkerPool::GetInstance() {
+  static BlockWorkerPool* instance = new BlockWorkerPool();
+  return instance;
+}
+
+bool BlockWorkerPool::Run(size_t task_count, size_t max_threads,
+                          const std::function<bool(size_t)>& task) {
+  if (task_count == 0) {
+    return true;
+  }
+
+  auto job = std::make_shared<Job>(task_count, &task);
+  size_t helpers = std::min({max_threads > 0 ? max_threads - 1 : 0,
+                             task_count - 1, kMaxWorkers});
+  if (helpers > 0) {
+    absl::MutexLock lock(&mu_);
+    while (workers_.size() < helpers && !stopping_) {
+      pthread_t worker;
+      if (pthread_create(&worker, nullptr, &BlockWorkerPool::WorkerThread,
+                         this) != 0) {
+        VLOG(1) << "Failed to start a secure storage block worker";
+        break;
+      }
+      workers_.push_back(worker);
+    }
+    helpers = std::min(helpers, workers_.size());
+    for (size_t i = 0; i < helpers; ++i) {
+      jobs_.push_back(job);
+    }
+    if (helpers > 0) {
+      work_available_.SignalAll();
+    }
+  }
+
+  RunTasks(job.get());
+
+  absl::MutexLock lock(&job->mu);
+  while (job->finished < task_count) {
+    job->all_finished.Wait(&job->mu);
+  }
+  return !job->failed.load(std::memory_order_relaxed);
+}
+
+void BlockWorkerPool::Stop() {
+  std::vector<pthread_t> workers;
+  {
+    absl::MutexLock lock(&mu_);
+    stopping_ = true;
+    workers.swap(workers_);
+  }
+  work_available_.SignalAll();
+  for (pthread_t worker : workers) {
+    pthread_join(worker, nullptr);
+  }
+
+  absl::MutexLock lock(&mu_);
+  stopping_ = false;
+}
+
+void* BlockWorkerPool::WorkerThread(void* arg) {
+  reinterpret_cast<BlockWorkerPool*>(arg)->WorkerLoop();
+  return nullptr;
+}
+
+void BlockWorkerPool::WorkerLoop() {
+  while (true) {
+    std::shared_ptr<Job> job;
+    {
+      absl::MutexLock lock(&mu_);
+      while (!stopping_ && jobs_.empty()) {
+        work_available_.Wait(&mu_);
+      }
+      if (stopping_) {
+        return;
+      }
+      job = std::move(jobs_.front());
+      jobs_.pop_front();
+    }
+    RunTasks(job.get());
+  }
+}
+
+void BlockWorkerPool::RunTasks(Job* job) {
+  while (true) {
+    size_t index = job->next_task.fetch_add(1, std::memory_order_relaxed);
+    if (index >= job->task_count) {
+      return;
+    }
+    if (job->failed.load(std::memory_order_relaxed) || !(*job->task)(index)) {
+      job->failed.store(true, std::memory_order_relaxed);
+    }
+    absl::MutexLock lock(&job->mu);
+    if (++job->finished == job->task_count) {
+      job->all_finished.Signal();
+    }
+  }
+}
+
+}  // namespace storage
+}  // namespace platform
+}  // namespace asylo
@@ -0,0 +1,100 @@
+/*
+ *
+ * Copyright 2018 Asylo authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef ASYLO_PLATFORM_STORAGE_SECURE_BLOCK_WORKER_POOL_H_
+#define ASYLO_PLATFORM_STORAGE_SECURE_BLOCK_WORKER_POOL_H_
+
+#include <pthread.h>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "absl/synchronization/mutex.h"
+
+namespace asylo {
+namespace platform {
+namespace storage {
+
+// A bounded pool of enclave threads that share the work of encrypting and
+// decrypting runs of secure file blocks with the thread that issued the I/O.
+//
+// Workers are started with pthread_create when first needed, so the enclave
+// must be built with a TCS for each of them, and stay inside the enclave until
+// Stop() is called. If a worker cannot be started, the issuing thread does the
+// work itself.
+class BlockWorkerPool {
+ public:
+  // Maximum number of worker threads.
+  static constexpr size_t kMaxWorkers = 8;
+
+  // Returns the process-wide pool.
+  static BlockWorkerPool* GetInstance();
+
+  BlockWorkerPool(const BlockWorkerPool&) = delete;
+  BlockWorkerPool& operator=(const BlockWorkerPool&) = delete;
+
+  // Calls |task| once for each index in [0, |task_count|), using the calling
+  // thread and up to |max_threads| - 1 workers, and waits for all calls to
+  // return. Tasks must be independent of each other. Returns true if every call
+  // returned true. Once a call returns false, tasks not yet started are
+  // skipped.
+  bool Run(size_t task_count, size_t max_threads,
+           const std::function<bool(size_t)>& task) LOCKS_EXCLUDED(mu_);
+
+  // Stops and joins all workers. Workers are started again by later calls to
+  // Run().
+  void Stop() LOCKS_EXCLUDED(mu_);
+
+ private:
+  // A set of tasks submitted by a call to Run().
+  struct Job;
+
+  BlockWorkerPool() = default;
+
+  // Entry point of the worker threads.
+  static void* WorkerThread(void* arg);
+
+  // Serves jobs until the pool is stopped.
+  void WorkerLoop() LOCKS_EXCLUDED(mu_);
+
+  // Runs tasks of |job| until none are left to start.
+  static void RunTasks(Job* job);
+
+  absl::Mutex mu_;
+
+  // Signalled when jobs are added or the workers are asked to exit.
+  absl::CondVar work_available_;
+
+  // Jobs with tasks for workers to pick up. A job appears once for each worker
+  // it asked for.
+  std::deque<std::shared_ptr<Job>> jobs_ GUARDED_BY(mu_);
+
+  // Started workers.
+  std::vector<pthread_t> workers_ GUARDED_BY(mu_);
+
+  // Whether the workers are asked to exit.
+  bool stopping_ GUARDED_BY(mu_) = false;
+};
+
+}  // namespace storage
+}  // namespace platform
+}  // namespace asylo
+
+#endif  // ASYLO_PLATFORM_STORAGE_SECURE_BLOCK_WORKER_POOL_H_
@@ -30,7 +30,6 @@
 #include "asylo/platform/arch/include/trusted/host_calls.h"
 #include "asylo/platform/storage/secure/aead_handler.h"
 #include "asylo/platform/storage/utils/fd_closer.h"
-#include "asylo/platform/storage/utils/offset_translator.h"
 
 namespace asylo {
 namespace platform {
@@ -60,14 +59,9 @@ int secure_open(const char *pathname, int flags, ...) {
 
   FdCloser fd_closer(fd, &enc_untrusted_close);
 
-  // Set cursor to the logical offset of 0.
-  if (secure_lseek(fd, 0, SEEK_SET) == -1) {
-    LOG(ERROR) << "Failed to initialize cursor to the logical offset of 0, fd="
-               << fd;
-    return -1;
-  }
-
-  if (!AeadHandler::GetInstance().InitializeFile(fd, pathname, is_new_file)) {
+  // Initializing the file sets its cursor to the logical offset of 0.
+  if (!AeadHandler::GetInstance().InitializeFile(fd, pathname, is_new_file,
+                                                 flags)) {
     LOG(ERROR) << "Failed to initialize secure handling of file: " << pathname;
     return -1;
   }
@@ -89,51 +83,20 @@ int secure_close(int fd) {
   return (finalize_result && enc_untrusted_close(fd) == 0) ? 0 : -1;
 }
 
-off_t secure_lseek(int fd, off_t offset, int whence) {
-  if (offset < 0) {
+int secure_fsync(int fd) {
+  if (!AeadHandler::GetInstance().FlushDigest(fd)) {
     return -1;
   }
+  return enc_untrusted_fsync(fd);
+}
 
-  const OffsetTranslator &offset_translator =
-      AeadHandler::GetInstance().GetOffsetTranslator();
-
-  // The net logical offset to which lseek has been requested.
-  off_t logical_offset;
-  switch (whence) {
-    case SEEK_SET: {
-      logical_offset = offset;
-    } break;
-    case SEEK_CUR: {
-      off_t physical_cur_offset = enc_untrusted_lseek(fd, 0, SEEK_CUR);
-      if (physical_cur_offset == -1) {
-        LOG(ERROR) << "Failed to retrieve cursor offset on descriptor: " << fd;
-        return -1;
-      }
-      off_t logical_cur_offset =
-          offset_translator.PhysicalToLogical(physical_cur_offset);
-      logical_offset = logical_cur_offset + offset;
-    } break;
-    case SEEK_END: {
-      off_t physical_eof_offset = enc_untrusted_lseek(fd, 0, SEEK_END);
-      if (physical_eof_offset == -1) {
-        LOG(ERROR) << "Failed to retrieve EOF offset on descriptor: " << fd;
-        return -1;
-      }
-      off_t logical_eof_offset =
-          offset_translator.PhysicalToLogical(physical_eof_offset);
-      logical_offset = logical_eof_offset + offset;
-    } break;
-  }
-
-  // The net physical offset that corresponds to the requested logical offset.
-  off_t physical_offset = offset_translator.LogicalToPhysical(logical_offset);
-  physical_offset = enc_untrusted_lseek(fd, physical_offset, SEEK_SET);
-  if (physical_offset == -1) {
-    LOG(ERROR) << "enclave_lseek failed, fd = " << fd
-               << ", offset = " << offset;
+off_t secure_lseek(int fd, off_t offset, int whence) {
+  if (offset < 0) {
     return -1;
   }
-  return offset_translator.PhysicalToLogical(physical_offset);
+
+  // The cursor is kept in the enclave, so moving it does not exit the enclave.
+  return AeadHandler::GetInstance().Seek(fd, offset, whence);
 }
 
 }  // namespace storage
@@ -44,6 +44,10 @@ ssize_t secure_write(int fd, const void *buf, size_t count);
 
 int secure_close(int fd);
 
+// Persists the file digest if it has not been persisted since the last write,
+// then flushes the file on the host.
+int secure_fsync(int fd);
+
 off_t secure_lseek(int fd, off_t offset, int whence);
 
 }  // namespace storage
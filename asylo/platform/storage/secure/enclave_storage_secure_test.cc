@@ -21,6 +21,11 @@
 // IO syscall interface constants.
 #include <fcntl.h>
 #include <openssl/rand.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <thread>
+#include <vector>
 
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
@@ -29,6 +34,7 @@
 #include "asylo/platform/arch/include/trusted/host_calls.h"
 #include "asylo/platform/storage/secure/aead_handler.h"
 #include "asylo/platform/storage/secure/enclave_storage_secure.h"
+#include "asylo/platform/storage/secure/memory_mapper.h"
 #include "asylo/platform/storage/utils/fd_closer.h"
 #include "asylo/test/util/status_matchers.h"
 #include "asylo/test/util/test_flags.h"
@@ -43,7 +49,11 @@ using platform::storage::AeadHandler;
 using platform::storage::kBlockLength;
 using platform::storage::kCipherBlockLength;
 using platform::storage::kFileHashLength;
+using platform::storage::kSecureBlockLength;
+using platform::storage::kTreeFileSuffix;
+using platform::storage::MemoryMapper;
 using platform::storage::secure_close;
+using platform::storage::secure_fsync;
 using platform::storage::secure_lseek;
 using platform::storage::secure_open;
 using platform::storage::secure_read;
@@ -73,6 +83,37 @@ class EnclaveStorageSecureTest : public ::testing::Test,
     return AeadHandler::GetInstance().SetMasterKey(fd, key_.data(),
                                                    key_.size());
   }
+  int EmulateSetBlockLengthIoctl(int fd, size_t block_length) const {
+    return AeadHandler::GetInstance().SetBlockLength(fd, block_length);
+  }
+  int EmulateSetParallelismIoctl(int fd, uint32_t max_threads,
+                                 uint64_t min_bytes) const {
+    return AeadHandler::GetInstance().SetParallelism(fd, max_threads,
+                                                     min_bytes);
+  }
+  int EmulateSetDigestWriteBackIoctl(int fd, uint64_t max_dirty_bytes) const {
+    return AeadHandler::GetInstance().SetDigestWriteBack(fd, max_dirty_bytes,
+                                                         0);
+  }
+  std::string ReadFileHeader() const {
+    std::string header(kFileHeaderLength, '\0');
+    int fd = enc_untrusted_open(GetPath().c_str(), O_RDONLY);
+    if (fd < 0 ||
+        enc_untrusted_read(fd, &header[0], header.size()) !=
+            static_cast<ssize_t>(header.size())) {
+      header.clear();
+    }
+    enc_untrusted_close(fd);
+    return header;
+  }
+  bool WriteFileHeader(const std::string& header) const {
+    int fd = enc_untrusted_open(GetPath().c_str(), O_WRONLY);
+    bool written =
+        fd >= 0 && enc_untrusted_write(fd, header.data(), header.size()) ==
+                       static_cast<ssize_t>(header.size());
+    enc_untrusted_close(fd);
+    return written;
+  }
 
   size_t test_buf_len_;
   std::string path_;
@@ -94,6 +135,7 @@ void EnclaveStorageSecureTest::PrepareTest() {
   // occasionally the test is executed on the same (virtual) machine.
   LOG(INFO) << "Cleaning up test file if present, path = " << path_;
   remove(path_.c_str());
+  remove(absl::StrCat(path_, kTreeFileSuffix).c_str());
 
   // Generate the test key.
   key_.resize(kKeyLength);
@@ -237,6 +279,331 @@ TEST_P(EnclaveStorageSecureTest, ReadWriteInterlacedSuccess) {
   }
 }
 
+TEST_P(EnclaveStorageSecureTest, DigestWriteBackSuccess) {
+  int fd = secure_open(GetPath().c_str(), O_RDWR | O_CREAT,
+                       S_IRWXU | S_IRWXG | S_IRWXO);
+  ASSERT_GE(fd, 0);
+  ASSERT_EQ(EmulateSetKeyIoctl(fd), 0);
+  ASSERT_EQ(EmulateSetDigestWriteBackIoctl(fd, 1 << 20), 0);
+  const std::string initial_header = ReadFileHeader();
+  ASSERT_FALSE(initial_header.empty());
+
+  // Writes below the threshold leave the persisted digest untouched.
+  EXPECT_EQ(secure_write(fd, GetWriteBuffer(), test_buf_len_), test_buf_len_);
+  EXPECT_EQ(ReadFileHeader(), initial_header);
+
+  // Reads through the same file see the written data.
+  EXPECT_EQ(secure_lseek(fd, 0, SEEK_SET), 0);
+  EXPECT_EQ(secure_read(fd, GetReadBuffer(), test_buf_len_), test_buf_len_);
+  EXPECT_EQ(memcmp(GetWriteBuffer(), GetReadBuffer(), test_buf_len_), 0);
+
+  // Fsync persists the digest.
+  EXPECT_EQ(secure_fsync(fd), 0);
+  EXPECT_NE(ReadFileHeader(), initial_header);
+
+  EXPECT_EQ(secure_close(fd), 0);
+  EXPECT_THAT(OpenReadVerifyClose(0, test_buf_len_), IsOk());
+}
+
+TEST_P(EnclaveStorageSecureTest, DigestWriteBackThresholdSuccess) {
+  int fd = secure_open(GetPath().c_str(), O_WRONLY | O_CREAT,
+                       S_IRWXU | S_IRWXG | S_IRWXO);
+  ASSERT_GE(fd, 0);
+  ASSERT_EQ(EmulateSetKeyIoctl(fd), 0);
+  ASSERT_EQ(EmulateSetDigestWriteBackIoctl(fd, test_buf_len_), 0);
+  const std::string initial_header = ReadFileHeader();
+
+  // Reaching the threshold persists the digest without a close.
+  EXPECT_EQ(secure_write(fd, GetWriteBuffer(), test_buf_len_), test_buf_len_);
+  EXPECT_NE(ReadFileHeader(), initial_header);
+  EXPECT_THAT(OpenReadVerifyClose(0, test_buf_len_), IsOk());
+
+  EXPECT_EQ(secure_close(fd), 0);
+}
+
+TEST_P(EnclaveStorageSecureTest, LargeBlockLengthSuccess) {
+  constexpr size_t kLargeBlockLength = 4096;
+  int fd = secure_open(GetPath().c_str(), O_WRONLY | O_CREAT,
+                       S_IRWXU | S_IRWXG | S_IRWXO);
+  ASSERT_GE(fd, 0);
+  ASSERT_EQ(EmulateSetBlockLengthIoctl(fd, kLargeBlockLength), 0);
+  ASSERT_EQ(EmulateSetKeyIoctl(fd), 0);
+  EXPECT_EQ(secure_write(fd, GetWriteBuffer(), test_buf_len_), test_buf_len_);
+  EXPECT_EQ(secure_close(fd), 0);
+
+  // The data fits into a single block of the configured length.
+  struct stat st;
+  ASSERT_EQ(stat(GetPath().c_str(), &st), 0);
+  EXPECT_EQ(st.st_size, kFileHeaderLength + kLargeBlockLength +
+                            kSecureBlockLength - kBlockLength);
+
+  // The block length is read back from the header of the file.
+  EXPECT_THAT(OpenReadVerifyClose(0, test_buf_len_), IsOk());
+  off_t offset = kBlockLength / 2;
+  EXPECT_THAT(OpenReadVerifyClose(offset, test_buf_len_ - offset), IsOk());
+}
+
+TEST_P(EnclaveStorageSecureTest, ParallelReadWriteSuccess) {
+  constexpr size_t kSparseLength = 16 * kBlockLength;
+  std::vector<uint8_t> data(64 * kBlockLength + test_buf_len_);
+  for (size_t i = 0; i < data.size(); ++i) {
+    data[i] = reinterpret_cast<const uint8_t*>(
+        GetWriteBuffer())[i % test_buf_len_];
+  }
+
+  int fd = secure_open(GetPath().c_str(), O_RDWR | O_CREAT,
+                       S_IRWXU | S_IRWXG | S_IRWXO);
+  ASSERT_GE(fd, 0);
+  ASSERT_EQ(EmulateSetKeyIoctl(fd), 0);
+  ASSERT_EQ(EmulateSetParallelismIoctl(fd, 4, 0), 0);
+
+  // Write the data at a misaligned offset, after a sparse region.
+  off_t offset = kSparseLength + kBlockLength / 2;
+  EXPECT_EQ(secure_lseek(fd, offset, SEEK_SET), offset);
+  EXPECT_EQ(secure_write(fd, data.data(), data.size()), data.size());
+  EXPECT_EQ(secure_close(fd), 0);
+
+  // Read the whole file back with parallelism only for large reads.
+  fd = secure_open(GetPath().c_str(), O_RDONLY);
+  ASSERT_GE(fd, 0);
+  ASSERT_EQ(EmulateSetKeyIoctl(fd), 0);
+  ASSERT_EQ(EmulateSetParallelismIoctl(fd, 4, 8 * kBlockLength), 0);
+  std::vector<uint8_t> read_back(offset + data.size());
+  EXPECT_EQ(secure_read(fd, read_back.data(), read_back.size()),
+            read_back.size());
+  std::vector<uint8_t> zeros(offset, 0);
+  EXPECT_EQ(memcmp(read_back.data(), zeros.data(), offset), 0);
+  EXPECT_EQ(memcmp(read_back.data() + offset, data.data(), data.size()), 0);
+
+  // Small reads take the sequential path.
+  EXPECT_EQ(secure_lseek(fd, offset, SEEK_SET), offset);
+  EXPECT_EQ(secure_read(fd, GetReadBuffer(), test_buf_len_), test_buf_len_);
+  EXPECT_EQ(memcmp(GetWriteBuffer(), GetReadBuffer(), test_buf_len_), 0);
+  EXPECT_EQ(secure_close(fd), 0);
+
+  // Parallelism is not persisted with the file.
+  EXPECT_THAT(OpenReadVerifyClose(offset, test_buf_len_), IsOk());
+}
+
+TEST_P(EnclaveStorageSecureTest, ConcurrentReadersSuccess) {
+  constexpr int kReaders = 4;
+  constexpr int kIterations = 50;
+  std::vector<uint8_t> data(16 * kBlockLength);
+  for (size_t i = 0; i < data.size(); ++i) {
+    data[i] = reinterpret_cast<const uint8_t*>(
+        GetWriteBuffer())[i % test_buf_len_];
+  }
+
+  int writer_fd = secure_open(GetPath().c_str(), O_RDWR | O_CREAT,
+                              S_IRWXU | S_IRWXG | S_IRWXO);
+  ASSERT_GE(writer_fd, 0);
+  ASSERT_EQ(EmulateSetKeyIoctl(writer_fd), 0);
+  ASSERT_EQ(secure_write(writer_fd, data.data(), data.size()), data.size());
+
+  std::vector<int> reader_fds;
+  for (int i = 0; i < kReaders; ++i) {
+    int fd = secure_open(GetPath().c_str(), O_RDONLY);
+    ASSERT_GE(fd, 0);
+    ASSERT_EQ(EmulateSetKeyIoctl(fd), 0);
+    reader_fds.push_back(fd);
+  }
+
+  // Readers read the same and disjoint ranges of the file in parallel, while a
+  // writer rewrites the file with the same data, so that every read sees it.
+  std::vector<std::thread> threads;
+  std::vector<int> failures(kReaders + 1, 0);
+  for (int i = 0; i < kReaders; ++i) {
+    threads.emplace_back([&, i] {
+      std::vector<uint8_t> read_back(data.size());
+      for (int j = 0; j < kIterations; ++j) {
+        off_t offset = (i + j) % 2 == 0 ? 0 : i * kBlockLength;
+        size_t length = data.size() - offset;
+        if (secure_lseek(reader_fds[i], offset, SEEK_SET) != offset ||
+            secure_read(reader_fds[i], read_back.data(), length) != length ||
+            memcmp(read_back.data(), data.data() + offset, length) != 0) {
+          failures[i]++;
+        }
+      }
+    });
+  }
+  threads.emplace_back([&] {
+    for (int j = 0; j < kIterations; ++j) {
+      off_t offset = (j % 4) * kBlockLength + test_buf_len_;
+      size_t length = 2 * kBlockLength;
+      if (secure_lseek(writer_fd, offset, SEEK_SET) != offset ||
+          secure_write(writer_fd, data.data() + offset, length) != length) {
+        failures[kReaders]++;
+      }
+    }
+  });
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  EXPECT_EQ(failures, std::vector<int>(kReaders + 1, 0));
+
+  for (int fd : reader_fds) {
+    EXPECT_EQ(secure_close(fd), 0);
+  }
+  EXPECT_EQ(secure_close(writer_fd), 0);
+  EXPECT_THAT(OpenReadVerifyClose(0, test_buf_len_), IsOk());
+}
+
+TEST_P(EnclaveStorageSecureTest, LseekWhenceSuccess) {
+  int fd = secure_open(GetPath().c_str(), O_RDWR | O_CREAT,
+                       S_IRWXU | S_IRWXG | S_IRWXO);
+  ASSERT_GE(fd, 0);
+  ASSERT_EQ(EmulateSetKeyIoctl(fd), 0);
+  EXPECT_EQ(secure_write(fd, GetWriteBuffer(), test_buf_len_), test_buf_len_);
+
+  // The cursor is kept in the enclave - the host cursor is not moved.
+  EXPECT_EQ(enc_untrusted_lseek(fd, 0, SEEK_CUR), 0);
+
+  // SEEK_END is relative to the logical size, which need not be a multiple of
+  // the block length.
+  EXPECT_EQ(secure_lseek(fd, 0, SEEK_END), test_buf_len_);
+  EXPECT_EQ(secure_read(fd, GetReadBuffer(), test_buf_len_), 0);
+
+  off_t offset = test_buf_len_ / 2;
+  EXPECT_EQ(secure_lseek(fd, offset, SEEK_SET), offset);
+  EXPECT_EQ(secure_lseek(fd, 0, SEEK_CUR), offset);
+  EXPECT_EQ(secure_read(fd, GetReadBuffer(), test_buf_len_ - offset),
+            test_buf_len_ - offset);
+  EXPECT_EQ(secure_lseek(fd, 0, SEEK_CUR), test_buf_len_);
+  EXPECT_EQ(memcmp(reinterpret_cast<const char*>(GetWriteBuffer()) + offset,
+                   GetReadBuffer(), test_buf_len_ - offset),
+            0);
+  EXPECT_EQ(secure_close(fd), 0);
+}
+
+TEST_P(EnclaveStorageSecureTest, OverwriteKeepsSizeSuccess) {
+  EXPECT_THAT(OpenWriteClose(test_buf_len_), IsOk());
+
+  // Overwriting the start of the file does not truncate it.
+  EXPECT_THAT(OpenWriteClose(0), IsOk());
+  EXPECT_THAT(OpenReadVerifyClose(test_buf_len_, test_buf_len_), IsOk());
+  EXPECT_THAT(OpenReadVerifyClose(0, test_buf_len_), IsOk());
+}
+
+TEST_P(EnclaveStorageSecureTest, SparseMisalignedReadSuccess) {
+  // Leave a sparse block before the data.
+  EXPECT_THAT(OpenWriteClose(2 * kBlockLength), IsOk());
+
+  int fd = secure_open(GetPath().c_str(), O_RDONLY);
+  ASSERT_GE(fd, 0);
+  ASSERT_EQ(EmulateSetKeyIoctl(fd), 0);
+
+  // A read within a sparse block fills only the requested bytes.
+  constexpr size_t kReadLength = 16;
+  memset(GetReadBuffer(), 0xff, kMaxTestBufLen);
+  EXPECT_EQ(secure_lseek(fd, kBlockLength / 2, SEEK_SET), kBlockLength / 2);
+  EXPECT_EQ(secure_read(fd, GetReadBuffer(), kReadLength), kReadLength);
+  EXPECT_EQ(memcmp(GetZeroBuffer(), GetReadBuffer(), kReadLength), 0);
+  EXPECT_EQ(reinterpret_cast<uint8_t*>(GetReadBuffer())[kReadLength], 0xff);
+  EXPECT_EQ(secure_close(fd), 0);
+}
+
+TEST_P(EnclaveStorageSecureTest, TreeFileSuccess) {
+  // Write enough blocks for the tree to have inner nodes.
+  for (int i = 0; i < 8; i++) {
+    EXPECT_THAT(OpenWriteClose(i * test_buf_len_), IsOk());
+  }
+  const std::string tree_path = absl::StrCat(GetPath(), kTreeFileSuffix);
+  struct stat st;
+  ASSERT_EQ(stat(tree_path.c_str(), &st), 0);
+  EXPECT_GT(st.st_size, 0);
+
+  // The committed tree is loaded on open.
+  EXPECT_THAT(OpenReadVerifyClose(3 * test_buf_len_, test_buf_len_), IsOk());
+
+  // A damaged tree is rebuilt from the file. Only a writable open stores the
+  // rebuilt tree.
+  int fd = enc_untrusted_open(tree_path.c_str(), O_WRONLY);
+  ASSERT_GE(fd, 0);
+  std::vector<uint8_t> garbage(st.st_size, 0x5a);
+  EXPECT_EQ(enc_untrusted_write(fd, garbage.data(), garbage.size()),
+            garbage.size());
+  EXPECT_EQ(enc_untrusted_close(fd), 0);
+  EXPECT_THAT(OpenReadVerifyClose(5 * test_buf_len_, test_buf_len_), IsOk());
+  std::vector<uint8_t> tree(st.st_size);
+  fd = enc_untrusted_open(tree_path.c_str(), O_RDONLY);
+  ASSERT_GE(fd, 0);
+  EXPECT_EQ(enc_untrusted_read(fd, tree.data(), tree.size()), tree.size());
+  EXPECT_EQ(enc_untrusted_close(fd), 0);
+  EXPECT_EQ(tree, garbage);
+  EXPECT_THAT(OpenWriteClose(5 * test_buf_len_), IsOk());
+  EXPECT_THAT(OpenReadVerifyClose(5 * test_buf_len_, test_buf_len_), IsOk());
+
+  // So is a missing tree, which a read-only open does not create.
+  ASSERT_EQ(remove(tree_path.c_str()), 0);
+  EXPECT_THAT(OpenReadVerifyClose(7 * test_buf_len_, test_buf_len_), IsOk());
+  EXPECT_NE(stat(tree_path.c_str(), &st), 0);
+  EXPECT_THAT(OpenWriteClose(7 * test_buf_len_), IsOk());
+  EXPECT_EQ(stat(tree_path.c_str(), &st), 0);
+  EXPECT_THAT(OpenReadVerifyClose(7 * test_buf_len_, test_buf_len_), IsOk());
+}
+
+TEST_P(EnclaveStorageSecureTest, TreeFileWrittenAfterReadOnlyOpen) {
+  EXPECT_THAT(OpenWriteClose(0), IsOk());
+  const std::string tree_path = absl::StrCat(GetPath(), kTreeFileSuffix);
+  auto read_tree_file = [&tree_path]() {
+    std::string contents(1 << 16, '\0');
+    int fd = enc_untrusted_open(tree_path.c_str(), O_RDONLY);
+    ssize_t bytes_read = enc_untrusted_read(fd, &contents[0], contents.size());
+    enc_untrusted_close(fd);
+    contents.resize(bytes_read > 0 ? bytes_read : 0);
+    return contents;
+  };
+  const std::string initial_tree = read_tree_file();
+  ASSERT_FALSE(initial_tree.empty());
+
+  // The tree file is opened read-only with the first file descriptor, and
+  // written once the file is written through the second one.
+  int read_fd = secure_open(GetPath().c_str(), O_RDONLY);
+  ASSERT_GE(read_fd, 0);
+  ASSERT_EQ(EmulateSetKeyIoctl(read_fd), 0);
+  int write_fd = secure_open(GetPath().c_str(), O_WRONLY);
+  ASSERT_GE(write_fd, 0);
+  ASSERT_EQ(EmulateSetKeyIoctl(write_fd), 0);
+  EXPECT_EQ(secure_write(write_fd, GetZeroBuffer(), test_buf_len_),
+            test_buf_len_);
+  EXPECT_EQ(secure_close(write_fd), 0);
+  EXPECT_EQ(secure_close(read_fd), 0);
+  EXPECT_NE(read_tree_file(), initial_tree);
+
+  int fd = secure_open(GetPath().c_str(), O_RDONLY);
+  ASSERT_GE(fd, 0);
+  ASSERT_EQ(EmulateSetKeyIoctl(fd), 0);
+  EXPECT_EQ(secure_read(fd, GetReadBuffer(), test_buf_len_), test_buf_len_);
+  EXPECT_EQ(memcmp(GetZeroBuffer(), GetReadBuffer(), test_buf_len_), 0);
+  EXPECT_EQ(secure_close(fd), 0);
+}
+
+TEST_P(EnclaveStorageSecureTest, BlockCacheSuccess) {
+  AeadHandler::GetInstance().SetBlockCacheCapacity(16);
+  EXPECT_THAT(OpenWriteClose(0), IsOk());
+
+  int fd = secure_open(GetPath().c_str(), O_RDONLY);
+  ASSERT_GE(fd, 0);
+  ASSERT_EQ(EmulateSetKeyIoctl(fd), 0);
+
+  // Blocks written through the handler are read back from the cache.
+  uint64_t hits = AeadHandler::GetInstance().GetBlockCacheStats().hits;
+  for (int i = 0; i < 2; i++) {
+    EXPECT_EQ(secure_lseek(fd, 0, SEEK_SET), 0);
+    memset(GetReadBuffer(), 0, kMaxTestBufLen);
+    EXPECT_EQ(secure_read(fd, GetReadBuffer(), test_buf_len_), test_buf_len_);
+    EXPECT_EQ(memcmp(GetWriteBuffer(), GetReadBuffer(), test_buf_len_), 0);
+    uint64_t new_hits = AeadHandler::GetInstance().GetBlockCacheStats().hits;
+    EXPECT_GT(new_hits, hits);
+    hits = new_hits;
+  }
+  EXPECT_EQ(secure_close(fd), 0);
+
+  // Disabling the cache frees all cached blocks.
+  AeadHandler::GetInstance().SetBlockCacheCapacity(0);
+  EXPECT_EQ(AeadHandler::GetInstance().GetBlockCacheStats().cached_bytes, 0);
+}
+
 TEST_P(EnclaveStorageSecureTest, LseekReadWriteInterlacedSingleFdSuccess) {
   const int interations = 10;
   for (int iter = 0; iter < interations; iter++) {
@@ -524,6 +891,60 @@ TEST_P(EnclaveStorageSecureTest, ReadWriteTokensModified) {
   EXPECT_THAT(OpenReadVerifyClose(0, test_buf_len_), Not(IsOk()));
 }
 
+TEST_P(EnclaveStorageSecureTest, DigestWriteBackLostWithoutFinalFlush) {
+  EXPECT_THAT(OpenWriteClose(0), IsOk());
+  const std::string persisted_header = ReadFileHeader();
+  ASSERT_FALSE(persisted_header.empty());
+
+  // Overwrite persisted data in write-back mode. The blocks reach the host
+  // file, the digest does not.
+  int fd = secure_open(GetPath().c_str(), O_RDWR);
+  ASSERT_GE(fd, 0);
+  ASSERT_EQ(EmulateSetKeyIoctl(fd), 0);
+  ASSERT_EQ(EmulateSetDigestWriteBackIoctl(fd, 1 << 20), 0);
+  EXPECT_EQ(secure_write(fd, GetZeroBuffer(), test_buf_len_), test_buf_len_);
+  EXPECT_EQ(ReadFileHeader(), persisted_header);
+
+  // Emulate the enclave stopping before the final flush: the overwritten blocks
+  // stay on disk with the digest persisted before them.
+  EXPECT_EQ(secure_close(fd), 0);
+  ASSERT_TRUE(WriteFileHeader(persisted_header));
+
+  // Neither the new nor the previously persisted contents can be read back.
+  EXPECT_THAT(OpenReadVerifyClose(0, test_buf_len_), Not(IsOk()));
+  fd = secure_open(GetPath().c_str(), O_RDONLY);
+  ASSERT_GE(fd, 0);
+  EXPECT_EQ(EmulateSetKeyIoctl(fd), -1);
+  secure_close(fd);
+}
+
+TEST_P(EnclaveStorageSecureTest, FailedWriteKeepsFileContents) {
+  EXPECT_THAT(OpenWriteClose(0), IsOk());
+
+  // Writes to a file opened read-only fail on the host, after the blocks are
+  // encrypted.
+  int fd = secure_open(GetPath().c_str(), O_RDONLY);
+  ASSERT_GE(fd, 0);
+  ASSERT_EQ(EmulateSetKeyIoctl(fd), 0);
+  EXPECT_EQ(secure_write(fd, GetZeroBuffer(), test_buf_len_), -1);
+  EXPECT_EQ(secure_lseek(fd, 0, SEEK_END), test_buf_len_);
+  EXPECT_EQ(secure_write(fd, GetZeroBuffer(), test_buf_len_), -1);
+  EXPECT_EQ(secure_lseek(fd, 4 * kBlockLength, SEEK_SET), 4 * kBlockLength);
+  EXPECT_EQ(secure_write(fd, GetZeroBuffer(), test_buf_len_), -1);
+
+  // The failed writes change neither the size nor the contents of the file.
+  EXPECT_EQ(secure_lseek(fd, 0, SEEK_END), test_buf_len_);
+  EXPECT_EQ(secure_lseek(fd, 0, SEEK_SET), 0);
+  EXPECT_EQ(secure_read(fd, GetReadBuffer(), test_buf_len_), test_buf_len_);
+  EXPECT_EQ(memcmp(GetWriteBuffer(), GetReadBuffer(), test_buf_len_), 0);
+  EXPECT_EQ(secure_close(fd), 0);
+
+  // The reopened file verifies and can be written again.
+  EXPECT_THAT(OpenReadVerifyClose(0, test_buf_len_), IsOk());
+  EXPECT_THAT(OpenWriteClose(test_buf_len_), IsOk());
+  EXPECT_THAT(OpenReadVerifyClose(test_buf_len_, test_buf_len_), IsOk());
+}
+
 TEST_P(EnclaveStorageSecureTest, FileTruncateAttack) {
   EXPECT_THAT(OpenWriteClose(0), IsOk());
 
@@ -562,6 +983,133 @@ TEST_P(EnclaveStorageSecureTest, RedundantIoctlFailure) {
   EXPECT_EQ(secure_close(fd), 0);
 }
 
+TEST_P(EnclaveStorageSecureTest, BlockLengthIoctlFailure) {
+  EXPECT_THAT(OpenWriteClose(0), IsOk());
+
+  int fd = secure_open(GetPath().c_str(), O_RDWR);
+  ASSERT_GE(fd, 0);
+
+  // Unsupported block lengths are rejected.
+  EXPECT_EQ(EmulateSetBlockLengthIoctl(fd, kBlockLength + 1), -1);
+  EXPECT_EQ(EmulateSetBlockLengthIoctl(fd, kBlockLength / 2), -1);
+
+  // The block length of an existing file cannot be changed.
+  EXPECT_EQ(EmulateSetBlockLengthIoctl(fd, kBlockLength * 2), -1);
+  EXPECT_EQ(EmulateSetBlockLengthIoctl(fd, kBlockLength), 0);
+
+  EXPECT_EQ(secure_close(fd), 0);
+}
+
+TEST_P(EnclaveStorageSecureTest, MapReadSuccess) {
+  constexpr size_t kPageLength = MemoryMapper::kPageLength;
+  std::vector<uint8_t> data(3 * kPageLength + test_buf_len_);
+  for (size_t i = 0; i < data.size(); ++i) {
+    data[i] = static_cast<uint8_t>(i * 7);
+  }
+
+  int fd = secure_open(GetPath().c_str(), O_RDWR | O_CREAT,
+                       S_IRWXU | S_IRWXG | S_IRWXO);
+  ASSERT_GE(fd, 0);
+  ASSERT_EQ(EmulateSetKeyIoctl(fd), 0);
+  EXPECT_EQ(secure_write(fd, data.data(), data.size()), data.size());
+
+  // Map the file from its second page, past its end.
+  const size_t length = data.size() - kPageLength + kPageLength / 2;
+  uint8_t *mapped = static_cast<uint8_t *>(MemoryMapper::GetInstance().Map(
+      fd, length, PROT_READ, MAP_PRIVATE, kPageLength));
+  ASSERT_NE(mapped, MAP_FAILED);
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(mapped) % kPageLength, 0);
+
+  // Mapping does not move the cursor of the file.
+  EXPECT_EQ(secure_lseek(fd, 0, SEEK_CUR), data.size());
+  EXPECT_EQ(secure_close(fd), 0);
+
+  // The mapping outlives the file descriptor. Bytes past the end of the file
+  // read as zero.
+  EXPECT_EQ(memcmp(mapped, data.data() + kPageLength,
+                   data.size() - kPageLength),
+            0);
+  std::vector<uint8_t> zeros(length - (data.size() - kPageLength), 0);
+  EXPECT_EQ(memcmp(mapped + data.size() - kPageLength, zeros.data(),
+                   zeros.size()),
+            0);
+  EXPECT_EQ(MemoryMapper::GetInstance().Sync(mapped, length, MS_SYNC), 0);
+  EXPECT_EQ(MemoryMapper::GetInstance().Unmap(mapped, length), 0);
+}
+
+TEST_P(EnclaveStorageSecureTest, MapWriteBackSuccess) {
+  constexpr size_t kPageLength = MemoryMapper::kPageLength;
+  std::vector<uint8_t> data(2 * kPageLength + test_buf_len_, 'a');
+
+  int fd = secure_open(GetPath().c_str(), O_RDWR | O_CREAT,
+                       S_IRWXU | S_IRWXG | S_IRWXO);
+  ASSERT_GE(fd, 0);
+  ASSERT_EQ(EmulateSetKeyIoctl(fd), 0);
+  EXPECT_EQ(secure_write(fd, data.data(), data.size()), data.size());
+  uint8_t *mapped = static_cast<uint8_t *>(MemoryMapper::GetInstance().Map(
+      fd, data.size(), PROT_READ | PROT_WRITE, MAP_SHARED, 0));
+  ASSERT_NE(mapped, MAP_FAILED);
+  EXPECT_EQ(secure_close(fd), 0);
+
+  // Changes are written back by msync.
+  memcpy(mapped + kPageLength / 2, GetWriteBuffer(), test_buf_len_);
+  memcpy(data.data() + kPageLength / 2, GetWriteBuffer(), test_buf_len_);
+  EXPECT_EQ(MemoryMapper::GetInstance().Sync(mapped, kPageLength, MS_SYNC), 0);
+  fd = secure_open(GetPath().c_str(), O_RDONLY);
+  ASSERT_GE(fd, 0);
+  ASSERT_EQ(EmulateSetKeyIoctl(fd), 0);
+  std::vector<uint8_t> read_back(data.size());
+  EXPECT_EQ(secure_read(fd, read_back.data(), read_back.size()),
+            read_back.size());
+  EXPECT_EQ(read_back, data);
+  EXPECT_EQ(secure_close(fd), 0);
+
+  // And by munmap, except past the end of the file, which is not extended.
+  mapped[2 * kPageLength] = 'b';
+  data[2 * kPageLength] = 'b';
+  mapped[data.size()] = 'c';
+  EXPECT_EQ(MemoryMapper::GetInstance().Unmap(mapped, data.size()), 0);
+  fd = secure_open(GetPath().c_str(), O_RDONLY);
+  ASSERT_GE(fd, 0);
+  ASSERT_EQ(EmulateSetKeyIoctl(fd), 0);
+  read_back.assign(data.size() + 1, 0);
+  EXPECT_EQ(secure_read(fd, read_back.data(), read_back.size()), data.size());
+  read_back.resize(data.size());
+  EXPECT_EQ(read_back, data);
+  EXPECT_EQ(secure_close(fd), 0);
+}
+
+TEST_P(EnclaveStorageSecureTest, MapInvalidArgumentsFailure) {
+  EXPECT_THAT(OpenWriteClose(0), IsOk());
+  int fd = secure_open(GetPath().c_str(), O_RDONLY);
+  ASSERT_GE(fd, 0);
+  platform::storage::FdCloser fd_closer(fd, &secure_close);
+  ASSERT_EQ(EmulateSetKeyIoctl(fd), 0);
+
+  MemoryMapper &mapper = MemoryMapper::GetInstance();
+  EXPECT_EQ(mapper.Map(fd, test_buf_len_, PROT_READ, MAP_PRIVATE, 1),
+            MAP_FAILED);
+  EXPECT_EQ(errno, EINVAL);
+  EXPECT_EQ(mapper.Map(fd, 0, PROT_READ, MAP_PRIVATE, 0), MAP_FAILED);
+  EXPECT_EQ(errno, EINVAL);
+
+  // Shared writable mappings need a file opened for writing.
+  EXPECT_EQ(
+      mapper.Map(fd, test_buf_len_, PROT_READ | PROT_WRITE, MAP_SHARED, 0),
+      MAP_FAILED);
+  EXPECT_EQ(errno, EACCES);
+
+  // Only whole mappings can be unmapped.
+  void *mapped = mapper.Map(fd, test_buf_len_, PROT_READ, MAP_PRIVATE, 0);
+  ASSERT_NE(mapped, MAP_FAILED);
+  EXPECT_EQ(mapper.Unmap(mapped, 2 * MemoryMapper::kPageLength), -1);
+  EXPECT_EQ(errno, EINVAL);
+  EXPECT_EQ(mapper.Unmap(mapped, test_buf_len_), 0);
+  EXPECT_EQ(mapper.Unmap(mapped, test_buf_len_), -1);
+  EXPECT_EQ(mapper.Sync(mapped, test_buf_len_, MS_SYNC), -1);
+  EXPECT_EQ(errno, ENOMEM);
+}
+
 TEST_P(EnclaveStorageSecureTest, UnknownFdIoctlFailure) {
   // Open for write.
   int fd = secure_open(GetPath().c_str(), O_WRONLY | O_CREAT,
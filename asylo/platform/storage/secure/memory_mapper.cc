@@ -0,0 +1,350 @@
+/*
+ *
+ * Copyright 2018 Asylo authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "asylo/platform/storage/secure/memory_mapper.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <openssl/sha.h>
+#include <sys/mman.h>
+
+#include <algorithm>
+#include <limits>
+#include <string>
+
+#include "absl/memory/memory.h"
+#include "asylo/util/logging.h"
+#include "asylo/platform/arch/include/trusted/host_calls.h"
+#include "asylo/platform/storage/secure/aead_handler.h"
+#include "asylo/platform/storage/secure/enclave_storage_secure.h"
+#include "asylo/platform/storage/utils/fd_closer.h"
+
+namespace asylo {
+namespace platform {
+namespace storage {
+
+constexpr size_t MemoryMapper::kPageLength;
+
+namespace {
+
+// Length of the chunks in which a mapped host file is read, which bounds the
+// length of each host call.
+constexpr size_t kHostReadChunkLength = 64 * 1024;
+
+// Number of consecutive interrupted reads after which mapping a host file
+// fails.
+constexpr int kMaxInterruptedHostReads = 16;
+
+size_t RoundUpToPage(size_t length) {
+  return (length + MemoryMapper::kPageLength - 1) /
+         MemoryMapper::kPageLength * MemoryMapper::kPageLength;
+}
+
+}  // namespace
+
+void* MemoryMapper::Map(int fd, size_t length, int prot, int flags,
+                        off_t offset) {
+  if (!ValidateMapping(length, prot, flags, offset)) {
+    return MAP_FAILED;
+  }
+
+  // Only shared writable mappings modify the file.
+  const bool write_back = flags == MAP_SHARED && (prot & PROT_WRITE);
+  if (!CheckAccessMode(fd, write_back)) {
+    return MAP_FAILED;
+  }
+
+  const std::string path = AeadHandler::GetInstance().GetPathName(fd);
+  if (path.empty()) {
+    LOG(ERROR) << "Attempt made to map an unopened file, fd = " << fd;
+    errno = EBADF;
+    return MAP_FAILED;
+  }
+
+  // The mapping reads and writes the file through its own descriptor, which
+  // shares the state of the opened file, including its key, and keeps its own
+  // cursor.
+  int map_fd = secure_open(path.c_str(), write_back ? O_RDWR : O_RDONLY);
+  if (map_fd == -1) {
+    return MAP_FAILED;
+  }
+  FdCloser fd_closer(map_fd, &secure_close);
+
+  // Reads may return less than requested, so read until the range is filled or
+  // the end of the file is reached. The part of the range past the end of the
+  // file reads as zeros.
+  std::unique_ptr<Mapping> mapping = CreateMapping(length, offset);
+  if (secure_lseek(map_fd, offset, SEEK_SET) != offset) {
+    LOG(ERROR) << "Failed to seek to the mapped range of " << path
+               << ", offset = " << offset;
+    return MAP_FAILED;
+  }
+  size_t bytes_read = 0;
+  while (bytes_read < mapping->length) {
+    const size_t remaining = mapping->length - bytes_read;
+    ssize_t result =
+        secure_read(map_fd, mapping->data + bytes_read, remaining);
+    if (result < 0 || static_cast<size_t>(result) > remaining) {
+      LOG(ERROR) << "Failed to read the mapped range of " << path
+                 << ", offset = " << offset + bytes_read
+                 << ", length = " << length;
+      errno = EIO;
+      return MAP_FAILED;
+    }
+    if (result == 0) {
+      break;
+    }
+    bytes_read += result;
+  }
+
+  if (write_back) {
+    const size_t page_count = mapping->length / kPageLength;
+    mapping->page_hashes.reserve(page_count);
+    for (size_t page = 0; page < page_count; page++) {
+      mapping->page_hashes.push_back(HashPage(*mapping, page));
+    }
+    mapping->fd = fd_closer.release();
+  }
+
+  return Insert(std::move(mapping));
+}
+
+void* MemoryMapper::MapHostFile(int host_fd, size_t length, int prot,
+                                int flags, off_t offset) {
+  if (!ValidateMapping(length, prot, flags, offset)) {
+    return MAP_FAILED;
+  }
+  if (flags == MAP_SHARED && (prot & PROT_WRITE)) {
+    LOG(ERROR) << "Shared writable mappings of host files are not supported.";
+    errno = ENOTSUP;
+    return MAP_FAILED;
+  }
+  if (!CheckAccessMode(host_fd, /*write_back=*/false)) {
+    return MAP_FAILED;
+  }
+
+  // Read the range in bounded chunks, without moving the cursor of the file.
+  // Only interrupted reads are retried, a bounded number of times. The part of
+  // the range past the end of the file reads as zeros.
+  std::unique_ptr<Mapping> mapping = CreateMapping(length, offset);
+  size_t bytes_read = 0;
+  int interrupted_reads = 0;
+  while (bytes_read < mapping->length) {
+    const size_t chunk_length =
+        std::min(kHostReadChunkLength, mapping->length - bytes_read);
+    ssize_t result =
+        enc_untrusted_pread(host_fd, mapping->data + bytes_read, chunk_length,
+                            offset + bytes_read);
+    if (result == -1 && errno == EINTR &&
+        ++interrupted_reads < kMaxInterruptedHostReads) {
+      continue;
+    }
+    if (result < 0 || static_cast<size_t>(result) > chunk_length) {
+      if (result != -1) {
+        errno = EIO;
+      }
+      LOG(ERROR) << "Failed to read the mapped range of host file, fd = "
+                 << host_fd << ", offset = " << offset + bytes_read
+                 << ", errno = " << errno;
+      return MAP_FAILED;
+    }
+    if (result == 0) {
+      break;
+    }
+    interrupted_reads = 0;
+    bytes_read += result;
+  }
+
+  return Insert(std::move(mapping));
+}
+
+int MemoryMapper::Unmap(void* addr, size_t length) {
+  absl::MutexLock lock(&mu_);
+  auto it = mappings_.find(static_cast<uint8_t*>(addr));
+  if (it == mappings_.end() || RoundUpToPage(length) != it->second->length) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  std::unique_ptr<Mapping> mapping = std::move(it->second);
+  mappings_.erase(it);
+  if (mapping->fd == -1) {
+    return 0;
+  }
+
+  bool written_back =
+      WriteBack(mapping.get(), 0, mapping->length / kPageLength);
+  bool closed = secure_close(mapping->fd) == 0;
+  return (written_back && closed) ? 0 : -1;
+}
+
+int MemoryMapper::Sync(void* addr, size_t length, int flags) {
+  const uint8_t* start = static_cast<uint8_t*>(addr);
+  if (reinterpret_cast<uintptr_t>(start) % kPageLength != 0 ||
+      (flags & ~(MS_ASYNC | MS_SYNC | MS_INVALIDATE)) != 0 ||
+      ((flags & MS_ASYNC) && (flags & MS_SYNC))) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  absl::MutexLock lock(&mu_);
+  Mapping* mapping = Find(start);
+  if (!mapping || length > mapping->length - (start - mapping->data)) {
+    errno = ENOMEM;
+    return -1;
+  }
+  if (mapping->fd == -1) {
+    return 0;
+  }
+
+  // Pages are written back right away, with MS_ASYNC as well.
+  const size_t first_page = (start - mapping->data) / kPageLength;
+  const size_t end_page =
+      RoundUpToPage(start - mapping->data + length) / kPageLength;
+  if (!WriteBack(mapping, first_page, end_page)) {
+    return -1;
+  }
+  if ((flags & MS_SYNC) && secure_fsync(mapping->fd) != 0) {
+    return -1;
+  }
+  return 0;
+}
+
+bool MemoryMapper::ValidateMapping(size_t length, int prot, int flags,
+                                   off_t offset) {
+  if (length == 0 ||
+      length > std::numeric_limits<size_t>::max() - 2 * kPageLength ||
+      offset < 0 || offset % kPageLength != 0 ||
+      (flags != MAP_SHARED && flags != MAP_PRIVATE) ||
+      (prot & ~(PROT_READ | PROT_WRITE | PROT_EXEC)) != 0) {
+    errno = EINVAL;
+    return false;
+  }
+  if (prot & PROT_EXEC) {
+    LOG(ERROR) << "Executable mappings of files are not supported.";
+    errno = ENOTSUP;
+    return false;
+  }
+  return true;
+}
+
+bool MemoryMapper::CheckAccessMode(int fd, bool write_back) {
+  int access_mode = enc_untrusted_fcntl(fd, F_GETFL, int64_t{0});
+  if (access_mode == -1) {
+    return false;
+  }
+  access_mode &= O_ACCMODE;
+  if (access_mode == O_WRONLY || (write_back && access_mode != O_RDWR)) {
+    errno = EACCES;
+    return false;
+  }
+  return true;
+}
+
+std::unique_ptr<MemoryMapper::Mapping> MemoryMapper::CreateMapping(
+    size_t length, off_t offset) {
+  auto mapping = absl::make_unique<Mapping>();
+  mapping->length = RoundUpToPage(length);
+  mapping->buffer.reset(new uint8_t[mapping->length + kPageLength]());
+  const uintptr_t buffer_address =
+      reinterpret_cast<uintptr_t>(mapping->buffer.get());
+  mapping->data = mapping->buffer.get() +
+                  (RoundUpToPage(buffer_address) - buffer_address);
+  mapping->offset = offset;
+  mapping->fd = -1;
+  return mapping;
+}
+
+void* MemoryMapper::Insert(std::unique_ptr<Mapping> mapping) {
+  uint8_t* data = mapping->data;
+  absl::MutexLock lock(&mu_);
+  mappings_.emplace(data, std::move(mapping));
+  return data;
+}
+
+MemoryMapper::PageHash MemoryMapper::HashPage(const Mapping& mapping,
+                                              size_t page) {
+  PageHash hash;
+  SHA256(mapping.data + page * kPageLength, kPageLength, hash.data());
+  return hash;
+}
+
+bool MemoryMapper::WriteBack(Mapping* mapping, size_t first_page,
+                             size_t end_page) {
+  const off_t logical_size = secure_lseek(mapping->fd, 0, SEEK_END);
+  if (logical_size == -1) {
+    return false;
+  }
+
+  std::vector<PageHash> hashes;
+  hashes.reserve(end_page - first_page);
+  for (size_t page = first_page; page < end_page; page++) {
+    hashes.push_back(HashPage(*mapping, page));
+  }
+  auto changed = [&](size_t page) {
+    return hashes[page - first_page] != mapping->page_hashes[page];
+  };
+
+  // Write each run of changed pages with a single write, up to the end of the
+  // file.
+  size_t page = first_page;
+  while (page < end_page) {
+    if (!changed(page)) {
+      page++;
+      continue;
+    }
+    size_t run_end = page + 1;
+    while (run_end < end_page && changed(run_end)) {
+      run_end++;
+    }
+
+    const off_t run_offset = mapping->offset + page * kPageLength;
+    if (run_offset >= logical_size) {
+      break;
+    }
+    const size_t run_length =
+        std::min<size_t>((run_end - page) * kPageLength,
+                         logical_size - run_offset);
+    if (secure_lseek(mapping->fd, run_offset, SEEK_SET) != run_offset ||
+        secure_write(mapping->fd, mapping->data + page * kPageLength,
+                     run_length) != static_cast<ssize_t>(run_length)) {
+      LOG(ERROR) << "Failed to write back mapped pages, offset = "
+                 << run_offset << ", length = " << run_length;
+      return false;
+    }
+    for (; page < run_end; page++) {
+      mapping->page_hashes[page] = hashes[page - first_page];
+    }
+  }
+
+  return true;
+}
+
+MemoryMapper::Mapping* MemoryMapper::Find(const uint8_t* addr) {
+  auto it = mappings_.upper_bound(addr);
+  if (it == mappings_.begin()) {
+    return nullptr;
+  }
+  --it;
+  Mapping* mapping = it->second.get();
+  return addr < mapping->data + mapping->length ? mapping : nullptr;
+}
+
+}  // namespace storage
+}  // namespace platform
+}  // namespace asylo
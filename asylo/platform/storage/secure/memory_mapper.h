@@ -0,0 +1,154 @@
+/*
+ *
+ * Copyright 2018 Asylo authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef ASYLO_PLATFORM_STORAGE_SECURE_MEMORY_MAPPER_H_
+#define ASYLO_PLATFORM_STORAGE_SECURE_MEMORY_MAPPER_H_
+
+#include <sys/types.h>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <vector>
+
+#include "absl/synchronization/mutex.h"
+
+namespace asylo {
+namespace platform {
+namespace storage {
+
+// Maps files into enclave memory. A mapping is a page-aligned copy of a range
+// of a file, read when the file is mapped. The enclave cannot intercept the
+// first access to a page, so the whole range is read up front. Secure files are
+// read through the AeadHandler, which decrypts and verifies the range. Host
+// files are read with positioned host reads, and can only be mapped privately
+// or read-only. Mappings can only be unmapped as a whole.
+//
+// Shared writable mappings keep their own descriptor on the file, so they
+// outlive the descriptor they were created from. Their pages are written back
+// through the AeadHandler by Sync and Unmap. Write-back is limited to the pages
+// whose contents changed since they were read or last written back, and to the
+// logical size of the file - mappings do not extend files. Writes to the file
+// made after it was mapped are not reflected in the mapping.
+class MemoryMapper {
+ public:
+  // Length of an EPC page. Mappings start at page boundaries of the file and of
+  // enclave memory, and span whole pages.
+  static constexpr size_t kPageLength = 4096;
+
+  static MemoryMapper& GetInstance() {
+    static MemoryMapper* instance = new MemoryMapper;
+    return *instance;
+  }
+
+  // Maps |length| bytes of the secure file opened as |fd| from |offset|, as
+  // mmap does. |prot| may combine PROT_READ and PROT_WRITE, and |flags| is
+  // either MAP_SHARED or MAP_PRIVATE. Bytes beyond the end of the file read as
+  // zero. The mapping can only be unmapped as a whole, see Unmap. Returns the
+  // address of the mapping, or MAP_FAILED on failure, with errno set to EIO if
+  // the file could not be read.
+  void* Map(int fd, size_t length, int prot, int flags, off_t offset)
+      LOCKS_EXCLUDED(mu_);
+
+  // Maps |length| bytes of the host file |host_fd| from |offset|, as mmap
+  // does, except that the mapping is a copy of the file that is never written
+  // back. Shared mappings must not be writable. Bytes beyond the end of the
+  // file read as zero. The mapping can only be unmapped as a whole, see Unmap.
+  // Returns the address of the mapping, or MAP_FAILED on failure.
+  void* MapHostFile(int host_fd, size_t length, int prot, int flags,
+                    off_t offset) LOCKS_EXCLUDED(mu_);
+
+  // Writes back and removes the mapping at |addr|, as munmap does. Unlike
+  // munmap, only whole mappings can be unmapped: |addr| must be an address
+  // returned by Map or MapHostFile, and |length| must round up to the same
+  // number of pages as the length it was mapped with. Otherwise fails with
+  // EINVAL and leaves the mapping in place. Returns 0 on success, or -1 on
+  // failure, in which case a mapping found at |addr| is removed all the same.
+  int Unmap(void* addr, size_t length) LOCKS_EXCLUDED(mu_);
+
+  // Writes back the pages of a mapping from |addr| to |addr| + |length|, as
+  // msync does. With MS_SYNC the file digest is also persisted. Returns 0 on
+  // success, or -1 on failure.
+  int Sync(void* addr, size_t length, int flags) LOCKS_EXCLUDED(mu_);
+
+ private:
+  using PageHash = std::array<uint8_t, 32>;
+
+  struct Mapping {
+    // Buffer holding the mapped pages at its first page boundary.
+    std::unique_ptr<uint8_t[]> buffer;
+    uint8_t* data;
+
+    // Length of the mapping, a multiple of kPageLength.
+    size_t length;
+
+    // Offset of the mapping in the file.
+    off_t offset;
+
+    // Descriptor on the file that pages are written back through, or -1 if
+    // the mapping is not written back.
+    int fd;
+
+    // Hashes of the pages as last read or written back, for mappings that are
+    // written back.
+    std::vector<PageHash> page_hashes;
+  };
+
+  MemoryMapper() = default;
+  MemoryMapper(const MemoryMapper&) = delete;
+  MemoryMapper& operator=(const MemoryMapper&) = delete;
+
+  // Returns false and sets errno if the arguments of a mapping are not valid
+  // or not supported.
+  static bool ValidateMapping(size_t length, int prot, int flags,
+                              off_t offset);
+
+  // Returns false and sets errno if the host file |fd| is not opened for
+  // reading, or, if |write_back|, for writing.
+  static bool CheckAccessMode(int fd, bool write_back);
+
+  // Returns an empty mapping of |length| bytes rounded up to whole pages, at
+  // |offset| in its file.
+  static std::unique_ptr<Mapping> CreateMapping(size_t length, off_t offset);
+
+  // Adds |mapping| and returns its address.
+  void* Insert(std::unique_ptr<Mapping> mapping) LOCKS_EXCLUDED(mu_);
+
+  // Returns the hash of the |page|th page of |mapping|.
+  static PageHash HashPage(const Mapping& mapping, size_t page);
+
+  // Writes back the changed pages of |mapping| from |first_page| up to
+  // |end_page|. Returns false on failure.
+  static bool WriteBack(Mapping* mapping, size_t first_page, size_t end_page);
+
+  // Returns the mapping containing |addr|, or nullptr if there is none.
+  Mapping* Find(const uint8_t* addr) EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  absl::Mutex mu_;
+
+  // Mappings keyed by address.
+  std::map<const uint8_t*, std::unique_ptr<Mapping>> mappings_ GUARDED_BY(mu_);
+};
+
+}  // namespace storage
+}  // namespace platform
+}  // namespace asylo
+
+#endif  // ASYLO_PLATFORM_STORAGE_SECURE_MEMORY_MAPPER_H_
@@ -0,0 +1,550 @@
+/*
+ *
+ * Copyright 2018 Asylo authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "asylo/platform/storage/secure/persistent_authenticated_dictionary.h"
+
+#include <openssl/sha.h>
+
+#include <algorithm>
+#include <functional>
+#include <utility>
+
+#include "asylo/util/logging.h"
+
+namespace asylo {
+namespace platform {
+namespace storage {
+namespace {
+
+// Prefixes distinguishing the hashes of leaves and inner nodes, as in RFC 6962.
+constexpr uint8_t kLeafHashPrefix = 0;
+constexpr uint8_t kNodeHashPrefix = 1;
+
+// Identifies the storage of a PersistentAuthenticatedDictionary.
+constexpr uint64_t kStorageMagic = 0x3165657254656c4dULL;
+
+// Leaf count recorded in the storage header of a tree that is not committed.
+constexpr uint64_t kUncommittedLeafCount = ~0ULL;
+
+// Stands for the leaf count recorded in a storage header that was not read.
+constexpr uint64_t kUnknownLeafCount = ~0ULL - 1;
+
+// Number of nodes held in memory above which the nodes that are not needed
+// are dropped before more are loaded.
+constexpr size_t kMaxNodesInMemory = 32 * 1024;
+
+// Layout of the storage header.
+struct StorageHeader {
+  uint64_t magic;
+  uint64_t leaf_count;
+};
+
+uint64_t NodeOffset(uint64_t position) {
+  return sizeof(StorageHeader) +
+         position * PersistentAuthenticatedDictionary::kHashLength;
+}
+
+}  // namespace
+
+PersistentAuthenticatedDictionary::PersistentAuthenticatedDictionary(
+    std::unique_ptr<NodeStorage> storage)
+    : storage_(std::move(storage)),
+      leaf_count_(0),
+      dirty_count_(0),
+      stored_leaf_count_(kUnknownLeafCount) {}
+
+uint64_t PersistentAuthenticatedDictionary::Position(NodeId node) {
+  return (node.index << (node.level + 1)) + (1ULL << node.level) - 1;
+}
+
+PersistentAuthenticatedDictionary::Hash
+PersistentAuthenticatedDictionary::HashChildren(const Hash& left,
+                                                const Hash& right) {
+  SHA256_CTX context;
+  SHA256_Init(&context);
+  SHA256_Update(&context, &kNodeHashPrefix, sizeof(kNodeHashPrefix));
+  SHA256_Update(&context, left.data(), left.size());
+  SHA256_Update(&context, right.data(), right.size());
+  Hash hash;
+  SHA256_Final(hash.data(), &context);
+  return hash;
+}
+
+std::vector<PersistentAuthenticatedDictionary::NodeId>
+PersistentAuthenticatedDictionary::Peaks(uint64_t leaf_count) {
+  std::vector<NodeId> peaks;
+  uint64_t first_leaf = 0;
+  for (int level = 63; level >= 0; level--) {
+    const uint64_t size = 1ULL << level;
+    if (leaf_count & size) {
+      peaks.push_back({level, first_leaf >> level});
+      first_leaf += size;
+    }
+  }
+  return peaks;
+}
+
+const PersistentAuthenticatedDictionary::Node*
+PersistentAuthenticatedDictionary::Find(uint64_t position) const {
+  auto it = nodes_.find(position);
+  return it == nodes_.end() ? nullptr : &it->second;
+}
+
+void PersistentAuthenticatedDictionary::SetDirty(NodeId node,
+                                                 const Hash& hash) {
+  Node& entry = nodes_[Position(node)];
+  if (storage_ && !entry.dirty) {
+    dirty_count_++;
+  }
+  entry.hash = hash;
+  entry.dirty = storage_ != nullptr;
+}
+
+void PersistentAuthenticatedDictionary::Prune() const {
+  std::vector<uint64_t> keep;
+  for (const NodeId& peak : Peaks(leaf_count_)) {
+    keep.push_back(Position(peak));
+  }
+  for (const auto& entry : nodes_) {
+    if (!entry.second.dirty) {
+      continue;
+    }
+    keep.push_back(entry.first);
+
+    // The sibling of a node is at the same distance from their parent on the
+    // other side of it.
+    const uint64_t position = entry.first;
+    int level = 0;
+    while ((position >> level) & 1) {
+      level++;
+    }
+    const uint64_t distance = 1ULL << level;
+    const bool is_left = ((position >> (level + 1)) & 1) == 0;
+    keep.push_back(is_left ? position + 2 * distance : position - 2 * distance);
+  }
+
+  std::unordered_map<uint64_t, Node> kept;
+  for (uint64_t position : keep) {
+    auto it = nodes_.find(position);
+    if (it != nodes_.end()) {
+      kept.insert(*it);
+    }
+  }
+  nodes_.swap(kept);
+}
+
+bool PersistentAuthenticatedDictionary::Load(size_t leaf_count) {
+  if (!storage_ || leaf_count_ != 0) {
+    return false;
+  }
+
+  // Read the header and the peaks with a single read from the storage.
+  const std::vector<NodeId> peaks = Peaks(leaf_count);
+  StorageHeader header;
+  std::vector<Hash> peak_hashes(peaks.size());
+  std::vector<NodeStorage::Segment> segments;
+  segments.push_back({0, &header, sizeof(header)});
+  for (size_t i = 0; i < peaks.size(); i++) {
+    segments.push_back(
+        {NodeOffset(Position(peaks[i])), peak_hashes[i].data(), kHashLength});
+  }
+  if (!storage_->Read(segments) || header.magic != kStorageMagic ||
+      header.leaf_count != leaf_count) {
+    return false;
+  }
+
+  for (size_t i = 0; i < peaks.size(); i++) {
+    nodes_[Position(peaks[i])] = {peak_hashes[i], false};
+  }
+  leaf_count_ = leaf_count;
+  stored_leaf_count_ = leaf_count;
+  return true;
+}
+
+bool PersistentAuthenticatedDictionary::LoadLeaves(size_t first_leaf,
+                                                   size_t count) const {
+  absl::MutexLock lock(&load_mu_);
+  return LoadLeavesLocked(first_leaf, count);
+}
+
+bool PersistentAuthenticatedDictionary::LoadLeavesLocked(size_t first_leaf,
+                                                         size_t count) const {
+  if (count == 0) {
+    return true;
+  }
+  if (first_leaf < 1 || first_leaf - 1 + count > leaf_count_) {
+    LOG(ERROR) << "Attempt made to load leaves outside of the tree, leaf = "
+               << first_leaf << ", count = " << count;
+    return false;
+  }
+
+  // Leaves at the ends of the range that are in memory need no loading. If
+  // any leaf needs loading, the nodes that are not needed are dropped first
+  // once there are too many in memory.
+  uint64_t first;
+  uint64_t last;
+  for (bool pruned = false;; pruned = true) {
+    first = first_leaf - 1;
+    last = first + count - 1;
+    while (first <= last && Find(Position({0, first}))) {
+      first++;
+    }
+    while (last > first && Find(Position({0, last}))) {
+      last--;
+    }
+    if (first > last) {
+      return true;
+    }
+    if (pruned || nodes_.size() <= kMaxNodesInMemory) {
+      break;
+    }
+    Prune();
+  }
+
+  // Verify the range within each perfect subtree it overlaps against the
+  // lowest node in memory that covers the part of the range in that subtree.
+  std::vector<NodeId> anchors;
+  uint64_t peak_first = 0;
+  for (const NodeId& peak : Peaks(leaf_count_)) {
+    const uint64_t peak_last = peak_first + (1ULL << peak.level) - 1;
+    const uint64_t range_first = std::max(first, peak_first);
+    const uint64_t range_last = std::min(last, peak_last);
+    peak_first = peak_last + 1;
+    if (range_first > range_last) {
+      continue;
+    }
+
+    NodeId anchor = {0, range_first};
+    while (anchor.level < peak.level &&
+           ((range_first >> anchor.level) != (range_last >> anchor.level) ||
+            anchor.level == 0 || !Find(Position(anchor)))) {
+      anchor.level++;
+      anchor.index = range_first >> anchor.level;
+    }
+    anchors.push_back(anchor);
+  }
+  return VerifyLeaves(anchors, first, last);
+}
+
+bool PersistentAuthenticatedDictionary::VerifyLeaves(
+    const std::vector<NodeId>& anchors, uint64_t first, uint64_t last) const {
+  auto is_disjoint = [first, last](NodeId node) {
+    return ((node.index + 1) << node.level) <= first ||
+           (node.index << node.level) > last;
+  };
+
+  // Collect the nodes to read - the leaves of the range and the roots of the
+  // subtrees disjoint from the range that are not in memory.
+  std::vector<uint64_t> positions;
+  std::function<void(NodeId)> collect = [&](NodeId node) {
+    if (node.level == 0 || is_disjoint(node)) {
+      if (!Find(Position(node))) {
+        positions.push_back(Position(node));
+      }
+      return;
+    }
+    collect({node.level - 1, node.index * 2});
+    collect({node.level - 1, node.index * 2 + 1});
+  };
+  for (const NodeId& anchor : anchors) {
+    collect(anchor);
+  }
+
+  // Read the nodes with a single read from the storage. Nodes at most one
+  // position apart are read in a single segment, so that the leaves of a range
+  // are read together with the inner nodes between them.
+  std::sort(positions.begin(), positions.end());
+  std::vector<std::pair<uint64_t, std::vector<Hash>>> runs;
+  for (uint64_t position : positions) {
+    if (runs.empty() ||
+        position > runs.back().first + runs.back().second.size() + 1) {
+      runs.emplace_back(position, std::vector<Hash>());
+    }
+    runs.back().second.resize(position - runs.back().first + 1);
+  }
+  if (!runs.empty()) {
+    if (!storage_) {
+      LOG(ERROR) << "Tree nodes missing from memory.";
+      return false;
+    }
+    std::vector<NodeStorage::Segment> segments;
+    for (auto& run : runs) {
+      segments.push_back({NodeOffset(run.first), run.second.data(),
+                          run.second.size() * kHashLength});
+    }
+    if (!storage_->Read(segments)) {
+      LOG(ERROR) << "Failed to read tree nodes from storage.";
+      return false;
+    }
+  }
+  auto read_hash = [&runs](uint64_t position) -> const Hash& {
+    auto run = std::upper_bound(
+        runs.begin(), runs.end(), position,
+        [](uint64_t value, const std::pair<uint64_t, std::vector<Hash>>& run) {
+          return value < run.first;
+        });
+    --run;
+    return run->second[position - run->first];
+  };
+
+  // Hash the subtrees of the anchors, checking the computed hashes of the nodes
+  // in memory, and collect the nodes they are computed from.
+  bool verified = true;
+  std::vector<std::pair<uint64_t, Hash>> verified_nodes;
+  std::function<Hash(NodeId)> compute = [&](NodeId node) {
+    const uint64_t position = Position(node);
+    const Node* in_memory = Find(position);
+    if (node.level == 0 || is_disjoint(node)) {
+      if (in_memory) {
+        return in_memory->hash;
+      }
+      verified_nodes.emplace_back(position, read_hash(position));
+      return verified_nodes.back().second;
+    }
+    Hash hash = HashChildren(compute({node.level - 1, node.index * 2}),
+                             compute({node.level - 1, node.index * 2 + 1}));
+    if (in_memory) {
+      verified = verified && in_memory->hash == hash;
+    } else {
+      verified_nodes.emplace_back(position, hash);
+    }
+    return hash;
+  };
+  for (const NodeId& anchor : anchors) {
+    compute(anchor);
+  }
+  if (!verified) {
+    LOG(ERROR) << "Tree nodes in storage failed integrity verification.";
+    return false;
+  }
+
+  for (const auto& node : verified_nodes) {
+    nodes_[node.first] = {node.second, false};
+  }
+  return true;
+}
+
+bool PersistentAuthenticatedDictionary::Flush() {
+  if (dirty_count_ == 0) {
+    return true;
+  }
+
+  // Clear the committed mark ahead of the nodes, so that a partially updated
+  // tree is never loaded.
+  StorageHeader header = {kStorageMagic, kUncommittedLeafCount};
+  std::vector<NodeStorage::Segment> segments;
+  if (stored_leaf_count_ != kUncommittedLeafCount) {
+    segments.push_back({0, &header, sizeof(header)});
+  }
+
+  // Write runs of consecutive dirty nodes as single segments.
+  std::vector<uint64_t> positions;
+  for (const auto& entry : nodes_) {
+    if (entry.second.dirty) {
+      positions.push_back(entry.first);
+    }
+  }
+  std::sort(positions.begin(), positions.end());
+  std::vector<std::pair<uint64_t, std::vector<Hash>>> runs;
+  for (uint64_t position : positions) {
+    if (runs.empty() ||
+        position != runs.back().first + runs.back().second.size()) {
+      runs.emplace_back(position, std::vector<Hash>());
+    }
+    runs.back().second.push_back(nodes_[position].hash);
+  }
+  for (auto& run : runs) {
+    segments.push_back({NodeOffset(run.first), run.second.data(),
+                        run.second.size() * kHashLength});
+  }
+
+  if (!storage_->Write(segments)) {
+    LOG(ERROR) << "Failed to write tree nodes to storage.";
+    return false;
+  }
+
+  stored_leaf_count_ = kUncommittedLeafCount;
+  for (uint64_t position : positions) {
+    nodes_[position].dirty = false;
+  }
+  dirty_count_ = 0;
+  return true;
+}
+
+bool PersistentAuthenticatedDictionary::Commit() {
+  if (!storage_) {
+    return true;
+  }
+  if (!Flush()) {
+    return false;
+  }
+  if (stored_leaf_count_ == leaf_count_) {
+    return true;
+  }
+
+  StorageHeader header = {kStorageMagic, leaf_count_};
+  if (!storage_->Write({{0, &header, sizeof(header)}})) {
+    LOG(ERROR) << "Failed to commit tree to storage.";
+    return false;
+  }
+  stored_leaf_count_ = leaf_count_;
+  return true;
+}
+
+bool PersistentAuthenticatedDictionary::Truncate(size_t leaf_count) {
+  if (leaf_count > leaf_count_) {
+    LOG(ERROR) << "Attempt made to truncate a tree of " << leaf_count_
+               << " leaves to " << leaf_count;
+    return false;
+  }
+
+  // Nodes within the first |leaf_count| leaves are not changed by adding
+  // leaves, so the peaks of the smaller tree hold its hashes if they are in
+  // memory.
+  for (const NodeId& peak : Peaks(leaf_count)) {
+    if (!Find(Position(peak))) {
+      LOG(ERROR) << "Tree nodes missing from memory.";
+      return false;
+    }
+  }
+
+  // Drop the nodes covering any of the dropped leaves. The level of a node is
+  // the number of trailing ones of its position.
+  for (auto it = nodes_.begin(); it != nodes_.end();) {
+    int level = 0;
+    while ((it->first >> level) & 1) {
+      level++;
+    }
+    const uint64_t index = it->first >> (level + 1);
+    if (((index + 1) << level) <= leaf_count) {
+      ++it;
+      continue;
+    }
+    if (it->second.dirty) {
+      dirty_count_--;
+    }
+    it = nodes_.erase(it);
+  }
+  leaf_count_ = leaf_count;
+  return true;
+}
+
+size_t PersistentAuthenticatedDictionary::AddLeaf(const std::string& data) {
+  return AddLeafHash(LeafHash(data));
+}
+
+size_t PersistentAuthenticatedDictionary::AddLeafHash(const std::string& hash) {
+  if (hash.size() != kHashLength) {
+    LOG(ERROR) << "Unexpected leaf hash length: " << hash.size();
+    return 0;
+  }
+
+  // The new leaf is merged with each perfect subtree of the size of the subtree
+  // it is in, the smallest first.
+  NodeId node = {0, leaf_count_};
+  Hash node_hash;
+  std::copy(hash.begin(), hash.end(), node_hash.begin());
+  SetDirty(node, node_hash);
+  while ((leaf_count_ >> node.level) & 1) {
+    const Node* left = Find(Position({node.level, node.index - 1}));
+    node_hash = HashChildren(left->hash, node_hash);
+    node = {node.level + 1, node.index / 2};
+    SetDirty(node, node_hash);
+  }
+  return ++leaf_count_;
+}
+
+std::string PersistentAuthenticatedDictionary::CurrentRoot() {
+  Hash root;
+  const std::vector<NodeId> peaks = Peaks(leaf_count_);
+  if (peaks.empty()) {
+    SHA256(nullptr, 0, root.data());
+  } else {
+    // The root of an imperfect tree joins its largest perfect subtree with the
+    // tree of the remaining leaves.
+    root = Find(Position(peaks.back()))->hash;
+    for (auto peak = peaks.rbegin() + 1; peak != peaks.rend(); ++peak) {
+      root = HashChildren(Find(Position(*peak))->hash, root);
+    }
+  }
+  return std::string(reinterpret_cast<const char*>(root.data()), root.size());
+}
+
+std::string PersistentAuthenticatedDictionary::LeafHash(size_t leaf) const {
+  // Another caller may prune the node once the lock is released, so the hash
+  // is copied with the lock held.
+  absl::MutexLock lock(&load_mu_);
+  if (!LoadLeavesLocked(leaf, 1)) {
+    return std::string();
+  }
+  const Hash& hash = Find(Position({0, leaf - 1}))->hash;
+  return std::string(reinterpret_cast<const char*>(hash.data()), hash.size());
+}
+
+std::string PersistentAuthenticatedDictionary::LeafHash(
+    const std::string& data) const {
+  SHA256_CTX context;
+  SHA256_Init(&context);
+  SHA256_Update(&context, &kLeafHashPrefix, sizeof(kLeafHashPrefix));
+  SHA256_Update(&context, data.data(), data.size());
+  std::string hash(kHashLength, '\0');
+  SHA256_Final(reinterpret_cast<uint8_t*>(&hash[0]), &context);
+  return hash;
+}
+
+bool PersistentAuthenticatedDictionary::UpdateLeaf(size_t leaf,
+                                                   const std::string& data) {
+  return UpdateLeafHash(leaf, LeafHash(data));
+}
+
+bool PersistentAuthenticatedDictionary::UpdateLeafHash(
+    size_t leaf, const std::string& hash) {
+  if (hash.size() != kHashLength || !LoadLeaves(leaf, 1)) {
+    return false;
+  }
+
+  // Find the height of the perfect subtree of the leaf.
+  uint64_t peak_first = 0;
+  int peak_level = 0;
+  for (const NodeId& peak : Peaks(leaf_count_)) {
+    peak_first += 1ULL << peak.level;
+    if (leaf <= peak_first) {
+      peak_level = peak.level;
+      break;
+    }
+  }
+
+  // Rehash the path from the leaf to the root of its perfect subtree. The
+  // siblings on the path are in memory with the leaf.
+  NodeId node = {0, leaf - 1};
+  Hash node_hash;
+  std::copy(hash.begin(), hash.end(), node_hash.begin());
+  SetDirty(node, node_hash);
+  while (node.level < peak_level) {
+    const Node* sibling = Find(Position({node.level, node.index ^ 1}));
+    node_hash = (node.index & 1) ? HashChildren(sibling->hash, node_hash)
+                                 : HashChildren(node_hash, sibling->hash);
+    node = {node.level + 1, node.index / 2};
+    SetDirty(node, node_hash);
+  }
+  return true;
+}
+
+}  // namespace storage
+}  // namespace platform
+}  // namespace asylo
@@ -0,0 +1,210 @@
+/*
+ *
+ * Copyright 2018 Asylo authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef ASYLO_PLATFORM_STORAGE_SECURE_PERSISTENT_AUTHENTICATED_DICTIONARY_H_
+#define ASYLO_PLATFORM_STORAGE_SECURE_PERSISTENT_AUTHENTICATED_DICTIONARY_H_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "absl/synchronization/mutex.h"
+#include "asylo/platform/storage/secure/authenticated_dictionary.h"
+
+namespace asylo {
+namespace platform {
+namespace storage {
+
+// Positioned storage of the nodes of a PersistentAuthenticatedDictionary.
+class NodeStorage {
+ public:
+  // A range of bytes of the storage.
+  struct Segment {
+    uint64_t offset;
+    void* data;
+    size_t length;
+  };
+
+  virtual ~NodeStorage() = default;
+
+  // Reads the bytes of |segments| into their data. Returns false unless all the
+  // bytes are read.
+  virtual bool Read(const std::vector<Segment>& segments) = 0;
+
+  // Writes the data of |segments|, in order. Returns false unless all the bytes
+  // are written.
+  virtual bool Write(const std::vector<Segment>& segments) = 0;
+};
+
+// Authenticated Dictionary implementation backed by a Merkle tree whose nodes
+// are persisted to a NodeStorage. The root of the tree is the Merkle Tree Hash
+// of RFC 6962, as computed by CTMMTAuthenticatedDictionary, so either can
+// verify digests produced by the other.
+//
+// A persisted tree is loaded by reading only the roots of its perfect
+// subtrees, at most one per bit of the leaf count. Other nodes are read when
+// their leaves are first used, and verified by hashing them up to a node that
+// is already trusted. Updating a leaf rehashes only its path to the root.
+// Updated nodes are kept in memory until they are flushed.
+//
+// The storage holds a small header followed by the node hashes in the in-order
+// layout of a binary tree, in which the nodes of any subtree are contiguous
+// and appending leaves does not move existing nodes. The header records the
+// leaf count of the tree once it is committed, and is cleared before the
+// committed tree is first modified, so a tree that was not committed, for
+// example because the enclave stopped, is never loaded.
+//
+// Const methods may be called concurrently with each other - the nodes they
+// load into memory are synchronized internally. Other methods require exclusive
+// access to the instance.
+class PersistentAuthenticatedDictionary : public AuthenticatedDictionary {
+ public:
+  // Length of the hash of a node.
+  static constexpr size_t kHashLength = 32;
+
+  // Creates an empty dictionary that persists its nodes to |storage|. If
+  // |storage| is null, all nodes are kept in memory.
+  explicit PersistentAuthenticatedDictionary(
+      std::unique_ptr<NodeStorage> storage);
+
+  PersistentAuthenticatedDictionary(const PersistentAuthenticatedDictionary&) =
+      delete;
+  PersistentAuthenticatedDictionary& operator=(
+      const PersistentAuthenticatedDictionary&) = delete;
+
+  // Loads the committed tree of |leaf_count| leaves from the storage into an
+  // empty dictionary. The loaded tree is not verified - the caller must check
+  // CurrentRoot against a trusted digest before using the dictionary. Returns
+  // false if the storage does not hold a committed tree of |leaf_count|
+  // leaves.
+  bool Load(size_t leaf_count);
+
+  // Reads and verifies the hashes of |count| leaves starting from the
+  // |first_leaf|th, unless they are already in memory. Indexing starts from 1.
+  // Loading the leaves used by an operation up front reads them from the
+  // storage together, instead of one by one on first use. Returns false on
+  // failure, including if the stored nodes do not match the tree.
+  bool LoadLeaves(size_t first_leaf, size_t count) const
+      LOCKS_EXCLUDED(load_mu_);
+
+  // Writes the nodes updated since they were last written to the storage.
+  // Returns false on failure.
+  bool Flush();
+
+  // Flushes the tree and marks it as committed with its current leaf count,
+  // so that Load accepts it. Returns false on failure.
+  bool Commit();
+
+  // Drops the leaves after the first |leaf_count|, undoing the leaves added
+  // since the dictionary had |leaf_count| leaves. Returns false if the tree of
+  // |leaf_count| leaves cannot be restored from the nodes in memory, which
+  // holds unless nodes were dropped from memory since it was last in use.
+  bool Truncate(size_t leaf_count);
+
+  // Returns the number of updated nodes not yet written to the storage.
+  size_t DirtyNodeCount() const { return dirty_count_; }
+
+  // From AuthenticatedDictionary. LeafHash(size_t) loads the leaf if needed,
+  // and returns an empty string if it cannot be loaded.
+  size_t LeafCount() const override { return leaf_count_; }
+  size_t AddLeaf(const std::string& data) override;
+  size_t AddLeafHash(const std::string& hash) override;
+  std::string CurrentRoot() override;
+  std::string LeafHash(size_t leaf) const override LOCKS_EXCLUDED(load_mu_);
+  std::string LeafHash(const std::string& data) const override;
+  bool UpdateLeaf(size_t leaf, const std::string& data) override;
+
+  // Updates the hash of the |leaf|th leaf. Indexing starts from 1. Returns
+  // false on failure.
+  bool UpdateLeafHash(size_t leaf, const std::string& hash);
+
+ private:
+  using Hash = std::array<uint8_t, kHashLength>;
+
+  // A node of the tree, identified by its level above the leaves and its index
+  // among the nodes of that level.
+  struct NodeId {
+    int level;
+    uint64_t index;
+  };
+
+  // A node held in memory.
+  struct Node {
+    Hash hash;
+
+    // Whether the node was updated since it was last written to the storage.
+    bool dirty;
+  };
+
+  // Returns the position of |node| in the in-order layout of the tree.
+  static uint64_t Position(NodeId node);
+
+  // Returns the hash of an inner node with children hashed to |left| and
+  // |right|.
+  static Hash HashChildren(const Hash& left, const Hash& right);
+
+  // Returns the roots of the perfect subtrees of a tree of |leaf_count|
+  // leaves, the largest first.
+  static std::vector<NodeId> Peaks(uint64_t leaf_count);
+
+  // Implements LoadLeaves.
+  bool LoadLeavesLocked(size_t first_leaf, size_t count) const
+      EXCLUSIVE_LOCKS_REQUIRED(load_mu_);
+
+  // Returns the node in memory at |position|, or nullptr if there is none.
+  const Node* Find(uint64_t position) const;
+
+  // Stores |hash| as the updated hash of |node|.
+  void SetDirty(NodeId node, const Hash& hash);
+
+  // Drops from memory the nodes that are neither dirty nor needed to update
+  // the dirty nodes.
+  void Prune() const;
+
+  // Verifies the leaves |first| to |last| (counting from 0) against the hashes
+  // of the in-memory nodes |anchors|, whose subtrees cover the leaves, and
+  // keeps the hashes of the leaves and the hashes used to verify them in
+  // memory. Reads the hashes that are not in memory with a single read.
+  bool VerifyLeaves(const std::vector<NodeId>& anchors, uint64_t first,
+                    uint64_t last) const;
+
+  std::unique_ptr<NodeStorage> storage_;
+  uint64_t leaf_count_;
+
+  // Nodes held in memory, keyed by position. Every node held in memory was
+  // verified or computed in the enclave, and so are the nodes on its path to
+  // the root of its perfect subtree and their siblings.
+  mutable std::unordered_map<uint64_t, Node> nodes_;
+  size_t dirty_count_;
+
+  // Serializes the loading of nodes by const methods.
+  mutable absl::Mutex load_mu_;
+
+  // Leaf count recorded in the header in the storage, if known.
+  uint64_t stored_leaf_count_;
+};
+
+}  // namespace storage
+}  // namespace platform
+}  // namespace asylo
+
+#endif  // ASYLO_PLATFORM_STORAGE_SECURE_PERSISTENT_AUTHENTICATED_DICTIONARY_H_
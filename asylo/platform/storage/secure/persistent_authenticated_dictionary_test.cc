@@ -0,0 +1,273 @@
+/*
+ *
+ * Copyright 2018 Asylo authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "asylo/platform/storage/secure/persistent_authenticated_dictionary.h"
+
+#include <cstring>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+#include "absl/memory/memory.h"
+#include "absl/strings/escaping.h"
+
+namespace asylo {
+namespace platform {
+namespace storage {
+namespace {
+
+// Node storage backed by a buffer shared by the storages of a test.
+class MemoryStorage : public NodeStorage {
+ public:
+  MemoryStorage(std::vector<uint8_t>* bytes, int* reads)
+      : bytes_(bytes), reads_(reads) {}
+
+  bool Read(const std::vector<Segment>& segments) override {
+    ++*reads_;
+    for (const Segment& segment : segments) {
+      if (segment.offset + segment.length > bytes_->size()) {
+        return false;
+      }
+      memcpy(segment.data, bytes_->data() + segment.offset, segment.length);
+    }
+    return true;
+  }
+
+  bool Write(const std::vector<Segment>& segments) override {
+    for (const Segment& segment : segments) {
+      if (segment.offset + segment.length > bytes_->size()) {
+        bytes_->resize(segment.offset + segment.length);
+      }
+      memcpy(bytes_->data() + segment.offset, segment.data, segment.length);
+    }
+    return true;
+  }
+
+ private:
+  std::vector<uint8_t>* bytes_;
+  int* reads_;
+};
+
+class PersistentAuthenticatedDictionaryTest : public ::testing::Test {
+ protected:
+  std::unique_ptr<PersistentAuthenticatedDictionary> CreateDictionary() {
+    return absl::make_unique<PersistentAuthenticatedDictionary>(
+        absl::make_unique<MemoryStorage>(&bytes_, &reads_));
+  }
+
+  std::vector<uint8_t> bytes_;
+  int reads_ = 0;
+};
+
+// Roots of the trees of the first leaves of the RFC 6962 test data.
+TEST_F(PersistentAuthenticatedDictionaryTest, Rfc6962Roots) {
+  const char* leaves[] = {
+      "",         "00",         "10",
+      "2021",     "3031",       "40414243",
+      "5051525354555657", "606162636465666768696a6b6c6d6e6f"};
+  const char* roots[] = {
+      "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855",
+      "6e340b9cffb37a989ca544e6bb780a2c78901d3fb33738768511a30617afa01d",
+      "fac54203e7cc696cf0dfcb42c92a1d9dbaf70ad9e621f4bd8d98662f00e3c125",
+      "aeb6bcfe274b70a14fb067a5e5578264db0fa9b51af5e0ba159158f329e06e77",
+      "d37ee418976dd95753c1c73862b9398fa2a2cf9b4ff0fdfe8b30cd95209614b7",
+      "4e3bbb1f7b478dcfe71fb631631519a3bca12c9aefca1612bfce4c13a86264d4",
+      "76e67dadbcdf1e10e1b74ddc608abd2f98dfb16fbce75277b5232a127f2087ef",
+      "ddb89be403809e325750d3d263cd78929c2942b7942a34b77e122c9594a74c8c",
+      "5dc9da79a70659a9ad559cb701ded9a2ab9d823aad2f4960cfe370eff4604328"};
+
+  PersistentAuthenticatedDictionary dictionary(nullptr);
+  EXPECT_EQ(absl::BytesToHexString(dictionary.CurrentRoot()), roots[0]);
+  for (size_t i = 0; i < 8; i++) {
+    EXPECT_EQ(dictionary.AddLeaf(absl::HexStringToBytes(leaves[i])), i + 1);
+    EXPECT_EQ(absl::BytesToHexString(dictionary.CurrentRoot()), roots[i + 1]);
+  }
+}
+
+TEST_F(PersistentAuthenticatedDictionaryTest, LoadCommittedTree) {
+  auto dictionary = CreateDictionary();
+  for (int i = 0; i < 13; i++) {
+    dictionary->AddLeaf(std::to_string(i));
+  }
+  ASSERT_TRUE(dictionary->Commit());
+
+  // Loading reads the three peaks of the tree together.
+  auto loaded = CreateDictionary();
+  reads_ = 0;
+  ASSERT_TRUE(loaded->Load(13));
+  EXPECT_EQ(reads_, 1);
+  EXPECT_EQ(loaded->CurrentRoot(), dictionary->CurrentRoot());
+
+  // Leaves are read when used.
+  EXPECT_TRUE(loaded->LoadLeaves(1, 13));
+  EXPECT_EQ(reads_, 2);
+  for (size_t leaf = 1; leaf <= 13; leaf++) {
+    EXPECT_EQ(loaded->LeafHash(leaf), dictionary->LeafHash(leaf));
+  }
+  EXPECT_EQ(reads_, 2);
+}
+
+TEST_F(PersistentAuthenticatedDictionaryTest, LoadFailsWithoutCommittedTree) {
+  auto dictionary = CreateDictionary();
+  EXPECT_FALSE(CreateDictionary()->Load(0));
+
+  dictionary->AddLeaf("leaf");
+  ASSERT_TRUE(dictionary->Commit());
+  EXPECT_FALSE(CreateDictionary()->Load(2));
+  EXPECT_TRUE(CreateDictionary()->Load(1));
+
+  // A tree flushed after it was modified is no longer committed.
+  dictionary->AddLeaf("another leaf");
+  ASSERT_TRUE(dictionary->Flush());
+  EXPECT_FALSE(CreateDictionary()->Load(1));
+  EXPECT_FALSE(CreateDictionary()->Load(2));
+  ASSERT_TRUE(dictionary->Commit());
+  EXPECT_TRUE(CreateDictionary()->Load(2));
+}
+
+TEST_F(PersistentAuthenticatedDictionaryTest, TamperedNodeFailsVerification) {
+  auto dictionary = CreateDictionary();
+  for (int i = 0; i < 8; i++) {
+    dictionary->AddLeaf(std::to_string(i));
+  }
+  ASSERT_TRUE(dictionary->Commit());
+
+  // Tamper with the hash of the sixth leaf, at position 10 of the 15 nodes of
+  // the tree.
+  bytes_[bytes_.size() - 5 * PersistentAuthenticatedDictionary::kHashLength] ^=
+      1;
+
+  auto loaded = CreateDictionary();
+  ASSERT_TRUE(loaded->Load(8));
+  EXPECT_EQ(loaded->CurrentRoot(), dictionary->CurrentRoot());
+  EXPECT_FALSE(loaded->LoadLeaves(5, 2));
+  EXPECT_TRUE(loaded->LeafHash(6).empty());
+  EXPECT_FALSE(loaded->UpdateLeaf(6, "leaf"));
+  EXPECT_EQ(loaded->LeafHash(1), dictionary->LeafHash(1));
+}
+
+// Applies the same random updates to trees kept in memory and in storage,
+// loading the stored tree again from time to time.
+TEST_F(PersistentAuthenticatedDictionaryTest, MatchesTreeInMemory) {
+  std::mt19937 random(1);
+  PersistentAuthenticatedDictionary expected(nullptr);
+  auto dictionary = CreateDictionary();
+  for (int i = 0; i < 3000; i++) {
+    const std::string data = std::to_string(random());
+    const size_t leaf_count = expected.LeafCount();
+    switch (random() % 4) {
+      case 0:
+        expected.AddLeaf(data);
+        dictionary->AddLeaf(data);
+        break;
+      case 1:
+      case 2:
+        if (leaf_count > 0) {
+          const size_t leaf = random() % leaf_count + 1;
+          ASSERT_TRUE(expected.UpdateLeaf(leaf, data));
+          ASSERT_TRUE(dictionary->UpdateLeaf(leaf, data));
+        }
+        break;
+      case 3:
+        if (leaf_count > 0) {
+          const size_t leaf = random() % leaf_count + 1;
+          ASSERT_EQ(dictionary->LeafHash(leaf), expected.LeafHash(leaf));
+        }
+        break;
+    }
+    ASSERT_EQ(dictionary->CurrentRoot(), expected.CurrentRoot());
+
+    if (random() % 100 == 0) {
+      ASSERT_TRUE(dictionary->Commit());
+      dictionary = CreateDictionary();
+      ASSERT_TRUE(dictionary->Load(expected.LeafCount()));
+      ASSERT_EQ(dictionary->CurrentRoot(), expected.CurrentRoot());
+    }
+  }
+}
+
+TEST_F(PersistentAuthenticatedDictionaryTest, TruncateUndoesAddedLeaves) {
+  for (size_t leaf_count = 0; leaf_count < 12; leaf_count++) {
+    for (size_t added = 1; added < 12; added++) {
+      bytes_.clear();
+      PersistentAuthenticatedDictionary expected(nullptr);
+      auto dictionary = CreateDictionary();
+      for (size_t i = 0; i < leaf_count; i++) {
+        expected.AddLeaf(std::to_string(i));
+        dictionary->AddLeaf(std::to_string(i));
+      }
+      for (size_t i = 0; i < added; i++) {
+        dictionary->AddLeaf("dropped");
+      }
+      ASSERT_TRUE(dictionary->Truncate(leaf_count));
+      ASSERT_EQ(dictionary->LeafCount(), leaf_count);
+      ASSERT_EQ(dictionary->CurrentRoot(), expected.CurrentRoot());
+
+      // The truncated tree grows and is stored like one that never had the
+      // dropped leaves.
+      for (size_t i = 0; i < added; i++) {
+        expected.AddLeaf("kept");
+        dictionary->AddLeaf("kept");
+      }
+      ASSERT_EQ(dictionary->CurrentRoot(), expected.CurrentRoot());
+      ASSERT_TRUE(dictionary->Commit());
+      dictionary = CreateDictionary();
+      ASSERT_TRUE(dictionary->Load(expected.LeafCount()));
+      ASSERT_TRUE(dictionary->LoadLeaves(1, expected.LeafCount()));
+      ASSERT_EQ(dictionary->CurrentRoot(), expected.CurrentRoot());
+    }
+  }
+
+  auto dictionary = CreateDictionary();
+  dictionary->AddLeaf("leaf");
+  EXPECT_FALSE(dictionary->Truncate(2));
+}
+
+// Loads and updates a tree with more nodes than are kept in memory.
+TEST_F(PersistentAuthenticatedDictionaryTest, LargeTree) {
+  constexpr size_t kLeafCount = 100000;
+  PersistentAuthenticatedDictionary expected(nullptr);
+  auto dictionary = CreateDictionary();
+  for (size_t i = 0; i < kLeafCount; i++) {
+    expected.AddLeaf(std::to_string(i));
+    dictionary->AddLeaf(std::to_string(i));
+  }
+  ASSERT_TRUE(dictionary->Commit());
+
+  dictionary = CreateDictionary();
+  ASSERT_TRUE(dictionary->Load(kLeafCount));
+  for (size_t first = 1; first <= kLeafCount; first += 1000) {
+    ASSERT_TRUE(dictionary->LoadLeaves(first, 1000));
+    for (size_t leaf = first; leaf < first + 1000; leaf += 7) {
+      ASSERT_EQ(dictionary->LeafHash(leaf), expected.LeafHash(leaf));
+      ASSERT_TRUE(dictionary->UpdateLeaf(leaf, "updated"));
+      ASSERT_TRUE(expected.UpdateLeaf(leaf, "updated"));
+    }
+    if (dictionary->DirtyNodeCount() > 10000) {
+      ASSERT_TRUE(dictionary->Flush());
+    }
+  }
+  EXPECT_EQ(dictionary->CurrentRoot(), expected.CurrentRoot());
+}
+
+}  // namespace
+}  // namespace storage
+}  // namespace platform
+}  // namespace asylo
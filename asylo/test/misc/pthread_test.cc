@@ -0,0 +1,509 @@
+/*
+ *
+ * Copyright 2018 Asylo authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+namespace asylo {
+namespace {
+
+// The most threads a test starts, which must stay below the number of TCS
+// slots of the test enclave.
+constexpr int kMaxThreads = 64;
+
+// Returns the number of threads to start so that there are more threads than
+// CPUs, and waiters cannot all keep spinning on a CPU of their own.
+int ContendingThreadCount() {
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  if (cpus < 1) {
+    cpus = 1;
+  }
+  return static_cast<int>(std::min<long>(2 * cpus + 1, kMaxThreads));
+}
+
+// Sleeps for |microseconds|, exiting the enclave.
+void SleepFor(int microseconds) {
+  struct timespec duration = {0, microseconds * 1000L};
+  nanosleep(&duration, nullptr);
+}
+
+// Starts |count| threads running |start_routine| with |arg| and joins them.
+void RunThreads(int count, void *(*start_routine)(void *), void *arg) {
+  std::vector<pthread_t> threads(count);
+  for (pthread_t &thread : threads) {
+    ASSERT_EQ(pthread_create(&thread, nullptr, start_routine, arg), 0);
+  }
+  for (pthread_t thread : threads) {
+    ASSERT_EQ(pthread_join(thread, nullptr), 0);
+  }
+}
+
+struct ContendedCounter {
+  pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+  int value = 0;
+};
+
+constexpr int kIncrements = 200;
+
+// Increments the counter, sleeping with the mutex held now and then so that the
+// other threads run out of spins and block outside the enclave.
+void *IncrementContendedCounter(void *arg) {
+  ContendedCounter *counter = static_cast<ContendedCounter *>(arg);
+  for (int i = 0; i < kIncrements; ++i) {
+    pthread_mutex_lock(&counter->mutex);
+    int value = counter->value;
+    if (i % 16 == 0) {
+      SleepFor(500);
+    }
+    counter->value = value + 1;
+    pthread_mutex_unlock(&counter->mutex);
+  }
+  return nullptr;
+}
+
+// Tests that threads blocked on a contended mutex are all woken, and that the
+// mutex still excludes them from each other.
+TEST(PthreadTest, ContendedMutexBlocksAndWakes) {
+  int thread_count = ContendingThreadCount();
+  ContendedCounter counter;
+  RunThreads(thread_count, &IncrementContendedCounter, &counter);
+  EXPECT_EQ(counter.value, thread_count * kIncrements);
+}
+
+struct TurnTaking {
+  pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+  pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+  int thread_count = 0;
+  int next_id = 0;
+  int turn = 0;
+  int turns_taken = 0;
+};
+
+constexpr int kRounds = 20;
+
+// Waits for the turns of the calling thread in a round robin over all threads,
+// so that all but one thread are blocked on the condition variable at a time.
+void *TakeTurns(void *arg) {
+  TurnTaking *turns = static_cast<TurnTaking *>(arg);
+  pthread_mutex_lock(&turns->mutex);
+  int id = turns->next_id++;
+  for (int round = 0; round < kRounds; ++round) {
+    while (turns->turn % turns->thread_count != id) {
+      pthread_cond_wait(&turns->cond, &turns->mutex);
+    }
+    ++turns->turn;
+    ++turns->turns_taken;
+    pthread_cond_broadcast(&turns->cond);
+  }
+  pthread_mutex_unlock(&turns->mutex);
+  return nullptr;
+}
+
+// Tests that more threads than CPUs can block on a condition variable and be
+// woken by broadcasts without losing any wakeup.
+TEST(PthreadTest, ContendedCondVarBlocksAndWakes) {
+  TurnTaking turns;
+  turns.thread_count = ContendingThreadCount();
+  RunThreads(turns.thread_count, &TakeTurns, &turns);
+  EXPECT_EQ(turns.turns_taken, turns.thread_count * kRounds);
+}
+
+struct Handoff {
+  pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+  pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+  int waiting = 0;
+  int tokens = 0;
+  int consumed = 0;
+};
+
+// Waits for a token posted with pthread_cond_signal and consumes it.
+void *ConsumeToken(void *arg) {
+  Handoff *handoff = static_cast<Handoff *>(arg);
+  pthread_mutex_lock(&handoff->mutex);
+  ++handoff->waiting;
+  while (handoff->tokens == 0) {
+    pthread_cond_wait(&handoff->cond, &handoff->mutex);
+  }
+  --handoff->tokens;
+  ++handoff->consumed;
+  pthread_mutex_unlock(&handoff->mutex);
+  return nullptr;
+}
+
+// Tests that each pthread_cond_signal wakes a blocked waiter once all threads
+// are parked outside the enclave.
+TEST(PthreadTest, CondVarSignalWakesParkedWaiters) {
+  int thread_count = ContendingThreadCount();
+  Handoff handoff;
+  std::vector<pthread_t> threads(thread_count);
+  for (pthread_t &thread : threads) {
+    ASSERT_EQ(pthread_create(&thread, nullptr, &ConsumeToken, &handoff), 0);
+  }
+
+  // Let every consumer queue up and run out of spins before posting tokens.
+  for (;;) {
+    pthread_mutex_lock(&handoff.mutex);
+    int waiting = handoff.waiting;
+    pthread_mutex_unlock(&handoff.mutex);
+    if (waiting == thread_count) {
+      break;
+    }
+    SleepFor(1000);
+  }
+  SleepFor(10000);
+
+  for (int i = 0; i < thread_count; ++i) {
+    pthread_mutex_lock(&handoff.mutex);
+    ++handoff.tokens;
+    pthread_cond_signal(&handoff.cond);
+    pthread_mutex_unlock(&handoff.mutex);
+  }
+  for (pthread_t thread : threads) {
+    ASSERT_EQ(pthread_join(thread, nullptr), 0);
+  }
+  EXPECT_EQ(handoff.consumed, thread_count);
+  EXPECT_EQ(handoff.tokens, 0);
+}
+
+// Returns the CLOCK_REALTIME time |microseconds| from now, which is in the past
+// if |microseconds| is negative.
+struct timespec DeadlineIn(int64_t microseconds) {
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  int64_t nanoseconds = now.tv_sec * 1000000000LL + now.tv_nsec +
+                        microseconds * 1000;
+  struct timespec deadline;
+  deadline.tv_sec = nanoseconds / 1000000000LL;
+  deadline.tv_nsec = nanoseconds % 1000000000LL;
+  return deadline;
+}
+
+// Returns the number of microseconds elapsed since |start|.
+int64_t MicrosecondsSince(const struct timespec &start) {
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  return (now.tv_sec - start.tv_sec) * 1000000LL +
+         (now.tv_nsec - start.tv_nsec) / 1000;
+}
+
+// Tests that pthread_cond_timedwait returns ETIMEDOUT with the mutex held once
+// its deadline passes without a wakeup, and not before.
+TEST(PthreadTest, CondTimedWaitTimesOut) {
+  pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+  pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+  struct timespec start;
+  clock_gettime(CLOCK_REALTIME, &start);
+  struct timespec deadline = DeadlineIn(50000);
+
+  pthread_mutex_lock(&mutex);
+  EXPECT_EQ(pthread_cond_timedwait(&cond, &mutex, &deadline), ETIMEDOUT);
+  EXPECT_GE(MicrosecondsSince(start), 50000);
+  EXPECT_EQ(pthread_mutex_trylock(&mutex), EBUSY);
+  pthread_mutex_unlock(&mutex);
+}
+
+// Tests that a deadline that has already passed times out right away.
+TEST(PthreadTest, CondTimedWaitWithPastDeadline) {
+  pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+  pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+  struct timespec past = DeadlineIn(-1000000);
+  struct timespec epoch = {0, 0};
+
+  pthread_mutex_lock(&mutex);
+  EXPECT_EQ(pthread_cond_timedwait(&cond, &mutex, &past), ETIMEDOUT);
+  EXPECT_EQ(pthread_cond_timedwait(&cond, &mutex, &epoch), ETIMEDOUT);
+  pthread_mutex_unlock(&mutex);
+}
+
+// Tests that a malformed deadline is rejected.
+TEST(PthreadTest, CondTimedWaitRejectsInvalidDeadline) {
+  pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+  pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+  struct timespec invalid = DeadlineIn(1000000);
+  invalid.tv_nsec = 1000000000;
+
+  pthread_mutex_lock(&mutex);
+  EXPECT_EQ(pthread_cond_timedwait(&cond, &mutex, &invalid), EINVAL);
+  pthread_mutex_unlock(&mutex);
+}
+
+struct TimedWakeup {
+  pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+  pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+  bool waiting = false;
+  bool signaled = false;
+};
+
+// Signals the waiter of a TimedWakeup once it is waiting.
+void *SignalTimedWaiter(void *arg) {
+  TimedWakeup *wakeup = static_cast<TimedWakeup *>(arg);
+  for (;;) {
+    pthread_mutex_lock(&wakeup->mutex);
+    if (wakeup->waiting) {
+      break;
+    }
+    pthread_mutex_unlock(&wakeup->mutex);
+    SleepFor(1000);
+  }
+  // Let the waiter park outside the enclave before waking it.
+  pthread_mutex_unlock(&wakeup->mutex);
+  SleepFor(20000);
+  pthread_mutex_lock(&wakeup->mutex);
+  wakeup->signaled = true;
+  pthread_cond_signal(&wakeup->cond);
+  pthread_mutex_unlock(&wakeup->mutex);
+  return nullptr;
+}
+
+// Tests that a wakeup arriving before the deadline ends the wait early and
+// returns 0.
+TEST(PthreadTest, CondTimedWaitWokenBeforeDeadline) {
+  TimedWakeup wakeup;
+  pthread_t thread;
+  ASSERT_EQ(pthread_create(&thread, nullptr, &SignalTimedWaiter, &wakeup), 0);
+
+  struct timespec start;
+  clock_gettime(CLOCK_REALTIME, &start);
+  struct timespec deadline = DeadlineIn(30 * 1000000LL);
+  pthread_mutex_lock(&wakeup.mutex);
+  wakeup.waiting = true;
+  int ret = 0;
+  while (ret == 0 && !wakeup.signaled) {
+    ret = pthread_cond_timedwait(&wakeup.cond, &wakeup.mutex, &deadline);
+  }
+  pthread_mutex_unlock(&wakeup.mutex);
+
+  EXPECT_EQ(ret, 0);
+  EXPECT_TRUE(wakeup.signaled);
+  EXPECT_LT(MicrosecondsSince(start), 30 * 1000000LL);
+  ASSERT_EQ(pthread_join(thread, nullptr), 0);
+}
+
+struct SharedReaders {
+  pthread_rwlock_t rwlock;
+  int reader_count = 0;
+  std::atomic<int> readers_inside{0};
+  std::atomic<bool> all_inside{false};
+};
+
+// Holds a read lock until all readers hold it at the same time, or gives up
+// after a few seconds.
+void *ReadConcurrently(void *arg) {
+  SharedReaders *readers = static_cast<SharedReaders *>(arg);
+  pthread_rwlock_rdlock(&readers->rwlock);
+  ++readers->readers_inside;
+  for (int i = 0; i < 5000 && !readers->all_inside; ++i) {
+    if (readers->readers_inside == readers->reader_count) {
+      readers->all_inside = true;
+    }
+    SleepFor(1000);
+  }
+  pthread_rwlock_unlock(&readers->rwlock);
+  return nullptr;
+}
+
+// Tests that readers hold a rwlock concurrently.
+TEST(PthreadTest, RwlockReadersShareLock) {
+  SharedReaders readers;
+  ASSERT_EQ(pthread_rwlock_init(&readers.rwlock, nullptr), 0);
+  readers.reader_count = ContendingThreadCount();
+  RunThreads(readers.reader_count, &ReadConcurrently, &readers);
+  EXPECT_TRUE(readers.all_inside);
+  EXPECT_EQ(pthread_rwlock_destroy(&readers.rwlock), 0);
+}
+
+struct GuardedPair {
+  pthread_rwlock_t rwlock;
+  int first = 0;
+  int second = 0;
+  std::atomic<int> torn_reads{0};
+};
+
+constexpr int kPairUpdates = 50;
+
+// Updates both values of the pair under the write lock, sleeping in between so
+// that a reader let in by mistake sees them differ.
+void *WritePair(void *arg) {
+  GuardedPair *pair = static_cast<GuardedPair *>(arg);
+  for (int i = 0; i < kPairUpdates; ++i) {
+    pthread_rwlock_wrlock(&pair->rwlock);
+    ++pair->first;
+    if (i % 8 == 0) {
+      SleepFor(200);
+    }
+    ++pair->second;
+    pthread_rwlock_unlock(&pair->rwlock);
+  }
+  return nullptr;
+}
+
+// Reads the pair under the read lock, counting reads that see a half-written
+// update.
+void *ReadPair(void *arg) {
+  GuardedPair *pair = static_cast<GuardedPair *>(arg);
+  for (int i = 0; i < kPairUpdates; ++i) {
+    pthread_rwlock_rdlock(&pair->rwlock);
+    if (pair->first != pair->second) {
+      ++pair->torn_reads;
+    }
+    pthread_rwlock_unlock(&pair->rwlock);
+  }
+  return nullptr;
+}
+
+// Runs WritePair on even threads and ReadPair on odd threads.
+void *WriteOrReadPair(void *arg) {
+  static std::atomic<int> next_thread{0};
+  return next_thread++ % 2 == 0 ? WritePair(arg) : ReadPair(arg);
+}
+
+// Tests that a writer excludes both other writers and readers.
+TEST(PthreadTest, RwlockWriterExcludesOthers) {
+  GuardedPair pair;
+  ASSERT_EQ(pthread_rwlock_init(&pair.rwlock, nullptr), 0);
+  int thread_count = ContendingThreadCount() & ~1;
+  RunThreads(thread_count, &WriteOrReadPair, &pair);
+  EXPECT_EQ(pair.first, thread_count / 2 * kPairUpdates);
+  EXPECT_EQ(pair.second, pair.first);
+  EXPECT_EQ(pair.torn_reads, 0);
+  EXPECT_EQ(pthread_rwlock_destroy(&pair.rwlock), 0);
+}
+
+struct TryLockResults {
+  pthread_rwlock_t *rwlock;
+  int tryrdlock;
+  int trywrlock;
+};
+
+// Tries to take |rwlock| for reading and for writing without blocking,
+// releasing any lock it gets.
+void *TryLockRwlock(void *arg) {
+  TryLockResults *results = static_cast<TryLockResults *>(arg);
+  results->tryrdlock = pthread_rwlock_tryrdlock(results->rwlock);
+  if (results->tryrdlock == 0) {
+    pthread_rwlock_unlock(results->rwlock);
+  }
+  results->trywrlock = pthread_rwlock_trywrlock(results->rwlock);
+  if (results->trywrlock == 0) {
+    pthread_rwlock_unlock(results->rwlock);
+  }
+  return nullptr;
+}
+
+// Tests that the try-lock functions return EBUSY instead of blocking when the
+// lock is held in a conflicting mode.
+TEST(PthreadTest, RwlockTryLocksReturnBusy) {
+  pthread_rwlock_t rwlock;
+  ASSERT_EQ(pthread_rwlock_init(&rwlock, nullptr), 0);
+  TryLockResults results = {&rwlock, -1, -1};
+
+  ASSERT_EQ(pthread_rwlock_wrlock(&rwlock), 0);
+  RunThreads(1, &TryLockRwlock, &results);
+  EXPECT_EQ(results.tryrdlock, EBUSY);
+  EXPECT_EQ(results.trywrlock, EBUSY);
+  ASSERT_EQ(pthread_rwlock_unlock(&rwlock), 0);
+
+  ASSERT_EQ(pthread_rwlock_rdlock(&rwlock), 0);
+  RunThreads(1, &TryLockRwlock, &results);
+  EXPECT_EQ(results.tryrdlock, 0);
+  EXPECT_EQ(results.trywrlock, EBUSY);
+  ASSERT_EQ(pthread_rwlock_unlock(&rwlock), 0);
+
+  RunThreads(1, &TryLockRwlock, &results);
+  EXPECT_EQ(results.tryrdlock, 0);
+  EXPECT_EQ(results.trywrlock, 0);
+  EXPECT_EQ(pthread_rwlock_destroy(&rwlock), 0);
+}
+
+struct SemaphoreHandoff {
+  sem_t items;
+  std::atomic<int> taken{0};
+};
+
+// Blocks in sem_wait until an item is posted and takes it.
+void *TakeItem(void *arg) {
+  SemaphoreHandoff *handoff = static_cast<SemaphoreHandoff *>(arg);
+  if (sem_wait(&handoff->items) == 0) {
+    ++handoff->taken;
+  }
+  return nullptr;
+}
+
+// Tests that sem_post wakes threads blocked in sem_wait, one per post.
+TEST(PthreadTest, SemaphorePostWakesWaiters) {
+  SemaphoreHandoff handoff;
+  ASSERT_EQ(sem_init(&handoff.items, 0, 0), 0);
+  int thread_count = ContendingThreadCount();
+  std::vector<pthread_t> threads(thread_count);
+  for (pthread_t &thread : threads) {
+    ASSERT_EQ(pthread_create(&thread, nullptr, &TakeItem, &handoff), 0);
+  }
+
+  // Let the waiters block before posting.
+  SleepFor(20000);
+  EXPECT_EQ(handoff.taken, 0);
+  for (int i = 0; i < thread_count; ++i) {
+    ASSERT_EQ(sem_post(&handoff.items), 0);
+  }
+  for (pthread_t thread : threads) {
+    ASSERT_EQ(pthread_join(thread, nullptr), 0);
+  }
+  EXPECT_EQ(handoff.taken, thread_count);
+
+  int value = -1;
+  ASSERT_EQ(sem_getvalue(&handoff.items, &value), 0);
+  EXPECT_EQ(value, 0);
+  EXPECT_EQ(sem_destroy(&handoff.items), 0);
+}
+
+// Tests that sem_trywait takes a posted count and fails with EAGAIN instead of
+// blocking once the count is zero.
+TEST(PthreadTest, SemaphoreTryWait) {
+  sem_t sem;
+  ASSERT_EQ(sem_init(&sem, 0, 2), 0);
+  EXPECT_EQ(sem_trywait(&sem), 0);
+  EXPECT_EQ(sem_trywait(&sem), 0);
+  errno = 0;
+  EXPECT_EQ(sem_trywait(&sem), -1);
+  EXPECT_EQ(errno, EAGAIN);
+
+  SemaphoreHandoff handoff;
+  ASSERT_EQ(sem_init(&handoff.items, 0, 0), 0);
+  ASSERT_EQ(sem_post(&handoff.items), 0);
+  RunThreads(1, &TakeItem, &handoff);
+  EXPECT_EQ(handoff.taken, 1);
+  errno = 0;
+  EXPECT_EQ(sem_trywait(&handoff.items), -1);
+  EXPECT_EQ(errno, EAGAIN);
+
+  EXPECT_EQ(sem_destroy(&sem), 0);
+  EXPECT_EQ(sem_destroy(&handoff.items), 0);
+}
+
+}  // namespace
+}  // namespace asylo
@@ -706,6 +706,25 @@ TEST_F(SyscallsTest, Readv) {
       RunSyscallInsideEnclave("readv", FLAGS_test_tmpdir + "/readv", nullptr));
 }
 
+// Tests epoll_create1(), epoll_ctl() and epoll_wait() by watching the read end
+// of a pipe inside the enclave before and after writing to it.
+TEST_F(SyscallsTest, Epoll) {
+  EXPECT_TRUE(RunSyscallInsideEnclave("epoll", "", nullptr));
+}
+
+// Tests select() by waiting on the ends of a pipe inside the enclave, and on a
+// file descriptor that is not open.
+TEST_F(SyscallsTest, Select) {
+  EXPECT_TRUE(RunSyscallInsideEnclave("select", "", nullptr));
+}
+
+// Tests sendmsg() and recvmsg() by sending datagrams between two Unix sockets
+// inside the enclave, with several buffers, the address of the sender,
+// credentials as control data, an untrusted receive buffer, and truncation.
+TEST_F(SyscallsTest, SendmsgRecvmsg) {
+  EXPECT_TRUE(RunSyscallInsideEnclave("sendmsg recvmsg", "", nullptr));
+}
+
 // Tests getrlimit() and setrlimit() with RLIMIT_NOFILE by setting the limit and
 // getting it to compare the result.
 TEST_F(SyscallsTest, RlimitNoFile) {
@@ -18,16 +18,23 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <regex.h>
 #include <sched.h>
+#include <stddef.h>
 #include <stdio.h>
+#include <sys/epoll.h>
 #include <sys/resource.h>
+#include <sys/select.h>
+#include <sys/socket.h>
 #include <sys/uio.h>
+#include <sys/un.h>
 #include <unistd.h>
 #include <algorithm>
 #include <unordered_set>
 
 #include "absl/strings/str_cat.h"
+#include "asylo/platform/arch/include/trusted/memory.h"
 #include "asylo/util/logging.h"
 #include "asylo/platform/storage/utils/fd_closer.h"
 #include "asylo/test/misc/syscalls_test.pb.h"
@@ -101,6 +108,12 @@ class SyscallsEnclave : public EnclaveTestCase {
       return RunWritevTest(test_input.path_name());
     } else if (test_input.test_target() == "readv") {
       return RunReadvTest(test_input.path_name());
+    } else if (test_input.test_target() == "epoll") {
+      return RunEpollTest();
+    } else if (test_input.test_target() == "select") {
+      return RunSelectTest();
+    } else if (test_input.test_target() == "sendmsg recvmsg") {
+      return RunSendmsgRecvmsgTest();
     } else if (test_input.test_target() == "rlimit nofile") {
       return RunRlimitNoFileTest(test_input.path_name());
     } else if (test_input.test_target() == "rlimit low nofile") {
@@ -213,6 +226,30 @@ class SyscallsEnclave : public EnclaveTestCase {
     return Status::OkStatus();
   }
 
+  // Binds a new Unix datagram socket to the abstract socket address |name|,
+  // which is stored in |addr| and |addrlen|.
+  StatusOr<int> BindDatagramSocket(const std::string &name,
+                                   struct sockaddr_un *addr,
+                                   socklen_t *addrlen) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    // An abstract address starts with a null byte and is not a file.
+    memcpy(addr->sun_path + 1, name.data(), name.size());
+    *addrlen = offsetof(struct sockaddr_un, sun_path) + 1 + name.size();
+    int fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+    if (fd < 0) {
+      return Status(static_cast<error::PosixError>(errno),
+                    absl::StrCat("socket failed: ", strerror(errno)));
+    }
+    if (bind(fd, reinterpret_cast<struct sockaddr *>(addr), *addrlen) == -1) {
+      Status status(static_cast<error::PosixError>(errno),
+                    absl::StrCat("bind failed: ", strerror(errno)));
+      close(fd);
+      return status;
+    }
+    return fd;
+  }
+
   Status RunSysconfTest(EnclaveOutput *output) {
     SyscallsTestOutput output_ret;
     output_ret.set_int_syscall_return(sysconf(_SC_NPROCESSORS_ONLN));
@@ -909,6 +946,300 @@ class SyscallsEnclave : public EnclaveTestCase {
     return Status::OkStatus();
   }
 
+  Status RunEpollTest() {
+    int pipefd[2];
+    if (pipe(pipefd) == -1) {
+      return Status(static_cast<error::PosixError>(errno),
+                    absl::StrCat("pipe failed: ", strerror(errno)));
+    }
+    platform::storage::FdCloser read_closer(pipefd[0]);
+    platform::storage::FdCloser write_closer(pipefd[1]);
+
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd == -1) {
+      return Status(static_cast<error::PosixError>(errno),
+                    absl::StrCat("epoll_create1 failed: ", strerror(errno)));
+    }
+    platform::storage::FdCloser epoll_closer(epfd);
+
+    constexpr uint64_t kData = 0x123456789;
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.u64 = kData;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, pipefd[0], &event) == -1) {
+      return Status(static_cast<error::PosixError>(errno),
+                    absl::StrCat("epoll_ctl failed: ", strerror(errno)));
+    }
+
+    struct epoll_event events[4];
+    int rc = epoll_wait(epfd, events, 4, 0);
+    if (rc != 0) {
+      return Status(error::GoogleError::INTERNAL,
+                    absl::StrCat("epoll_wait on an empty pipe returned ", rc));
+    }
+
+    // Event counts which are not positive or exceed the limit of Linux are
+    // rejected before any buffer is allocated for them.
+    for (int maxevents : {0, -1, INT_MAX}) {
+      errno = 0;
+      rc = epoll_wait(epfd, events, maxevents, 0);
+      if (rc != -1 || errno != EINVAL) {
+        return Status(error::GoogleError::INTERNAL,
+                      absl::StrCat("epoll_wait with ", maxevents,
+                                   " events returned ", rc, ", errno ", errno,
+                                   " instead of failing with EINVAL"));
+      }
+    }
+
+    if (write(pipefd[1], "x", 1) != 1) {
+      return Status(static_cast<error::PosixError>(errno),
+                    absl::StrCat("write failed: ", strerror(errno)));
+    }
+    rc = epoll_wait(epfd, events, 4, -1);
+    if (rc != 1 || !(events[0].events & EPOLLIN) ||
+        events[0].data.u64 != kData) {
+      return Status(error::GoogleError::INTERNAL,
+                    absl::StrCat("epoll_wait returned ", rc,
+                                 " instead of the read event of the pipe"));
+    }
+
+    if (epoll_ctl(epfd, EPOLL_CTL_DEL, pipefd[0], nullptr) == -1) {
+      return Status(static_cast<error::PosixError>(errno),
+                    absl::StrCat("epoll_ctl failed: ", strerror(errno)));
+    }
+    rc = epoll_wait(epfd, events, 4, 0);
+    if (rc != 0) {
+      return Status(error::GoogleError::INTERNAL,
+                    absl::StrCat("epoll_wait returned ", rc,
+                                 " for a file descriptor no longer watched"));
+    }
+    return Status::OkStatus();
+  }
+
+  Status RunSelectTest() {
+    int pipefd[2];
+    if (pipe(pipefd) == -1) {
+      return Status(static_cast<error::PosixError>(errno),
+                    absl::StrCat("pipe failed: ", strerror(errno)));
+    }
+    platform::storage::FdCloser read_closer(pipefd[0]);
+    platform::storage::FdCloser write_closer(pipefd[1]);
+    const int nfds = std::max(pipefd[0], pipefd[1]) + 1;
+
+    fd_set readfds;
+    fd_set writefds;
+    FD_ZERO(&readfds);
+    FD_ZERO(&writefds);
+    FD_SET(pipefd[0], &readfds);
+    FD_SET(pipefd[1], &writefds);
+    struct timeval timeout = {0, 1000};
+    int rc = select(nfds, &readfds, &writefds, nullptr, &timeout);
+    if (rc != 1 || FD_ISSET(pipefd[0], &readfds) ||
+        !FD_ISSET(pipefd[1], &writefds)) {
+      return Status(error::GoogleError::INTERNAL,
+                    absl::StrCat("select returned ", rc,
+                                 " instead of the write end of the pipe"));
+    }
+
+    if (write(pipefd[1], "x", 1) != 1) {
+      return Status(static_cast<error::PosixError>(errno),
+                    absl::StrCat("write failed: ", strerror(errno)));
+    }
+    FD_ZERO(&readfds);
+    FD_SET(pipefd[0], &readfds);
+    rc = select(nfds, &readfds, nullptr, nullptr, nullptr);
+    if (rc != 1 || !FD_ISSET(pipefd[0], &readfds)) {
+      return Status(error::GoogleError::INTERNAL,
+                    absl::StrCat("select returned ", rc,
+                                 " instead of the read end of the pipe"));
+    }
+
+    const int closed_fd = FD_SETSIZE - 1;
+    FD_ZERO(&readfds);
+    FD_SET(closed_fd, &readfds);
+    rc = select(closed_fd + 1, &readfds, nullptr, nullptr, nullptr);
+    if (rc != -1 || errno != EBADF) {
+      return Status(error::GoogleError::INTERNAL,
+                    absl::StrCat("select on a closed fd returned ", rc));
+    }
+    return Status::OkStatus();
+  }
+
+  Status RunSendmsgRecvmsgTest() {
+    const std::string suffix = absl::StrCat(getpid());
+    struct sockaddr_un sender_addr;
+    socklen_t sender_addrlen;
+    auto fd_or_error = BindDatagramSocket(
+        absl::StrCat("asylo_syscalls_test_sender_", suffix), &sender_addr,
+        &sender_addrlen);
+    if (!fd_or_error.ok()) {
+      return fd_or_error.status();
+    }
+    int sender = fd_or_error.ValueOrDie();
+    platform::storage::FdCloser sender_closer(sender);
+    struct sockaddr_un receiver_addr;
+    socklen_t receiver_addrlen;
+    fd_or_error = BindDatagramSocket(
+        absl::StrCat("asylo_syscalls_test_receiver_", suffix), &receiver_addr,
+        &receiver_addrlen);
+    if (!fd_or_error.ok()) {
+      return fd_or_error.status();
+    }
+    int receiver = fd_or_error.ValueOrDie();
+    platform::storage::FdCloser receiver_closer(receiver);
+    int enable = 1;
+    if (setsockopt(receiver, SOL_SOCKET, SO_PASSCRED, &enable,
+                   sizeof(enable)) == -1) {
+      return Status(static_cast<error::PosixError>(errno),
+                    absl::StrCat("setsockopt failed: ", strerror(errno)));
+    }
+
+    // A control message with the credentials of the sender, laid out as the
+    // struct cmsghdr and struct ucred of the host. The host kernel rejects the
+    // message unless the credentials are those of the host process.
+    struct CredentialsMessage {
+      size_t len;
+      int level;
+      int type;
+      int32_t pid;
+      uint32_t uid;
+      uint32_t gid;
+    };
+    constexpr int kScmCredentials = 2;
+    CredentialsMessage credentials;
+    memset(&credentials, 0, sizeof(credentials));
+    credentials.len = offsetof(CredentialsMessage, gid) + sizeof(uint32_t);
+    credentials.level = SOL_SOCKET;
+    credentials.type = kScmCredentials;
+    credentials.pid = getpid();
+    credentials.uid = getuid();
+    credentials.gid = getgid();
+
+    constexpr int num_parts = 3;
+    const std::string parts[num_parts] = {"sendmsg gathers ", "a message from ",
+                                          "several buffers"};
+    const std::string message = parts[0] + parts[1] + parts[2];
+    struct iovec send_iov[num_parts];
+    for (int i = 0; i < num_parts; ++i) {
+      send_iov[i].iov_base = const_cast<char *>(parts[i].data());
+      send_iov[i].iov_len = parts[i].size();
+    }
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name = &receiver_addr;
+    msg.msg_namelen = receiver_addrlen;
+    msg.msg_iov = send_iov;
+    msg.msg_iovlen = num_parts;
+    msg.msg_control = &credentials;
+    msg.msg_controllen = sizeof(credentials);
+    ssize_t rc = sendmsg(sender, &msg, 0);
+    if (rc != message.size()) {
+      return Status(static_cast<error::PosixError>(errno),
+                    absl::StrCat("sendmsg returned ", rc, " instead of ",
+                                 message.size(), ": ", strerror(errno)));
+    }
+
+    // The message is scattered over a buffer in the enclave and a buffer in
+    // untrusted memory, which the host fills directly.
+    constexpr size_t kTrustedLength = 10;
+    char trusted_buf[kTrustedLength];
+    const size_t untrusted_length = message.size() - kTrustedLength;
+    UntrustedArenaUniquePtr<char> untrusted_buf(
+        static_cast<char *>(UntrustedArenaMalloc(untrusted_length)));
+    struct iovec recv_iov[2];
+    recv_iov[0].iov_base = trusted_buf;
+    recv_iov[0].iov_len = kTrustedLength;
+    recv_iov[1].iov_base = untrusted_buf.get();
+    recv_iov[1].iov_len = untrusted_length;
+    struct sockaddr_un from;
+    memset(&from, 0, sizeof(from));
+    CredentialsMessage received;
+    memset(&received, 0, sizeof(received));
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name = &from;
+    msg.msg_namelen = sizeof(from);
+    msg.msg_iov = recv_iov;
+    msg.msg_iovlen = 2;
+    msg.msg_control = &received;
+    msg.msg_controllen = sizeof(received);
+    rc = recvmsg(receiver, &msg, 0);
+    if (rc != message.size()) {
+      return Status(static_cast<error::PosixError>(errno),
+                    absl::StrCat("recvmsg returned ", rc, " instead of ",
+                                 message.size(), ": ", strerror(errno)));
+    }
+    if (memcmp(trusted_buf, message.data(), kTrustedLength) != 0 ||
+        memcmp(untrusted_buf.get(), message.data() + kTrustedLength,
+               untrusted_length) != 0) {
+      return Status(error::GoogleError::INTERNAL,
+                    "Message from recvmsg does not match the sent message.");
+    }
+    if (msg.msg_namelen != sender_addrlen ||
+        memcmp(&from, &sender_addr, sender_addrlen) != 0) {
+      return Status(error::GoogleError::INTERNAL,
+                    "recvmsg did not return the address of the sender");
+    }
+    if (msg.msg_controllen < credentials.len ||
+        received.len != credentials.len || received.level != SOL_SOCKET ||
+        received.type != kScmCredentials || received.pid != credentials.pid ||
+        received.uid != credentials.uid || received.gid != credentials.gid) {
+      return Status(error::GoogleError::INTERNAL,
+                    "recvmsg did not return the credentials of the sender");
+    }
+    if (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) {
+      return Status(error::GoogleError::INTERNAL,
+                    absl::StrCat("recvmsg returned flags ", msg.msg_flags,
+                                 " for a message that fits its buffers"));
+    }
+
+    // A datagram longer than the buffers is truncated. recvmsg returns the
+    // number of bytes received, or the full length with MSG_TRUNC.
+    std::string long_message;
+    for (int i = 0; i < 64; ++i) {
+      long_message.push_back('a' + i % 26);
+    }
+    constexpr size_t kPartLength = 8;
+    const int recv_flags[] = {0, MSG_TRUNC};
+    for (int flags : recv_flags) {
+      send_iov[0].iov_base = const_cast<char *>(long_message.data());
+      send_iov[0].iov_len = long_message.size();
+      memset(&msg, 0, sizeof(msg));
+      msg.msg_name = &receiver_addr;
+      msg.msg_namelen = receiver_addrlen;
+      msg.msg_iov = send_iov;
+      msg.msg_iovlen = 1;
+      rc = sendmsg(sender, &msg, 0);
+      if (rc != long_message.size()) {
+        return Status(static_cast<error::PosixError>(errno),
+                      absl::StrCat("sendmsg failed: ", strerror(errno)));
+      }
+
+      recv_iov[0].iov_len = kPartLength;
+      recv_iov[1].iov_len = kPartLength;
+      memset(&msg, 0, sizeof(msg));
+      msg.msg_iov = recv_iov;
+      msg.msg_iovlen = 2;
+      rc = recvmsg(receiver, &msg, flags);
+      const ssize_t expected =
+          (flags & MSG_TRUNC) ? long_message.size() : 2 * kPartLength;
+      if (rc != expected || !(msg.msg_flags & MSG_TRUNC)) {
+        return Status(
+            error::GoogleError::INTERNAL,
+            absl::StrCat("recvmsg with flags ", flags, " returned ", rc,
+                         " and flags ", msg.msg_flags, " for a datagram of ",
+                         long_message.size(), " bytes"));
+      }
+      if (memcmp(trusted_buf, long_message.data(), kPartLength) != 0 ||
+          memcmp(untrusted_buf.get(), long_message.data() + kPartLength,
+                 kPartLength) != 0) {
+        return Status(error::GoogleError::INTERNAL,
+                      "Truncated message from recvmsg does not match the "
+                      "start of the sent message.");
+      }
+    }
+    return Status::OkStatus();
+  }
+
   Status RunRlimitNoFileTest(const std::string &path) {
     constexpr int soft_limit = 100;
     constexpr int hard_limit = 200;
@@ -0,0 +1,59 @@
+/*
+ *
+ * Copyright 2018 Asylo authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <string>
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include "asylo/test/util/enclave_test.h"
+#include "asylo/test/util/status_matchers.h"
+#include "asylo/util/status.h"
+
+namespace asylo {
+namespace {
+
+// Tests the pool of donated threads that serves pthread_create in the enclave.
+class ThreadPoolTest : public EnclaveTest {
+ protected:
+  void SetUp() override {
+    config_.set_thread_pool_min_threads(2);
+    config_.set_thread_pool_max_threads(4);
+    SetUpBase();
+  }
+
+  Status RunTest(const std::string &test_name) {
+    EnclaveInput enclave_input;
+    SetEnclaveInputTestString(&enclave_input, test_name);
+    return client_->EnterAndRun(enclave_input, /*output=*/nullptr);
+  }
+};
+
+TEST_F(ThreadPoolTest, ReusesPooledThreads) {
+  EXPECT_THAT(RunTest("ReusesPooledThreads"), IsOk());
+}
+
+TEST_F(ThreadPoolTest, RunsMoreThreadsThanThePool) {
+  EXPECT_THAT(RunTest("RunsMoreThreadsThanThePool"), IsOk());
+}
+
+TEST_F(ThreadPoolTest, JoinsAndDetachesPooledThreads) {
+  EXPECT_THAT(RunTest("JoinsAndDetachesPooledThreads"), IsOk());
+}
+
+}  // namespace
+}  // namespace asylo
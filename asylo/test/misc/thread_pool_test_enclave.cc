@@ -0,0 +1,246 @@
+/*
+ *
+ * Copyright 2018 Asylo authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <time.h>
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "absl/strings/str_cat.h"
+#include "asylo/platform/posix/threading/thread_manager.h"
+#include "asylo/test/util/enclave_test_application.h"
+#include "asylo/util/logging.h"
+#include "asylo/util/status.h"
+
+namespace asylo {
+namespace {
+
+// Sleeps for |microseconds|, exiting the enclave.
+void SleepFor(int microseconds) {
+  struct timespec duration = {0, microseconds * 1000L};
+  nanosleep(&duration, nullptr);
+}
+
+// Returns a test failure status with |message|.
+Status Failure(const std::string &message) {
+  return Status(error::GoogleError::INTERNAL, message);
+}
+
+ThreadManager::ThreadPoolStats GetStats() {
+  return ThreadManager::GetInstance()->GetThreadPoolStats();
+}
+
+// Waits until at least |count| pooled threads are idle, so that the next
+// pthread_create is served by the pool.
+Status WaitForIdleThreads(int count) {
+  for (int i = 0; i < 10000; ++i) {
+    if (GetStats().idle_threads >= count) {
+      return Status::OkStatus();
+    }
+    SleepFor(1000);
+  }
+  return Status(error::GoogleError::DEADLINE_EXCEEDED,
+                absl::StrCat("Fewer than ", count, " pooled threads are idle"));
+}
+
+// Waits until the pool holds at most |count| threads.
+Status WaitForPoolThreadsAtMost(int count) {
+  for (int i = 0; i < 10000; ++i) {
+    if (GetStats().pool_threads <= count) {
+      return Status::OkStatus();
+    }
+    SleepFor(1000);
+  }
+  return Status(error::GoogleError::DEADLINE_EXCEEDED,
+                absl::StrCat("Pool holds more than ", count, " threads"));
+}
+
+std::atomic<int> runs{0};
+
+// Counts its run and returns |arg|.
+void *CountRun(void *arg) {
+  ++runs;
+  return arg;
+}
+
+// Waits on the semaphore |arg| before counting its run.
+void *WaitThenCountRun(void *arg) {
+  sem_wait(static_cast<sem_t *>(arg));
+  ++runs;
+  return nullptr;
+}
+
+class ThreadPoolTest : public EnclaveTestCase {
+ public:
+  ThreadPoolTest() = default;
+
+  Status Initialize(const EnclaveConfig &config) final {
+    min_threads_ = config.thread_pool_min_threads();
+    max_threads_ = config.thread_pool_max_threads();
+    return Status::OkStatus();
+  }
+
+  Status Run(const EnclaveInput &input, EnclaveOutput *output) final {
+    std::string test_name = GetEnclaveInputTestString(input);
+    runs = 0;
+    if (test_name == "ReusesPooledThreads") {
+      return ReusesPooledThreads();
+    } else if (test_name == "RunsMoreThreadsThanThePool") {
+      return RunsMoreThreadsThanThePool();
+    } else if (test_name == "JoinsAndDetachesPooledThreads") {
+      return JoinsAndDetachesPooledThreads();
+    }
+
+    LOG(ERROR) << "Unexpected test name: '" << test_name << "'";
+    return Status(error::GoogleError::INTERNAL, "Unknown test");
+  }
+
+ private:
+  // Creates and joins threads one after the other, each of which is served by
+  // an idle pooled thread without donating a new one.
+  Status ReusesPooledThreads() {
+    constexpr int kThreads = 10;
+    ThreadManager::ThreadPoolStats before = GetStats();
+    for (int i = 0; i < kThreads; ++i) {
+      Status status = WaitForIdleThreads(1);
+      if (!status.ok()) {
+        return status;
+      }
+      pthread_t thread;
+      if (pthread_create(&thread, nullptr, &CountRun, nullptr) != 0 ||
+          pthread_join(thread, nullptr) != 0) {
+        return Failure("Failed to run a thread");
+      }
+    }
+
+    ThreadManager::ThreadPoolStats after = GetStats();
+    if (runs != kThreads) {
+      return Failure("Not every thread ran");
+    }
+    if (after.reused - before.reused != kThreads) {
+      return Failure("Threads were not reused from the pool");
+    }
+    if (after.donated != before.donated) {
+      return Failure("Threads were donated although the pool had idle threads");
+    }
+    return Status::OkStatus();
+  }
+
+  // Runs more threads at once than the pool retains. The extra threads are
+  // donated on demand and leave the enclave once joined.
+  Status RunsMoreThreadsThanThePool() {
+    const int thread_count = 2 * max_threads_ + 2;
+    sem_t start;
+    if (sem_init(&start, 0, 0) != 0) {
+      return Failure("sem_init failed");
+    }
+    ThreadManager::ThreadPoolStats before = GetStats();
+
+    std::vector<pthread_t> threads(thread_count);
+    for (pthread_t &thread : threads) {
+      if (pthread_create(&thread, nullptr, &WaitThenCountRun, &start) != 0) {
+        return Failure("pthread_create failed");
+      }
+    }
+    if (runs != 0) {
+      return Failure("Threads ran before they were released");
+    }
+    for (int i = 0; i < thread_count; ++i) {
+      sem_post(&start);
+    }
+    for (pthread_t thread : threads) {
+      if (pthread_join(thread, nullptr) != 0) {
+        return Failure("pthread_join failed");
+      }
+    }
+    sem_destroy(&start);
+
+    ThreadManager::ThreadPoolStats after = GetStats();
+    if (runs != thread_count) {
+      return Failure("Not every thread ran");
+    }
+    if (after.donated - before.donated <
+        static_cast<uint64_t>(thread_count - max_threads_)) {
+      return Failure("Threads beyond the pool were not donated");
+    }
+    return WaitForPoolThreadsAtMost(max_threads_);
+  }
+
+  // Joins a pooled thread for its return value, and detaches another one,
+  // which goes back to the pool without being joined.
+  Status JoinsAndDetachesPooledThreads() {
+    Status status = WaitForIdleThreads(min_threads_);
+    if (!status.ok()) {
+      return status;
+    }
+    int value = 0;
+    void *result = nullptr;
+    pthread_t thread;
+    if (pthread_create(&thread, nullptr, &CountRun, &value) != 0 ||
+        pthread_join(thread, &result) != 0) {
+      return Failure("Failed to run a thread");
+    }
+    if (result != &value) {
+      return Failure("pthread_join returned the wrong value");
+    }
+
+    status = WaitForIdleThreads(min_threads_);
+    if (!status.ok()) {
+      return status;
+    }
+    sem_t start;
+    if (sem_init(&start, 0, 0) != 0) {
+      return Failure("sem_init failed");
+    }
+    if (pthread_create(&thread, nullptr, &WaitThenCountRun, &start) != 0) {
+      return Failure("pthread_create failed");
+    }
+    if (pthread_detach(thread) != 0) {
+      return Failure("pthread_detach failed");
+    }
+    if (pthread_join(thread, nullptr) != EINVAL) {
+      return Failure("Joined a detached thread");
+    }
+    sem_post(&start);
+
+    // The detached thread returns to the pool without being joined, so all
+    // pooled threads become idle again.
+    status = WaitForIdleThreads(min_threads_);
+    if (!status.ok()) {
+      return status;
+    }
+    sem_destroy(&start);
+    if (runs != 2) {
+      return Failure("Not every thread ran");
+    }
+    return Status::OkStatus();
+  }
+
+  int min_threads_ = 0;
+  int max_threads_ = 0;
+};
+
+}  // namespace
+
+TrustedApplication *BuildTrustedApplication() { return new ThreadPoolTest; }
+
+}  // namespace asylo
@@ -25,12 +25,20 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
+#include <atomic>
 #include <cctype>
+#include <chrono>
+#include <condition_variable>
 #include <cstdio>
 #include <cstdlib>
 #include <ctime>
+#include <memory>
+#include <mutex>
 #include <sstream>
 #include <string>
+#include <thread>
+
+#include "asylo/platform/common/ring_buffer.h"
 
 namespace asylo {
 
@@ -85,6 +93,284 @@ const std::string get_log_basename() {
   return *log_basename;
 }
 
+// Destination of log messages. The log file is opened on first use and kept
+// open, so that logging a message does not have to open and close it.
+struct LogSink {
+  // Guards all other members.
+  std::mutex mutex;
+
+  // Descriptor of the open log file, or -1 if it is not open.
+  int fd = -1;
+
+  // Messages not yet written to the log file.
+  std::string pending;
+
+  // Size of |pending| at which it is written out. Zero disables buffering.
+  size_t buffer_size = 0;
+
+  // Age of the oldest pending message at which |pending| is written out.
+  int64_t flush_interval_ns = 0;
+
+  // Time at which the oldest pending message was logged.
+  int64_t oldest_pending_ns = 0;
+
+  // Whether messages are printed to standard output as well.
+  bool log_to_stdout = true;
+};
+
+LogSink *GetLogSink() {
+  static LogSink *sink = new LogSink();
+  return sink;
+}
+
+int64_t MonotonicNanoseconds() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return static_cast<int64_t>(now.tv_sec) * 1000000000 + now.tv_nsec;
+}
+
+// Writes the pending messages of |sink| to the log file. Requires that
+// |sink->mutex| is held.
+void FlushLogSinkLocked(LogSink *sink) {
+  if (sink->pending.empty()) {
+    return;
+  }
+
+  std::string log_path = get_log_directory() + get_log_basename();
+  if (sink->fd < 0) {
+    sink->fd = open(log_path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+  }
+  if (sink->fd < 0) {
+    fprintf(stderr, "Failed to open log file : %s!\n", log_path.c_str());
+    sink->pending.clear();
+    return;
+  }
+
+  const char *data = sink->pending.data();
+  size_t remaining = sink->pending.size();
+  while (remaining > 0) {
+    ssize_t written = write(sink->fd, data, remaining);
+    if (written < 0 && errno == EINTR) {
+      continue;
+    }
+    if (written <= 0) {
+      fprintf(stderr, "Failed to write to log file : %s!\n", log_path.c_str());
+      break;
+    }
+    data += written;
+    remaining -= written;
+  }
+  sink->pending.clear();
+}
+
+// Appends |message_text| to the pending messages of |sink| as one line, and
+// writes the pending messages out if |flush| is set or a buffering threshold
+// is reached. Returns whether messages should also be printed to stdout.
+bool AppendToLogSink(LogSink *sink, const std::string &message_text,
+                     bool flush) {
+  std::lock_guard<std::mutex> lock(sink->mutex);
+  if (sink->pending.empty()) {
+    sink->oldest_pending_ns = MonotonicNanoseconds();
+  }
+  sink->pending.append(message_text);
+  if (message_text.empty() || message_text.back() != '\n') {
+    sink->pending.push_back('\n');
+  }
+  if (flush || sink->buffer_size == 0 ||
+      sink->pending.size() >= sink->buffer_size ||
+      MonotonicNanoseconds() - sink->oldest_pending_ns >=
+          sink->flush_interval_ns) {
+    FlushLogSinkLocked(sink);
+  }
+  return sink->log_to_stdout;
+}
+
+// Capacity in bytes of the buffer of each thread logging asynchronously.
+constexpr size_t kAsyncLogBufferSize = 64 * 1024;
+
+// Maximum number of threads logging asynchronously at the same time.
+constexpr size_t kMaxAsyncLogBuffers = 64;
+
+// Records logged by one thread and not yet written out by the flusher. The
+// owning thread is the only writer of |records| and the thread draining the
+// buffers is the only reader, so no lock is needed to log a message.
+struct AsyncLogBuffer {
+  // Whether a thread currently owns the buffer.
+  std::atomic<bool> in_use{false};
+
+  // Formatted records, each terminated by a newline.
+  RingBuffer<kAsyncLogBufferSize> records;
+};
+
+// State of asynchronous logging. Buffers are allocated on demand and never
+// freed, so a thread that raced with StopAsyncLogging() can still safely
+// finish writing its record.
+struct AsyncLogger {
+  // Whether messages are currently logged asynchronously.
+  std::atomic<bool> enabled{false};
+
+  // Number of buffers threads may claim, derived from the memory budget.
+  std::atomic<size_t> buffer_limit{0};
+
+  // Buffers, of which the first |buffer_limit| may be claimed.
+  std::atomic<AsyncLogBuffer *> buffers[kMaxAsyncLogBuffers];
+
+  // Number of messages dropped because no buffer space was available.
+  std::atomic<uint64_t> dropped{0};
+
+  // Value of |dropped| last reported in the log.
+  uint64_t reported_dropped = 0;
+
+  // Serializes readers of the buffers.
+  std::mutex drain_mutex;
+
+  AsyncLogger() {
+    for (auto &buffer : buffers) {
+      buffer = nullptr;
+    }
+  }
+};
+
+AsyncLogger *GetAsyncLogger() {
+  static AsyncLogger *logger = new AsyncLogger();
+  return logger;
+}
+
+// Releases the buffer claimed by a thread when the thread exits.
+struct AsyncLogBufferOwner {
+  AsyncLogBuffer *buffer = nullptr;
+
+  ~AsyncLogBufferOwner() {
+    if (buffer) {
+      buffer->in_use.store(false, std::memory_order_release);
+    }
+  }
+};
+
+thread_local AsyncLogBufferOwner async_log_buffer_owner;
+
+// Returns the buffer of the calling thread, claiming one if the thread does
+// not have one yet. Returns nullptr if every buffer is owned by another thread.
+AsyncLogBuffer *GetThreadAsyncLogBuffer(AsyncLogger *logger) {
+  if (async_log_buffer_owner.buffer) {
+    return async_log_buffer_owner.buffer;
+  }
+  size_t limit = logger->buffer_limit.load(std::memory_order_acquire);
+  for (size_t i = 0; i < limit; ++i) {
+    AsyncLogBuffer *buffer = logger->buffers[i].load(std::memory_order_acquire);
+    if (!buffer) {
+      std::unique_ptr<AsyncLogBuffer> created(new AsyncLogBuffer());
+      if (logger->buffers[i].compare_exchange_strong(
+              buffer, created.get(), std::memory_order_acq_rel)) {
+        buffer = created.release();
+      }
+    }
+    bool in_use = false;
+    if (buffer->in_use.compare_exchange_strong(in_use, true,
+                                               std::memory_order_acquire)) {
+      async_log_buffer_owner.buffer = buffer;
+      return buffer;
+    }
+  }
+  return nullptr;
+}
+
+// Appends |message_text| as one record to the buffer of the calling thread.
+// Returns false if the message had to be dropped.
+bool AppendToAsyncLog(AsyncLogger *logger, const std::string &message_text) {
+  AsyncLogBuffer *buffer = GetThreadAsyncLogBuffer(logger);
+  bool newline = message_text.empty() || message_text.back() != '\n';
+  size_t size = message_text.size() + (newline ? 1 : 0);
+  if (!buffer || buffer->records.available() < size) {
+    logger->dropped.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+
+  // The record is published with a single write, since the reader may drain
+  // the buffer at any time and must only see complete records.
+  if (newline) {
+    std::string record = message_text + '\n';
+    buffer->records.Write(reinterpret_cast<const uint8_t *>(record.data()),
+                          record.size());
+  } else {
+    buffer->records.Write(
+        reinterpret_cast<const uint8_t *>(message_text.data()), size);
+  }
+  return true;
+}
+
+// Moves every record logged asynchronously so far to the log file, and prints
+// them to stdout if enabled.
+void DrainAsyncLog(AsyncLogger *logger, LogSink *sink) {
+  std::lock_guard<std::mutex> drain_lock(logger->drain_mutex);
+  std::string drained;
+  for (auto &slot : logger->buffers) {
+    AsyncLogBuffer *buffer = slot.load(std::memory_order_acquire);
+    if (!buffer) {
+      continue;
+    }
+    // Take only the bytes present now, all of which are complete records.
+    size_t size = buffer->records.size();
+    if (size == 0) {
+      continue;
+    }
+    size_t offset = drained.size();
+    drained.resize(offset + size);
+    buffer->records.Read(reinterpret_cast<uint8_t *>(&drained[offset]), size);
+  }
+
+  uint64_t dropped = logger->dropped.load(std::memory_order_relaxed);
+  if (dropped != logger->reported_dropped) {
+    drained += "Dropped " + std::to_string(dropped - logger->reported_dropped) +
+               " log messages because the log buffer was full\n";
+    logger->reported_dropped = dropped;
+  }
+  if (drained.empty()) {
+    return;
+  }
+
+  bool log_to_stdout;
+  {
+    std::lock_guard<std::mutex> lock(sink->mutex);
+    sink->pending.append(drained);
+    FlushLogSinkLocked(sink);
+    log_to_stdout = sink->log_to_stdout;
+  }
+  if (log_to_stdout) {
+    fwrite(drained.data(), 1, drained.size(), stdout);
+    fflush(stdout);
+  }
+}
+
+// Thread that periodically writes out messages buffered in the log sink or
+// logged asynchronously, so that they do not wait for the next message to be
+// logged.
+struct LogFlusher {
+  // Guards |stopping| and serializes starting and stopping the thread.
+  std::mutex mutex;
+  std::condition_variable wakeup;
+  bool stopping = false;
+  std::chrono::milliseconds interval{0};
+  std::thread thread;
+};
+
+LogFlusher *GetLogFlusher() {
+  static LogFlusher *flusher = new LogFlusher();
+  return flusher;
+}
+
+// Body of the flusher thread. Writes out everything logged so far every flush
+// interval until the flusher is stopped.
+void RunLogFlusher(LogFlusher *flusher) {
+  std::unique_lock<std::mutex> lock(flusher->mutex);
+  while (!flusher->stopping) {
+    flusher->wakeup.wait_for(lock, flusher->interval);
+    lock.unlock();
+    FlushLog();
+    lock.lock();
+  }
+}
+
 }  // namespace
 
 bool set_log_directory(const std::string &log_directory) {
@@ -114,6 +400,95 @@ void set_vlog_level(int level) { vlog_level = level; }
 
 int get_vlog_level() { return vlog_level; }
 
+void set_log_buffering(size_t buffer_size, int64_t flush_interval_ms) {
+  LogSink *sink = GetLogSink();
+  std::lock_guard<std::mutex> lock(sink->mutex);
+  sink->buffer_size = buffer_size;
+  sink->flush_interval_ns = flush_interval_ms * 1000000;
+  if (buffer_size == 0) {
+    FlushLogSinkLocked(sink);
+  }
+}
+
+void set_log_to_stdout(bool enabled) {
+  LogSink *sink = GetLogSink();
+  std::lock_guard<std::mutex> lock(sink->mutex);
+  sink->log_to_stdout = enabled;
+}
+
+void FlushLog() {
+  LogSink *sink = GetLogSink();
+  DrainAsyncLog(GetAsyncLogger(), sink);
+  std::lock_guard<std::mutex> lock(sink->mutex);
+  FlushLogSinkLocked(sink);
+}
+
+bool StartLogFlusher(int64_t flush_interval_ms) {
+  if (flush_interval_ms <= 0) {
+    return false;
+  }
+  LogFlusher *flusher = GetLogFlusher();
+  std::lock_guard<std::mutex> lock(flusher->mutex);
+  std::chrono::milliseconds interval(flush_interval_ms);
+  if (flusher->thread.joinable()) {
+    // Messages are written out at the shortest interval requested.
+    if (interval < flusher->interval) {
+      flusher->interval = interval;
+      flusher->wakeup.notify_all();
+    }
+    return true;
+  }
+  flusher->stopping = false;
+  flusher->interval = interval;
+  flusher->thread = std::thread(RunLogFlusher, flusher);
+  return true;
+}
+
+void StopLogFlusher() {
+  LogFlusher *flusher = GetLogFlusher();
+  std::thread thread;
+  {
+    std::lock_guard<std::mutex> lock(flusher->mutex);
+    flusher->stopping = true;
+    thread = std::move(flusher->thread);
+  }
+  flusher->wakeup.notify_all();
+  if (thread.joinable()) {
+    thread.join();
+  }
+  FlushLog();
+}
+
+bool StartAsyncLogging(size_t memory_budget, int64_t flush_interval_ms) {
+  AsyncLogger *logger = GetAsyncLogger();
+  size_t buffer_count = memory_budget / kAsyncLogBufferSize;
+  if (buffer_count == 0 || flush_interval_ms <= 0 ||
+      logger->enabled.load(std::memory_order_acquire)) {
+    return false;
+  }
+  if (buffer_count > kMaxAsyncLogBuffers) {
+    buffer_count = kMaxAsyncLogBuffers;
+  }
+
+  if (!StartLogFlusher(flush_interval_ms)) {
+    return false;
+  }
+  logger->buffer_limit.store(buffer_count, std::memory_order_release);
+  logger->enabled.store(true, std::memory_order_release);
+  return true;
+}
+
+void StopAsyncLogging() {
+  AsyncLogger *logger = GetAsyncLogger();
+  logger->enabled.store(false, std::memory_order_release);
+  logger->buffer_limit.store(0, std::memory_order_release);
+  StopLogFlusher();
+}
+
+uint64_t GetDroppedLogMessages() {
+  return GetAsyncLogger()->dropped.load(std::memory_order_relaxed);
+}
+
 bool EnsureDirectory(const char *path) {
   struct stat dirStat;
   if (stat(path, &dirStat)) {
@@ -130,6 +505,17 @@ bool EnsureDirectory(const char *path) {
 }
 
 bool InitLogging(const char *directory, const char *file_name, int level) {
+  // Messages logged so far go to the previous log file, and later messages
+  // reopen the log file under its new path.
+  {
+    LogSink *sink = GetLogSink();
+    std::lock_guard<std::mutex> lock(sink->mutex);
+    FlushLogSinkLocked(sink);
+    if (sink->fd >= 0) {
+      close(sink->fd);
+      sink->fd = -1;
+    }
+  }
   set_vlog_level(level);
   std::string log_directory = directory ? std::string(directory) : "";
   if (!set_log_directory(log_directory)) {
@@ -190,27 +576,33 @@ LogMessage::~LogMessage() {
 }
 
 void LogMessage::SendToLog(const std::string &message_text) {
-  std::string log_path = get_log_directory() + get_log_basename();
-
-  FILE *file = fopen(log_path.c_str(), "ab");
-  if (file) {
-    if (fprintf(file, "%s", message_text.c_str()) > 0) {
-      if (message_text.back() != '\n') {
-        fprintf(file, "\n");
-      }
-    } else {
-      fprintf(stderr, "Failed to write to log file : %s!\n", log_path.c_str());
+  AsyncLogger *logger = GetAsyncLogger();
+  if (severity_ != FATAL && logger->enabled.load(std::memory_order_acquire)) {
+    // The flusher thread writes the record to the log file and stdout later.
+    AppendToAsyncLog(logger, message_text);
+    if (severity_ >= ERROR) {
+      fprintf(stderr, "%s\n", message_text.c_str());
+      fflush(stderr);
     }
-    fclose(file);
-  } else {
-    fprintf(stderr, "Failed to open log file : %s!\n", log_path.c_str());
+    return;
   }
+
+  // FATAL messages are written out, after everything logged before them,
+  // before the program aborts.
+  LogSink *sink = GetLogSink();
+  if (severity_ == FATAL) {
+    DrainAsyncLog(logger, sink);
+  }
+  bool log_to_stdout = AppendToLogSink(sink, message_text, severity_ == FATAL);
+
   if (severity_ >= ERROR) {
     fprintf(stderr, "%s\n", message_text.c_str());
     fflush(stderr);
   }
-  printf("%s\n", message_text.c_str());
-  fflush(stdout);
+  if (log_to_stdout) {
+    printf("%s\n", message_text.c_str());
+    fflush(stdout);
+  }
 
   // if FATAL occurs, abort enclave.
   if (severity_ == FATAL) {
@@ -321,6 +321,65 @@ bool EnsureDirectory(const char *path);
 ///        a level equal to or lower than it will be logged.
 bool InitLogging(const char *directory, const char *file_name, int level);
 
+/// Sets how log messages are written to the log file. By default, each message
+/// is written as soon as it is logged. The log file is kept open in either
+/// case.
+///
+/// \param buffer_size If non-zero, messages are collected in memory and written
+///        to the log file together once at least this many bytes are pending.
+/// \param flush_interval_ms If `buffer_size` is non-zero, pending messages are
+///        also written once the oldest of them is this many milliseconds old.
+///        The age is checked whenever a message is logged, so messages logged
+///        before a period of silence are only written on time if the flusher
+///        thread is running; see StartLogFlusher().
+void set_log_buffering(size_t buffer_size, int64_t flush_interval_ms);
+
+/// Sets whether log messages are also printed to standard output, which they
+/// are by default.
+///
+/// \param enabled True to print log messages to standard output.
+void set_log_to_stdout(bool enabled);
+
+/// Writes all pending log messages to the log file. FATAL messages flush the
+/// log before aborting.
+void FlushLog();
+
+/// Starts a flusher thread that writes out all pending log messages every
+/// `flush_interval_ms`, whether or not further messages are logged. If the
+/// flusher is already running, it keeps the shorter of the two intervals.
+///
+/// \param flush_interval_ms How often pending messages are written out.
+/// \return False if `flush_interval_ms` is not positive.
+bool StartLogFlusher(int64_t flush_interval_ms);
+
+/// Stops the flusher thread, if it is running, and writes out all pending log
+/// messages.
+void StopLogFlusher();
+
+/// Starts logging asynchronously. Logging a message then only copies it into a
+/// buffer owned by the logging thread, without taking a lock or doing any I/O,
+/// and the flusher thread of StartLogFlusher() writes the buffered messages to
+/// the log file and stdout. Messages that find their thread's buffer full, or that are
+/// logged by a thread when every buffer is owned by another thread, are
+/// dropped and counted. FATAL messages are still written synchronously, after
+/// all messages logged before them. Messages with severity ERROR are still
+/// printed to stderr synchronously.
+///
+/// \param memory_budget The number of bytes of buffer space that may be
+///        allocated for all logging threads together.
+/// \param flush_interval_ms How often the flusher thread writes out the
+///        buffered messages.
+/// \return False if the arguments are invalid or asynchronous logging is
+///         already running.
+bool StartAsyncLogging(size_t memory_budget, int64_t flush_interval_ms);
+
+/// Stops logging asynchronously and the flusher thread, and writes out all
+/// buffered messages.
+void StopAsyncLogging();
+
+/// Returns the number of messages dropped by asynchronous logging so far.
+uint64_t GetDroppedLogMessages();
+
 /// Class representing a log message created by a log macro.
 class LogMessage {
  public:
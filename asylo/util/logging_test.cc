@@ -0,0 +1,224 @@
+/*
+ *
+ * Copyright 2018 Asylo authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "asylo/util/logging.h"
+
+#include <unistd.h>
+
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include "absl/strings/str_cat.h"
+#include "asylo/test/util/test_flags.h"
+
+namespace asylo {
+namespace {
+
+using ::testing::HasSubstr;
+using ::testing::Not;
+
+constexpr char kLogBasename[] = "logging_test";
+
+// Messages are never written out because of their age unless a test asks for
+// it.
+constexpr int64_t kNeverMs = 24 * 60 * 60 * 1000;
+
+class LoggingTest : public ::testing::Test {
+ protected:
+  // The log directory and file can only be set once per process.
+  static void SetUpTestCase() {
+    ASSERT_TRUE(InitLogging(FLAGS_test_tmpdir.c_str(), kLogBasename, 0));
+  }
+
+  void SetUp() override { set_log_to_stdout(false); }
+
+  void TearDown() override {
+    StopAsyncLogging();
+    StopLogFlusher();
+    set_log_buffering(0, 0);
+    set_log_to_stdout(true);
+  }
+
+  // Returns the contents of the log file.
+  static std::string ReadLog() {
+    std::ifstream log(get_log_directory() + kLogBasename);
+    std::stringstream contents;
+    contents << log.rdbuf();
+    return contents.str();
+  }
+
+  // Waits up to a few seconds for |text| to appear in the log file.
+  static bool WaitForLog(const std::string &text) {
+    for (int i = 0; i < 500; ++i) {
+      if (ReadLog().find(text) != std::string::npos) {
+        return true;
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    return false;
+  }
+};
+
+TEST_F(LoggingTest, UnbufferedMessagesAreWrittenImmediately) {
+  LOG(INFO) << "unbuffered message";
+  EXPECT_THAT(ReadLog(), HasSubstr("unbuffered message"));
+}
+
+TEST_F(LoggingTest, BufferedMessagesWaitForSizeThreshold) {
+  constexpr size_t kBufferSize = 4096;
+  set_log_buffering(kBufferSize, kNeverMs);
+  LOG(INFO) << "size threshold first";
+  EXPECT_THAT(ReadLog(), Not(HasSubstr("size threshold first")));
+
+  // Each message is well under the buffer size, so the buffer is written out
+  // by one of them once it fills up, and not before.
+  const std::string filler(100, 'x');
+  for (size_t logged = 0; logged < kBufferSize; logged += filler.size()) {
+    LOG(INFO) << filler;
+  }
+  EXPECT_THAT(ReadLog(), HasSubstr("size threshold first"));
+}
+
+TEST_F(LoggingTest, FlushLogWritesBufferedMessages) {
+  set_log_buffering(1 << 20, kNeverMs);
+  LOG(INFO) << "flushed by FlushLog";
+  EXPECT_THAT(ReadLog(), Not(HasSubstr("flushed by FlushLog")));
+  FlushLog();
+  EXPECT_THAT(ReadLog(), HasSubstr("flushed by FlushLog"));
+}
+
+TEST_F(LoggingTest, DisablingBufferingWritesBufferedMessages) {
+  set_log_buffering(1 << 20, kNeverMs);
+  LOG(INFO) << "flushed when buffering stops";
+  EXPECT_THAT(ReadLog(), Not(HasSubstr("flushed when buffering stops")));
+  set_log_buffering(0, 0);
+  EXPECT_THAT(ReadLog(), HasSubstr("flushed when buffering stops"));
+}
+
+TEST_F(LoggingTest, FlusherWritesBufferedMessagesWithoutFurtherLogging) {
+  constexpr int64_t kFlushIntervalMs = 50;
+  set_log_buffering(1 << 20, kFlushIntervalMs);
+  ASSERT_TRUE(StartLogFlusher(kFlushIntervalMs));
+
+  // Nothing else is logged, so only the flusher can write the message out.
+  LOG(INFO) << "written by the flusher";
+  EXPECT_TRUE(WaitForLog("written by the flusher"));
+}
+
+TEST_F(LoggingTest, StartLogFlusherRejectsInvalidInterval) {
+  EXPECT_FALSE(StartLogFlusher(0));
+  EXPECT_FALSE(StartLogFlusher(-1));
+}
+
+// Returns whether each of |texts| appears in |log|, in order.
+bool AppearInOrder(const std::string &log,
+                   const std::vector<std::string> &texts) {
+  size_t position = 0;
+  for (const std::string &text : texts) {
+    position = log.find(text, position);
+    if (position == std::string::npos) {
+      return false;
+    }
+    position += text.size();
+  }
+  return true;
+}
+
+constexpr size_t kAsyncMemoryBudget = 1 << 20;
+
+TEST_F(LoggingTest, AsyncMessagesAreWrittenInOrderOnStop) {
+  ASSERT_TRUE(StartAsyncLogging(kAsyncMemoryBudget, kNeverMs));
+  std::vector<std::string> messages;
+  for (int i = 0; i < 100; ++i) {
+    messages.push_back(absl::StrCat("async before stop ", i, ";"));
+    LOG(INFO) << messages.back();
+  }
+  EXPECT_THAT(ReadLog(), Not(HasSubstr("async before stop 0;")));
+
+  StopAsyncLogging();
+  EXPECT_TRUE(AppearInOrder(ReadLog(), messages));
+  EXPECT_EQ(GetDroppedLogMessages(), 0u);
+}
+
+TEST_F(LoggingTest, AsyncMessagesOfEachThreadKeepTheirOrder) {
+  constexpr int kThreads = 4;
+  constexpr int kMessages = 200;
+  ASSERT_TRUE(StartAsyncLogging(kAsyncMemoryBudget, 10));
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreads; ++t) {
+    threads.emplace_back([t] {
+      for (int i = 0; i < kMessages; ++i) {
+        LOG(INFO) << "async thread " << t << " message " << i << ";";
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  StopAsyncLogging();
+
+  std::string log = ReadLog();
+  for (int t = 0; t < kThreads; ++t) {
+    std::vector<std::string> messages;
+    for (int i = 0; i < kMessages; ++i) {
+      messages.push_back(
+          absl::StrCat("async thread ", t, " message ", i, ";"));
+    }
+    EXPECT_TRUE(AppearInOrder(log, messages)) << "thread " << t;
+  }
+}
+
+TEST_F(LoggingTest, FlusherWritesAsyncMessages) {
+  ASSERT_TRUE(StartAsyncLogging(kAsyncMemoryBudget, 50));
+  LOG(INFO) << "async written by the flusher";
+  EXPECT_TRUE(WaitForLog("async written by the flusher"));
+}
+
+TEST_F(LoggingTest, AsyncErrorsArePrintedToStderrSynchronously) {
+  ASSERT_TRUE(StartAsyncLogging(kAsyncMemoryBudget, kNeverMs));
+  ::testing::internal::CaptureStderr();
+  LOG(ERROR) << "async error message";
+  std::string printed = ::testing::internal::GetCapturedStderr();
+  EXPECT_THAT(printed, HasSubstr("async error message"));
+  EXPECT_THAT(ReadLog(), Not(HasSubstr("async error message")));
+
+  StopAsyncLogging();
+  EXPECT_THAT(ReadLog(), HasSubstr("async error message"));
+}
+
+TEST_F(LoggingTest, AsyncFatalIsWrittenSynchronouslyAfterEarlierMessages) {
+  ::testing::FLAGS_gtest_death_test_style = "threadsafe";
+  EXPECT_DEATH(
+      {
+        StartAsyncLogging(kAsyncMemoryBudget, kNeverMs);
+        LOG(INFO) << "async before fatal";
+        LOG(FATAL) << "async fatal message";
+      },
+      "");
+  EXPECT_TRUE(
+      AppearInOrder(ReadLog(), {"async before fatal", "async fatal message"}));
+}
+
+}  // namespace
+}  // namespace asylo